@@ -135,6 +135,14 @@ bool DecodeImageJXL(const uint8_t* bytes, size_t bytes_size,
     return false;
   }
 
+  if (dparams.profiling_sink != nullptr &&
+      JXL_DEC_SUCCESS !=
+          JxlDecoderSetProfilingSink(dec, dparams.profiling_sink,
+                                     dparams.profiling_sink_opaque)) {
+    fprintf(stderr, "JxlDecoderSetProfilingSink failed\n");
+    return false;
+  }
+
   JxlPixelFormat format = {};  // Initialize to calm down clang-tidy.
   std::vector<JxlPixelFormat> accepted_formats = dparams.accepted_formats;
 
@@ -138,6 +138,14 @@ bool EncodeImageJXL(const JXLCompressParams& params, const PackedPixelFile& ppf,
     return false;
   }
 
+  if (params.profiling_sink != nullptr &&
+      JXL_ENC_SUCCESS !=
+          JxlEncoderSetProfilingSink(enc, params.profiling_sink,
+                                     params.profiling_sink_opaque)) {
+    fprintf(stderr, "JxlEncoderSetProfilingSink failed\n");
+    return false;
+  }
+
   if (params.HasOutputProcessor() &&
       JXL_ENC_SUCCESS !=
           JxlEncoderSetOutputProcessor(enc, params.output_processor)) {
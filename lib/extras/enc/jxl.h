@@ -70,6 +70,10 @@ struct JXLCompressParams {
   JxlParallelRunner runner = JxlThreadParallelRunner;
   void* runner_opaque = nullptr;
 
+  // If profiling_sink is set, it receives the timing of every parallel stage.
+  JxlProfilingSink profiling_sink = nullptr;
+  void* profiling_sink_opaque = nullptr;
+
   // If memory_manager is set, encoder uses it.
   JxlMemoryManager* memory_manager = nullptr;
 
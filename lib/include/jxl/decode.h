@@ -100,7 +100,8 @@ JXL_EXPORT JxlDecoder* JxlDecoderCreate(const JxlMemoryManager* memory_manager);
 /**
  * Re-initializes a @ref JxlDecoder instance, so it can be re-used for decoding
  * another image. All state and settings are reset as if the object was
- * newly created with @ref JxlDecoderCreate, but the memory manager is kept.
+ * newly created with @ref JxlDecoderCreate, but the memory manager is kept,
+ * as are the buffers if @ref JxlDecoderSetReuseBuffers was enabled.
  *
  * @param dec instance to be re-initialized.
  */
@@ -377,9 +378,13 @@ typedef enum {
  *  - @ref JxlDecoderSetDesiredIntensityTarget,
  *  - @ref JxlDecoderSetDecompressBoxes,
  *  - @ref JxlDecoderSetKeepOrientation,
+ *  - @ref JxlDecoderSetOutputSize,
+ *  - @ref JxlDecoderSetRegionOfInterest,
  *  - @ref JxlDecoderSetUnpremultiplyAlpha,
  *  - @ref JxlDecoderSetParallelRunner,
- *  - @ref JxlDecoderSetRenderSpotcolors, and
+ *  - @ref JxlDecoderSetProfilingSink,
+ *  - @ref JxlDecoderSetRenderSpotcolors,
+ *  - @ref JxlDecoderSetReuseBuffers, and
  *  - @ref JxlDecoderSubscribeEvents.
  *
  * @param dec decoder object
@@ -436,6 +441,70 @@ JXL_EXPORT JxlDecoderStatus
 JxlDecoderSetParallelRunner(JxlDecoder* dec, JxlParallelRunner parallel_runner,
                             void* parallel_runner_opaque);
 
+/**
+ * Sets a callback that receives the name and timing of every parallel stage
+ * of decoding, for profiling. May only be set before starting decoding.
+ * Timing adds a small overhead per task, so the sink should be left unset
+ * when not profiling.
+ *
+ * @param dec decoder object
+ * @param sink callback receiving a @ref JxlProfilingEvent per stage, or NULL
+ *     to stop profiling.
+ * @param opaque user pointer passed to @p sink.
+ * @return ::JXL_DEC_SUCCESS if the sink was set, ::JXL_DEC_ERROR otherwise.
+ */
+JXL_EXPORT JxlDecoderStatus JxlDecoderSetProfilingSink(JxlDecoder* dec,
+                                                       JxlProfilingSink sink,
+                                                       void* opaque);
+
+/**
+ * Cost of one stage of the pipeline that renders the pixels of a frame, as
+ * returned by @ref JxlDecoderGetRenderStageStats.
+ */
+typedef struct {
+  /** Name of the stage, for example "Splines" or "EPF0". Valid for the
+   * lifetime of the library.
+   */
+  const char* name;
+  /** Time spent in the stage, summed over all threads, in seconds. Zero unless
+   * a sink was set with @ref JxlDecoderSetProfilingSink.
+   */
+  double time;
+  /** Approximate number of bytes of samples read and written by the stage.
+   * Zero unless a sink was set with @ref JxlDecoderSetProfilingSink.
+   */
+  uint64_t bytes;
+} JxlRenderStageStats;
+
+/**
+ * Returns the number of stages that the decoder chose to render the last frame
+ * it fully decoded, or 0 if it did not decode any frame yet. Frames that are
+ * not displayed, such as reference frames, count as well. May be called after
+ * ::JXL_DEC_FULL_IMAGE or any later event.
+ *
+ * @param dec decoder object
+ * @param count output value for the number of stages.
+ * @return ::JXL_DEC_SUCCESS.
+ */
+JXL_EXPORT JxlDecoderStatus JxlDecoderGetRenderStageCount(const JxlDecoder* dec,
+                                                          size_t* count);
+
+/**
+ * Returns the name of a stage that rendered the last frame, in the order in
+ * which the stages run, and its cumulative cost while a profiling sink is set.
+ * Comparing these between files shows which features, such as noise, patches,
+ * splines, EPF iterations or color management, make a file slow to decode.
+ *
+ * @param dec decoder object
+ * @param index index of the stage, smaller than the count given by @ref
+ *     JxlDecoderGetRenderStageCount.
+ * @param stats output for the stage.
+ * @return ::JXL_DEC_SUCCESS on success, ::JXL_DEC_ERROR if @p index is out of
+ *     range.
+ */
+JXL_EXPORT JxlDecoderStatus JxlDecoderGetRenderStageStats(
+    const JxlDecoder* dec, size_t index, JxlRenderStageStats* stats);
+
 /**
  * Returns a hint indicating how many more bytes the decoder is expected to
  * need to make @ref JxlDecoderGetBasicInfo available after the next @ref
@@ -550,6 +619,27 @@ JxlDecoderSetRenderSpotcolors(JxlDecoder* dec, JXL_BOOL render_spotcolors);
 JXL_EXPORT JxlDecoderStatus JxlDecoderSetCoalescing(JxlDecoder* dec,
                                                     JXL_BOOL coalescing);
 
+/**
+ * Enables or disables keeping internal buffers across images. When enabled,
+ * @ref JxlDecoderReset and @ref JxlDecoderRewind keep the per-frame decoder
+ * state, such as the computed dequantization tables, the per-thread group
+ * buffers and the planes of the last frame, and the next image reuses them
+ * when its frames have the same dimensions. This makes decoding batches of
+ * same-sized images, e.g. thumbnails, cheaper, at the cost of holding the
+ * memory of the last frame while idle. Combine with a @ref JxlMemoryPool to
+ * also recycle the render pipeline buffers.
+ *
+ * Unlike the other settings, this one is not reset by @ref JxlDecoderReset.
+ * Disabled by default.
+ *
+ * @param dec decoder object
+ * @param reuse_buffers JXL_TRUE to keep buffers across images, JXL_FALSE to
+ *     release them on reset (default).
+ * @return ::JXL_DEC_SUCCESS if no error, ::JXL_DEC_ERROR otherwise.
+ */
+JXL_EXPORT JxlDecoderStatus JxlDecoderSetReuseBuffers(JxlDecoder* dec,
+                                                      JXL_BOOL reuse_buffers);
+
 /**
  * Decodes JPEG XL file using the available bytes. Requires input has been
  * set with @ref JxlDecoderSetInput. After @ref JxlDecoderProcessInput, input
@@ -1145,6 +1235,69 @@ JXL_EXPORT JxlDecoderStatus JxlDecoderSetMultithreadedImageOutCallback(
     JxlImageOutInitCallback init_callback, JxlImageOutRunCallback run_callback,
     JxlImageOutDestroyCallback destroy_callback, void* init_opaque);
 
+/** Layouts of the planes of @ref JxlYCbCrBuffer.
+ */
+typedef enum {
+  /** Y, Cb and Cr planes of the image size.
+   */
+  JXL_YCBCR_444 = 0,
+  /** Y plane of the image size, Cb and Cr planes of half the image size in
+   * both directions, rounded up (I420).
+   */
+  JXL_YCBCR_420 = 1,
+  /** Y plane of the image size and a single plane with the Cb and Cr samples
+   * interleaved, of half the image size in both directions, rounded up
+   * (NV12).
+   */
+  JXL_YCBCR_NV12 = 2,
+} JxlYCbCrLayout;
+
+/** Planar output buffer for @ref JxlDecoderSetImageOutYCbCrBuffer. The
+ * samples are 8-bit full range BT.601 YCbCr as defined by JFIF, i.e. the
+ * color space of JPEG files.
+ */
+typedef struct {
+  /** Layout of the planes.
+   */
+  JxlYCbCrLayout layout;
+  /** Y, Cb and Cr planes, owned by the caller. For ::JXL_YCBCR_NV12,
+   * `planes[1]` holds the interleaved Cb and Cr samples and `planes[2]` is
+   * unused.
+   */
+  uint8_t* planes[3];
+  /** Distance in bytes between the starts of consecutive rows of each plane,
+   * at least the number of bytes of a row.
+   */
+  size_t strides[3];
+} JxlYCbCrBuffer;
+
+/**
+ * Sets planar YCbCr buffers to write the full resolution image to, instead of
+ * the interleaved pixels of @ref JxlDecoderSetImageOutBuffer. This can be set
+ * when the ::JXL_DEC_FRAME event occurs, must be set when the @ref
+ * JXL_DEC_NEED_IMAGE_OUT_BUFFER event occurs, and applies only for the
+ * current frame. The size of the image is that of the frame as for @ref
+ * JxlDecoderImageOutBufferSize.
+ *
+ * Frames stored as YCbCr, such as losslessly recompressed JPEG files, are
+ * written directly from the decoded samples if the layout matches their
+ * chroma subsampling, without converting them to RGB and without upsampling
+ * the chroma. Other frames are converted to YCbCr from the RGB pixels in the
+ * output color profile, averaging the chroma of each 2x2 block for the
+ * subsampled layouts.
+ *
+ * Only the color channels are output; extra channel buffers cannot be used at
+ * the same time, nor can @ref JxlDecoderSetOutputSize.
+ *
+ * @param dec decoder object
+ * @param buffer layout and planes to output the pixel data to. Object owned
+ *     by user and its contents are copied internally.
+ * @return ::JXL_DEC_SUCCESS on success, ::JXL_DEC_ERROR on error, such as
+ *     invalid layout or strides, or an incompatible setting.
+ */
+JXL_EXPORT JxlDecoderStatus JxlDecoderSetImageOutYCbCrBuffer(
+    JxlDecoder* dec, const JxlYCbCrBuffer* buffer);
+
 /**
  * Returns the minimum size in bytes of an extra channel pixel buffer for the
  * given format. This is the buffer for @ref JxlDecoderSetExtraChannelBuffer.
@@ -1442,6 +1595,93 @@ JXL_EXPORT size_t JxlDecoderGetIntendedDownsamplingRatio(JxlDecoder* dec);
  */
 JXL_EXPORT JxlDecoderStatus JxlDecoderFlushImage(JxlDecoder* dec);
 
+/** Filters for resampling the decoded image to the size set with @ref
+ * JxlDecoderSetOutputSize.
+ */
+typedef enum {
+  /** Average of the covered pixels, or nearest neighbour when upsampling.
+   * Fastest, but prone to aliasing.
+   */
+  JXL_RESAMPLE_BOX = 0,
+  /** Mitchell-Netravali cubic filter, a compromise between sharpness and
+   * ringing.
+   */
+  JXL_RESAMPLE_MITCHELL = 1,
+  /** Lanczos filter with 3 lobes, the sharpest but may ring at hard edges.
+   */
+  JXL_RESAMPLE_LANCZOS3 = 2,
+} JxlResampleFilter;
+
+/**
+ * Sets the size of the pixels returned for the frames of the image, which are
+ * then resampled with `filter` from the image dimensions. The size applies to
+ * the oriented image, i.e. after the orientation was undone unless @ref
+ * JxlDecoderSetKeepOrientation is enabled, and the output buffer sizes, such
+ * as returned by @ref JxlDecoderImageOutBufferSize, are for this size. The
+ * preview image and the JPEG reconstruction are not resampled, and the basic
+ * info and frame headers still describe the image dimensions.
+ *
+ * When the output is downscaled by 2 or more, the decoder stops decoding a
+ * frame as soon as the progressive passes decoded so far have enough detail,
+ * for frames that no later frame depends on, and skips the remaining bytes of
+ * the frame. This makes decoding thumbnails of progressive images cheaper.
+ * Frames of recompressed JPEG images are also rendered directly at 1/2, 1/4
+ * or 1/8 of their size, with reduced inverse DCTs, before the resampling.
+ *
+ * Requires coalescing, see @ref JxlDecoderSetCoalescing. Must be called before
+ * the decoder starts decoding pixels, e.g. after the ::JXL_DEC_BASIC_INFO
+ * event, at which point the image dimensions are known. Like the other
+ * settings, it is kept by @ref JxlDecoderRewind.
+ *
+ * @param dec decoder object
+ * @param xsize width of the output, or 0 to output the image dimensions
+ *     (default).
+ * @param ysize height of the output, 0 if and only if `xsize` is 0.
+ * @param filter resampling filter.
+ * @return ::JXL_DEC_SUCCESS if the size was set, ::JXL_DEC_ERROR if called
+ *     too late, if only one of the dimensions is 0, or if coalescing is
+ *     disabled.
+ */
+JXL_EXPORT JxlDecoderStatus JxlDecoderSetOutputSize(JxlDecoder* dec,
+                                                    size_t xsize, size_t ysize,
+                                                    JxlResampleFilter filter);
+
+/**
+ * Sets a region of the image that the decoder must output at full quality,
+ * for random access to a part of a large image. The region applies to the
+ * oriented image, like @ref JxlDecoderSetOutputSize, and to every frame.
+ *
+ * For frames that no later frame depends on, the decoder only reads the
+ * sections of the frame that the pixels of the region depend on: the global
+ * sections, the DC, and the AC groups around the region. As soon as these are
+ * decoded, in whatever order they are available in the input, the frame is
+ * completed and its remaining bytes are skipped. The pixels outside of the
+ * region, and of the groups around it, are then only rendered from the DC, as
+ * by @ref JxlDecoderFlushImage. Frames that cannot be completed this way,
+ * such as modular frames, frames with extra channels and recompressed JPEG
+ * frames, are decoded entirely.
+ *
+ * Together with @ref JxlDecoderSkipFrames, which jumps to a frame, and
+ * @ref JxlDecoderSetOutputSize, which stops at the DC for 1/8 outputs, this
+ * gives access to parts of an image without decoding all of it.
+ *
+ * Must be called before the decoder starts decoding pixels. Like the other
+ * settings, it is kept by @ref JxlDecoderRewind.
+ *
+ * @param dec decoder object
+ * @param x0 horizontal position of the region.
+ * @param y0 vertical position of the region.
+ * @param xsize width of the region, or 0 to decode the whole image at full
+ *     quality (default).
+ * @param ysize height of the region, 0 if and only if `xsize` is 0.
+ * @return ::JXL_DEC_SUCCESS if the region was set, ::JXL_DEC_ERROR if called
+ *     too late or if only one of the dimensions is 0.
+ */
+JXL_EXPORT JxlDecoderStatus JxlDecoderSetRegionOfInterest(JxlDecoder* dec,
+                                                          size_t x0, size_t y0,
+                                                          size_t xsize,
+                                                          size_t ysize);
+
 /**
  * Sets the bit depth of the output buffer or callback.
  *
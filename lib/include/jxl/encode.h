@@ -393,6 +393,15 @@ typedef enum {
    */
   JXL_ENC_FRAME_SETTING_DISABLE_PERCEPTUAL_HEURISTICS = 39,
 
+  /** Reuse the patches found in previous frames. Patches are stored once in a
+   * reference frame that later frames with this option enabled refer to, which
+   * saves both encoding time and size for multi-page documents and screen
+   * recordings where the same glyphs or UI elements recur. A new reference
+   * frame is only encoded when a frame contains many patches that are not in
+   * the stored one. 0 = disabled (default), 1 = enabled.
+   */
+  JXL_ENC_FRAME_SETTING_REUSE_PATCHES = 40,
+
   /** Enum value not to be used as an option. This value is added to force the
    * C compiler to have the enum to take a known size.
    */
@@ -417,12 +426,34 @@ JXL_EXPORT JxlEncoder* JxlEncoderCreate(const JxlMemoryManager* memory_manager);
 /**
  * Re-initializes a @ref JxlEncoder instance, so it can be re-used for encoding
  * another image. All state and settings are reset as if the object was
- * newly created with @ref JxlEncoderCreate, but the memory manager is kept.
+ * newly created with @ref JxlEncoderCreate, but the memory manager is kept,
+ * as are the buffers if @ref JxlEncoderSetReuseBuffers was enabled.
  *
  * @param enc instance to be re-initialized.
  */
 JXL_EXPORT void JxlEncoderReset(JxlEncoder* enc);
 
+/**
+ * Enables or disables keeping internal buffers across frames and images. When
+ * enabled, the dequantization tables computed for a frame are kept, also
+ * through @ref JxlEncoderReset, and the next frames that use the same tables
+ * skip computing them again, including the quantization tables of recompressed
+ * JPEGs. This makes encoding batches of small images, e.g. thumbnails, or of
+ * JPEGs from the same camera cheaper. Combine with a @ref JxlMemoryPool to also
+ * recycle the image buffers.
+ *
+ * Unlike the other settings, this one is not reset by @ref JxlEncoderReset.
+ * Disabled by default. Must be set before the first output is written.
+ *
+ * @param enc encoder object.
+ * @param reuse_buffers JXL_TRUE to keep buffers across images, JXL_FALSE to
+ *     release them on reset (default).
+ * @return ::JXL_ENC_SUCCESS if the setting was applied, ::JXL_ENC_ERROR
+ *     otherwise.
+ */
+JXL_EXPORT JxlEncoderStatus JxlEncoderSetReuseBuffers(JxlEncoder* enc,
+                                                      JXL_BOOL reuse_buffers);
+
 /**
  * Deinitializes and frees a @ref JxlEncoder instance.
  *
@@ -457,6 +488,24 @@ JXL_EXPORT JxlEncoderStatus
 JxlEncoderSetParallelRunner(JxlEncoder* enc, JxlParallelRunner parallel_runner,
                             void* parallel_runner_opaque);
 
+/**
+ * Sets a callback that receives the name and timing of every parallel stage
+ * of encoding, for profiling. Can be called before or after @ref
+ * JxlEncoderSetParallelRunner; without a parallel runner the stages run on
+ * the default single-threaded runner. Timing adds a small overhead per task,
+ * so the sink should be left unset when not profiling. @ref JxlEncoderReset
+ * removes the sink.
+ *
+ * @param enc encoder object.
+ * @param sink callback receiving a @ref JxlProfilingEvent per stage, or NULL
+ *     to stop profiling.
+ * @param opaque user pointer passed to @p sink.
+ * @return ::JXL_ENC_SUCCESS if the sink was set, ::JXL_ENC_ERROR otherwise.
+ */
+JXL_EXPORT JxlEncoderStatus JxlEncoderSetProfilingSink(JxlEncoder* enc,
+                                                       JxlProfilingSink sink,
+                                                       void* opaque);
+
 /**
  * Get the (last) error code in case ::JXL_ENC_ERROR was returned.
  *
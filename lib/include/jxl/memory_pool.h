@@ -0,0 +1,117 @@
+/* Copyright (c) the JPEG XL Project Authors. All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+
+/** @addtogroup libjxl_common
+ * @{
+ * @file memory_pool.h
+ * @brief Memory manager that recycles buffers across frames and instances.
+ */
+
+#ifndef JXL_MEMORY_POOL_H_
+#define JXL_MEMORY_POOL_H_
+
+#include <jxl/jxl_export.h>
+#include <jxl/memory_manager.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__cplusplus) || defined(c_plusplus)
+extern "C" {
+#endif
+
+/**
+ * Opaque structure holding a pool of recycled allocations.
+ *
+ * Allocations of at least a few kilobytes (image planes, group buffers, ...)
+ * are rounded up to one of 8 size classes per power of two; when freed, they
+ * are kept in the pool, up to a configurable total size, and handed out again
+ * to the next allocation of the same size class. Smaller allocations are
+ * passed through to the underlying memory manager.
+ *
+ * A pool is thread-safe and may be shared by any number of encoder and decoder
+ * instances, which then reuse each other's buffers.
+ */
+typedef struct JxlMemoryPoolStruct JxlMemoryPool;
+
+/**
+ * Statistics of a ::JxlMemoryPool. All sizes are in bytes, rounded up to the
+ * size class, and do not include the small per-allocation bookkeeping.
+ */
+typedef struct {
+  /** Bytes currently allocated by the users of the pool. */
+  size_t bytes_in_use;
+  /** High-water mark of @c bytes_in_use. */
+  size_t peak_bytes_in_use;
+  /** Bytes of freed allocations currently kept for reuse. */
+  size_t bytes_cached;
+  /** High-water mark of the memory held from the underlying memory manager,
+   * that is, of the sum of @c bytes_in_use and @c bytes_cached. */
+  size_t peak_bytes_reserved;
+  /** Number of allocations served by the pool. */
+  uint64_t num_allocations;
+  /** Number of allocations served with a recycled buffer. */
+  uint64_t num_reused;
+} JxlMemoryPoolStats;
+
+/**
+ * Creates a memory pool.
+ *
+ * @param memory_manager underlying memory manager used to allocate new buffers
+ * and to release those that are not kept, or @c NULL to use the default one.
+ * @param max_cached_bytes maximum total size of the freed buffers kept for
+ * reuse.
+ * @return pointer to the pool, or @c NULL on failure.
+ */
+JXL_EXPORT JxlMemoryPool* JxlMemoryPoolCreate(
+    const JxlMemoryManager* memory_manager, size_t max_cached_bytes);
+
+/**
+ * Destroys the pool and releases all cached buffers. All the encoders and
+ * decoders using the pool must have been destroyed before.
+ *
+ * @param pool the pool to destroy, or @c NULL.
+ */
+JXL_EXPORT void JxlMemoryPoolDestroy(JxlMemoryPool* pool);
+
+/**
+ * Returns the memory manager that allocates through the pool, to be passed to
+ * @ref JxlEncoderCreate or @ref JxlDecoderCreate. It remains valid until the
+ * pool is destroyed.
+ *
+ * @param pool the pool.
+ * @return the memory manager of the pool.
+ */
+JXL_EXPORT const JxlMemoryManager* JxlMemoryPoolGetMemoryManager(
+    JxlMemoryPool* pool);
+
+/**
+ * Releases cached buffers to the underlying memory manager until at most @p
+ * max_cached_bytes remain cached, largest buffers first. Does not change the
+ * limit passed to @ref JxlMemoryPoolCreate; use 0 to release everything, e.g.
+ * after a burst of large images.
+ *
+ * @param pool the pool.
+ * @param max_cached_bytes number of cached bytes to keep at most.
+ */
+JXL_EXPORT void JxlMemoryPoolTrim(JxlMemoryPool* pool,
+                                  size_t max_cached_bytes);
+
+/**
+ * Retrieves the statistics of the pool.
+ *
+ * @param pool the pool.
+ * @param stats structure to fill in.
+ */
+JXL_EXPORT void JxlMemoryPoolGetStats(JxlMemoryPool* pool,
+                                      JxlMemoryPoolStats* stats);
+
+#if defined(__cplusplus) || defined(c_plusplus)
+}
+#endif
+
+#endif /* JXL_MEMORY_POOL_H_ */
+
+/** @}*/
@@ -123,6 +123,60 @@ typedef JxlParallelRetCode (*JxlParallelRunner)(
     void* runner_opaque, void* jpegxl_opaque, JxlParallelRunInit init,
     JxlParallelRunFunction func, uint32_t start_range, uint32_t end_range);
 
+/**
+ * Timing of one parallel stage of encoding or decoding, as reported to a
+ * @ref JxlProfilingSink. All times are in seconds.
+ */
+typedef struct {
+  /** Name of the stage, for example "DecodeGroup". Only valid during the
+   * callback.
+   */
+  const char* stage;
+  /** Number of tasks the stage was split into. */
+  uint32_t num_tasks;
+  /** Number of threads the runner passed to @ref JxlParallelRunInit. */
+  size_t num_threads;
+  /** Start of the stage, relative to an arbitrary fixed point in time that is
+   * the same for all events of the process.
+   */
+  double start;
+  /** Wall time from the start of the stage until its last task finished. */
+  double wall_time;
+  /** Time each thread spent running tasks of this stage, @p num_threads
+   * entries. The difference to @p wall_time is the idle time of that thread.
+   * Only valid during the callback.
+   */
+  const double* thread_busy_time;
+  /** CPU time each thread spent running tasks of this stage, @p num_threads
+   * entries, from the per-thread CPU clock. Lower than @p thread_busy_time
+   * when the thread was blocked or descheduled while running them, and 0
+   * where the platform has no per-thread CPU clock. Only valid during the
+   * callback.
+   */
+  const double* thread_cpu_time;
+  /** Time from the start of the stage until each thread started its first
+   * task, @p num_threads entries, that is, how long the runner took to hand
+   * it work; @p wall_time for threads that ran no task. Only valid during
+   * the callback.
+   */
+  const double* thread_wait_time;
+  /** High-water mark, during the stage, of the bytes allocated through the
+   * memory manager of the encoder or decoder, including the allocations that
+   * were made before the stage and are still in use.
+   */
+  size_t peak_memory;
+} JxlProfilingEvent;
+
+/**
+ * Callback receiving the timing of every parallel stage of an encoder or
+ * decoder, once the stage finished. It is called on the thread that called
+ * the encoder or decoder function.
+ *
+ * @param opaque the user pointer given together with the sink.
+ * @param event timing of the stage.
+ */
+typedef void (*JxlProfilingSink)(void* opaque, const JxlProfilingEvent* event);
+
 /* The following is an example of a @ref JxlParallelRunner that doesn't use any
  * multi-threading. Note that this implementation doesn't store any state
  * between multiple calls of the ExampleSequentialRunner function, so the
@@ -12,6 +12,10 @@
 #include <jxl/parallel_runner.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <time.h>
+
+#include <chrono>
+#include <vector>
 
 #include "lib/jxl/base/compiler_specific.h"
 #include "lib/jxl/base/status.h"
@@ -34,6 +38,23 @@ class ThreadPool {
   JxlParallelRunner runner() const { return runner_; }
   void* runner_opaque() const { return runner_opaque_; }
 
+  // Returns the high-water mark of the bytes in use since its previous call,
+  // and restarts it from the bytes currently in use.
+  using PeakMemoryFunc = size_t (*)(void* opaque);
+
+  // Reports the timing of every subsequent Run to `sink`, or stops reporting
+  // if `sink` is nullptr. While set, every task is timed, and `peak_memory`,
+  // if not nullptr, is called before and after every Run for the memory
+  // high-water mark of its event.
+  void SetProfilingSink(JxlProfilingSink sink, void* opaque,
+                        PeakMemoryFunc peak_memory = nullptr,
+                        void* memory_opaque = nullptr) {
+    profiling_sink_ = sink;
+    profiling_opaque_ = opaque;
+    peak_memory_ = peak_memory;
+    memory_opaque_ = memory_opaque;
+  }
+
   // Runs init_func(num_threads) followed by data_func(task, thread) on worker
   // thread(s) for every task in [begin, end). init_func() must return a Status
   // indicating whether the initialization succeeded.
@@ -47,6 +68,79 @@ class ThreadPool {
              const DataFunc& data_func, const char* caller = "") {
     JXL_ASSERT(begin <= end);
     if (begin == end) return true;
+    if (profiling_sink_ != nullptr) {
+      return RunProfiled(begin, end, init_func, data_func, caller);
+    }
+    return RunUnprofiled(begin, end, init_func, data_func);
+  }
+
+  // Use this as init_func when no initialization is needed.
+  static Status NoInit(size_t num_threads) { return true; }
+
+ private:
+  static double Now() {
+    return std::chrono::duration<double>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+  }
+
+  // CPU time of the calling thread, or 0 without a per-thread CPU clock.
+  static double ThreadCpuTime() {
+#if defined(CLOCK_THREAD_CPUTIME_ID)
+    timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0) {
+      return static_cast<double>(ts.tv_sec) +
+             1e-9 * static_cast<double>(ts.tv_nsec);
+    }
+#endif
+    return 0.0;
+  }
+
+  template <class InitFunc, class DataFunc>
+  Status RunProfiled(uint32_t begin, uint32_t end, const InitFunc& init_func,
+                     const DataFunc& data_func, const char* caller) {
+    std::vector<double> busy;
+    std::vector<double> cpu;
+    std::vector<double> wait;
+    if (peak_memory_ != nullptr) peak_memory_(memory_opaque_);
+    const double start = Now();
+    const auto timed_init = [&](size_t num_threads) -> Status {
+      busy.assign(num_threads, 0.0);
+      cpu.assign(num_threads, 0.0);
+      // Negative until the thread starts its first task.
+      wait.assign(num_threads, -1.0);
+      return init_func(num_threads);
+    };
+    const auto timed_data = [&](uint32_t task, size_t thread) {
+      const double task_start = Now();
+      const double cpu_start = ThreadCpuTime();
+      if (wait[thread] < 0.0) wait[thread] = task_start - start;
+      data_func(task, thread);
+      cpu[thread] += ThreadCpuTime() - cpu_start;
+      busy[thread] += Now() - task_start;
+    };
+    const Status status = RunUnprofiled(begin, end, timed_init, timed_data);
+    JxlProfilingEvent event;
+    event.stage = caller;
+    event.num_tasks = end - begin;
+    event.num_threads = busy.size();
+    event.start = start;
+    event.wall_time = Now() - start;
+    for (double& thread_wait : wait) {
+      if (thread_wait < 0.0) thread_wait = event.wall_time;
+    }
+    event.thread_busy_time = busy.data();
+    event.thread_cpu_time = cpu.data();
+    event.thread_wait_time = wait.data();
+    event.peak_memory =
+        peak_memory_ != nullptr ? peak_memory_(memory_opaque_) : 0;
+    profiling_sink_(profiling_opaque_, &event);
+    return status;
+  }
+
+  template <class InitFunc, class DataFunc>
+  Status RunUnprofiled(uint32_t begin, uint32_t end, const InitFunc& init_func,
+                       const DataFunc& data_func) {
     RunCallState<InitFunc, DataFunc> call_state(init_func, data_func);
     // The runner_ uses the C convention and returns 0 in case of error, so we
     // convert it to a Status.
@@ -65,10 +159,6 @@ class ThreadPool {
                       end) == 0;
   }
 
-  // Use this as init_func when no initialization is needed.
-  static Status NoInit(size_t num_threads) { return true; }
-
- private:
   // class holding the state of a Run() call to pass to the runner_ as an
   // opaque_jpegxl pointer.
   template <class InitFunc, class DataFunc>
@@ -102,6 +192,11 @@ class ThreadPool {
   // The caller supplied runner function and its opaque void*.
   const JxlParallelRunner runner_;
   void* const runner_opaque_;
+
+  JxlProfilingSink profiling_sink_ = nullptr;
+  void* profiling_opaque_ = nullptr;
+  PeakMemoryFunc peak_memory_ = nullptr;
+  void* memory_opaque_ = nullptr;
 };
 
 template <class InitFunc, class DataFunc>
@@ -39,6 +39,8 @@
 #define HWY_TARGET_INCLUDE "lib/jxl/butteraugli/butteraugli.cc"
 #include <hwy/foreach_target.h>
 
+#include "lib/jxl/base/common.h"
+#include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/base/fast_math-inl.h"
 #include "lib/jxl/base/printf_macros.h"
 #include "lib/jxl/base/rect.h"
@@ -81,7 +83,8 @@ std::vector<float> ComputeKernel(float sigma) {
 }
 
 void ConvolveBorderColumn(const ImageF& in, const std::vector<float>& kernel,
-                          const size_t x, float* BUTTERAUGLI_RESTRICT row_out) {
+                          const size_t x, const size_t y0, const size_t y1,
+                          float* BUTTERAUGLI_RESTRICT row_out) {
   const size_t offset = kernel.size() / 2;
   int minx = x < offset ? 0 : x - offset;
   int maxx = std::min<int>(in.xsize() - 1, x + offset);
@@ -90,7 +93,7 @@ void ConvolveBorderColumn(const ImageF& in, const std::vector<float>& kernel,
     weight += kernel[j - x + offset];
   }
   float scale = 1.0f / weight;
-  for (size_t y = 0; y < in.ysize(); ++y) {
+  for (size_t y = y0; y < y1; ++y) {
     const float* BUTTERAUGLI_RESTRICT row_in = in.Row(y);
     float sum = 0.0f;
     for (int j = minx; j <= maxx; ++j) {
@@ -100,10 +103,11 @@ void ConvolveBorderColumn(const ImageF& in, const std::vector<float>& kernel,
   }
 }
 
-// Computes a horizontal convolution and transposes the result.
+// Computes a horizontal convolution of rows [y0, y1) and transposes the
+// result.
 void ConvolutionWithTranspose(const ImageF& in,
-                              const std::vector<float>& kernel,
-                              ImageF* BUTTERAUGLI_RESTRICT out) {
+                              const std::vector<float>& kernel, size_t y0,
+                              size_t y1, ImageF* BUTTERAUGLI_RESTRICT out) {
   JXL_CHECK(out->xsize() == in.ysize());
   JXL_CHECK(out->ysize() == in.xsize());
   const size_t len = kernel.size();
@@ -127,7 +131,7 @@ void ConvolutionWithTranspose(const ImageF& in,
       const float sk1 = scaled_kernel[1];
       const float sk2 = scaled_kernel[2];
       const float sk3 = scaled_kernel[3];
-      for (size_t y = 0; y < in.ysize(); ++y) {
+      for (size_t y = y0; y < y1; ++y) {
         const float* BUTTERAUGLI_RESTRICT row_in = in.Row(y) + border1 - offset;
         for (size_t x = border1; x < border2; ++x, ++row_in) {
           const float sum0 = (row_in[0] + row_in[6]) * sk0;
@@ -140,7 +144,7 @@ void ConvolutionWithTranspose(const ImageF& in,
       }
     } break;
     case 13: {
-      for (size_t y = 0; y < in.ysize(); ++y) {
+      for (size_t y = y0; y < y1; ++y) {
         const float* BUTTERAUGLI_RESTRICT row_in = in.Row(y) + border1 - offset;
         for (size_t x = border1; x < border2; ++x, ++row_in) {
           float sum0 = (row_in[0] + row_in[12]) * scaled_kernel[0];
@@ -157,7 +161,7 @@ void ConvolutionWithTranspose(const ImageF& in,
       break;
     }
     case 15: {
-      for (size_t y = 0; y < in.ysize(); ++y) {
+      for (size_t y = y0; y < y1; ++y) {
         const float* BUTTERAUGLI_RESTRICT row_in = in.Row(y) + border1 - offset;
         for (size_t x = border1; x < border2; ++x, ++row_in) {
           float sum0 = (row_in[0] + row_in[14]) * scaled_kernel[0];
@@ -175,7 +179,7 @@ void ConvolutionWithTranspose(const ImageF& in,
       break;
     }
     case 33: {
-      for (size_t y = 0; y < in.ysize(); ++y) {
+      for (size_t y = y0; y < y1; ++y) {
         const float* BUTTERAUGLI_RESTRICT row_in = in.Row(y) + border1 - offset;
         for (size_t x = border1; x < border2; ++x, ++row_in) {
           float sum0 = (row_in[0] + row_in[32]) * scaled_kernel[0];
@@ -206,15 +210,34 @@ void ConvolutionWithTranspose(const ImageF& in,
   }
   // left border
   for (size_t x = 0; x < border1; ++x) {
-    ConvolveBorderColumn(in, kernel, x, out->Row(x));
+    ConvolveBorderColumn(in, kernel, x, y0, y1, out->Row(x));
   }
 
   // right border
   for (size_t x = border2; x < in.xsize(); ++x) {
-    ConvolveBorderColumn(in, kernel, x, out->Row(x));
+    ConvolveBorderColumn(in, kernel, x, y0, y1, out->Row(x));
   }
 }
 
+// Each task convolves a band of input rows, i.e. writes a band of columns of
+// the transposed output, so the result does not depend on the thread count.
+Status ConvolutionWithTranspose(const ImageF& in,
+                                const std::vector<float>& kernel,
+                                ThreadPool* pool,
+                                ImageF* BUTTERAUGLI_RESTRICT out) {
+  JXL_CHECK(out->xsize() == in.ysize());
+  JXL_CHECK(out->ysize() == in.xsize());
+  constexpr size_t kRowsPerTask = 64;
+  const size_t ysize = in.ysize();
+  const auto convolve_band = [&](const uint32_t task, size_t /*thread*/) {
+    const size_t y0 = task * kRowsPerTask;
+    const size_t y1 = std::min(ysize, y0 + kRowsPerTask);
+    ConvolutionWithTranspose(in, kernel, y0, y1, out);
+  };
+  return RunOnPool(pool, 0, DivCeil(ysize, kRowsPerTask), ThreadPool::NoInit,
+                   convolve_band, "ButteraugliBlur");
+}
+
 // A blur somewhat similar to a 2D Gaussian blur.
 // See: https://en.wikipedia.org/wiki/Gaussian_blur
 //
@@ -243,14 +266,16 @@ Status Blur(const ImageF& in, float sigma, const ButteraugliParams& params,
         {HWY_REP4(w0), HWY_REP4(w1), HWY_REP4(w2)},
         {HWY_REP4(w0), HWY_REP4(w1), HWY_REP4(w2)},
     };
-    Separable5(in, Rect(in), weights, /*pool=*/nullptr, out);
+    Separable5(in, Rect(in), weights, temp->pool, out);
     return true;
   }
 
   ImageF* temp_t;
   JXL_RETURN_IF_ERROR(temp->GetTransposed(in, &temp_t));
-  ConvolutionWithTranspose(in, kernel, temp_t);
-  ConvolutionWithTranspose(*temp_t, kernel, out);
+  JXL_RETURN_IF_ERROR(
+      ConvolutionWithTranspose(in, kernel, temp->pool, temp_t));
+  JXL_RETURN_IF_ERROR(
+      ConvolutionWithTranspose(*temp_t, kernel, temp->pool, out));
   return true;
 }
 
@@ -1778,7 +1803,7 @@ ButteraugliComparator::ButteraugliComparator(size_t xsize, size_t ysize,
     : xsize_(xsize), ysize_(ysize), params_(params) {}
 
 StatusOr<std::unique_ptr<ButteraugliComparator>> ButteraugliComparator::Make(
-    const Image3F& rgb0, const ButteraugliParams& params) {
+    const Image3F& rgb0, const ButteraugliParams& params, ThreadPool* pool) {
   size_t xsize = rgb0.xsize();
   size_t ysize = rgb0.ysize();
   JxlMemoryManager* memory_manager = rgb0.memory_manager();
@@ -1787,6 +1812,7 @@ StatusOr<std::unique_ptr<ButteraugliComparator>> ButteraugliComparator::Make(
           new ButteraugliComparator(xsize, ysize, params));
   JXL_ASSIGN_OR_RETURN(result->temp_,
                        Image3F::Create(memory_manager, xsize, ysize));
+  result->blur_temp_.pool = pool;
 
   if (xsize < 8 || ysize < 8) {
     return result;
@@ -1805,7 +1831,7 @@ StatusOr<std::unique_ptr<ButteraugliComparator>> ButteraugliComparator::Make(
   // functionality with the PsychoImage multi-resolution approach.
   JXL_ASSIGN_OR_RETURN(Image3F subsampledRgb0, SubSample2x(rgb0));
   StatusOr<std::unique_ptr<ButteraugliComparator>> sub =
-      ButteraugliComparator::Make(subsampledRgb0, params);
+      ButteraugliComparator::Make(subsampledRgb0, params, pool);
   if (!sub.ok()) return sub.status();
   result->sub_ = std::move(sub).value();
 
@@ -17,6 +17,7 @@
 #include <memory>
 
 #include "lib/jxl/base/compiler_specific.h"
+#include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/base/status.h"
 #include "lib/jxl/image.h"
 
@@ -161,6 +162,9 @@ struct BlurTemp {
   }
 
   ImageF transposed_temp;
+  // If set, Blur runs its passes on this pool. The result does not depend on
+  // the number of threads.
+  ThreadPool *pool = nullptr;
 };
 
 class ButteraugliComparator {
@@ -170,8 +174,11 @@ class ButteraugliComparator {
   // improve results at higher Butteraugli values.
   virtual ~ButteraugliComparator() = default;
 
+  // `pool` is used for the blurs of all subsequent comparisons and must
+  // outlive the comparator; it may be null.
   static StatusOr<std::unique_ptr<ButteraugliComparator>> Make(
-      const Image3F &rgb0, const ButteraugliParams &params);
+      const Image3F &rgb0, const ButteraugliParams &params,
+      ThreadPool *pool = nullptr);
 
   // Computes the butteraugli map between the original image given in the
   // constructor and the distorted image give here.
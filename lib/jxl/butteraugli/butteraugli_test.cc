@@ -10,6 +10,7 @@
 
 #include <algorithm>
 #include <cstdint>
+#include <memory>
 #include <utility>
 
 #include "lib/extras/metrics.h"
@@ -19,6 +20,7 @@
 #include "lib/jxl/enc_external_image.h"
 #include "lib/jxl/image.h"
 #include "lib/jxl/image_ops.h"
+#include "lib/jxl/image_test_utils.h"
 #include "lib/jxl/test_image.h"
 #include "lib/jxl/test_utils.h"
 #include "lib/jxl/testing.h"
@@ -119,5 +121,32 @@ TEST(ButteraugliInPlaceTest, LargeImage) {
   EXPECT_NEAR(distp, distp2, 1e-7);
 }
 
+TEST(ButteraugliComparatorTest, SameResultWithThreads) {
+  JxlMemoryManager* memory_manager = jxl::test::MemoryManager();
+  const size_t xsize = 300;
+  const size_t ysize = 200;
+  TestImage img;
+  img.SetDimensions(xsize, ysize).AddFrame().RandomFill(123);
+  Image3F rgb0 = GetColorImage(img.ppf());
+  JXL_ASSIGN_OR_DIE(Image3F rgb1,
+                    Image3F::Create(memory_manager, xsize, ysize));
+  CopyImageTo(rgb0, &rgb1);
+  AddUniformNoise(&rgb1, 0.02f, 321);
+  AddEdge(&rgb1, 0.1f, xsize / 3, ysize / 3);
+  ButteraugliParams ba;
+
+  JXL_ASSIGN_OR_DIE(std::unique_ptr<ButteraugliComparator> serial,
+                    ButteraugliComparator::Make(rgb0, ba));
+  ImageF diffmap;
+  ASSERT_TRUE(serial->Diffmap(rgb1, diffmap));
+
+  test::ThreadPoolForTests pool(8);
+  JXL_ASSIGN_OR_DIE(std::unique_ptr<ButteraugliComparator> threaded,
+                    ButteraugliComparator::Make(rgb0, ba, pool.get()));
+  ImageF diffmap_threaded;
+  ASSERT_TRUE(threaded->Diffmap(rgb1, diffmap_threaded));
+  JXL_EXPECT_OK(SamePixels(diffmap, diffmap_threaded, _));
+}
+
 }  // namespace
 }  // namespace jxl
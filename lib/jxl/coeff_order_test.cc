@@ -8,16 +8,21 @@
 #include <jxl/memory_manager.h>
 
 #include <algorithm>
+#include <cstring>
+#include <memory>
 #include <numeric>  // iota
 #include <utility>
 #include <vector>
 
+#include "lib/jxl/ac_strategy.h"
 #include "lib/jxl/base/printf_macros.h"
 #include "lib/jxl/base/random.h"
 #include "lib/jxl/base/span.h"
 #include "lib/jxl/coeff_order_fwd.h"
+#include "lib/jxl/dct_util.h"
 #include "lib/jxl/dec_bit_reader.h"
 #include "lib/jxl/enc_coeff_order.h"
+#include "lib/jxl/frame_dimensions.h"
 #include "lib/jxl/test_utils.h"
 #include "lib/jxl/testing.h"
 
@@ -95,5 +100,52 @@ TEST(CoeffOrderTest, FewSlidesBig) { TestPermutation(kFewSlides, 1 << 16); }
 TEST(CoeffOrderTest, FewSwapsBig) { TestPermutation(kFewSwaps, 1 << 16); }
 TEST(CoeffOrderTest, RandomBig) { TestPermutation(kRandom, 1 << 16); }
 
+TEST(CoeffOrderTest, StatsInStripes) {
+  JxlMemoryManager* memory_manager = jxl::test::MemoryManager();
+  FrameDimensions frame_dim;
+  frame_dim.Set(/*xsize=*/512, /*ysize=*/1024, /*group_size_shift=*/1,
+                /*max_hshift=*/0, /*max_vshift=*/0, /*modular_mode=*/false,
+                /*upsampling=*/1);
+  JXL_ASSIGN_OR_DIE(
+      AcStrategyImage ac_strategy,
+      AcStrategyImage::Create(memory_manager, frame_dim.xsize_blocks,
+                              frame_dim.ysize_blocks));
+  ac_strategy.FillDCT8();
+  const size_t group_size = kGroupDim * kGroupDim;
+  JXL_ASSIGN_OR_DIE(std::unique_ptr<ACImageT<int32_t>> all,
+                         ACImageT<int32_t>::Make(memory_manager, group_size,
+                                                 frame_dim.num_groups));
+  Rng rng(0);
+  for (size_t c = 0; c < 3; c++) {
+    for (size_t g = 0; g < frame_dim.num_groups; g++) {
+      int32_t* row = all->PlaneRow(c, g, 0).ptr32;
+      for (size_t i = 0; i < group_size; i++) {
+        row[i] = rng.UniformU(0, 4) == 0 ? 1 : 0;
+      }
+    }
+  }
+  CoeffOrderStats expected(SpeedTier::kSquirrel, 1);
+  expected.AddGroups(*all, ac_strategy, frame_dim, 0, frame_dim.num_groups);
+
+  // Same groups, two rows of groups at a time.
+  const size_t stripe_groups = 2 * frame_dim.xsize_groups;
+  JXL_ASSIGN_OR_DIE(
+      std::unique_ptr<ACImageT<int32_t>> stripe,
+      ACImageT<int32_t>::Make(memory_manager, group_size, stripe_groups));
+  CoeffOrderStats stats(SpeedTier::kSquirrel, 1);
+  for (size_t begin = 0; begin < frame_dim.num_groups;
+       begin += stripe_groups) {
+    for (size_t c = 0; c < 3; c++) {
+      for (size_t g = begin; g < begin + stripe_groups; g++) {
+        memcpy(stripe->PlaneRow(c, g - begin, 0).ptr32,
+               all->PlaneRow(c, g, 0).ptr32, group_size * sizeof(int32_t));
+      }
+    }
+    stats.AddGroups(*stripe, ac_strategy, frame_dim, begin,
+                    begin + stripe_groups);
+  }
+  EXPECT_EQ(expected.num_zeros(), stats.num_zeros());
+}
+
 }  // namespace
 }  // namespace jxl
@@ -15,6 +15,8 @@ constexpr float DCTResampleScales<8, 64>::kScales[];
 constexpr float DCTResampleScales<16, 128>::kScales[];
 constexpr float DCTResampleScales<32, 256>::kScales[];
 constexpr float DCTResampleScales<8, 1>::kScales[];
+constexpr float DCTResampleScales<8, 4>::kScales[];
+constexpr float DCTResampleScales<8, 2>::kScales[];
 constexpr float DCTResampleScales<16, 2>::kScales[];
 constexpr float DCTResampleScales<32, 4>::kScales[];
 constexpr float DCTResampleScales<64, 8>::kScales[];
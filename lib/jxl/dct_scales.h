@@ -49,6 +49,26 @@ struct DCTResampleScales<8, 1> {
   };
 };
 
+// Used to render 8x8 blocks at 1/2 and 1/4 of their size; the scales are
+// cos(i / 16 * pi) and cos(i / 16 * pi) * cos(i / 8 * pi).
+template <>
+struct DCTResampleScales<8, 4> {
+  static constexpr float kScales[] = {
+      1.000000000000000000,
+      0.980785280403230449,
+      0.923879532511286756,
+      0.831469612302545237,
+  };
+};
+
+template <>
+struct DCTResampleScales<8, 2> {
+  static constexpr float kScales[] = {
+      1.000000000000000000,
+      0.906127446352887778,
+  };
+};
+
 template <>
 struct DCTResampleScales<16, 2> {
   static constexpr float kScales[] = {
@@ -16,6 +16,7 @@
 #include "lib/jxl/render_pipeline/stage_epf.h"
 #include "lib/jxl/render_pipeline/stage_from_linear.h"
 #include "lib/jxl/render_pipeline/stage_gaborish.h"
+#include "lib/jxl/render_pipeline/stage_loop_filter.h"
 #include "lib/jxl/render_pipeline/stage_noise.h"
 #include "lib/jxl/render_pipeline/stage_patches.h"
 #include "lib/jxl/render_pipeline/stage_splines.h"
@@ -29,6 +30,59 @@
 
 namespace jxl {
 
+namespace {
+
+// Whether the output encoding is reached from linear colors by the from-linear
+// stage alone, rather than by a CMS stage.
+bool IsFromLinearEnough(const OutputEncodingInfo& output_encoding_info) {
+  const size_t channels_src =
+      (output_encoding_info.orig_color_encoding.IsCMYK()
+           ? 4
+           : output_encoding_info.orig_color_encoding.Channels());
+  const size_t channels_dst = output_encoding_info.color_encoding.Channels();
+  bool mixing_color_and_grey = (channels_dst != channels_src);
+  // In those cases we only need a linear stage in other cases we attempt to
+  // obtain a cms stage: the cases are
+  // - output_encoding_info.color_encoding_is_original: no cms stage needed
+  // because it would be a no-op
+  // - !output_encoding_info.cms_set: can't use the cms, so no point in trying
+  // to add a cms stage
+  // - mixing_color_and_grey: cms stage can't handle that
+  // TODO(firsching): remove "mixing_color_and_grey" condition after adding
+  // support for greyscale to cms stage.
+  return output_encoding_info.color_encoding_is_original ||
+         !output_encoding_info.cms_set || mixing_color_and_grey;
+}
+
+// Whether the channels of a YCbCr frame reach the end of the render pipeline
+// unmodified, other than by chroma upsampling, and the chroma subsampling
+// matches the layout of the YCbCr output, so that they can be written to it
+// directly.
+bool CanWriteYCbCrDirectly(const FrameHeader& frame_header,
+                           const PassesDecoderState::PipelineOptions& options,
+                           const OutputEncodingInfo& output_encoding_info,
+                           const YCbCrOutput& output,
+                           Orientation undo_orientation) {
+  const YCbCrChromaSubsampling& cs = frame_header.chroma_subsampling;
+  const bool subsampled = output.layout != JXL_YCBCR_444;
+  const LoopFilter& lf = frame_header.loop_filter;
+  const uint64_t kModifiesColor = FrameHeader::kPatches |
+                                  FrameHeader::kSplines | FrameHeader::kNoise;
+  return frame_header.color_transform == ColorTransform::kYCbCr &&
+         (subsampled ? cs.Is420() : cs.Is444()) && !lf.gab &&
+         lf.epf_iters == 0 && (frame_header.flags & kModifiesColor) == 0 &&
+         frame_header.upsampling == 1 && frame_header.dc_level == 0 &&
+         !frame_header.CanBeReferenced() &&
+         !(options.coalescing && NeedsBlending(frame_header)) &&
+         !(options.render_spotcolors &&
+           frame_header.nonserialized_metadata->m.Find(
+               ExtraChannel::kSpotColor)) &&
+         !GetToneMappingStage(output_encoding_info) &&
+         undo_orientation == Orientation::kIdentity;
+}
+
+}  // namespace
+
 Status PassesDecoderState::PreparePipeline(const FrameHeader& frame_header,
                                            const ImageMetadata* metadata,
                                            ImageBundle* decoded,
@@ -50,7 +104,14 @@ Status PassesDecoderState::PreparePipeline(const FrameHeader& frame_header,
     builder.UseSimpleImplementation();
   }
 
-  if (!frame_header.chroma_subsampling.Is444()) {
+  ycbcr_output_direct =
+      ycbcr_output.planes[0] != nullptr &&
+      CanWriteYCbCrDirectly(frame_header, options, output_encoding_info,
+                            ycbcr_output, undo_orientation);
+
+  // The stages that write subsampled chroma to the YCbCr output replace the
+  // upsampling.
+  if (!frame_header.chroma_subsampling.Is444() && !ycbcr_output_direct) {
     for (size_t c = 0; c < 3; c++) {
       if (frame_header.chroma_subsampling.HShift(c) != 0) {
         builder.AddStage(GetChromaUpsamplingStage(c, /*horizontal=*/true));
@@ -61,12 +122,20 @@ Status PassesDecoderState::PreparePipeline(const FrameHeader& frame_header,
     }
   }
 
-  if (frame_header.loop_filter.gab) {
-    builder.AddStage(GetGaborishStage(frame_header.loop_filter));
-  }
-
-  {
+  // The slow pipeline keeps the separate stages as a reference. Frames that
+  // are rendered at a reduced size with filters are drawn from their DC alone,
+  // and the filters are skipped for them.
+  std::unique_ptr<RenderPipelineStage> loop_filter =
+      options.use_slow_render_pipeline || idct_downsampling != 1
+          ? nullptr
+          : GetLoopFilterStage(memory_manager, frame_header.loop_filter, sigma);
+  if (loop_filter) {
+    builder.AddStage(std::move(loop_filter));
+  } else if (idct_downsampling == 1) {
     const LoopFilter& lf = frame_header.loop_filter;
+    if (lf.gab) {
+      builder.AddStage(GetGaborishStage(lf));
+    }
     if (lf.epf_iters >= 3) {
       builder.AddStage(GetEPFStage(lf, sigma, 0));
     }
@@ -143,7 +212,33 @@ Status PassesDecoderState::PreparePipeline(const FrameHeader& frame_header,
     }
   }
 
-  if (fast_xyb_srgb8_conversion) {
+  const bool write_output =
+      !resample_output &&
+      (main_output.callback.IsPresent() || main_output.buffer);
+  // The XYB, from-linear and write stages can be fused into one if none of the
+  // optional stages below would run between them. The simple pipeline keeps
+  // them separate, as a reference.
+  const bool fuse_xyb_to_output =
+      write_output && !options.use_slow_render_pipeline &&
+      frame_header.color_transform == ColorTransform::kXYB &&
+      output_encoding_info.color_encoding.GetColorSpace() != ColorSpace::kXYB &&
+      !(options.coalescing && NeedsBlending(frame_header)) &&
+      !(options.coalescing && frame_header.CanBeReferenced() &&
+        !frame_header.save_before_color_transform) &&
+      !(options.render_spotcolors &&
+        frame_header.nonserialized_metadata->m.Find(
+            ExtraChannel::kSpotColor)) &&
+      !GetToneMappingStage(output_encoding_info) &&
+      IsFromLinearEnough(output_encoding_info);
+
+  if (ycbcr_output_direct) {
+    const size_t shift = frame_header.chroma_subsampling.Is444() ? 0 : 1;
+    // The luma stage goes last, as the chroma stages are kInOut if subsampled.
+    for (size_t c : {0, 2, 1}) {
+      builder.AddStage(GetWriteToYCbCrPlaneStage(
+          ycbcr_output, c, c == 1 ? 0 : shift, width, height));
+    }
+  } else if (fast_xyb_srgb8_conversion) {
 #if !JXL_HIGH_PRECISION
     JXL_ASSERT(!NeedsBlending(frame_header));
     JXL_ASSERT(!frame_header.CanBeReferenced() ||
@@ -156,6 +251,11 @@ Status PassesDecoderState::PreparePipeline(const FrameHeader& frame_header,
                                             width, height, is_rgba, has_alpha,
                                             alpha_c));
 #endif
+  } else if (fuse_xyb_to_output) {
+    builder.AddStage(GetXYBToOutputStage(
+        output_encoding_info, main_output, width, height, has_alpha,
+        unpremul_alpha, alpha_c, undo_orientation, extra_output,
+        memory_manager));
   } else {
     bool linear = false;
     if (frame_header.color_transform == ColorTransform::kYCbCr) {
@@ -219,24 +319,7 @@ Status PassesDecoderState::PreparePipeline(const FrameHeader& frame_header,
     }
 
     if (linear) {
-      const size_t channels_src =
-          (output_encoding_info.orig_color_encoding.IsCMYK()
-               ? 4
-               : output_encoding_info.orig_color_encoding.Channels());
-      const size_t channels_dst =
-          output_encoding_info.color_encoding.Channels();
-      bool mixing_color_and_grey = (channels_dst != channels_src);
-      if ((output_encoding_info.color_encoding_is_original) ||
-          (!output_encoding_info.cms_set) || mixing_color_and_grey) {
-        // in those cases we only need a linear stage in other cases we attempt
-        // to obtain a cms stage: the cases are
-        // - output_encoding_info.color_encoding_is_original: no cms stage
-        // needed because it would be a no-op
-        // - !output_encoding_info.cms_set: can't use the cms, so no point in
-        // trying to add a cms stage
-        // - mixing_color_and_grey: cms stage can't handle that
-        // TODO(firsching): remove "mixing_color_and_grey" condition after
-        // adding support for greyscale to cms stage.
+      if (IsFromLinearEnough(output_encoding_info)) {
         builder.AddStage(GetFromLinearStage(output_encoding_info));
       } else {
         if (!output_encoding_info.linear_color_encoding.CreateICC()) {
@@ -251,7 +334,7 @@ Status PassesDecoderState::PreparePipeline(const FrameHeader& frame_header,
     }
     (void)linear;
 
-    if (main_output.callback.IsPresent() || main_output.buffer) {
+    if (write_output) {
       builder.AddStage(GetWriteToOutputStage(
           main_output, width, height, has_alpha, unpremul_alpha, alpha_c,
           undo_orientation, extra_output, memory_manager));
@@ -260,8 +343,13 @@ Status PassesDecoderState::PreparePipeline(const FrameHeader& frame_header,
           GetWriteToImageBundleStage(decoded, output_encoding_info));
     }
   }
+  const FrameDimensions frame_dim =
+      idct_downsampling == 1
+          ? shared->frame_dim
+          : shared->frame_dim.Downsampled(idct_downsampling);
   JXL_ASSIGN_OR_RETURN(render_pipeline,
-                       std::move(builder).Finalize(shared->frame_dim));
+                       std::move(builder).Finalize(frame_dim));
+  if (options.collect_stage_stats) render_pipeline->EnableStageStats();
   return render_pipeline->IsInitialized();
 }
 
@@ -14,6 +14,7 @@
 #include <atomic>
 #include <cmath>
 #include <cstdint>
+#include <cstring>
 #include <hwy/base.h>  // HWY_ALIGN_MAX
 #include <memory>
 #include <vector>
@@ -28,6 +29,7 @@
 #include "lib/jxl/common.h"
 #include "lib/jxl/dct_util.h"
 #include "lib/jxl/dec_ans.h"
+#include "lib/jxl/dec_resample.h"
 #include "lib/jxl/dec_xyb.h"
 #include "lib/jxl/frame_dimensions.h"
 #include "lib/jxl/frame_header.h"
@@ -84,6 +86,93 @@ struct ImageOutput {
   size_t stride;
 };
 
+// Planar 8-bit YCbCr output, see JxlDecoderSetImageOutYCbCrBuffer.
+struct YCbCrOutput {
+  JxlYCbCrLayout layout;
+  // Y, Cb and Cr planes, or Y and interleaved CbCr planes for NV12. The first
+  // plane is nullptr if there is no YCbCr output.
+  uint8_t* planes[3];
+  size_t strides[3];
+};
+
+// Temp images required for decoding a single group. Reduces memory allocations
+// for large images because we only initialize min(#threads, #groups) instances.
+struct GroupDecCache {
+  Status InitOnce(JxlMemoryManager* memory_manager, size_t num_passes,
+                  size_t used_acs) {
+    for (size_t i = 0; i < num_passes; i++) {
+      if (num_nzeroes[i].xsize() == 0) {
+        // Allocate enough for a whole group - partial groups on the
+        // right/bottom border just use a subset. The valid size is passed via
+        // Rect.
+
+        JXL_ASSIGN_OR_RETURN(num_nzeroes[i],
+                             Image3I::Create(memory_manager, kGroupDimInBlocks,
+                                             kGroupDimInBlocks));
+      }
+    }
+    size_t max_block_area = 0;
+
+    for (uint8_t o = 0; o < AcStrategy::kNumValidStrategies; ++o) {
+      AcStrategy acs = AcStrategy::FromRawStrategy(o);
+      if ((used_acs & (1 << o)) == 0) continue;
+      size_t area =
+          acs.covered_blocks_x() * acs.covered_blocks_y() * kDCTBlockSize;
+      max_block_area = std::max(area, max_block_area);
+    }
+
+    if (max_block_area > max_block_area_) {
+      max_block_area_ = max_block_area;
+      // We need 3x float blocks for dequantized coefficients and 1x for scratch
+      // space for transforms.
+      float_memory_ = hwy::AllocateAligned<float>(max_block_area_ * 7);
+      // We need 3x int32 or int16 blocks for quantized coefficients.
+      int32_memory_ = hwy::AllocateAligned<int32_t>(max_block_area_ * 3);
+      int16_memory_ = hwy::AllocateAligned<int16_t>(max_block_area_ * 3);
+    }
+
+    dec_group_block = float_memory_.get();
+    scratch_space = dec_group_block + max_block_area_ * 3;
+    dec_group_qblock = int32_memory_.get();
+    dec_group_qblock16 = int16_memory_.get();
+    return true;
+  }
+
+  Status InitDCBufferOnce(JxlMemoryManager* memory_manager) {
+    if (dc_buffer.xsize() == 0) {
+      JXL_ASSIGN_OR_RETURN(
+          dc_buffer,
+          ImageF::Create(memory_manager,
+                         kGroupDimInBlocks + kRenderPipelineXOffset * 2,
+                         kGroupDimInBlocks + 4));
+    }
+    return true;
+  }
+
+  // Scratch space used by DecGroupImpl().
+  float* dec_group_block;
+  int32_t* dec_group_qblock;
+  int16_t* dec_group_qblock16;
+
+  // For TransformToPixels.
+  float* scratch_space;
+  // Note that scratch_space is never used at the same time as dec_group_qblock.
+  // Moreover, only one of dec_group_qblock16 is ever used.
+  // TODO(veluca): figure out if we can save allocations.
+
+  // AC decoding
+  Image3I num_nzeroes[kMaxNumPasses];
+
+  // Buffer for DC upsampling.
+  ImageF dc_buffer;
+
+ private:
+  hwy::AlignedFreeUniquePtr<float[]> float_memory_;
+  hwy::AlignedFreeUniquePtr<int32_t[]> int32_memory_;
+  hwy::AlignedFreeUniquePtr<int16_t[]> int16_memory_;
+  size_t max_block_area_ = 0;
+};
+
 // Per-frame decoder state. All the images here should be accessed through a
 // group rect (either with block units or pixel units).
 struct PassesDecoderState {
@@ -95,8 +184,9 @@ struct PassesDecoderState {
   // Allows avoiding copies for encoder loop.
   const PassesSharedState* JXL_RESTRICT shared = &shared_storage;
 
-  // 8x upsampling stage for DC.
+  // 8x upsampling stage for DC, and the weights it was created with.
   std::unique_ptr<RenderPipelineStage> upsampler8x;
+  float upsampler8x_weights[210];
 
   // For ANS decoding.
   std::vector<ANSCode> code;
@@ -114,6 +204,12 @@ struct PassesDecoderState {
   size_t height;
   ImageOutput main_output;
   std::vector<ImageOutput> extra_output;
+  // Replaces main_output if set.
+  YCbCrOutput ycbcr_output;
+  // If true, the render pipeline writes the YCbCr samples of the frame to
+  // ycbcr_output directly, otherwise it writes to the ImageBundle and the
+  // frame decoder converts the RGB pixels to ycbcr_output.
+  bool ycbcr_output_direct = false;
 
   // Whether to use int16 float-XYB-to-uint8-srgb conversion.
   bool fast_xyb_srgb8_conversion;
@@ -126,6 +222,20 @@ struct PassesDecoderState {
   // intended display orientation.
   Orientation undo_orientation;
 
+  // If true, the render pipeline writes to the ImageBundle instead of the
+  // outputs, and the frame decoder resamples it to (width, height) with
+  // `resample_filter` when writing the outputs.
+  bool resample_output = false;
+  ResampleFilter resample_filter = ResampleFilter::kLanczos3;
+  // Largest downsampling of the frame that is still at least as large as the
+  // resampled output.
+  size_t resample_max_downsampling = 1;
+  // If not 1, the frame is rendered at 1/idct_downsampling of its size: every
+  // 8x8 block is rendered to (8/idct_downsampling)^2 pixels by an IDCT of its
+  // lowest frequencies, or from its DC alone, and the render pipeline runs at
+  // the reduced size.
+  size_t idct_downsampling = 1;
+
   // Used for seeding noise.
   size_t visible_frame_index = 0;
   size_t nonvisible_frame_index = 0;
@@ -142,11 +252,16 @@ struct PassesDecoderState {
   // Storage for the current frame if it can be referenced by future frames.
   ImageBundle frame_storage_for_referencing;
 
+  // Per-thread group scratch buffers, kept across frames.
+  std::vector<GroupDecCache> group_dec_caches;
+
   struct PipelineOptions {
     bool use_slow_render_pipeline;
     bool coalescing;
     bool render_spotcolors;
     bool render_noise;
+    // See RenderPipeline::EnableStageStats().
+    bool collect_stage_stats;
   };
 
   JxlMemoryManager* memory_manager() const { return shared->memory_manager; }
@@ -167,24 +282,57 @@ struct PassesDecoderState {
     main_output.callback = PixelCallback();
     main_output.buffer = nullptr;
     extra_output.clear();
+    ycbcr_output.planes[0] = nullptr;
+    ycbcr_output_direct = false;
 
     fast_xyb_srgb8_conversion = false;
     unpremul_alpha = false;
     undo_orientation = Orientation::kIdentity;
+    resample_output = false;
+    resample_max_downsampling = 1;
+    idct_downsampling = 1;
 
     used_acs = 0;
 
-    upsampler8x = GetUpsamplingStage(shared->metadata->transform_data, 0, 3);
+    const CustomTransformData& transform_data =
+        shared->metadata->transform_data;
+    static_assert(sizeof(upsampler8x_weights) ==
+                      sizeof(transform_data.upsampling8_weights),
+                  "Update upsampler8x_weights");
+    if (!upsampler8x ||
+        memcmp(upsampler8x_weights, transform_data.upsampling8_weights,
+               sizeof(upsampler8x_weights)) != 0) {
+      upsampler8x = GetUpsamplingStage(transform_data, 0, 3);
+      memcpy(upsampler8x_weights, transform_data.upsampling8_weights,
+             sizeof(upsampler8x_weights));
+    }
     if (frame_header.loop_filter.epf_iters > 0) {
-      JXL_ASSIGN_OR_RETURN(
-          sigma,
-          ImageF::Create(memory_manager,
-                         shared->frame_dim.xsize_blocks + 2 * kSigmaPadding,
-                         shared->frame_dim.ysize_blocks + 2 * kSigmaPadding));
+      const size_t xsize = shared->frame_dim.xsize_blocks + 2 * kSigmaPadding;
+      const size_t ysize = shared->frame_dim.ysize_blocks + 2 * kSigmaPadding;
+      if (sigma.xsize() != xsize || sigma.ysize() != ysize) {
+        JXL_ASSIGN_OR_RETURN(sigma,
+                             ImageF::Create(memory_manager, xsize, ysize));
+      }
     }
     return true;
   }
 
+  // Prepares the state for decoding another image with the same memory
+  // manager, keeping the buffers and tables that do not depend on the previous
+  // image; everything else is reset as after construction.
+  void ResetForNextImage() {
+    for (auto& reference_frame : shared_storage.reference_frames) {
+      reference_frame.frame = jxl::make_unique<ImageBundle>(memory_manager());
+      reference_frame.ib_is_in_xyb = false;
+    }
+    for (Image3F& dc_frame : shared_storage.dc_frames) dc_frame = Image3F();
+    frame_storage_for_referencing = ImageBundle(memory_manager());
+    render_pipeline.reset();
+    output_encoding_info = OutputEncodingInfo();
+    visible_frame_index = 0;
+    nonvisible_frame_index = 0;
+  }
+
   // Initialize the decoder state after all of DC is decoded.
   Status InitForAC(size_t num_passes, ThreadPool* pool) {
     shared_storage.coeff_order_size = 0;
@@ -203,84 +351,6 @@ struct PassesDecoderState {
   }
 };
 
-// Temp images required for decoding a single group. Reduces memory allocations
-// for large images because we only initialize min(#threads, #groups) instances.
-struct GroupDecCache {
-  Status InitOnce(JxlMemoryManager* memory_manager, size_t num_passes,
-                  size_t used_acs) {
-    for (size_t i = 0; i < num_passes; i++) {
-      if (num_nzeroes[i].xsize() == 0) {
-        // Allocate enough for a whole group - partial groups on the
-        // right/bottom border just use a subset. The valid size is passed via
-        // Rect.
-
-        JXL_ASSIGN_OR_RETURN(num_nzeroes[i],
-                             Image3I::Create(memory_manager, kGroupDimInBlocks,
-                                             kGroupDimInBlocks));
-      }
-    }
-    size_t max_block_area = 0;
-
-    for (uint8_t o = 0; o < AcStrategy::kNumValidStrategies; ++o) {
-      AcStrategy acs = AcStrategy::FromRawStrategy(o);
-      if ((used_acs & (1 << o)) == 0) continue;
-      size_t area =
-          acs.covered_blocks_x() * acs.covered_blocks_y() * kDCTBlockSize;
-      max_block_area = std::max(area, max_block_area);
-    }
-
-    if (max_block_area > max_block_area_) {
-      max_block_area_ = max_block_area;
-      // We need 3x float blocks for dequantized coefficients and 1x for scratch
-      // space for transforms.
-      float_memory_ = hwy::AllocateAligned<float>(max_block_area_ * 7);
-      // We need 3x int32 or int16 blocks for quantized coefficients.
-      int32_memory_ = hwy::AllocateAligned<int32_t>(max_block_area_ * 3);
-      int16_memory_ = hwy::AllocateAligned<int16_t>(max_block_area_ * 3);
-    }
-
-    dec_group_block = float_memory_.get();
-    scratch_space = dec_group_block + max_block_area_ * 3;
-    dec_group_qblock = int32_memory_.get();
-    dec_group_qblock16 = int16_memory_.get();
-    return true;
-  }
-
-  Status InitDCBufferOnce(JxlMemoryManager* memory_manager) {
-    if (dc_buffer.xsize() == 0) {
-      JXL_ASSIGN_OR_RETURN(
-          dc_buffer,
-          ImageF::Create(memory_manager,
-                         kGroupDimInBlocks + kRenderPipelineXOffset * 2,
-                         kGroupDimInBlocks + 4));
-    }
-    return true;
-  }
-
-  // Scratch space used by DecGroupImpl().
-  float* dec_group_block;
-  int32_t* dec_group_qblock;
-  int16_t* dec_group_qblock16;
-
-  // For TransformToPixels.
-  float* scratch_space;
-  // Note that scratch_space is never used at the same time as dec_group_qblock.
-  // Moreover, only one of dec_group_qblock16 is ever used.
-  // TODO(veluca): figure out if we can save allocations.
-
-  // AC decoding
-  Image3I num_nzeroes[kMaxNumPasses];
-
-  // Buffer for DC upsampling.
-  ImageF dc_buffer;
-
- private:
-  hwy::AlignedFreeUniquePtr<float[]> float_memory_;
-  hwy::AlignedFreeUniquePtr<int32_t[]> int32_memory_;
-  hwy::AlignedFreeUniquePtr<int16_t[]> int16_memory_;
-  size_t max_block_area_ = 0;
-};
-
 }  // namespace jxl
 
 #endif  // LIB_JXL_DEC_CACHE_H_
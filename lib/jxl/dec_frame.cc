@@ -10,6 +10,7 @@
 
 #include <algorithm>
 #include <atomic>
+#include <cmath>
 #include <cstddef>
 #include <cstdint>
 #include <cstdlib>
@@ -19,6 +20,7 @@
 
 #include "lib/jxl/ac_context.h"
 #include "lib/jxl/ac_strategy.h"
+#include "lib/jxl/alpha.h"
 #include "lib/jxl/base/bits.h"
 #include "lib/jxl/base/common.h"
 #include "lib/jxl/base/compiler_specific.h"
@@ -26,6 +28,7 @@
 #include "lib/jxl/base/printf_macros.h"
 #include "lib/jxl/base/rect.h"
 #include "lib/jxl/base/status.h"
+#include "lib/jxl/blending.h"
 #include "lib/jxl/chroma_from_luma.h"
 #include "lib/jxl/coeff_order.h"
 #include "lib/jxl/coeff_order_fwd.h"
@@ -35,10 +38,12 @@
 #include "lib/jxl/dec_ans.h"
 #include "lib/jxl/dec_bit_reader.h"
 #include "lib/jxl/dec_cache.h"
+#include "lib/jxl/dec_external_image.h"
 #include "lib/jxl/dec_group.h"
 #include "lib/jxl/dec_modular.h"
 #include "lib/jxl/dec_noise.h"
 #include "lib/jxl/dec_patch_dictionary.h"
+#include "lib/jxl/dec_resample.h"
 #include "lib/jxl/entropy_coder.h"
 #include "lib/jxl/epf.h"
 #include "lib/jxl/fields.h"
@@ -77,6 +82,23 @@ Status DecodeGlobalDCInfo(BitReader* reader, bool is_jpeg,
   state->shared_storage.ac_strategy.FillInvalid();
   return true;
 }
+
+StatusOr<ImageF> ResampleChannel(const ImageF& in, size_t xsize, size_t ysize,
+                                 ResampleFilter filter, ThreadPool* pool) {
+  JXL_ASSIGN_OR_RETURN(ImageF out,
+                       ImageF::Create(in.memory_manager(), xsize, ysize));
+  JXL_RETURN_IF_ERROR(Resample(in, filter, pool, &out));
+  return out;
+}
+
+bool IsFloatOutput(const JxlPixelFormat& format) {
+  return format.data_type == JXL_TYPE_FLOAT ||
+         format.data_type == JXL_TYPE_FLOAT16;
+}
+
+uint8_t ToYCbCrSample(float v) {
+  return static_cast<uint8_t>(std::lround(std::min(std::max(v, 0.0f), 255.0f)));
+}
 }  // namespace
 
 Status DecodeFrame(PassesDecoderState* dec_state, ThreadPool* JXL_RESTRICT pool,
@@ -139,7 +161,7 @@ Status FrameDecoder::InitFrame(BitReader* JXL_RESTRICT br, ImageBundle* decoded,
   JxlMemoryManager* memory_manager = decoded_->memory_manager();
 
   // Reset the dequantization matrices to their default values.
-  dec_state_->shared_storage.matrices = DequantMatrices();
+  dec_state_->shared_storage.matrices.ResetToDefault();
 
   frame_header_.nonserialized_is_preview = is_preview;
   JXL_ASSERT(frame_header_.nonserialized_metadata != nullptr);
@@ -261,6 +283,7 @@ Status FrameDecoder::InitFrameOutput() {
   decoded_passes_per_ac_group_.resize(frame_dim_.num_groups, 0);
   processed_section_.clear();
   processed_section_.resize(toc_.size());
+  ac_group_needed_.clear();
   allocated_ = false;
   return true;
 }
@@ -495,11 +518,11 @@ Status FrameDecoder::ProcessACGroup(size_t ac_group_id,
   bool should_run_pipeline = true;
 
   if (frame_header_.encoding == FrameEncoding::kVarDCT) {
-    JXL_RETURN_IF_ERROR(group_dec_caches_[thread].InitOnce(
+    JXL_RETURN_IF_ERROR(dec_state_->group_dec_caches[thread].InitOnce(
         memory_manager, frame_header_.passes.num_passes, dec_state_->used_acs));
     JXL_RETURN_IF_ERROR(DecodeGroup(
         frame_header_, br, num_passes, ac_group_id, dec_state_,
-        &group_dec_caches_[thread], thread, render_pipeline_input,
+        &dec_state_->group_dec_caches[thread], thread, render_pipeline_input,
         decoded_->jpeg_data.get(), decoded_passes_per_ac_group_[ac_group_id],
         force_draw, dc_only, &should_run_pipeline));
   }
@@ -684,6 +707,8 @@ Status FrameDecoder::ProcessSections(const SectionInfo* sections, size_t num,
     pipeline_options.coalescing = coalescing_;
     pipeline_options.render_spotcolors = render_spotcolors_;
     pipeline_options.render_noise = true;
+    pipeline_options.collect_stage_stats = collect_stage_stats_;
+    dec_state_->idct_downsampling = ScaledIDCTDownsampling();
     JXL_RETURN_IF_ERROR(dec_state_->PreparePipeline(
         frame_header_, &frame_header_.nonserialized_metadata->m, decoded_,
         pipeline_options));
@@ -751,6 +776,9 @@ Status FrameDecoder::ProcessSections(const SectionInfo* sections, size_t num,
         "DecodeGroup"));
   }
   if (has_error) return JXL_FAILURE("Error in AC group");
+  if (decoded_ac_global_) {
+    JXL_RETURN_IF_ERROR(dec_state_->render_pipeline->RenderDeferred(pool_));
+  }
 
   MarkSections(sections, num, section_status);
   return true;
@@ -813,6 +841,7 @@ Status FrameDecoder::Flush() {
         },
         "ForceDrawGroup"));
     if (has_error) return JXL_FAILURE("Drawing groups failed");
+    JXL_RETURN_IF_ERROR(dec_state_->render_pipeline->RenderDeferred(pool_));
   }
 
   // undo global modular transforms and copy int pixel buffers to float ones
@@ -907,4 +936,242 @@ Status FrameDecoder::FinalizeFrame() {
   return true;
 }
 
+bool FrameDecoder::CanCompleteEarly() const {
+  // Pausing at the DC or at passes is only enabled when flushing produces a
+  // valid image, see SetPauseAtProgressive.
+  if (progressive_detail_ < JxlProgressiveDetail::kDC) return false;
+  return frame_header_.frame_type == FrameType::kRegularFrame &&
+         !frame_header_.CanBeReferenced() && !NeedsBlending(frame_header_);
+}
+
+bool FrameDecoder::HasDecodedForDownsampling(size_t downsampling) const {
+  if (!CanCompleteEarly() || !HasDecodedDC()) return false;
+  return frame_header_.passes.GetDownsamplingTargetForCompletedPasses(
+             NumCompletePasses()) <= downsampling;
+}
+
+bool FrameDecoder::SetRegionOfInterest(const Rect& rect) {
+  ac_group_needed_.clear();
+  bool single_section =
+      frame_dim_.num_groups == 1 && frame_header_.passes.num_passes == 1;
+  if (single_section || decoded_->IsJPEG() ||
+      frame_header_.encoding != FrameEncoding::kVarDCT ||
+      frame_header_.frame_type != FrameType::kRegularFrame ||
+      frame_header_.CanBeReferenced() || NeedsBlending(frame_header_) ||
+      frame_header_.custom_size_or_origin ||
+      !decoded_->metadata()->extra_channel_info.empty()) {
+    return false;
+  }
+  // Pixels of the frame around the region that the filters and the upsampling
+  // read from.
+  constexpr size_t kMargin = 4 * kBlockDim;
+  const size_t upsampling = frame_header_.upsampling;
+  const size_t group_dim = frame_dim_.group_dim;
+  const size_t x0 = rect.x0() / upsampling;
+  const size_t y0 = rect.y0() / upsampling;
+  const size_t x1 = DivCeil(rect.x0() + rect.xsize(), upsampling);
+  const size_t y1 = DivCeil(rect.y0() + rect.ysize(), upsampling);
+  const size_t gx0 = (x0 - std::min(x0, kMargin)) / group_dim;
+  const size_t gy0 = (y0 - std::min(y0, kMargin)) / group_dim;
+  const size_t gx1 =
+      std::min(DivCeil(x1 + kMargin, group_dim), frame_dim_.xsize_groups);
+  const size_t gy1 =
+      std::min(DivCeil(y1 + kMargin, group_dim), frame_dim_.ysize_groups);
+  ac_group_needed_.resize(frame_dim_.num_groups, 0);
+  for (size_t gy = gy0; gy < gy1; ++gy) {
+    for (size_t gx = gx0; gx < gx1; ++gx) {
+      ac_group_needed_[gy * frame_dim_.xsize_groups + gx] = 1;
+    }
+  }
+  // The passes are not complete in the groups that are not needed.
+  passes_to_pause_.clear();
+  return true;
+}
+
+bool FrameDecoder::SectionNeeded(size_t id) const {
+  if (ac_group_needed_.empty()) return true;
+  size_t ac_global_index = frame_dim_.num_dc_groups + 1;
+  if (id <= ac_global_index) return true;
+  return ac_group_needed_[(id - ac_global_index - 1) % frame_dim_.num_groups];
+}
+
+bool FrameDecoder::HasDecodedRegion() const {
+  if (ac_group_needed_.empty() || !HasDecodedDC() || !decoded_ac_global_) {
+    return false;
+  }
+  for (size_t g = 0; g < ac_group_needed_.size(); ++g) {
+    if (ac_group_needed_[g] &&
+        decoded_passes_per_ac_group_[g] < frame_header_.passes.num_passes) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool FrameDecoder::CompletedFromDC() const {
+  return CanCompleteEarly() &&
+         frame_header_.passes.GetDownsamplingTargetForCompletedPasses(0) <=
+             dec_state_->resample_max_downsampling;
+}
+
+size_t FrameDecoder::ScaledIDCTDownsampling() const {
+  size_t downsampling = dec_state_->resample_max_downsampling;
+  // Keep the groups at least as wide as the borders that the render pipeline
+  // stores around them.
+  while (downsampling > 1 && frame_dim_.group_dim / downsampling < 32) {
+    downsampling /= 2;
+  }
+  if (downsampling == 1) return 1;
+  const uint64_t kFullResolutionFlags =
+      FrameHeader::kPatches | FrameHeader::kSplines | FrameHeader::kNoise;
+  if (decoded_->IsJPEG() || frame_header_.encoding != FrameEncoding::kVarDCT ||
+      (frame_header_.flags & kFullResolutionFlags) != 0 ||
+      frame_header_.upsampling != 1 ||
+      frame_header_.frame_type != FrameType::kRegularFrame ||
+      frame_header_.CanBeReferenced() || NeedsBlending(frame_header_) ||
+      frame_header_.custom_size_or_origin ||
+      frame_header_.nonserialized_metadata->m.num_extra_channels != 0) {
+    return 1;
+  }
+  // Frames completed from their DC are drawn with one value per block at the
+  // reduced size, whatever their AC strategies; their loop filters are
+  // skipped, see PreparePipeline.
+  if (CompletedFromDC()) return downsampling;
+  // Otherwise, every pixel of the frame must come from the 8x8 DCT of its
+  // block, with no filter applied at full resolution. The output of the XYB
+  // stage is not linear in its input, so XYB frames are left at full size.
+  const LoopFilter& lf = frame_header_.loop_filter;
+  if (frame_header_.color_transform == ColorTransform::kXYB || lf.gab ||
+      lf.epf_iters != 0) {
+    return 1;
+  }
+  if (dec_state_->used_acs != (1u << AcStrategy::Type::DCT)) return 1;
+  return downsampling;
+}
+
+Status FrameDecoder::WriteResampledOutput() {
+  if (!dec_state_->resample_output || decoded_->IsJPEG()) return true;
+  const ResampleFilter filter = dec_state_->resample_filter;
+  const size_t xsize = dec_state_->width;
+  const size_t ysize = dec_state_->height;
+  const ImageOutput& main_output = dec_state_->main_output;
+  const size_t num_channels = main_output.format.num_channels;
+  const bool want_alpha = num_channels == 2 || num_channels == 4;
+  const bool has_alpha = want_alpha && decoded_->HasAlpha();
+  const bool unpremul_alpha = has_alpha && dec_state_->unpremul_alpha;
+  // Unpremultiplying needs all three color channels.
+  const size_t num_color = (num_channels >= 3 || unpremul_alpha) ? 3 : 1;
+
+  std::vector<ImageF> resampled;
+  for (size_t c = 0; c < num_color; c++) {
+    JXL_ASSIGN_OR_RETURN(
+        ImageF plane, ResampleChannel(decoded_->color()->Plane(c), xsize, ysize,
+                                      filter, pool_));
+    resampled.push_back(std::move(plane));
+  }
+  if (has_alpha) {
+    JXL_ASSIGN_OR_RETURN(
+        ImageF alpha,
+        ResampleChannel(*decoded_->alpha(), xsize, ysize, filter, pool_));
+    resampled.push_back(std::move(alpha));
+  }
+  if (unpremul_alpha) {
+    // Resampling the premultiplied colors weighs them by their alpha, as it
+    // should.
+    for (size_t y = 0; y < ysize; y++) {
+      UnpremultiplyAlpha(resampled[0].Row(y), resampled[1].Row(y),
+                         resampled[2].Row(y), resampled[3].Row(y), xsize);
+    }
+  }
+
+  const ImageF* channels[kConvertMaxChannels];
+  size_t c = 0;
+  for (; c < (num_channels >= 3 ? 3 : 1); c++) {
+    channels[c] = &resampled[c];
+  }
+  if (want_alpha) {
+    channels[c++] = has_alpha ? &resampled[num_color] : nullptr;
+  }
+  JXL_RETURN_IF_ERROR(ConvertChannelsToExternal(
+      channels, num_channels, main_output.bits_per_sample,
+      IsFloatOutput(main_output.format), main_output.format.endianness,
+      main_output.stride, pool_, main_output.buffer, main_output.buffer_size,
+      main_output.callback, dec_state_->undo_orientation));
+
+  for (size_t i = 0; i < dec_state_->extra_output.size(); i++) {
+    const ImageOutput& extra = dec_state_->extra_output[i];
+    if (extra.buffer == nullptr) continue;
+    JXL_ASSIGN_OR_RETURN(ImageF plane,
+                         ResampleChannel(decoded_->extra_channels()[i], xsize,
+                                         ysize, filter, pool_));
+    const ImageF* extra_channels[1] = {&plane};
+    JXL_RETURN_IF_ERROR(ConvertChannelsToExternal(
+        extra_channels, 1, extra.bits_per_sample, IsFloatOutput(extra.format),
+        extra.format.endianness, extra.stride, pool_, extra.buffer,
+        extra.buffer_size, PixelCallback(), dec_state_->undo_orientation));
+  }
+  return true;
+}
+
+Status FrameDecoder::WriteYCbCrOutput() {
+  const YCbCrOutput& output = dec_state_->ycbcr_output;
+  if (output.planes[0] == nullptr || dec_state_->ycbcr_output_direct ||
+      decoded_->IsJPEG()) {
+    return true;
+  }
+  const Image3F& color = *decoded_->color();
+  const Orientation orientation = dec_state_->undo_orientation;
+  const bool transpose = static_cast<int>(orientation) > 4;
+  const bool flip_x = orientation == Orientation::kFlipHorizontal ||
+                      orientation == Orientation::kRotate180 ||
+                      orientation == Orientation::kAntiTranspose ||
+                      orientation == Orientation::kRotate270;
+  const bool flip_y = orientation == Orientation::kRotate180 ||
+                      orientation == Orientation::kFlipVertical ||
+                      orientation == Orientation::kRotate90 ||
+                      orientation == Orientation::kAntiTranspose;
+  // Dimensions of the oriented output.
+  const size_t xsize = transpose ? dec_state_->height : dec_state_->width;
+  const size_t ysize = transpose ? dec_state_->width : dec_state_->height;
+  const size_t block = output.layout == JXL_YCBCR_444 ? 1 : 2;
+  const bool nv12 = output.layout == JXL_YCBCR_NV12;
+
+  // Full range BT.601 as defined by JFIF, the inverse of stage_ycbcr.cc; the
+  // chroma of each block of pixels is averaged.
+  const auto convert_row = [&](const uint32_t cy, size_t /*thread*/) {
+    const size_t y1 = std::min<size_t>((cy + 1) * block, ysize);
+    uint8_t* row_cb = output.planes[1] + cy * output.strides[1];
+    uint8_t* row_cr =
+        nv12 ? row_cb + 1 : output.planes[2] + cy * output.strides[2];
+    const size_t chroma_step = nv12 ? 2 : 1;
+    for (size_t cx = 0; cx * block < xsize; cx++) {
+      const size_t x1 = std::min<size_t>((cx + 1) * block, xsize);
+      float cb = 0.0f;
+      float cr = 0.0f;
+      for (size_t y = cy * block; y < y1; y++) {
+        for (size_t x = cx * block; x < x1; x++) {
+          size_t sx = transpose ? y : x;
+          size_t sy = transpose ? x : y;
+          if (flip_x) sx = color.xsize() - 1 - sx;
+          if (flip_y) sy = color.ysize() - 1 - sy;
+          const float r = color.ConstPlaneRow(0, sy)[sx] * 255.0f;
+          const float g = color.ConstPlaneRow(1, sy)[sx] * 255.0f;
+          const float b = color.ConstPlaneRow(2, sy)[sx] * 255.0f;
+          output.planes[0][y * output.strides[0] + x] =
+              ToYCbCrSample(0.299f * r + 0.587f * g + 0.114f * b);
+          cb += -0.168736f * r - 0.331264f * g + 0.5f * b;
+          cr += 0.5f * r - 0.418688f * g - 0.081312f * b;
+        }
+      }
+      const float num_pixels = (y1 - cy * block) * (x1 - cx * block);
+      row_cb[cx * chroma_step] = ToYCbCrSample(cb / num_pixels + 128.0f);
+      row_cr[cx * chroma_step] = ToYCbCrSample(cr / num_pixels + 128.0f);
+    }
+  };
+  JXL_RETURN_IF_ERROR(RunOnPool(pool_, 0, DivCeil(ysize, block),
+                                ThreadPool::NoInit, convert_row,
+                                "WriteYCbCr"));
+  return true;
+}
+
 }  // namespace jxl
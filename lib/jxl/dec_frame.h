@@ -19,11 +19,13 @@
 #include "lib/jxl/base/common.h"
 #include "lib/jxl/base/compiler_specific.h"
 #include "lib/jxl/base/data_parallel.h"
+#include "lib/jxl/base/rect.h"
 #include "lib/jxl/base/status.h"
 #include "lib/jxl/common.h"  // JXL_HIGH_PRECISION
 #include "lib/jxl/dec_bit_reader.h"
 #include "lib/jxl/dec_cache.h"
 #include "lib/jxl/dec_modular.h"
+#include "lib/jxl/dec_resample.h"
 #include "lib/jxl/frame_header.h"
 #include "lib/jxl/image_bundle.h"
 #include "lib/jxl/image_metadata.h"
@@ -54,6 +56,15 @@ class FrameDecoder {
 
   void SetRenderSpotcolors(bool rsc) { render_spotcolors_ = rsc; }
   void SetCoalescing(bool c) { coalescing_ = c; }
+  // Measures the cost of every stage of the render pipeline, see
+  // RenderPipeline::GetStageStats().
+  void SetCollectStageStats(bool c) { collect_stage_stats_ = c; }
+  // Stages of the render pipeline of this frame, or nothing if it did not get
+  // as far as preparing the pipeline.
+  std::vector<RenderPipelineStageStats> GetStageStats() const {
+    if (!finalized_dc_ || !dec_state_->render_pipeline) return {};
+    return dec_state_->render_pipeline->GetStageStats();
+  }
 
   // Read FrameHeader and table of contents from the given BitReader.
   Status InitFrame(BitReader* JXL_RESTRICT br, ImageBundle* decoded,
@@ -103,6 +114,39 @@ class FrameDecoder {
   // Must be called exactly once per frame, after all calls to ProcessSections.
   Status FinalizeFrame();
 
+  // Returns whether the passes decoded so far suffice for an output that is
+  // downsampled by at least `downsampling`, in which case the frame can be
+  // completed with Flush and FinalizeFrame without the remaining sections.
+  // Only true for frames that no later frame depends on.
+  bool HasDecodedForDownsampling(size_t downsampling) const;
+
+  // Restricts the AC groups that the frame needs to those around `rect`, in
+  // pixels of the image before its orientation is undone. The DC and the
+  // global sections are always needed, and Flush draws the other groups from
+  // the DC. Only applies to multi-group VarDCT frames without extra channels
+  // that no later frame depends on; returns whether it applies. Must be called
+  // after InitFrame, and disables the pauses at progressive passes.
+  bool SetRegionOfInterest(const Rect& rect);
+
+  // Returns whether the section with the given TOC id is needed for the region
+  // of interest, always true if there is none.
+  bool SectionNeeded(size_t id) const;
+
+  // Returns whether all the sections needed for the region of interest are
+  // decoded, in which case the frame can be completed with Flush and
+  // FinalizeFrame without the remaining sections.
+  bool HasDecodedRegion() const;
+
+  // Resamples the pixels rendered so far to the output size given to
+  // SetImageOutput and writes them to the outputs. Needed after Flush and
+  // FinalizeFrame if SetOutputResampling was enabled.
+  Status WriteResampledOutput();
+
+  // Converts the pixels rendered so far to the YCbCr output given to
+  // SetYCbCrOutput, unless the render pipeline wrote them there directly.
+  // Needed after Flush and FinalizeFrame.
+  Status WriteYCbCrOutput();
+
   // Returns dependencies of this frame on reference ids as a bit mask: bits 0-3
   // indicate reference frame 0-3 for patches and blending, bits 4-7 indicate DC
   // frames this frame depends on. Only returns a valid result after all calls
@@ -184,6 +228,19 @@ class FrameDecoder {
                                          : std::numeric_limits<size_t>::max());
   }
 
+  // If `resample`, the frame is rendered at full size and then resampled with
+  // `filter` to the size given to SetImageOutput, see WriteResampledOutput.
+  // Frames that consist only of 8x8 DCTs, or that are completed from their DC
+  // alone, are rendered at up to 1/`max_downsampling` of their size instead,
+  // see ScaledIDCTDownsampling.
+  // Must be called before SetImageOutput.
+  void SetOutputResampling(bool resample, ResampleFilter filter,
+                           size_t max_downsampling) const {
+    dec_state_->resample_output = resample;
+    dec_state_->resample_filter = filter;
+    dec_state_->resample_max_downsampling = resample ? max_downsampling : 1;
+  }
+
   // Sets the pixel callback or image buffer where the pixels will be decoded.
   //
   // @param undo_orientation: if true, indicates the frame decoder should apply
@@ -216,7 +273,7 @@ class FrameDecoder {
 #if !JXL_HIGH_PRECISION
     if (dec_state_->main_output.buffer &&
         (format.data_type == JXL_TYPE_UINT8) && (format.num_channels >= 3) &&
-        !dec_state_->unpremul_alpha &&
+        !dec_state_->unpremul_alpha && !dec_state_->resample_output &&
         (dec_state_->undo_orientation == Orientation::kIdentity) &&
         decoded_->metadata()->xyb_encoded &&
         dec_state_->output_encoding_info.color_encoding.IsSRGB() &&
@@ -229,6 +286,23 @@ class FrameDecoder {
 #endif
   }
 
+  // Sets the planes where the frame will be decoded as 8-bit YCbCr, instead of
+  // the outputs of SetImageOutput; `xsize` and `ysize` are the dimensions of
+  // the luma plane.
+  void SetYCbCrOutput(const YCbCrOutput& output, size_t xsize, size_t ysize,
+                      bool undo_orientation) const {
+    dec_state_->width = xsize;
+    dec_state_->height = ysize;
+    dec_state_->ycbcr_output = output;
+    if (undo_orientation) {
+      dec_state_->undo_orientation = decoded_->metadata()->GetOrientation();
+      if (static_cast<int>(dec_state_->undo_orientation) > 4) {
+        std::swap(dec_state_->width, dec_state_->height);
+      }
+    }
+    dec_state_->extra_output.clear();
+  }
+
   void AddExtraChannelOutput(void* buffer, size_t buffer_size, size_t xsize,
                              JxlPixelFormat format, size_t bits_per_sample) {
     ImageOutput out;
@@ -251,6 +325,15 @@ class FrameDecoder {
                         bool dc_only);
   void MarkSections(const SectionInfo* sections, size_t num,
                     const SectionStatus* section_status);
+  // Whether the frame can be completed by Flush before all of its sections
+  // are decoded, see HasDecodedForDownsampling.
+  bool CanCompleteEarly() const;
+  // Whether the DC alone suffices for the output size, in which case no AC
+  // group is decoded before the frame is completed.
+  bool CompletedFromDC() const;
+  // Downsampling at which the frame is rendered with reduced IDCTs, or 1 if
+  // it is rendered at full size. Only known once all of the DC is decoded.
+  size_t ScaledIDCTDownsampling() const;
 
   // Allocates storage for parallel decoding using up to `num_threads` threads
   // of up to `num_tasks` tasks. The value of `thread` passed to
@@ -259,8 +342,8 @@ class FrameDecoder {
   // than the value of `num_tasks` passed here.
   Status PrepareStorage(size_t num_threads, size_t num_tasks) {
     size_t storage_size = std::min(num_threads, num_tasks);
-    if (storage_size > group_dec_caches_.size()) {
-      group_dec_caches_.resize(storage_size);
+    if (storage_size > dec_state_->group_dec_caches.size()) {
+      dec_state_->group_dec_caches.resize(storage_size);
     }
     use_task_id_ = num_threads > num_tasks;
     bool use_noise = (frame_header_.flags & FrameHeader::kNoise) != 0;
@@ -270,6 +353,11 @@ class FrameDecoder {
     if (dec_state_->render_pipeline) {
       JXL_RETURN_IF_ERROR(dec_state_->render_pipeline->PrepareForThreads(
           storage_size, use_group_ids));
+      // Each group has its own storage, so the threads left without a group
+      // can help rendering them afterwards.
+      if (use_task_id_) {
+        dec_state_->render_pipeline->DeferRendering(num_threads);
+      }
     }
     return true;
   }
@@ -310,10 +398,14 @@ class FrameDecoder {
   ModularFrameDecoder modular_frame_decoder_;
   bool render_spotcolors_ = true;
   bool coalescing_ = true;
+  bool collect_stage_stats_ = false;
 
   std::vector<uint8_t> processed_section_;
   std::vector<uint8_t> decoded_passes_per_ac_group_;
   std::vector<uint8_t> decoded_dc_groups_;
+  // Per AC group, whether it is needed for the region of interest; empty if
+  // all the groups are needed.
+  std::vector<uint8_t> ac_group_needed_;
   bool decoded_dc_global_;
   bool decoded_ac_global_;
   bool HasEverything() const;
@@ -322,8 +414,6 @@ class FrameDecoder {
   bool is_finalized_ = true;
   bool allocated_ = false;
 
-  std::vector<GroupDecCache> group_dec_caches_;
-
   // Whether or not the task id should be used for storage indexing, instead of
   // the thread id.
   bool use_task_id_ = false;
@@ -189,6 +189,8 @@ Status DecodeGroupImpl(const FrameHeader& frame_header,
   const auto kJpegDctMin = Set(di16_full, -4095);
   const auto kJpegDctMax = Set(di16_full, 4095);
 
+  // Pixels per side that each block is rendered to.
+  const size_t block_dim = kBlockDim / dec_state->idct_downsampling;
   size_t idct_stride[3];
   for (size_t c = 0; c < 3; c++) {
     idct_stride[c] = render_pipeline_input.GetBuffer(c).first->PixelsPerRow();
@@ -280,7 +282,7 @@ Status DecodeGroupImpl(const FrameHeader& frame_header,
     int16_t* JXL_RESTRICT jpeg_row[3];
     for (size_t c = 0; c < 3; c++) {
       idct_row[c] = render_pipeline_input.GetBuffer(c).second.Row(
-          render_pipeline_input.GetBuffer(c).first, sby[c] * kBlockDim);
+          render_pipeline_input.GetBuffer(c).first, sby[c] * block_dim);
       if (jpeg_data) {
         auto& component = jpeg_data->components[jpeg_c_map[c]];
         jpeg_row[c] =
@@ -426,9 +428,16 @@ Status DecodeGroupImpl(const FrameHeader& frame_header,
               continue;
             }
             // IDCT
-            float* JXL_RESTRICT idct_pos = idct_row[c] + sbx[c] * kBlockDim;
-            TransformToPixels(acs.Strategy(), block + c * size, idct_pos,
-                              idct_stride[c], group_dec_cache->scratch_space);
+            float* JXL_RESTRICT idct_pos = idct_row[c] + sbx[c] * block_dim;
+            if (block_dim == kBlockDim) {
+              TransformToPixels(acs.Strategy(), block + c * size, idct_pos,
+                                idct_stride[c], group_dec_cache->scratch_space);
+            } else {
+              // Only DCT blocks are rendered at a reduced size, see
+              // FrameDecoder::ScaledIDCTDownsampling.
+              DCT8ToPixels(block_dim, block + c * size, idct_pos,
+                           idct_stride[c], group_dec_cache->scratch_space);
+            }
           }
         }
         bx += llf_x;
@@ -703,8 +712,31 @@ Status DecodeGroup(const FrameHeader& frame_header,
   }
 
   if (draw == kDraw && num_passes == 0 && first_pass == 0) {
-    JXL_RETURN_IF_ERROR(group_dec_cache->InitDCBufferOnce(memory_manager));
     const YCbCrChromaSubsampling& cs = frame_header.chroma_subsampling;
+    if (dec_state->idct_downsampling != 1) {
+      // Blocks rendered at a reduced size are small enough to be drawn as
+      // their DC.
+      const size_t block_dim = kBlockDim / dec_state->idct_downsampling;
+      const Rect block_rect =
+          dec_state->shared->frame_dim.BlockGroupRect(group_idx);
+      for (size_t c : {0, 1, 2}) {
+        size_t hs = cs.HShift(c);
+        size_t vs = cs.VShift(c);
+        const Rect src_rect(block_rect.x0() >> hs, block_rect.y0() >> vs,
+                            block_rect.xsize() >> hs, block_rect.ysize() >> vs);
+        const auto dst = render_pipeline_input.GetBuffer(c);
+        for (size_t y = 0; y < src_rect.ysize() * block_dim; y++) {
+          const float* JXL_RESTRICT row_dc =
+              src_rect.ConstPlaneRow(*dec_state->shared->dc, c, y / block_dim);
+          float* JXL_RESTRICT row_out = dst.second.Row(dst.first, y);
+          for (size_t x = 0; x < src_rect.xsize() * block_dim; x++) {
+            row_out[x] = row_dc[x / block_dim];
+          }
+        }
+      }
+      return true;
+    }
+    JXL_RETURN_IF_ERROR(group_dec_cache->InitDCBufferOnce(memory_manager));
     for (size_t c : {0, 1, 2}) {
       size_t hs = cs.HShift(c);
       size_t vs = cs.VShift(c);
@@ -9,6 +9,7 @@
 
 #include <atomic>
 #include <cstdint>
+#include <mutex>
 #include <vector>
 
 #include "lib/jxl/frame_header.h"
@@ -26,6 +27,7 @@
 #include "lib/jxl/epf.h"
 #include "lib/jxl/modular/encoding/encoding.h"
 #include "lib/jxl/modular/modular_image.h"
+#include "lib/jxl/modular/transform/squeeze.h"
 #include "lib/jxl/modular/transform/transform.h"
 
 HWY_BEFORE_NAMESPACE();
@@ -282,6 +284,25 @@ Status ModularFrameDecoder::DecodeGlobalInfo(BitReader* reader,
     }
   }
   full_image = std::move(gi);
+  // The channels that the groups fill in are only read when finalizing, so
+  // for 8-bit images keep them in 16-bit storage until then. Samples that do
+  // not fit (e.g. after several squeeze levels) expand their channel again.
+  compact_full_image =
+      full_image.bitdepth <= 8 &&
+      !(full_image.transform.empty() && !have_something && all_same_shift);
+  deferred_stores.clear();
+  if (compact_full_image) {
+    size_t c = full_image.nb_meta_channels;
+    for (; c < full_image.channel.size(); c++) {
+      Channel& fc = full_image.channel[c];
+      if (fc.w > frame_dim.group_dim || fc.h > frame_dim.group_dim) break;
+    }
+    // These channels were not decoded yet, so there is nothing to copy.
+    for (; c < full_image.channel.size(); c++) {
+      JXL_RETURN_IF_ERROR(
+          full_image.channel[c].Compact(/*copy_samples=*/false));
+    }
+  }
   JXL_DEBUG_V(6, "DecodeGlobalInfo: full_image (with transforms) %s",
               full_image.DebugString().c_str());
   return dec_status;
@@ -328,10 +349,7 @@ Status ModularFrameDecoder::DecodeGroup(
            rect.xsize() >> fc.hshift, rect.ysize() >> fc.vshift, fc.w, fc.h);
     if (r.xsize() == 0 || r.ysize() == 0) continue;
     if (zerofill && use_full_image) {
-      for (size_t y = 0; y < r.ysize(); ++y) {
-        pixel_type* const JXL_RESTRICT row_out = r.Row(&fc.plane, y);
-        memset(row_out, 0, r.xsize() * sizeof(*row_out));
-      }
+      fc.ZeroFillRect(r);
     } else {
       JXL_ASSIGN_OR_RETURN(
           Channel gc, Channel::Create(memory_manager_, r.xsize(), r.ysize()));
@@ -385,10 +403,14 @@ Status ModularFrameDecoder::DecodeGroup(
            rect.xsize() >> fc.hshift, rect.ysize() >> fc.vshift, fc.w, fc.h);
     if (r.xsize() == 0 || r.ysize() == 0) continue;
     JXL_ASSERT(use_full_image);
-    CopyImageTo(/*rect_from=*/Rect(0, 0, r.xsize(), r.ysize()),
-                /*from=*/gi.channel[gic].plane,
-                /*rect_to=*/r, /*to=*/&fc.plane);
+    Plane<pixel_type>& samples = gi.channel[gic].plane;
     gic++;
+    if (!fc.Fits(samples, r)) {
+      std::lock_guard<std::mutex> lock(deferred_stores_mutex);
+      deferred_stores.push_back({c, r, std::move(samples)});
+      continue;
+    }
+    JXL_RETURN_IF_ERROR(fc.StoreRect(samples, r));
   }
   return true;
 }
@@ -699,6 +721,32 @@ Status ModularFrameDecoder::ModularImageToDecodedRect(
   return true;
 }
 
+namespace {
+
+// Whether undoing `transforms[0, end)` (last to first) only combines samples of
+// the same row, so that it can be done on a band of rows of the image.
+bool RowLocalTransforms(const std::vector<Transform>& transforms, size_t end,
+                        size_t nb_meta_channels) {
+  for (size_t i = end; i-- > 0;) {
+    const Transform& t = transforms[i];
+    if (t.id == TransformId::kRCT) {
+      if (t.begin_c < nb_meta_channels) return false;
+    } else if (t.id == TransformId::kPalette) {
+      // Delta palettes predict from the rows above.
+      if (t.nb_deltas != 0 || t.predictor != Predictor::Zero) return false;
+      if (nb_meta_channels == 0 || t.begin_c + 1 < nb_meta_channels) {
+        return false;
+      }
+      nb_meta_channels--;
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
 Status ModularFrameDecoder::FinalizeDecoding(const FrameHeader& frame_header,
                                              PassesDecoderState* dec_state,
                                              jxl::ThreadPool* pool,
@@ -711,6 +759,17 @@ Status ModularFrameDecoder::FinalizeDecoding(const FrameHeader& frame_header,
   } else {
     JXL_ASSIGN_OR_RETURN(gi, Image::Clone(full_image));
   }
+  for (Channel& ch : gi.channel) {
+    JXL_RETURN_IF_ERROR(ch.Expand());
+  }
+  {
+    std::lock_guard<std::mutex> lock(deferred_stores_mutex);
+    for (const DeferredStore& store : deferred_stores) {
+      JXL_RETURN_IF_ERROR(
+          gi.channel[store.channel].StoreRect(store.samples, store.rect));
+    }
+    if (inplace) deferred_stores.clear();
+  }
   size_t xsize = gi.w;
   size_t ysize = gi.h;
 
@@ -720,9 +779,21 @@ Status ModularFrameDecoder::FinalizeDecoding(const FrameHeader& frame_header,
   // Don't use threads if total image size is smaller than a group
   if (xsize * ysize < frame_dim.group_dim * frame_dim.group_dim) pool = nullptr;
 
+  JXL_DASSERT(global_transform.empty());
+  if (frame_dim.ysize_groups > 1 && !gi.transform.empty() &&
+      gi.transform.back().id == TransformId::kSqueeze) {
+    JXL_ASSIGN_OR_RETURN(
+        BandedInvSqueeze banded,
+        BandedInvSqueeze::Create(gi, gi.transform.back().squeezes));
+    if (banded.streamable() &&
+        RowLocalTransforms(gi.transform, gi.transform.size() - 1,
+                           banded.nb_meta_channels())) {
+      return FinalizeSqueezedBands(frame_header, gi, banded, dec_state, pool);
+    }
+  }
+
   // Undo the global transforms
   gi.undo_transforms(global_header.wp_header, pool);
-  JXL_DASSERT(global_transform.empty());
   if (gi.error) return JXL_FAILURE("Undoing transforms failed");
 
   for (size_t i = 0; i < dec_state->shared->frame_dim.num_groups; i++) {
@@ -731,11 +802,18 @@ Status ModularFrameDecoder::FinalizeDecoding(const FrameHeader& frame_header,
   std::atomic<bool> has_error{false};
   JXL_RETURN_IF_ERROR(RunOnPool(
       pool, 0, dec_state->shared->frame_dim.num_groups,
-      [&](size_t num_threads) {
+      [&](size_t num_threads) -> Status {
         bool use_group_ids = (frame_header.encoding == FrameEncoding::kVarDCT ||
                               (frame_header.flags & FrameHeader::kNoise));
-        return dec_state->render_pipeline->PrepareForThreads(num_threads,
-                                                             use_group_ids);
+        JXL_RETURN_IF_ERROR(dec_state->render_pipeline->PrepareForThreads(
+            num_threads, use_group_ids));
+        // Threads without a group can help rendering, unless groups processed
+        // by the same thread share their storage.
+        size_t num_groups = dec_state->shared->frame_dim.num_groups;
+        if (num_threads > num_groups && (use_group_ids || num_groups == 1)) {
+          dec_state->render_pipeline->DeferRendering(num_threads);
+        }
+        return true;
       },
       [&](const uint32_t group, size_t thread_id) {
         if (has_error) return;
@@ -754,6 +832,64 @@ Status ModularFrameDecoder::FinalizeDecoding(const FrameHeader& frame_header,
       },
       "ModularToRect"));
   if (has_error) return JXL_FAILURE("Error producing input to render pipeline");
+  JXL_RETURN_IF_ERROR(dec_state->render_pipeline->RenderDeferred(pool));
+  return true;
+}
+
+Status ModularFrameDecoder::FinalizeSqueezedBands(
+    const FrameHeader& frame_header, Image& gi, BandedInvSqueeze& banded,
+    PassesDecoderState* dec_state, jxl::ThreadPool* pool) {
+  // Undo the squeeze one row of groups at a time, and the row-local
+  // transforms that were applied before it on each band, so that the
+  // full-resolution image is never materialized.
+  const std::vector<Transform> band_transforms(gi.transform.begin(),
+                                               gi.transform.end() - 1);
+  for (size_t i = 0; i < frame_dim.num_groups; i++) {
+    dec_state->render_pipeline->ClearDone(i);
+  }
+  const bool use_group_ids =
+      (frame_header.encoding == FrameEncoding::kVarDCT ||
+       (frame_header.flags & FrameHeader::kNoise));
+  for (size_t gy = 0; gy < frame_dim.ysize_groups; gy++) {
+    const size_t y0 = gy * frame_dim.group_dim;
+    const size_t y1 = std::min(y0 + frame_dim.group_dim, gi.h);
+    Image band{gi.memory_manager()};
+    JXL_RETURN_IF_ERROR(banded.Band(y0, y1, pool, &band));
+    band.transform = band_transforms;
+    band.undo_transforms(global_header.wp_header, pool);
+    if (band.error) return JXL_FAILURE("Undoing transforms failed");
+
+    std::atomic<bool> has_error{false};
+    JXL_RETURN_IF_ERROR(RunOnPool(
+        pool, 0, frame_dim.xsize_groups,
+        [&](size_t num_threads) -> Status {
+          JXL_RETURN_IF_ERROR(dec_state->render_pipeline->PrepareForThreads(
+              num_threads, use_group_ids));
+          return true;
+        },
+        [&](const uint32_t gx, size_t thread_id) {
+          if (has_error) return;
+          const size_t group = gy * frame_dim.xsize_groups + gx;
+          const Rect rect = frame_dim.GroupRect(group);
+          RenderPipelineInput input =
+              dec_state->render_pipeline->GetInputBuffers(group, thread_id);
+          if (!ModularImageToDecodedRect(
+                  frame_header, band, dec_state, nullptr, input,
+                  Rect(rect.x0(), rect.y0() - y0, rect.xsize(),
+                       rect.ysize()))) {
+            has_error = true;
+            return;
+          }
+          if (!input.Done()) {
+            has_error = true;
+            return;
+          }
+        },
+        "ModularBandToRect"));
+    if (has_error) {
+      return JXL_FAILURE("Error producing input to render pipeline");
+    }
+  }
   return true;
 }
 
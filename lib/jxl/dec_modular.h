@@ -10,6 +10,7 @@
 
 #include <cstddef>
 #include <cstdint>
+#include <mutex>
 #include <string>
 #include <vector>
 
@@ -28,6 +29,8 @@
 
 namespace jxl {
 
+class BandedInvSqueeze;
+
 struct ModularStreamId {
   enum Kind {
     kGlobalData,
@@ -135,8 +138,27 @@ class ModularFrameDecoder {
                                    jxl::ThreadPool* pool,
                                    RenderPipelineInput& render_pipeline_input,
                                    Rect modular_rect) const;
+  // Renders `gi`, whose last transform is a squeeze, one row of groups at a
+  // time.
+  Status FinalizeSqueezedBands(const FrameHeader& frame_header, Image& gi,
+                               BandedInvSqueeze& banded,
+                               PassesDecoderState* dec_state,
+                               jxl::ThreadPool* pool);
   JxlMemoryManager* memory_manager_;
   Image full_image;
+  // Set if the channels filled in by the groups are kept in 16-bit storage.
+  // Groups store into disjoint rects of them without locking. A channel must
+  // not be expanded while other groups write to it, so the samples of a group
+  // that do not fit in 16 bits are kept in deferred_stores until
+  // FinalizeDecoding has expanded the channels.
+  bool compact_full_image = false;
+  struct DeferredStore {
+    size_t channel;
+    Rect rect;
+    Plane<pixel_type> samples;
+  };
+  std::vector<DeferredStore> deferred_stores;
+  std::mutex deferred_stores_mutex;
   std::vector<Transform> global_transform;
   FrameDimensions frame_dim;
   bool do_color;
@@ -0,0 +1,169 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include "lib/jxl/dec_resample.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#undef HWY_TARGET_INCLUDE
+#define HWY_TARGET_INCLUDE "lib/jxl/dec_resample.cc"
+#include <hwy/foreach_target.h>
+#include <hwy/highway.h>
+
+#include "lib/jxl/base/common.h"
+#include "lib/jxl/base/compiler_specific.h"
+#include "lib/jxl/base/status.h"
+#include "lib/jxl/image.h"
+#include "lib/jxl/image_ops.h"
+HWY_BEFORE_NAMESPACE();
+namespace jxl {
+namespace HWY_NAMESPACE {
+
+// These templates are not found via ADL.
+using hwy::HWY_NAMESPACE::MulAdd;
+
+float FilterRadius(ResampleFilter filter) {
+  switch (filter) {
+    case ResampleFilter::kBox:
+      return 0.5f;
+    case ResampleFilter::kMitchell:
+      return 2.0f;
+    case ResampleFilter::kLanczos3:
+      return 3.0f;
+  }
+  return 0.0f;
+}
+
+double FilterWeight(ResampleFilter filter, double t) {
+  t = std::abs(t);
+  switch (filter) {
+    case ResampleFilter::kBox:
+      return t < 0.5 ? 1.0 : 0.0;
+    case ResampleFilter::kMitchell:
+      if (t < 1.0) return (7.0 * t * t * t - 12.0 * t * t + 16.0 / 3) / 6;
+      if (t < 2.0) {
+        return (-7.0 / 3 * t * t * t + 12.0 * t * t - 20.0 * t + 32.0 / 3) / 6;
+      }
+      return 0.0;
+    case ResampleFilter::kLanczos3:
+      if (t < 1e-6) return 1.0;
+      if (t < 3.0) {
+        return 3.0 * std::sin(kPi * t) * std::sin(kPi * t / 3) /
+               (kPi * kPi * t * t);
+      }
+      return 0.0;
+  }
+  return 0.0;
+}
+
+// Input positions and normalized weights of the taps of every output pixel
+// along one axis, tap-major so that consecutive output pixels can be computed
+// in one vector: tap `k` of output pixel `i` is at `k * stride + i`. The
+// padding up to `stride` reads position 0 with weight 0.
+struct ResampleTaps {
+  size_t num_taps;
+  size_t stride;
+  std::vector<int32_t> positions;
+  std::vector<float> weights;
+};
+
+ResampleTaps ComputeTaps(ResampleFilter filter, size_t in_size,
+                         size_t out_size, size_t stride) {
+  const double scale = static_cast<double>(in_size) / out_size;
+  const double filter_scale = std::max(scale, 1.0);
+  const double support = FilterRadius(filter) * filter_scale;
+  ResampleTaps taps;
+  taps.num_taps = static_cast<size_t>(std::ceil(2 * support)) + 1;
+  taps.stride = stride;
+  taps.positions.resize(stride * taps.num_taps);
+  taps.weights.resize(stride * taps.num_taps);
+  std::vector<double> weights(taps.num_taps);
+  for (size_t i = 0; i < out_size; i++) {
+    const double center = (i + 0.5) * scale - 0.5;
+    const int64_t first = static_cast<int64_t>(std::floor(center - support));
+    double sum = 0;
+    for (size_t k = 0; k < taps.num_taps; k++) {
+      const double position = static_cast<double>(first) + k;
+      weights[k] = FilterWeight(filter, (position - center) / filter_scale);
+      sum += weights[k];
+    }
+    for (size_t k = 0; k < taps.num_taps; k++) {
+      const size_t j = k * stride + i;
+      taps.positions[j] = static_cast<int32_t>(
+          Mirror(first + static_cast<int64_t>(k), in_size));
+      taps.weights[j] = sum > 0 ? weights[k] / sum : 0.0f;
+    }
+  }
+  return taps;
+}
+
+Status Resample(const ImageF& in, ResampleFilter filter, ThreadPool* pool,
+                ImageF* out) {
+  const HWY_FULL(float) d;
+  const HWY_FULL(int32_t) di;
+  const size_t in_xsize = in.xsize();
+  const size_t out_xsize = out->xsize();
+  const size_t out_ysize = out->ysize();
+  const ResampleTaps taps_x = ComputeTaps(filter, in_xsize, out_xsize,
+                                          RoundUpTo(out_xsize, Lanes(d)));
+  const ResampleTaps taps_y =
+      ComputeTaps(filter, in.ysize(), out_ysize, out_ysize);
+
+  // Vertical pass first: it is vectorized along the rows, and the horizontal
+  // pass then only runs on the (usually fewer) output rows.
+  JXL_ASSIGN_OR_RETURN(
+      ImageF columns,
+      ImageF::Create(out->memory_manager(), in_xsize, out_ysize));
+  const auto resample_row = [&](const uint32_t y, size_t /*thread*/) {
+    float* JXL_RESTRICT row_columns = columns.Row(y);
+    for (size_t x = 0; x < in_xsize; x += Lanes(d)) {
+      auto sum = Zero(d);
+      for (size_t k = 0; k < taps_y.num_taps; k++) {
+        const size_t j = k * taps_y.stride + y;
+        const float* row_in = in.ConstRow(taps_y.positions[j]);
+        sum = MulAdd(Set(d, taps_y.weights[j]), Load(d, row_in + x), sum);
+      }
+      Store(sum, d, row_columns + x);
+    }
+
+    // Horizontal pass, one vector of output pixels at a time; the padding
+    // lanes are stored past `out_xsize`, within the row padding.
+    float* JXL_RESTRICT row_out = out->Row(y);
+    for (size_t x = 0; x < out_xsize; x += Lanes(d)) {
+      auto sum = Zero(d);
+      for (size_t k = 0; k < taps_x.num_taps; k++) {
+        const size_t j = k * taps_x.stride + x;
+        const auto positions = LoadU(di, &taps_x.positions[j]);
+        sum = MulAdd(LoadU(d, &taps_x.weights[j]),
+                     GatherIndex(d, row_columns, positions), sum);
+      }
+      Store(sum, d, row_out + x);
+    }
+  };
+  JXL_RETURN_IF_ERROR(RunOnPool(pool, 0, out_ysize, ThreadPool::NoInit,
+                                resample_row, "Resample"));
+  return true;
+}
+
+// NOLINTNEXTLINE(google-readability-namespace-comments)
+}  // namespace HWY_NAMESPACE
+}  // namespace jxl
+HWY_AFTER_NAMESPACE();
+
+#if HWY_ONCE
+namespace jxl {
+
+HWY_EXPORT(Resample);
+Status Resample(const ImageF& in, ResampleFilter filter, ThreadPool* pool,
+                ImageF* out) {
+  return HWY_DYNAMIC_DISPATCH(Resample)(in, filter, pool, out);
+}
+
+}  // namespace jxl
+#endif  // HWY_ONCE
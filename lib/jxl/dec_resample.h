@@ -0,0 +1,34 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef LIB_JXL_DEC_RESAMPLE_H_
+#define LIB_JXL_DEC_RESAMPLE_H_
+
+// Resampling of decoded images to an arbitrary output size.
+
+#include "lib/jxl/base/data_parallel.h"
+#include "lib/jxl/base/status.h"
+#include "lib/jxl/image.h"
+
+namespace jxl {
+
+enum class ResampleFilter {
+  // Average of the covered input pixels; nearest neighbour when upsampling.
+  kBox,
+  // Mitchell-Netravali cubic with B = C = 1/3.
+  kMitchell,
+  // Windowed sinc with 3 lobes.
+  kLanczos3,
+};
+
+// Resamples `in` to the size of `out` with the separable `filter`, which is
+// stretched by the scaling factor when downsampling so that every input pixel
+// contributes. Pixels outside of `in` are mirrored.
+Status Resample(const ImageF& in, ResampleFilter filter, ThreadPool* pool,
+                ImageF* out);
+
+}  // namespace jxl
+
+#endif  // LIB_JXL_DEC_RESAMPLE_H_
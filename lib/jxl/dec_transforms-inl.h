@@ -685,6 +685,52 @@ HWY_MAYBE_UNUSED void TransformToPixels(const AcStrategy::Type strategy,
   }
 }
 
+// Renders the lowest NxN frequencies of the DCT-8 `coefficients` to NxN pixels,
+// each approximating the average of the (8/N)x(8/N) pixels rendered by
+// TransformToPixels; the higher frequencies are dropped.
+template <size_t N>
+JXL_INLINE void DownsampledDCT8ToPixels(const float* JXL_RESTRICT coefficients,
+                                        float* JXL_RESTRICT pixels,
+                                        size_t pixels_stride,
+                                        float* JXL_RESTRICT scratch_space) {
+  const float* scales = DCTResampleScales<8, N>::kScales;
+  HWY_ALIGN float block[N * N];
+  for (size_t y = 0; y < N; y++) {
+    for (size_t x = 0; x < N; x++) {
+      block[y * N + x] = coefficients[y * 8 + x] * scales[y] * scales[x];
+    }
+  }
+  ComputeScaledIDCT<N, N>()(block, DCTTo(pixels, pixels_stride),
+                            scratch_space);
+}
+
+// Same as TransformToPixels for DCT blocks, but renders them to
+// `block_dim`x`block_dim` pixels, where `block_dim` is 1, 2, 4 or 8.
+HWY_MAYBE_UNUSED void DCT8ToPixels(size_t block_dim,
+                                   float* JXL_RESTRICT coefficients,
+                                   float* JXL_RESTRICT pixels,
+                                   size_t pixels_stride,
+                                   float* JXL_RESTRICT scratch_space) {
+  switch (block_dim) {
+    case 8:
+      ComputeScaledIDCT<8, 8>()(coefficients, DCTTo(pixels, pixels_stride),
+                                scratch_space);
+      break;
+    case 4:
+      DownsampledDCT8ToPixels<4>(coefficients, pixels, pixels_stride,
+                                 scratch_space);
+      break;
+    case 2:
+      DownsampledDCT8ToPixels<2>(coefficients, pixels, pixels_stride,
+                                 scratch_space);
+      break;
+    default:
+      // The DC is the average of the block.
+      pixels[0] = coefficients[0];
+      break;
+  }
+}
+
 HWY_MAYBE_UNUSED void LowestFrequenciesFromDC(const AcStrategy::Type strategy,
                                               const float* dc, size_t dc_stride,
                                               float* llf,
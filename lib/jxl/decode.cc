@@ -10,12 +10,14 @@
 #include <algorithm>
 #include <array>
 #include <functional>
+#include <limits>
 #include <memory>
 #include <utility>
 #include <vector>
 
 #include "lib/jxl/base/byte_order.h"
 #include "lib/jxl/base/common.h"
+#include "lib/jxl/base/rect.h"
 #include "lib/jxl/base/span.h"
 #include "lib/jxl/base/status.h"
 #include "lib/jxl/padded_bytes.h"
@@ -27,6 +29,7 @@
 #include "lib/jxl/box_content_decoder.h"
 #endif
 #include "lib/jxl/dec_frame.h"
+#include "lib/jxl/dec_resample.h"
 #if JPEGXL_ENABLE_TRANSCODE_JPEG
 #include "lib/jxl/decode_to_jpeg.h"
 #endif
@@ -341,8 +344,15 @@ typedef struct JxlDecoderFrameIndexBoxStruct {
 struct JxlDecoderStruct {
   JxlDecoderStruct() = default;
 
+  // Counts the bytes allocated through memory_manager, for the profiling
+  // events; holds the memory manager given to JxlDecoderCreate.
+  jxl::MemoryCounter memory_counter;
   JxlMemoryManager memory_manager;
   std::unique_ptr<jxl::ThreadPool> thread_pool;
+  JxlProfilingSink profiling_sink;
+  void* profiling_sink_opaque;
+  // Render pipeline stages of the last frame that was fully decoded.
+  std::vector<jxl::RenderPipelineStageStats> render_stage_stats;
 
   DecoderStage stage;
 
@@ -405,6 +415,15 @@ struct JxlDecoderStruct {
   bool render_spotcolors;
   bool coalescing;
   float desired_intensity_target;
+  // Size of the oriented output, or 0 for the image dimensions.
+  size_t output_xsize;
+  size_t output_ysize;
+  JxlResampleFilter output_filter;
+  // Region of the oriented image to decode at full quality, or an empty
+  // region for the whole image.
+  jxl::Rect region;
+  // Unlike the other settings, not cleared by JxlDecoderReset.
+  bool reuse_buffers = false;
 
   // Bitfield, for which informative events (JXL_DEC_BASIC_INFO, etc...) the
   // decoder returns a status. By default, do not return for any of the events,
@@ -424,6 +443,9 @@ struct JxlDecoderStruct {
   JxlProgressiveDetail frame_prog_detail;
   // The intended downsampling ratio for the current progression step.
   size_t downsampling_target;
+  // Downsampling ratio (1, 2, 4 or 8) of the current frame that the output
+  // size can be produced from, if the output is resampled.
+  size_t frame_max_downsampling;
 
   // Set to true if either an image out buffer or an image out callback was set.
   bool image_out_buffer_set;
@@ -445,6 +467,11 @@ struct JxlDecoderStruct {
   JxlPixelFormat image_out_format;
   JxlBitDepth image_out_bit_depth;
 
+  // If true, and image_out_buffer_set, the full resolution image is written to
+  // the planes of image_out_ycbcr instead of the buffer or callback above.
+  bool image_out_ycbcr_set;
+  JxlYCbCrBuffer image_out_ycbcr;
+
   // For extra channels. Empty if no extra channels are requested, and they are
   // reset each frame
   std::vector<ExtraChannelOutput> extra_channel_output;
@@ -598,13 +625,24 @@ struct JxlDecoderStruct {
                              next_in + avail_codestream);
       AdvanceInput(avail_codestream);
     } else {
-      AdvanceInput(codestream_unconsumed);
+      // GetCodestreamInput may have stitched only part of the current input.
+      size_t avail_codestream = AvailableCodestream();
+      codestream_copy.insert(codestream_copy.end(),
+                             next_in + codestream_unconsumed,
+                             next_in + avail_codestream);
+      AdvanceInput(avail_codestream);
       codestream_unconsumed = 0;
     }
     return JXL_DEC_NEED_MORE_INPUT;
   }
 
-  JxlDecoderStatus GetCodestreamInput(jxl::Span<const uint8_t>* span) {
+  // If `max_size` is given and the codestream copy is in use, only as much of
+  // the current input is appended to the copy as needed to make `max_size`
+  // bytes available after codestream_pos. The caller can then continue
+  // directly from the input once the copy is consumed.
+  JxlDecoderStatus GetCodestreamInput(
+      jxl::Span<const uint8_t>* span,
+      size_t max_size = std::numeric_limits<size_t>::max()) {
     if (codestream_copy.empty() && codestream_pos > 0) {
       size_t avail_codestream = AvailableCodestream();
       size_t skip = std::min<size_t>(codestream_pos, avail_codestream);
@@ -624,10 +662,20 @@ struct JxlDecoderStruct {
       *span = jxl::Bytes(next_in, avail_codestream);
       return JXL_DEC_SUCCESS;
     } else {
+      size_t stitched = avail_codestream;
+      if (max_size != std::numeric_limits<size_t>::max()) {
+        // Bytes of the copy that came from previously released inputs.
+        size_t old_bytes = codestream_copy.size() - codestream_unconsumed;
+        size_t wanted = codestream_pos + max_size;
+        stitched = wanted > old_bytes ? wanted - old_bytes : 0;
+        stitched = std::max(codestream_unconsumed,
+                            std::min(stitched, avail_codestream));
+        codestream_copy.reserve(old_bytes + stitched);
+      }
       codestream_copy.insert(codestream_copy.end(),
                              next_in + codestream_unconsumed,
-                             next_in + avail_codestream);
-      codestream_unconsumed = avail_codestream;
+                             next_in + stitched);
+      codestream_unconsumed = stitched;
       *span = jxl::Bytes(codestream_copy.data() + codestream_pos,
                          codestream_copy.size() - codestream_pos);
       return JXL_DEC_SUCCESS;
@@ -727,12 +775,18 @@ void JxlDecoderRewindDecodingState(JxlDecoder* dec) {
   dec->image_out_init_opaque = nullptr;
   dec->image_out_size = 0;
   dec->image_out_bit_depth.type = JXL_BIT_DEPTH_FROM_PIXEL_FORMAT;
+  dec->image_out_ycbcr_set = false;
   dec->extra_channel_output.clear();
+  dec->render_stage_stats.clear();
   dec->next_in = nullptr;
   dec->avail_in = 0;
   dec->input_closed = false;
 
-  dec->passes_state.reset(nullptr);
+  if (dec->reuse_buffers && dec->passes_state) {
+    dec->passes_state->ResetForNextImage();
+  } else {
+    dec->passes_state.reset(nullptr);
+  }
   dec->frame_dec.reset(nullptr);
   dec->next_section = 0;
   dec->section_processed.clear();
@@ -761,11 +815,17 @@ void JxlDecoderReset(JxlDecoder* dec) {
   JxlDecoderRewindDecodingState(dec);
 
   dec->thread_pool.reset();
+  dec->profiling_sink = nullptr;
+  dec->profiling_sink_opaque = nullptr;
   dec->keep_orientation = false;
   dec->unpremul_alpha = false;
   dec->render_spotcolors = true;
   dec->coalescing = true;
   dec->desired_intensity_target = 0;
+  dec->output_xsize = 0;
+  dec->output_ysize = 0;
+  dec->output_filter = JXL_RESAMPLE_LANCZOS3;
+  dec->region = jxl::Rect();
   dec->orig_events_wanted = 0;
   dec->events_wanted = 0;
   dec->frame_references.clear();
@@ -785,7 +845,8 @@ JxlDecoder* JxlDecoderCreate(const JxlMemoryManager* memory_manager) {
   if (!alloc) return nullptr;
   // Placement new constructor on allocated memory
   JxlDecoder* dec = new (alloc) JxlDecoder();
-  dec->memory_manager = local_memory_manager;
+  dec->memory_counter.inner = local_memory_manager;
+  jxl::MemoryManagerInitCounting(&dec->memory_manager, &dec->memory_counter);
 
 #ifdef FUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION
   if (!memory_manager) {
@@ -804,7 +865,7 @@ JxlDecoder* JxlDecoderCreate(const JxlMemoryManager* memory_manager) {
 
 void JxlDecoderDestroy(JxlDecoder* dec) {
   if (dec) {
-    JxlMemoryManager local_memory_manager = dec->memory_manager;
+    JxlMemoryManager local_memory_manager = dec->memory_counter.inner;
     // Call destructor directly since custom free function is used.
     dec->~JxlDecoder();
     jxl::MemoryManagerFree(&local_memory_manager, dec);
@@ -864,6 +925,44 @@ JxlDecoderSetParallelRunner(JxlDecoder* dec, JxlParallelRunner parallel_runner,
   }
   dec->thread_pool.reset(
       new jxl::ThreadPool(parallel_runner, parallel_runner_opaque));
+  dec->thread_pool->SetProfilingSink(
+      dec->profiling_sink, dec->profiling_sink_opaque,
+      jxl::MemoryCounterTakePeak, &dec->memory_counter);
+  return JXL_DEC_SUCCESS;
+}
+
+JxlDecoderStatus JxlDecoderSetProfilingSink(JxlDecoder* dec,
+                                            JxlProfilingSink sink,
+                                            void* opaque) {
+  if (dec->stage != DecoderStage::kInited) {
+    return JXL_API_ERROR(
+        "JxlDecoderSetProfilingSink must be called before starting");
+  }
+  dec->profiling_sink = sink;
+  dec->profiling_sink_opaque = opaque;
+  if (dec->thread_pool) {
+    dec->thread_pool->SetProfilingSink(
+        sink, opaque, jxl::MemoryCounterTakePeak, &dec->memory_counter);
+  }
+  return JXL_DEC_SUCCESS;
+}
+
+JxlDecoderStatus JxlDecoderGetRenderStageCount(const JxlDecoder* dec,
+                                               size_t* count) {
+  *count = dec->render_stage_stats.size();
+  return JXL_DEC_SUCCESS;
+}
+
+JxlDecoderStatus JxlDecoderGetRenderStageStats(const JxlDecoder* dec,
+                                               size_t index,
+                                               JxlRenderStageStats* stats) {
+  if (index >= dec->render_stage_stats.size()) {
+    return JXL_API_ERROR("Invalid render stage index");
+  }
+  const jxl::RenderPipelineStageStats& stage = dec->render_stage_stats[index];
+  stats->name = stage.name;
+  stats->time = stage.seconds;
+  stats->bytes = stage.bytes;
   return JXL_DEC_SUCCESS;
 }
 
@@ -915,10 +1014,57 @@ JxlDecoderStatus JxlDecoderSetCoalescing(JxlDecoder* dec, JXL_BOOL coalescing) {
   if (dec->stage != DecoderStage::kInited) {
     return JXL_API_ERROR("Must set coalescing option before starting");
   }
+  if (!coalescing && dec->output_xsize != 0) {
+    return JXL_API_ERROR("Output size requires coalescing");
+  }
   dec->coalescing = FROM_JXL_BOOL(coalescing);
   return JXL_DEC_SUCCESS;
 }
 
+JxlDecoderStatus JxlDecoderSetOutputSize(JxlDecoder* dec, size_t xsize,
+                                         size_t ysize,
+                                         JxlResampleFilter filter) {
+  if (dec->post_headers) {
+    return JXL_API_ERROR("Must set output size before decoding pixels");
+  }
+  if ((xsize == 0) != (ysize == 0)) {
+    return JXL_API_ERROR("Output size must be 0 in both or neither dimension");
+  }
+  if (xsize != 0 && !dec->coalescing) {
+    return JXL_API_ERROR("Output size requires coalescing");
+  }
+  if (filter != JXL_RESAMPLE_BOX && filter != JXL_RESAMPLE_MITCHELL &&
+      filter != JXL_RESAMPLE_LANCZOS3) {
+    return JXL_API_ERROR("Invalid resample filter");
+  }
+  dec->output_xsize = xsize;
+  dec->output_ysize = ysize;
+  dec->output_filter = filter;
+  return JXL_DEC_SUCCESS;
+}
+
+JxlDecoderStatus JxlDecoderSetRegionOfInterest(JxlDecoder* dec, size_t x0,
+                                               size_t y0, size_t xsize,
+                                               size_t ysize) {
+  if (dec->post_headers) {
+    return JXL_API_ERROR("Must set region of interest before decoding pixels");
+  }
+  if ((xsize == 0) != (ysize == 0)) {
+    return JXL_API_ERROR("Region size must be 0 in both or neither dimension");
+  }
+  dec->region = jxl::Rect(x0, y0, xsize, ysize);
+  return JXL_DEC_SUCCESS;
+}
+
+JxlDecoderStatus JxlDecoderSetReuseBuffers(JxlDecoder* dec,
+                                           JXL_BOOL reuse_buffers) {
+  if (dec->stage != DecoderStage::kInited) {
+    return JXL_API_ERROR("Must set reuse_buffers option before starting");
+  }
+  dec->reuse_buffers = FROM_JXL_BOOL(reuse_buffers);
+  return JXL_DEC_SUCCESS;
+}
+
 namespace {
 // helper function to get the dimensions of the current image buffer
 void GetCurrentDimensions(const JxlDecoder* dec, size_t& xsize, size_t& ysize) {
@@ -927,6 +1073,11 @@ void GetCurrentDimensions(const JxlDecoder* dec, size_t& xsize, size_t& ysize) {
     ysize = dec->metadata.oriented_preview_ysize(dec->keep_orientation);
     return;
   }
+  if (dec->output_xsize != 0) {
+    xsize = dec->output_xsize;
+    ysize = dec->output_ysize;
+    return;
+  }
   xsize = dec->metadata.oriented_xsize(dec->keep_orientation);
   ysize = dec->metadata.oriented_ysize(dec->keep_orientation);
   if (!dec->coalescing) {
@@ -939,6 +1090,79 @@ void GetCurrentDimensions(const JxlDecoder* dec, size_t& xsize, size_t& ysize) {
     }
   }
 }
+
+jxl::ResampleFilter GetResampleFilter(JxlResampleFilter filter) {
+  switch (filter) {
+    case JXL_RESAMPLE_BOX:
+      return jxl::ResampleFilter::kBox;
+    case JXL_RESAMPLE_MITCHELL:
+      return jxl::ResampleFilter::kMitchell;
+    case JXL_RESAMPLE_LANCZOS3:
+      break;
+  }
+  return jxl::ResampleFilter::kLanczos3;
+}
+
+// Largest power of two downsampling, up to 8, of the image that is still at
+// least as large as the output in both dimensions.
+size_t GetMaxOutputDownsampling(const JxlDecoder* dec) {
+  if (dec->output_xsize == 0) return 1;
+  const size_t xsize = dec->metadata.oriented_xsize(dec->keep_orientation);
+  const size_t ysize = dec->metadata.oriented_ysize(dec->keep_orientation);
+  size_t downsampling = 1;
+  while (downsampling < 8 &&
+         dec->output_xsize * downsampling * 2 <= xsize &&
+         dec->output_ysize * downsampling * 2 <= ysize) {
+    downsampling *= 2;
+  }
+  return downsampling;
+}
+
+// Returns the region of interest in pixels of the image as it is stored in the
+// codestream, i.e. before its orientation is undone.
+jxl::Rect GetCodestreamRegion(const JxlDecoder* dec) {
+  const size_t xsize = dec->metadata.oriented_xsize(dec->keep_orientation);
+  const size_t ysize = dec->metadata.oriented_ysize(dec->keep_orientation);
+  const jxl::Rect rect = dec->region.Crop(xsize, ysize);
+  const jxl::Orientation orientation =
+      dec->keep_orientation ? jxl::Orientation::kIdentity
+                            : dec->metadata.m.GetOrientation();
+  // The orientation is undone by flipping the stored image and then
+  // transposing it, so the region is mapped back in the reverse order.
+  size_t x0 = rect.x0();
+  size_t y0 = rect.y0();
+  size_t rect_xsize = rect.xsize();
+  size_t rect_ysize = rect.ysize();
+  if (orientation == jxl::Orientation::kTranspose ||
+      orientation == jxl::Orientation::kRotate90 ||
+      orientation == jxl::Orientation::kRotate270 ||
+      orientation == jxl::Orientation::kAntiTranspose) {
+    std::swap(x0, y0);
+    std::swap(rect_xsize, rect_ysize);
+  }
+  if (orientation == jxl::Orientation::kFlipHorizontal ||
+      orientation == jxl::Orientation::kRotate180 ||
+      orientation == jxl::Orientation::kRotate270 ||
+      orientation == jxl::Orientation::kAntiTranspose) {
+    x0 = dec->metadata.xsize() - x0 - rect_xsize;
+  }
+  if (orientation == jxl::Orientation::kFlipVertical ||
+      orientation == jxl::Orientation::kRotate180 ||
+      orientation == jxl::Orientation::kRotate90 ||
+      orientation == jxl::Orientation::kAntiTranspose) {
+    y0 = dec->metadata.ysize() - y0 - rect_ysize;
+  }
+  return jxl::Rect(x0, y0, rect_xsize, rect_ysize);
+}
+
+// Returns whether the sections of the current frame decoded so far suffice
+// for the output size or for the region of interest.
+bool HasDecodedEnough(const JxlDecoder* dec) {
+  return (dec->frame_max_downsampling > 1 &&
+          dec->frame_dec->HasDecodedForDownsampling(
+              dec->frame_max_downsampling)) ||
+         dec->frame_dec->HasDecodedRegion();
+}
 }  // namespace
 
 namespace jxl {
@@ -1096,15 +1320,18 @@ JxlDecoderStatus JxlDecoderReadAllHeaders(JxlDecoder* dec) {
   return JXL_DEC_SUCCESS;
 }
 
-JxlDecoderStatus JxlDecoderProcessSections(JxlDecoder* dec) {
+JxlDecoderStatus JxlDecoderProcessSectionsInSpan(JxlDecoder* dec,
+                                                 size_t max_size) {
   Span<const uint8_t> span;
-  JXL_API_RETURN_IF_ERROR(dec->GetCodestreamInput(&span));
+  JXL_API_RETURN_IF_ERROR(dec->GetCodestreamInput(&span, max_size));
   const auto& toc = dec->frame_dec->Toc();
   size_t pos = 0;
   std::vector<jxl::FrameDecoder::SectionInfo> section_info;
   std::vector<jxl::FrameDecoder::SectionStatus> section_status;
   for (size_t i = dec->next_section; i < toc.size(); ++i) {
-    if (dec->section_processed[i]) {
+    // Sections outside of the region of interest are left unread.
+    if (dec->section_processed[i] ||
+        !dec->frame_dec->SectionNeeded(toc[i].id)) {
       pos += toc[i].size;
       continue;
     }
@@ -1158,6 +1385,31 @@ JxlDecoderStatus JxlDecoderProcessSections(JxlDecoder* dec) {
   return JXL_DEC_SUCCESS;
 }
 
+JxlDecoderStatus JxlDecoderProcessSections(JxlDecoder* dec) {
+  constexpr size_t kAll = std::numeric_limits<size_t>::max();
+  if (dec->codestream_copy.empty()) {
+    return JxlDecoderProcessSectionsInSpan(dec, kAll);
+  }
+  // A section straddles the previous and the current input. Stitch only up to
+  // the end of the first section that is not yet processed, so that the
+  // sections after it can be read in place from the current input.
+  const auto& toc = dec->frame_dec->Toc();
+  size_t stitch_size = 0;
+  for (size_t i = dec->next_section; i < toc.size(); ++i) {
+    stitch_size += toc[i].size;
+    if (!dec->section_processed[i] &&
+        dec->frame_dec->SectionNeeded(toc[i].id)) {
+      break;
+    }
+  }
+  JXL_API_RETURN_IF_ERROR(JxlDecoderProcessSectionsInSpan(dec, stitch_size));
+  if (dec->next_section == toc.size()) return JXL_DEC_SUCCESS;
+  if (!dec->codestream_copy.empty() || dec->AvailableCodestream() > 0) {
+    return JxlDecoderProcessSectionsInSpan(dec, kAll);
+  }
+  return JXL_DEC_SUCCESS;
+}
+
 // TODO(eustas): no CodecInOut -> no image size reinforcement -> possible OOM.
 JxlDecoderStatus JxlDecoderProcessCodestream(JxlDecoder* dec) {
   // If no parallel runner is set, use the default
@@ -1165,6 +1417,9 @@ JxlDecoderStatus JxlDecoderProcessCodestream(JxlDecoder* dec) {
   // runner is used to decode pixels.
   if (!dec->thread_pool) {
     dec->thread_pool.reset(new jxl::ThreadPool(nullptr, nullptr));
+    dec->thread_pool->SetProfilingSink(
+        dec->profiling_sink, dec->profiling_sink_opaque,
+        jxl::MemoryCounterTakePeak, &dec->memory_counter);
   }
 
   // No matter what events are wanted, the basic info is always required.
@@ -1368,6 +1623,7 @@ JxlDecoderStatus JxlDecoderProcessCodestream(JxlDecoder* dec) {
     if (dec->frame_stage == FrameStage::kTOC) {
       dec->frame_dec->SetRenderSpotcolors(dec->render_spotcolors);
       dec->frame_dec->SetCoalescing(dec->coalescing);
+      dec->frame_dec->SetCollectStageStats(dec->profiling_sink != nullptr);
 
       if (!dec->preview_frame &&
           (dec->events_wanted & JXL_DEC_FRAME_PROGRESSION)) {
@@ -1376,6 +1632,19 @@ JxlDecoderStatus JxlDecoderProcessCodestream(JxlDecoder* dec) {
       } else {
         dec->frame_prog_detail = JxlProgressiveDetail::kFrames;
       }
+      dec->frame_max_downsampling =
+          dec->preview_frame ? 1 : GetMaxOutputDownsampling(dec);
+      if (dec->frame_max_downsampling > 1 &&
+          dec->frame_prog_detail < JxlProgressiveDetail::kLastPasses) {
+        // Pause at the DC and at every downsampling bracket to check whether
+        // the rest of the frame is needed; only frame_prog_detail decides
+        // which of these pauses are returned as events.
+        dec->frame_dec->SetPauseAtProgressive(
+            JxlProgressiveDetail::kLastPasses);
+      }
+      if (!dec->preview_frame && dec->region.xsize() != 0) {
+        dec->frame_dec->SetRegionOfInterest(GetCodestreamRegion(dec));
+      }
       dec->dc_frame_progression_done = false;
 
       dec->next_section = 0;
@@ -1412,12 +1681,28 @@ JxlDecoderStatus JxlDecoderProcessCodestream(JxlDecoder* dec) {
         }
       }
 
-      if (dec->image_out_buffer_set) {
+      if (dec->image_out_buffer_set && dec->image_out_ycbcr_set &&
+          !dec->preview_frame) {
+        size_t xsize;
+        size_t ysize;
+        GetCurrentDimensions(dec, xsize, ysize);
+        const JxlYCbCrBuffer& buffer = dec->image_out_ycbcr;
+        dec->frame_dec->SetYCbCrOutput(
+            jxl::YCbCrOutput{buffer.layout,
+                             {buffer.planes[0], buffer.planes[1],
+                              buffer.planes[2]},
+                             {buffer.strides[0], buffer.strides[1],
+                              buffer.strides[2]}},
+            xsize, ysize, !dec->keep_orientation);
+      } else if (dec->image_out_buffer_set) {
         size_t xsize;
         size_t ysize;
         GetCurrentDimensions(dec, xsize, ysize);
         size_t bits_per_sample = GetBitDepth(
             dec->image_out_bit_depth, dec->metadata.m, dec->image_out_format);
+        dec->frame_dec->SetOutputResampling(
+            !dec->preview_frame && dec->output_xsize != 0,
+            GetResampleFilter(dec->output_filter), dec->frame_max_downsampling);
         dec->frame_dec->SetImageOutput(
             PixelCallback{
                 dec->image_out_init_callback, dec->image_out_run_callback,
@@ -1437,8 +1722,15 @@ JxlDecoderStatus JxlDecoderProcessCodestream(JxlDecoder* dec) {
       }
 
       size_t next_num_passes_to_pause = dec->frame_dec->NextNumPassesToPause();
-
-      JXL_API_RETURN_IF_ERROR(JxlDecoderProcessSections(dec));
+      const bool had_dc = dec->frame_dec->HasDecodedDC();
+      const size_t num_complete_passes = dec->frame_dec->NumCompletePasses();
+
+      // After a progression event, the frame may already suffice for the
+      // output size; frames rendered from their DC alone at a reduced size
+      // must not decode any AC group.
+      if (!HasDecodedEnough(dec)) {
+        JXL_API_RETURN_IF_ERROR(JxlDecoderProcessSections(dec));
+      }
 
       bool all_sections_done = dec->frame_dec->HasDecodedAll();
       bool got_dc_only = !all_sections_done && dec->frame_dec->HasDecodedDC();
@@ -1462,12 +1754,33 @@ JxlDecoderStatus JxlDecoderProcessCodestream(JxlDecoder* dec) {
         return JXL_DEC_FRAME_PROGRESSION;
       }
 
+      bool skipped_sections = false;
+      if (!all_sections_done && HasDecodedEnough(dec)) {
+        // The remaining sections only add detail that resampling to the output
+        // size discards, or that is outside of the region of interest.
+        if (!dec->frame_dec->Flush()) {
+          return JXL_INPUT_ERROR("decoding frame failed");
+        }
+        dec->AdvanceCodestream(dec->remaining_frame_size);
+        dec->remaining_frame_size = 0;
+        all_sections_done = true;
+        skipped_sections = true;
+      }
+
       if (!all_sections_done) {
+        if (dec->frame_dec->HasDecodedDC() != had_dc ||
+            dec->frame_dec->NumCompletePasses() != num_complete_passes) {
+          // Paused at a step that is not returned as an event, the available
+          // input may contain more sections.
+          continue;
+        }
         // Not all sections have been processed yet
         return dec->RequestMoreInput();
       }
 
-      if (!dec->preview_frame) {
+      // The references are only known once all sections are decoded, keep the
+      // conservative value if some were skipped.
+      if (!dec->preview_frame && !skipped_sections) {
         size_t internal_index = dec->internal_frames - 1;
         JXL_ASSERT(dec->frame_references.size() > internal_index);
         // Always fill this in, even if it was already written, it could be that
@@ -1479,6 +1792,13 @@ JxlDecoderStatus JxlDecoderProcessCodestream(JxlDecoder* dec) {
       if (!dec->frame_dec->FinalizeFrame()) {
         return JXL_INPUT_ERROR("decoding frame failed");
       }
+      dec->render_stage_stats = dec->frame_dec->GetStageStats();
+      if (!dec->frame_dec->WriteResampledOutput()) {
+        return JXL_INPUT_ERROR("resampling frame failed");
+      }
+      if (!dec->frame_dec->WriteYCbCrOutput()) {
+        return JXL_INPUT_ERROR("writing YCbCr output failed");
+      }
 #if JPEGXL_ENABLE_TRANSCODE_JPEG
       // If jpeg output was requested, we merely return the JXL_DEC_FULL_IMAGE
       // status without outputting pixels.
@@ -2335,7 +2655,8 @@ JxlDecoderStatus JxlDecoderFlushImage(JxlDecoder* dec) {
     return JXL_DEC_ERROR;
   }
 
-  if (!dec->frame_dec->Flush()) {
+  if (!dec->frame_dec->Flush() || !dec->frame_dec->WriteResampledOutput() ||
+      !dec->frame_dec->WriteYCbCrOutput()) {
     return JXL_DEC_ERROR;
   }
 
@@ -2408,6 +2729,7 @@ JXL_EXPORT JxlDecoderStatus JxlDecoderSetPreviewOutBuffer(
   if (size < min_size) return JXL_DEC_ERROR;
 
   dec->image_out_buffer_set = true;
+  dec->image_out_ycbcr_set = false;
   dec->image_out_buffer = buffer;
   dec->image_out_size = size;
   dec->image_out_format = *format;
@@ -2449,6 +2771,7 @@ JxlDecoderStatus JxlDecoderSetImageOutBuffer(JxlDecoder* dec,
   if (size < min_size) return JXL_DEC_ERROR;
 
   dec->image_out_buffer_set = true;
+  dec->image_out_ycbcr_set = false;
   dec->image_out_buffer = buffer;
   dec->image_out_size = size;
   dec->image_out_format = *format;
@@ -2456,6 +2779,68 @@ JxlDecoderStatus JxlDecoderSetImageOutBuffer(JxlDecoder* dec,
   return JXL_DEC_SUCCESS;
 }
 
+JxlDecoderStatus JxlDecoderSetImageOutYCbCrBuffer(
+    JxlDecoder* dec, const JxlYCbCrBuffer* buffer) {
+  if (!dec->got_basic_info || !(dec->orig_events_wanted & JXL_DEC_FULL_IMAGE)) {
+    return JXL_API_ERROR("No image out buffer needed at this time");
+  }
+  if (dec->image_out_buffer_set && !!dec->image_out_run_callback) {
+    return JXL_API_ERROR(
+        "Cannot change from image out callback to image out buffer");
+  }
+  if (dec->output_xsize != 0) {
+    return JXL_API_ERROR("Cannot resample YCbCr output");
+  }
+  for (const auto& extra : dec->extra_channel_output) {
+    if (extra.buffer != nullptr) {
+      return JXL_API_ERROR("Cannot output extra channels with YCbCr output");
+    }
+  }
+  size_t xsize;
+  size_t ysize;
+  GetCurrentDimensions(dec, xsize, ysize);
+  size_t num_planes;
+  size_t chroma_row_size;
+  switch (buffer->layout) {
+    case JXL_YCBCR_444:
+      num_planes = 3;
+      chroma_row_size = xsize;
+      break;
+    case JXL_YCBCR_420:
+      num_planes = 3;
+      chroma_row_size = jxl::DivCeil(xsize, 2);
+      break;
+    case JXL_YCBCR_NV12:
+      num_planes = 2;
+      chroma_row_size = 2 * jxl::DivCeil(xsize, 2);
+      break;
+    default:
+      return JXL_API_ERROR("Invalid YCbCr layout");
+  }
+  for (size_t i = 0; i < num_planes; i++) {
+    if (buffer->planes[i] == nullptr) {
+      return JXL_API_ERROR("Missing YCbCr plane");
+    }
+    if (buffer->strides[i] < (i == 0 ? xsize : chroma_row_size)) {
+      return JXL_API_ERROR("YCbCr plane stride too small");
+    }
+  }
+
+  dec->image_out_buffer_set = true;
+  dec->image_out_ycbcr_set = true;
+  dec->image_out_ycbcr = *buffer;
+  if (num_planes == 2) {
+    dec->image_out_ycbcr.planes[2] = nullptr;
+    dec->image_out_ycbcr.strides[2] = 0;
+  }
+  dec->image_out_buffer = nullptr;
+  dec->image_out_size = 0;
+  // For the checks of the other settings against the output format.
+  dec->image_out_format = {3, JXL_TYPE_UINT8, JXL_NATIVE_ENDIAN, 0};
+
+  return JXL_DEC_SUCCESS;
+}
+
 JxlDecoderStatus JxlDecoderExtraChannelBufferSize(const JxlDecoder* dec,
                                                   const JxlPixelFormat* format,
                                                   size_t* size,
@@ -2484,6 +2869,9 @@ JxlDecoderStatus JxlDecoderSetExtraChannelBuffer(JxlDecoder* dec,
 
   if (size < min_size) return JXL_DEC_ERROR;
 
+  if (dec->image_out_buffer_set && dec->image_out_ycbcr_set) {
+    return JXL_API_ERROR("Cannot output extra channels with YCbCr output");
+  }
   if (dec->extra_channel_output.size() <= index) {
     dec->extra_channel_output.resize(dec->metadata.m.num_extra_channels,
                                      {{}, nullptr, 0});
@@ -2544,6 +2932,7 @@ JxlDecoderStatus JxlDecoderSetMultithreadedImageOutCallback(
   if (status != JXL_DEC_SUCCESS) return status;
 
   dec->image_out_buffer_set = true;
+  dec->image_out_ycbcr_set = false;
   dec->image_out_init_callback = init_callback;
   dec->image_out_run_callback = run_callback;
   dec->image_out_destroy_callback = destroy_callback;
@@ -2836,6 +3225,9 @@ JxlDecoderStatus JxlDecoderSetImageOutBitDepth(JxlDecoder* dec,
   if (!dec->image_out_buffer_set) {
     return JXL_API_ERROR("No image out buffer was set.");
   }
+  if (dec->image_out_ycbcr_set) {
+    return JXL_API_ERROR("YCbCr output is always 8-bit");
+  }
   JXL_API_RETURN_IF_ERROR(
       VerifyOutputBitDepth(*bit_depth, dec->metadata.m, dec->image_out_format));
   dec->image_out_bit_depth = *bit_depth;
@@ -11,6 +11,7 @@
 #include <jxl/decode.h>
 #include <jxl/decode_cxx.h>
 #include <jxl/memory_manager.h>
+#include <jxl/memory_pool.h>
 #include <jxl/parallel_runner.h>
 #include <jxl/resizable_parallel_runner.h>
 #include <jxl/resizable_parallel_runner_cxx.h>
@@ -23,7 +24,9 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <limits>
 #include <ostream>
+#include <set>
 #include <sstream>
 #include <string>
 #include <tuple>
@@ -38,6 +41,7 @@
 #include "lib/jxl/base/common.h"
 #include "lib/jxl/base/compiler_specific.h"
 #include "lib/jxl/base/override.h"
+#include "lib/jxl/base/rect.h"
 #include "lib/jxl/base/span.h"
 #include "lib/jxl/base/status.h"
 #include "lib/jxl/butteraugli/butteraugli.h"
@@ -62,6 +66,7 @@
 #include "lib/jxl/image_metadata.h"
 #include "lib/jxl/image_ops.h"
 #include "lib/jxl/jpeg/enc_jpeg_data.h"
+#include "lib/jxl/jpeg/jpeg_data.h"
 #include "lib/jxl/padded_bytes.h"
 #include "lib/jxl/test_image.h"
 #include "lib/jxl/test_utils.h"
@@ -705,6 +710,622 @@ TEST(DecodeTest, DefaultParallelRunnerTest) {
   JxlDecoderDestroy(dec);
 }
 
+TEST(DecodeTest, ProfilingSinkTest) {
+  size_t xsize = 123;
+  size_t ysize = 77;
+  std::vector<uint8_t> pixels = jxl::test::GetSomeTestImage(xsize, ysize, 3, 0);
+  std::vector<uint8_t> compressed = jxl::CreateTestJXLCodestream(
+      jxl::Bytes(pixels.data(), pixels.size()), xsize, ysize, 3,
+      jxl::TestCodestreamParams());
+
+  struct Profile {
+    std::set<std::string> stages;
+    bool consistent = true;
+    size_t peak_memory = 0;
+  };
+  Profile profile;
+  JxlDecoder* dec = JxlDecoderCreate(nullptr);
+  EXPECT_NE(nullptr, dec);
+  // The sink must survive the runner being set afterwards.
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSetProfilingSink(
+                dec,
+                +[](void* opaque, const JxlProfilingEvent* event) {
+                  Profile* profile = static_cast<Profile*>(opaque);
+                  profile->stages.insert(event->stage);
+                  if (event->num_tasks == 0 || event->num_threads == 0) {
+                    profile->consistent = false;
+                  }
+                  for (size_t i = 0; i < event->num_threads; ++i) {
+                    if (event->thread_busy_time[i] < 0 ||
+                        event->thread_busy_time[i] >
+                            event->wall_time + 1e-6) {
+                      profile->consistent = false;
+                    }
+                    // The CPU clock may be coarser than the wall clock.
+                    if (event->thread_cpu_time[i] < 0 ||
+                        event->thread_cpu_time[i] >
+                            event->thread_busy_time[i] + 1e-2) {
+                      profile->consistent = false;
+                    }
+                    if (event->thread_wait_time[i] < 0 ||
+                        event->thread_wait_time[i] >
+                            event->wall_time + 1e-6) {
+                      profile->consistent = false;
+                    }
+                  }
+                  profile->peak_memory =
+                      std::max(profile->peak_memory, event->peak_memory);
+                },
+                &profile));
+  JxlPixelFormat format = {3, JXL_TYPE_UINT8, JXL_LITTLE_ENDIAN, 0};
+  std::vector<uint8_t> pixels2 = jxl::DecodeWithAPI(
+      dec, jxl::Bytes(compressed.data(), compressed.size()), format,
+      /*use_callback=*/false, /*set_buffer_early=*/false,
+      /*use_resizable_runner=*/false, /*require_boxes=*/false,
+      /*expect_success*/ true);
+  EXPECT_EQ(xsize * ysize * 3, pixels2.size());
+  EXPECT_EQ(1, profile.stages.count("DecodeGroup"));
+  EXPECT_TRUE(profile.consistent);
+  // The images of the frame are allocated through the memory manager.
+  EXPECT_GT(profile.peak_memory, 0u);
+  JxlDecoderDestroy(dec);
+}
+
+TEST(DecodeTest, RenderStageStatsTest) {
+  size_t xsize = 123;
+  size_t ysize = 77;
+  std::vector<uint8_t> pixels = jxl::test::GetSomeTestImage(xsize, ysize, 3, 0);
+  std::vector<uint8_t> compressed = jxl::CreateTestJXLCodestream(
+      jxl::Bytes(pixels.data(), pixels.size()), xsize, ysize, 3,
+      jxl::TestCodestreamParams());
+
+  for (bool profile : {false, true}) {
+    JxlDecoder* dec = JxlDecoderCreate(nullptr);
+    EXPECT_NE(nullptr, dec);
+    size_t count;
+    EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderGetRenderStageCount(dec, &count));
+    EXPECT_EQ(0, count);
+    if (profile) {
+      EXPECT_EQ(JXL_DEC_SUCCESS,
+                JxlDecoderSetProfilingSink(
+                    dec, +[](void* opaque, const JxlProfilingEvent* event) {},
+                    nullptr));
+    }
+    JxlPixelFormat format = {3, JXL_TYPE_UINT8, JXL_LITTLE_ENDIAN, 0};
+    std::vector<uint8_t> pixels2 = jxl::DecodeWithAPI(
+        dec, jxl::Bytes(compressed.data(), compressed.size()), format,
+        /*use_callback=*/false, /*set_buffer_early=*/false,
+        /*use_resizable_runner=*/false, /*require_boxes=*/false,
+        /*expect_success*/ true);
+    EXPECT_EQ(xsize * ysize * 3, pixels2.size());
+
+    EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderGetRenderStageCount(dec, &count));
+    EXPECT_LT(0, count);
+    JxlRenderStageStats stats;
+    double time = 0;
+    uint64_t bytes = 0;
+    for (size_t i = 0; i < count; ++i) {
+      EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderGetRenderStageStats(dec, i, &stats));
+      EXPECT_NE(nullptr, stats.name);
+      time += stats.time;
+      bytes += stats.bytes;
+    }
+    EXPECT_EQ(JXL_DEC_ERROR, JxlDecoderGetRenderStageStats(dec, count, &stats));
+    if (profile) {
+      EXPECT_LT(0, time);
+      // At least the samples of the output are read.
+      EXPECT_LE(xsize * ysize * 3 * sizeof(float), bytes);
+    } else {
+      EXPECT_EQ(0, time);
+      EXPECT_EQ(0, bytes);
+    }
+    JxlDecoderDestroy(dec);
+  }
+}
+
+TEST(DecodeTest, MemoryPoolTest) {
+  size_t xsize = 300;
+  size_t ysize = 200;
+  std::vector<uint8_t> pixels = jxl::test::GetSomeTestImage(xsize, ysize, 3, 0);
+  std::vector<uint8_t> compressed = jxl::CreateTestJXLCodestream(
+      jxl::Bytes(pixels.data(), pixels.size()), xsize, ysize, 3,
+      jxl::TestCodestreamParams());
+
+  JxlMemoryPool* pool = JxlMemoryPoolCreate(nullptr, 64 << 20);
+  ASSERT_NE(nullptr, pool);
+  JxlMemoryPoolStats stats[2];
+  JxlPixelFormat format = {3, JXL_TYPE_UINT8, JXL_LITTLE_ENDIAN, 0};
+  for (JxlMemoryPoolStats& s : stats) {
+    // A fresh decoder every time, to check reuse across instances.
+    JxlDecoder* dec = JxlDecoderCreate(JxlMemoryPoolGetMemoryManager(pool));
+    EXPECT_NE(nullptr, dec);
+    std::vector<uint8_t> pixels2 = jxl::DecodeWithAPI(
+        dec, jxl::Bytes(compressed.data(), compressed.size()), format,
+        /*use_callback=*/false, /*set_buffer_early=*/false,
+        /*use_resizable_runner=*/false, /*require_boxes=*/false,
+        /*expect_success*/ true);
+    EXPECT_EQ(xsize * ysize * 3, pixels2.size());
+    JxlDecoderDestroy(dec);
+    JxlMemoryPoolGetStats(pool, &s);
+    EXPECT_EQ(0u, s.bytes_in_use);
+    EXPECT_GT(s.bytes_cached, 0u);
+    EXPECT_GE(s.peak_bytes_reserved, s.peak_bytes_in_use);
+  }
+  // The second decoder is served (mostly) from the buffers of the first one.
+  EXPECT_GT(stats[1].num_allocations, stats[0].num_allocations);
+  EXPECT_GT(stats[1].num_reused, stats[0].num_reused);
+
+  JxlMemoryPoolTrim(pool, 0);
+  JxlMemoryPoolGetStats(pool, &stats[0]);
+  EXPECT_EQ(0u, stats[0].bytes_cached);
+  JxlMemoryPoolDestroy(pool);
+}
+
+TEST(DecodeTest, MemoryPoolReuseLargestBlockTest) {
+  const size_t kSmall = 8 << 10;
+  const size_t kLarge = 64 << 10;
+  for (bool trim : {true, false}) {
+    JxlMemoryPool* pool = JxlMemoryPoolCreate(nullptr, kLarge + kSmall);
+    ASSERT_NE(nullptr, pool);
+    const JxlMemoryManager* mm = JxlMemoryPoolGetMemoryManager(pool);
+    void* large = mm->alloc(mm->opaque, kLarge);
+    void* small[2] = {mm->alloc(mm->opaque, kSmall),
+                      mm->alloc(mm->opaque, kSmall)};
+    ASSERT_NE(nullptr, large);
+    ASSERT_NE(nullptr, small[0]);
+    ASSERT_NE(nullptr, small[1]);
+    mm->free(mm->opaque, large);
+    // Takes the only cached block of the largest size class.
+    large = mm->alloc(mm->opaque, kLarge);
+    ASSERT_NE(nullptr, large);
+    mm->free(mm->opaque, small[0]);
+    mm->free(mm->opaque, small[1]);
+    // Does not fit in the cache anymore, so the largest class stays empty.
+    mm->free(mm->opaque, large);
+    JxlMemoryPoolStats stats;
+    JxlMemoryPoolGetStats(pool, &stats);
+    EXPECT_EQ(1u, stats.num_reused);
+    EXPECT_EQ(2 * kSmall, stats.bytes_cached);
+    if (trim) {
+      JxlMemoryPoolTrim(pool, 0);
+      JxlMemoryPoolGetStats(pool, &stats);
+      EXPECT_EQ(0u, stats.bytes_cached);
+    }
+    // Sizes that cannot be rounded up to a size class fail cleanly.
+    const size_t max = std::numeric_limits<size_t>::max();
+    EXPECT_EQ(nullptr, mm->alloc(mm->opaque, max));
+    EXPECT_EQ(nullptr, mm->alloc(mm->opaque, max - 64));
+    JxlMemoryPoolDestroy(pool);
+  }
+}
+
+TEST(DecodeTest, ReuseBuffersTest) {
+  // Two images of the same size, followed by a smaller one.
+  const size_t sizes[3][2] = {{300, 200}, {300, 200}, {150, 100}};
+  JxlPixelFormat format = {3, JXL_TYPE_UINT8, JXL_LITTLE_ENDIAN, 0};
+  JxlDecoder* dec = JxlDecoderCreate(nullptr);
+  EXPECT_NE(nullptr, dec);
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetReuseBuffers(dec, JXL_TRUE));
+  for (size_t i = 0; i < 3; i++) {
+    size_t xsize = sizes[i][0];
+    size_t ysize = sizes[i][1];
+    std::vector<uint8_t> pixels =
+        jxl::test::GetSomeTestImage(xsize, ysize, 3, i);
+    std::vector<uint8_t> compressed = jxl::CreateTestJXLCodestream(
+        jxl::Bytes(pixels.data(), pixels.size()), xsize, ysize, 3,
+        jxl::TestCodestreamParams());
+    jxl::Span<const uint8_t> span(compressed.data(), compressed.size());
+
+    // The setting survives the reset, so the buffers of the previous image are
+    // reused.
+    JxlDecoderReset(dec);
+    std::vector<uint8_t> reused = jxl::DecodeWithAPI(
+        dec, span, format, /*use_callback=*/false, /*set_buffer_early=*/false,
+        /*use_resizable_runner=*/false, /*require_boxes=*/false,
+        /*expect_success=*/true);
+    std::vector<uint8_t> fresh = jxl::DecodeWithAPI(
+        span, format, /*use_callback=*/false, /*set_buffer_early=*/false,
+        /*use_resizable_runner=*/false, /*require_boxes=*/false,
+        /*expect_success=*/true);
+    EXPECT_EQ(xsize * ysize * 3, reused.size());
+    EXPECT_EQ(fresh, reused);
+  }
+  JxlDecoderDestroy(dec);
+}
+
+// Decodes `data`, given to the decoder in chunks of `increment` bytes, to 8-bit
+// RGB pixels of the given output size. Sets `*used_size` to the number of bytes
+// of `data` that were given to the decoder when the image was complete. If
+// `render_bytes` is given, sets it to the bytes of samples that the render
+// stages of the frame read and wrote.
+std::vector<uint8_t> DecodeWithOutputSize(const std::vector<uint8_t>& data,
+                                          size_t xsize, size_t ysize,
+                                          JxlResampleFilter filter,
+                                          size_t increment, size_t* used_size,
+                                          uint64_t* render_bytes = nullptr) {
+  JxlPixelFormat format = {3, JXL_TYPE_UINT8, JXL_LITTLE_ENDIAN, 0};
+  std::vector<uint8_t> pixels(xsize * ysize * 3);
+  JxlDecoder* dec = JxlDecoderCreate(nullptr);
+  EXPECT_NE(nullptr, dec);
+  if (render_bytes) {
+    // The stage stats are only collected with a profiling sink.
+    EXPECT_EQ(JXL_DEC_SUCCESS,
+              JxlDecoderSetProfilingSink(
+                  dec, +[](void* opaque, const JxlProfilingEvent* event) {},
+                  nullptr));
+  }
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSubscribeEvents(dec,
+                                      JXL_DEC_BASIC_INFO | JXL_DEC_FULL_IMAGE));
+  size_t pos = 0;
+  size_t avail_in = 0;
+  for (;;) {
+    EXPECT_EQ(JXL_DEC_SUCCESS,
+              JxlDecoderSetInput(dec, data.data() + pos, avail_in));
+    JxlDecoderStatus status = JxlDecoderProcessInput(dec);
+    size_t remaining = JxlDecoderReleaseInput(dec);
+    pos += avail_in - remaining;
+    avail_in = remaining;
+    if (status == JXL_DEC_NEED_MORE_INPUT) {
+      EXPECT_LT(pos + avail_in, data.size());
+      if (pos + avail_in == data.size()) break;
+      avail_in = std::min(avail_in + increment, data.size() - pos);
+    } else if (status == JXL_DEC_BASIC_INFO) {
+      EXPECT_EQ(JXL_DEC_SUCCESS,
+                JxlDecoderSetOutputSize(dec, xsize, ysize, filter));
+    } else if (status == JXL_DEC_NEED_IMAGE_OUT_BUFFER) {
+      size_t buffer_size;
+      EXPECT_EQ(JXL_DEC_SUCCESS,
+                JxlDecoderImageOutBufferSize(dec, &format, &buffer_size));
+      EXPECT_EQ(pixels.size(), buffer_size);
+      EXPECT_EQ(JXL_DEC_SUCCESS,
+                JxlDecoderSetImageOutBuffer(dec, &format, pixels.data(),
+                                            pixels.size()));
+    } else {
+      EXPECT_EQ(JXL_DEC_FULL_IMAGE, status);
+      break;
+    }
+  }
+  *used_size = pos + avail_in;
+  if (render_bytes) {
+    *render_bytes = 0;
+    size_t count;
+    EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderGetRenderStageCount(dec, &count));
+    for (size_t i = 0; i < count; ++i) {
+      JxlRenderStageStats stats;
+      EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderGetRenderStageStats(dec, i, &stats));
+      *render_bytes += stats.bytes;
+    }
+  }
+  JxlDecoderDestroy(dec);
+  return pixels;
+}
+
+// Mean absolute difference between `pixels`, 8-bit RGB of size
+// xsize / factor x ysize / factor, and `full`, 8-bit RGB of size xsize x ysize
+// downscaled by averaging blocks of factor x factor pixels.
+double DiffToDownscaled(const std::vector<uint8_t>& pixels,
+                        const std::vector<uint8_t>& full, size_t xsize,
+                        size_t ysize, size_t factor) {
+  const size_t out_xsize = xsize / factor;
+  const size_t out_ysize = ysize / factor;
+  double sum = 0;
+  for (size_t y = 0; y < out_ysize; y++) {
+    for (size_t x = 0; x < out_xsize; x++) {
+      for (size_t c = 0; c < 3; c++) {
+        double average = 0;
+        for (size_t iy = 0; iy < factor; iy++) {
+          for (size_t ix = 0; ix < factor; ix++) {
+            size_t i = ((y * factor + iy) * xsize + x * factor + ix) * 3 + c;
+            average += full[i];
+          }
+        }
+        average /= factor * factor;
+        sum += std::abs(pixels[(y * out_xsize + x) * 3 + c] - average);
+      }
+    }
+  }
+  return sum / (out_xsize * out_ysize * 3);
+}
+
+TEST(DecodeTest, OutputSizeTest) {
+  size_t xsize = 256;
+  size_t ysize = 192;
+  std::vector<uint8_t> pixels = jxl::test::GetSomeTestImage(xsize, ysize, 3, 0);
+  std::vector<uint8_t> data = jxl::CreateTestJXLCodestream(
+      jxl::Bytes(pixels.data(), pixels.size()), xsize, ysize, 3,
+      jxl::TestCodestreamParams());
+  JxlPixelFormat format = {3, JXL_TYPE_UINT8, JXL_LITTLE_ENDIAN, 0};
+  std::vector<uint8_t> full = jxl::DecodeWithAPI(
+      jxl::Bytes(data.data(), data.size()), format, /*use_callback=*/false,
+      /*set_buffer_early=*/false, /*use_resizable_runner=*/false,
+      /*require_boxes=*/false, /*expect_success=*/true);
+  ASSERT_EQ(xsize * ysize * 3, full.size());
+
+  // Box filtering by an integer factor averages the covered pixels.
+  size_t used_size;
+  std::vector<uint8_t> box =
+      DecodeWithOutputSize(data, xsize / 4, ysize / 4, JXL_RESAMPLE_BOX,
+                           data.size(), &used_size);
+  EXPECT_EQ(data.size(), used_size);
+  EXPECT_LE(DiffToDownscaled(box, full, xsize, ysize, 4), 1.0);
+
+  for (JxlResampleFilter filter :
+       {JXL_RESAMPLE_MITCHELL, JXL_RESAMPLE_LANCZOS3}) {
+    std::vector<uint8_t> resampled =
+        DecodeWithOutputSize(data, xsize / 4, ysize / 4, filter, data.size(),
+                             &used_size);
+    EXPECT_LE(DiffToDownscaled(resampled, full, xsize, ysize, 4), 4.0);
+  }
+
+  JxlDecoder* dec = JxlDecoderCreate(nullptr);
+  EXPECT_EQ(JXL_DEC_ERROR,
+            JxlDecoderSetOutputSize(dec, 10, 0, JXL_RESAMPLE_BOX));
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSetOutputSize(dec, 10, 10, JXL_RESAMPLE_BOX));
+  EXPECT_EQ(JXL_DEC_ERROR, JxlDecoderSetCoalescing(dec, JXL_FALSE));
+  JxlDecoderDestroy(dec);
+}
+
+TEST(DecodeTest, OutputSizeProgressiveTest) {
+  size_t xsize = 256;
+  size_t ysize = 256;
+  std::vector<uint8_t> pixels = jxl::test::GetSomeTestImage(xsize, ysize, 3, 0);
+  jxl::TestCodestreamParams params;
+  jxl::PassDefinition passes[] = {{2, 0, 4}, {4, 0, 2}, {8, 0, 1}};
+  jxl::ProgressiveMode progressive_mode{passes};
+  params.cparams.custom_progressive_mode = &progressive_mode;
+  std::vector<uint8_t> data =
+      jxl::CreateTestJXLCodestream(jxl::Bytes(pixels.data(), pixels.size()),
+                                   xsize, ysize, 3, params);
+  JxlPixelFormat format = {3, JXL_TYPE_UINT8, JXL_LITTLE_ENDIAN, 0};
+  std::vector<uint8_t> full = jxl::DecodeWithAPI(
+      jxl::Bytes(data.data(), data.size()), format, /*use_callback=*/false,
+      /*set_buffer_early=*/false, /*use_resizable_runner=*/false,
+      /*require_boxes=*/false, /*expect_success=*/true);
+  ASSERT_EQ(xsize * ysize * 3, full.size());
+
+  size_t full_used_size;
+  uint64_t full_render_bytes;
+  DecodeWithOutputSize(data, xsize, ysize, JXL_RESAMPLE_BOX, data.size(),
+                       &full_used_size, &full_render_bytes);
+
+  // The 1/8 output only needs the DC, and the 1/4 output the first pass, so
+  // the decoder completes the image without the rest of the input. The DC is
+  // also rendered at 1/8 of the size of the frame, whatever its filters and
+  // AC strategies.
+  const size_t increment = data.size() / 32;
+  for (size_t factor : {8, 4}) {
+    size_t used_size;
+    uint64_t render_bytes;
+    std::vector<uint8_t> resampled =
+        DecodeWithOutputSize(data, xsize / factor, ysize / factor,
+                             JXL_RESAMPLE_BOX, increment, &used_size,
+                             &render_bytes);
+    EXPECT_LT(used_size, data.size());
+    EXPECT_LE(DiffToDownscaled(resampled, full, xsize, ysize, factor), 4.0);
+    if (factor == 8) {
+      EXPECT_LE(render_bytes * factor, full_render_bytes);
+    }
+  }
+}
+
+// Decodes `data` with the given region of interest, feeding the input in
+// steps of `increment` bytes, and returns the pixels of the whole image.
+std::vector<uint8_t> DecodeWithRegion(const std::vector<uint8_t>& data,
+                                      size_t xsize, size_t ysize,
+                                      const jxl::Rect& region,
+                                      size_t increment, size_t* used_size) {
+  JxlPixelFormat format = {3, JXL_TYPE_UINT8, JXL_LITTLE_ENDIAN, 0};
+  std::vector<uint8_t> pixels(xsize * ysize * 3);
+  JxlDecoder* dec = JxlDecoderCreate(nullptr);
+  EXPECT_NE(nullptr, dec);
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSubscribeEvents(dec,
+                                      JXL_DEC_BASIC_INFO | JXL_DEC_FULL_IMAGE));
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSetRegionOfInterest(dec, region.x0(), region.y0(),
+                                          region.xsize(), region.ysize()));
+  size_t pos = 0;
+  size_t avail_in = 0;
+  for (;;) {
+    EXPECT_EQ(JXL_DEC_SUCCESS,
+              JxlDecoderSetInput(dec, data.data() + pos, avail_in));
+    JxlDecoderStatus status = JxlDecoderProcessInput(dec);
+    size_t remaining = JxlDecoderReleaseInput(dec);
+    pos += avail_in - remaining;
+    avail_in = remaining;
+    if (status == JXL_DEC_NEED_MORE_INPUT) {
+      EXPECT_LT(pos + avail_in, data.size());
+      if (pos + avail_in == data.size()) break;
+      avail_in = std::min(avail_in + increment, data.size() - pos);
+    } else if (status == JXL_DEC_BASIC_INFO) {
+      continue;
+    } else if (status == JXL_DEC_NEED_IMAGE_OUT_BUFFER) {
+      EXPECT_EQ(JXL_DEC_SUCCESS,
+                JxlDecoderSetImageOutBuffer(dec, &format, pixels.data(),
+                                            pixels.size()));
+    } else {
+      EXPECT_EQ(JXL_DEC_FULL_IMAGE, status);
+      break;
+    }
+  }
+  *used_size = pos + avail_in;
+  JxlDecoderDestroy(dec);
+  return pixels;
+}
+
+// Returns the largest difference between the samples of `a` and `b` in `rect`.
+int MaxDiffInRect(const std::vector<uint8_t>& a, const std::vector<uint8_t>& b,
+                  size_t xsize, const jxl::Rect& rect) {
+  int max_diff = 0;
+  for (size_t y = rect.y0(); y < rect.y0() + rect.ysize(); y++) {
+    for (size_t x = rect.x0() * 3; x < (rect.x0() + rect.xsize()) * 3; x++) {
+      max_diff = std::max(max_diff, std::abs(a[y * xsize * 3 + x] -
+                                             b[y * xsize * 3 + x]));
+    }
+  }
+  return max_diff;
+}
+
+TEST(DecodeTest, RegionOfInterestTest) {
+  size_t xsize = 512;
+  size_t ysize = 512;
+  std::vector<uint8_t> pixels = jxl::test::GetSomeTestImage(xsize, ysize, 3, 0);
+  jxl::TestCodestreamParams params;
+  std::vector<uint8_t> data =
+      jxl::CreateTestJXLCodestream(jxl::Bytes(pixels.data(), pixels.size()),
+                                   xsize, ysize, 3, params);
+  JxlPixelFormat format = {3, JXL_TYPE_UINT8, JXL_LITTLE_ENDIAN, 0};
+  std::vector<uint8_t> full = jxl::DecodeWithAPI(
+      jxl::Bytes(data.data(), data.size()), format, /*use_callback=*/false,
+      /*set_buffer_early=*/false, /*use_resizable_runner=*/false,
+      /*require_boxes=*/false, /*expect_success=*/true);
+  ASSERT_EQ(xsize * ysize * 3, full.size());
+
+  // The region only needs the first of the four 256x256 groups: the decoder
+  // completes the frame without reading the others, and draws them from the
+  // DC.
+  const jxl::Rect region(16, 16, 64, 64);
+  size_t used_size;
+  std::vector<uint8_t> decoded = DecodeWithRegion(
+      data, xsize, ysize, region, data.size() / 32, &used_size);
+  EXPECT_LT(used_size, data.size());
+  EXPECT_LE(MaxDiffInRect(decoded, full, xsize, region), 1);
+  EXPECT_GT(MaxDiffInRect(decoded, full, xsize, jxl::Rect(256, 256, 256, 256)),
+            1);
+
+  // Without the region, the whole image is decoded.
+  decoded = DecodeWithRegion(data, xsize, ysize, jxl::Rect(), data.size(),
+                             &used_size);
+  EXPECT_EQ(data.size(), used_size);
+  const jxl::Rect full_image(0, 0, xsize, ysize);
+  EXPECT_EQ(0, MaxDiffInRect(decoded, full, xsize, full_image));
+}
+
+// Decodes `data` with a YCbCr output of the given layout, and returns the Y, Cb
+// and Cr planes without row padding, with the chroma of NV12 deinterleaved.
+std::vector<std::vector<uint8_t>> DecodeToYCbCr(
+    const std::vector<uint8_t>& data, JxlYCbCrLayout layout, size_t xsize,
+    size_t ysize) {
+  const size_t block = layout == JXL_YCBCR_444 ? 1 : 2;
+  const size_t chroma_xsize = jxl::DivCeil(xsize, block);
+  const size_t chroma_ysize = jxl::DivCeil(ysize, block);
+  const bool nv12 = layout == JXL_YCBCR_NV12;
+  // Padded rows, to test the strides.
+  const size_t luma_stride = xsize + 7;
+  const size_t chroma_stride = (nv12 ? 2 : 1) * chroma_xsize + 5;
+  std::vector<uint8_t> luma(luma_stride * ysize);
+  std::vector<uint8_t> cb(chroma_stride * chroma_ysize);
+  std::vector<uint8_t> cr(chroma_stride * chroma_ysize);
+  JxlYCbCrBuffer buffer = {layout,
+                           {luma.data(), cb.data(), cr.data()},
+                           {luma_stride, chroma_stride, chroma_stride}};
+
+  JxlDecoder* dec = JxlDecoderCreate(nullptr);
+  EXPECT_NE(nullptr, dec);
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSubscribeEvents(dec,
+                                      JXL_DEC_BASIC_INFO | JXL_DEC_FULL_IMAGE));
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSetInput(dec, data.data(), data.size()));
+  JxlDecoderCloseInput(dec);
+  for (;;) {
+    JxlDecoderStatus status = JxlDecoderProcessInput(dec);
+    if (status == JXL_DEC_BASIC_INFO) continue;
+    if (status == JXL_DEC_NEED_IMAGE_OUT_BUFFER) {
+      EXPECT_EQ(JXL_DEC_SUCCESS,
+                JxlDecoderSetImageOutYCbCrBuffer(dec, &buffer));
+      continue;
+    }
+    EXPECT_EQ(JXL_DEC_FULL_IMAGE, status);
+    break;
+  }
+  JxlDecoderDestroy(dec);
+
+  std::vector<std::vector<uint8_t>> planes(3);
+  for (size_t y = 0; y < ysize; y++) {
+    for (size_t x = 0; x < xsize; x++) {
+      planes[0].push_back(luma[y * luma_stride + x]);
+    }
+  }
+  for (size_t y = 0; y < chroma_ysize; y++) {
+    for (size_t x = 0; x < chroma_xsize; x++) {
+      if (nv12) {
+        planes[1].push_back(cb[y * chroma_stride + 2 * x]);
+        planes[2].push_back(cb[y * chroma_stride + 2 * x + 1]);
+      } else {
+        planes[1].push_back(cb[y * chroma_stride + x]);
+        planes[2].push_back(cr[y * chroma_stride + x]);
+      }
+    }
+  }
+  return planes;
+}
+
+// Mean absolute differences between the Y, Cb and Cr `planes` and those
+// computed from `rgb`, 8-bit RGB of size xsize x ysize, with the chroma
+// averaged over blocks of block x block pixels.
+std::vector<double> DiffToYCbCr(const std::vector<std::vector<uint8_t>>& planes,
+                                const std::vector<uint8_t>& rgb, size_t xsize,
+                                size_t ysize, size_t block) {
+  const size_t chroma_xsize = jxl::DivCeil(xsize, block);
+  const size_t chroma_ysize = jxl::DivCeil(ysize, block);
+  std::vector<double> chroma(2 * chroma_xsize * chroma_ysize);
+  std::vector<double> counts(chroma_xsize * chroma_ysize);
+  std::vector<double> diffs(3);
+  for (size_t y = 0; y < ysize; y++) {
+    for (size_t x = 0; x < xsize; x++) {
+      const double r = rgb[(y * xsize + x) * 3];
+      const double g = rgb[(y * xsize + x) * 3 + 1];
+      const double b = rgb[(y * xsize + x) * 3 + 2];
+      const double luma = 0.299 * r + 0.587 * g + 0.114 * b;
+      diffs[0] += std::abs(planes[0][y * xsize + x] - luma);
+      const size_t i = (y / block) * chroma_xsize + x / block;
+      chroma[2 * i] += 128 - 0.168736 * r - 0.331264 * g + 0.5 * b;
+      chroma[2 * i + 1] += 128 + 0.5 * r - 0.418688 * g - 0.081312 * b;
+      counts[i]++;
+    }
+  }
+  for (size_t i = 0; i < counts.size(); i++) {
+    diffs[1] += std::abs(planes[1][i] - chroma[2 * i] / counts[i]);
+    diffs[2] += std::abs(planes[2][i] - chroma[2 * i + 1] / counts[i]);
+  }
+  diffs[0] /= xsize * ysize;
+  diffs[1] /= counts.size();
+  diffs[2] /= counts.size();
+  return diffs;
+}
+
+TEST(DecodeTest, YCbCrOutputTest) {
+  size_t xsize = 123;
+  size_t ysize = 77;
+  std::vector<uint8_t> pixels = jxl::test::GetSomeTestImage(xsize, ysize, 3, 0);
+  std::vector<uint8_t> data = jxl::CreateTestJXLCodestream(
+      jxl::Bytes(pixels.data(), pixels.size()), xsize, ysize, 3,
+      jxl::TestCodestreamParams());
+  JxlPixelFormat format = {3, JXL_TYPE_UINT8, JXL_LITTLE_ENDIAN, 0};
+  std::vector<uint8_t> rgb = jxl::DecodeWithAPI(
+      jxl::Bytes(data.data(), data.size()), format, /*use_callback=*/false,
+      /*set_buffer_early=*/false, /*use_resizable_runner=*/false,
+      /*require_boxes=*/false, /*expect_success=*/true);
+  ASSERT_EQ(xsize * ysize * 3, rgb.size());
+
+  // The frame is XYB, so it is converted from the RGB pixels.
+  std::vector<std::vector<uint8_t>> ycbcr444 =
+      DecodeToYCbCr(data, JXL_YCBCR_444, xsize, ysize);
+  for (double diff : DiffToYCbCr(ycbcr444, rgb, xsize, ysize, 1)) {
+    EXPECT_LE(diff, 1.0);
+  }
+  std::vector<std::vector<uint8_t>> ycbcr420 =
+      DecodeToYCbCr(data, JXL_YCBCR_420, xsize, ysize);
+  for (double diff : DiffToYCbCr(ycbcr420, rgb, xsize, ysize, 2)) {
+    EXPECT_LE(diff, 1.0);
+  }
+  EXPECT_EQ(ycbcr420, DecodeToYCbCr(data, JXL_YCBCR_NV12, xsize, ysize));
+}
+
 // Creates the header of a JPEG XL file with various custom parameters for
 // testing.
 // xsize, ysize: image dimensions to store in the SizeHeader, max 512.
@@ -5044,6 +5665,243 @@ JXL_TRANSCODE_JPEG_TEST(DecodeTest, JPEGReconstructionTest) {
   VerifyJPEGReconstruction(jxl::Bytes(container), jxl::Bytes(orig));
 }
 
+// Recompresses `jpeg` to a container with the JPEG reconstruction data.
+std::vector<uint8_t> RecompressJPEGToContainer(
+    const std::vector<uint8_t>& jpeg, const jxl::CompressParams& cparams,
+    jxl::ThreadPool* pool) {
+  JxlMemoryManager* memory_manager = jxl::test::MemoryManager();
+  jxl::CodecInOut io{memory_manager};
+  EXPECT_TRUE(jxl::jpeg::DecodeImageJPG(jxl::Bytes(jpeg), &io));
+  io.metadata.m.xyb_encoded = false;
+  jxl::BitWriter writer{memory_manager};
+  EXPECT_TRUE(WriteCodestreamHeaders(&io.metadata, &writer, nullptr));
+  writer.ZeroPadToByte();
+  EXPECT_TRUE(jxl::EncodeFrame(memory_manager, cparams, jxl::FrameInfo{},
+                               &io.metadata, io.Main(), *JxlGetDefaultCms(),
+                               pool, &writer, /*aux_out=*/nullptr));
+  std::vector<uint8_t> jpeg_data;
+  EXPECT_TRUE(EncodeJPEGData(memory_manager, *io.Main().jpeg_data.get(),
+                             &jpeg_data, cparams));
+  std::vector<uint8_t> container;
+  jxl::Bytes(jxl::kContainerHeader).AppendTo(container);
+  jxl::AppendBoxHeader(jxl::MakeBoxType("jbrd"), jpeg_data.size(), false,
+                       &container);
+  jxl::Bytes(jpeg_data).AppendTo(container);
+  jxl::AppendBoxHeader(jxl::MakeBoxType("jxlc"), 0, true, &container);
+  jxl::PaddedBytes codestream = std::move(writer).TakeBytes();
+  jxl::Bytes(codestream).AppendTo(container);
+  return container;
+}
+
+// Frames taller than a DC group are recompressed one row of DC groups at a
+// time when they are larger than jpeg_max_unstriped_pixels. The codestream
+// does not depend on that, and the JPEG is reconstructed byte for byte.
+JXL_TRANSCODE_JPEG_TEST(DecodeTest, JPEGReconstructionStripedTest) {
+  TEST_LIBJPEG_SUPPORT();
+  const size_t xsize = 320;
+  const size_t ysize = 2 * jxl::kBlockDim * jxl::kGroupDim + 104;
+  JxlPixelFormat format = {3, JXL_TYPE_UINT8, JXL_LITTLE_ENDIAN, 0};
+  jxl::test::ThreadPoolForTests pool(4);
+  // 4:4:4 goes through chroma from luma, 4:2:0 leaves parts of the
+  // coefficient stripes unfilled.
+  for (const char* chroma_subsampling : {"444", "420"}) {
+    jxl::extras::PackedPixelFile ppf;
+    JXL_ASSIGN_OR_DIE(jxl::extras::PackedFrame frame,
+                      jxl::extras::PackedFrame::Create(xsize, ysize, format));
+    uint8_t* pixels = static_cast<uint8_t*>(frame.color.pixels());
+    for (size_t y = 0; y < ysize; ++y) {
+      for (size_t x = 0; x < xsize; ++x) {
+        uint8_t* pixel = pixels + (y * xsize + x) * 3;
+        const size_t noise = (x * 7919 + y * 104729 + x * y) % 61;
+        pixel[0] = (x + y / 16 + noise) & 0xFF;
+        pixel[1] = ((x / 8) ^ (y / 8)) & 1 ? 160 + noise : 96;
+        pixel[2] = (y / 4 + 2 * noise) & 0xFF;
+      }
+    }
+    ppf.frames.emplace_back(std::move(frame));
+    ppf.info.xsize = xsize;
+    ppf.info.ysize = ysize;
+    ppf.info.num_color_channels = 3;
+    ppf.info.bits_per_sample = 8;
+    auto encoder = jxl::extras::GetJPEGEncoder();
+    ASSERT_TRUE(encoder);
+    encoder->SetOption("q", "85");
+    encoder->SetOption("chroma_subsampling", chroma_subsampling);
+    jxl::extras::EncodedImage encoded;
+    ASSERT_TRUE(encoder->Encode(ppf, &encoded, nullptr));
+    const std::vector<uint8_t>& jpeg = encoded.bitstreams[0];
+
+    jxl::CompressParams cparams;
+    cparams.color_transform = jxl::ColorTransform::kNone;
+    const std::vector<uint8_t> whole =
+        RecompressJPEGToContainer(jpeg, cparams, pool.get());
+    cparams.jpeg_max_unstriped_pixels = 0;
+    const std::vector<uint8_t> striped =
+        RecompressJPEGToContainer(jpeg, cparams, pool.get());
+    EXPECT_EQ(whole, striped) << chroma_subsampling;
+    VerifyJPEGReconstruction(jxl::Bytes(striped), jxl::Bytes(jpeg));
+  }
+}
+
+JXL_TRANSCODE_JPEG_TEST(DecodeTest, YCbCrOutputJPEGTest) {
+  JxlMemoryManager* memory_manager = jxl::test::MemoryManager();
+  const std::string jpeg_path = "jxl/flower/flower.png.im_q85_420.jpg";
+  const std::vector<uint8_t> orig = jxl::test::ReadTestData(jpeg_path);
+  jxl::CodecInOut io{memory_manager};
+  ASSERT_TRUE(jxl::jpeg::DecodeImageJPG(jxl::Bytes(orig), &io));
+  io.metadata.m.xyb_encoded = false;
+  jxl::BitWriter writer{memory_manager};
+  ASSERT_TRUE(WriteCodestreamHeaders(&io.metadata, &writer, nullptr));
+  writer.ZeroPadToByte();
+  jxl::CompressParams cparams;
+  cparams.color_transform = jxl::ColorTransform::kNone;
+  ASSERT_TRUE(jxl::EncodeFrame(memory_manager, cparams, jxl::FrameInfo{},
+                               &io.metadata, io.Main(), *JxlGetDefaultCms(),
+                               /*pool=*/nullptr, &writer,
+                               /*aux_out=*/nullptr));
+  jxl::PaddedBytes codestream = std::move(writer).TakeBytes();
+  std::vector<uint8_t> data(codestream.data(),
+                            codestream.data() + codestream.size());
+  const size_t xsize = io.xsize();
+  const size_t ysize = io.ysize();
+
+  JxlPixelFormat format = {3, JXL_TYPE_UINT8, JXL_LITTLE_ENDIAN, 0};
+  std::vector<uint8_t> rgb = jxl::DecodeWithAPI(
+      jxl::Bytes(data.data(), data.size()), format, /*use_callback=*/false,
+      /*set_buffer_early=*/false, /*use_resizable_runner=*/false,
+      /*require_boxes=*/false, /*expect_success=*/true);
+  ASSERT_EQ(xsize * ysize * 3, rgb.size());
+
+  // The 4:2:0 layouts get the decoded YCbCr samples, which differ from those
+  // computed from the RGB pixels by rounding and, for the chroma, by the
+  // smoothing of the chroma upsampling.
+  std::vector<std::vector<uint8_t>> ycbcr420 =
+      DecodeToYCbCr(data, JXL_YCBCR_420, xsize, ysize);
+  std::vector<double> diffs = DiffToYCbCr(ycbcr420, rgb, xsize, ysize, 2);
+  EXPECT_LE(diffs[0], 1.0);
+  EXPECT_LE(diffs[1], 2.0);
+  EXPECT_LE(diffs[2], 2.0);
+  EXPECT_EQ(ycbcr420, DecodeToYCbCr(data, JXL_YCBCR_NV12, xsize, ysize));
+
+  // Converted from the RGB pixels.
+  std::vector<std::vector<uint8_t>> ycbcr444 =
+      DecodeToYCbCr(data, JXL_YCBCR_444, xsize, ysize);
+  for (double diff : DiffToYCbCr(ycbcr444, rgb, xsize, ysize, 1)) {
+    EXPECT_LE(diff, 1.0);
+  }
+}
+
+// Recompresses `jpeg` to a bare codestream without the reconstruction data, and
+// leaves the parsed JPEG in `io`.
+std::vector<uint8_t> RecompressJPEG(const std::vector<uint8_t>& jpeg,
+                                    jxl::CodecInOut* io) {
+  JxlMemoryManager* memory_manager = jxl::test::MemoryManager();
+  EXPECT_TRUE(jxl::jpeg::DecodeImageJPG(jxl::Bytes(jpeg), io));
+  io->metadata.m.xyb_encoded = false;
+  jxl::BitWriter writer{memory_manager};
+  EXPECT_TRUE(WriteCodestreamHeaders(&io->metadata, &writer, nullptr));
+  writer.ZeroPadToByte();
+  jxl::CompressParams cparams;
+  cparams.color_transform = jxl::ColorTransform::kNone;
+  EXPECT_TRUE(jxl::EncodeFrame(memory_manager, cparams, jxl::FrameInfo{},
+                               &io->metadata, io->Main(), *JxlGetDefaultCms(),
+                               /*pool=*/nullptr, &writer,
+                               /*aux_out=*/nullptr));
+  jxl::PaddedBytes codestream = std::move(writer).TakeBytes();
+  return std::vector<uint8_t>(codestream.data(),
+                              codestream.data() + codestream.size());
+}
+
+JXL_TRANSCODE_JPEG_TEST(DecodeTest, OutputSizeJPEGTest) {
+  JxlMemoryManager* memory_manager = jxl::test::MemoryManager();
+  const std::string jpeg_path = "jxl/flower/flower.png.im_q85_420.jpg";
+  const std::vector<uint8_t> orig = jxl::test::ReadTestData(jpeg_path);
+  jxl::CodecInOut io{memory_manager};
+  std::vector<uint8_t> data = RecompressJPEG(orig, &io);
+  const size_t xsize = io.xsize();
+  const size_t ysize = io.ysize();
+
+  JxlPixelFormat format = {3, JXL_TYPE_UINT8, JXL_LITTLE_ENDIAN, 0};
+  std::vector<uint8_t> full = jxl::DecodeWithAPI(
+      jxl::Bytes(data.data(), data.size()), format, /*use_callback=*/false,
+      /*set_buffer_early=*/false, /*use_resizable_runner=*/false,
+      /*require_boxes=*/false, /*expect_success=*/true);
+  ASSERT_EQ(xsize * ysize * 3, full.size());
+  size_t used_size;
+  uint64_t full_render_bytes;
+  DecodeWithOutputSize(data, xsize, ysize, JXL_RESAMPLE_BOX, data.size(),
+                       &used_size, &full_render_bytes);
+
+  // The frame is rendered at the reduced size with reduced IDCTs, which
+  // approximate the averages of the blocks of full size pixels.
+  for (size_t factor : {2, 4, 8}) {
+    uint64_t render_bytes;
+    std::vector<uint8_t> resampled =
+        DecodeWithOutputSize(data, xsize / factor, ysize / factor,
+                             JXL_RESAMPLE_BOX, data.size(), &used_size,
+                             &render_bytes);
+    EXPECT_LE(DiffToDownscaled(resampled, full, xsize, ysize, factor), 4.0);
+    // The render pipeline runs on about factor^2 times fewer pixels; allow
+    // for the borders of the groups.
+    EXPECT_LE(render_bytes * factor, full_render_bytes);
+  }
+}
+
+JXL_TRANSCODE_JPEG_TEST(DecodeTest, OutputSizeJPEGDCTest) {
+  JxlMemoryManager* memory_manager = jxl::test::MemoryManager();
+  const size_t xsize = 256;
+  const size_t ysize = 192;
+  JxlPixelFormat format = {3, JXL_TYPE_UINT8, JXL_LITTLE_ENDIAN, 0};
+  jxl::extras::PackedPixelFile ppf;
+  JXL_ASSIGN_OR_DIE(jxl::extras::PackedFrame frame,
+                    jxl::extras::PackedFrame::Create(xsize, ysize, format));
+  uint8_t* pixels = static_cast<uint8_t*>(frame.color.pixels());
+  for (size_t y = 0; y < ysize; ++y) {
+    for (size_t x = 0; x < xsize; ++x) {
+      uint8_t* pixel = pixels + (y * xsize + x) * 3;
+      pixel[0] = x;
+      pixel[1] = (x + 2 * y) / 3;
+      pixel[2] = ((x / 4) ^ (y / 4)) & 1 ? 192 : 64;
+    }
+  }
+  ppf.frames.emplace_back(std::move(frame));
+  ppf.info.xsize = xsize;
+  ppf.info.ysize = ysize;
+  ppf.info.num_color_channels = 3;
+  ppf.info.bits_per_sample = 8;
+  auto encoder = jxl::extras::GetJPEGEncoder();
+  encoder->SetOption("quality", "90");
+  jxl::extras::EncodedImage encoded;
+  ASSERT_TRUE(encoder->Encode(ppf, &encoded, nullptr));
+  jxl::CodecInOut io{memory_manager};
+  std::vector<uint8_t> data = RecompressJPEG(encoded.bitstreams[0], &io);
+  ASSERT_TRUE(io.Main().jpeg_data);
+
+  // At 1/8 every output pixel comes from the DC of one block. The luma of
+  // the RGB output matches the luma DC of the JPEG.
+  size_t used_size;
+  std::vector<uint8_t> dc = DecodeWithOutputSize(
+      data, xsize / 8, ysize / 8, JXL_RESAMPLE_BOX, data.size(), &used_size);
+  const jxl::jpeg::JPEGData& jpeg_data = *io.Main().jpeg_data;
+  const jxl::jpeg::JPEGComponent& luma = jpeg_data.components[0];
+  const int32_t dc_quant = jpeg_data.quant[luma.quant_idx].values[0];
+  ASSERT_LE(xsize / 8, luma.width_in_blocks);
+  ASSERT_LE(ysize / 8, luma.height_in_blocks);
+  double diff = 0;
+  for (size_t by = 0; by < ysize / 8; ++by) {
+    for (size_t bx = 0; bx < xsize / 8; ++bx) {
+      const size_t block = by * luma.width_in_blocks + bx;
+      const double expected =
+          luma.coeffs[block * jxl::kDCTBlockSize] * dc_quant / 8.0 +
+          128.0;
+      const uint8_t* rgb = &dc[(by * (xsize / 8) + bx) * 3];
+      const double actual = 0.299 * rgb[0] + 0.587 * rgb[1] + 0.114 * rgb[2];
+      diff += std::abs(actual - expected);
+    }
+  }
+  EXPECT_LE(diff / ((xsize / 8) * (ysize / 8)), 1.0);
+}
+
 JXL_TRANSCODE_JPEG_TEST(DecodeTest, JPEGReconstructionMetadataTest) {
   const std::string jpeg_path = "jxl/jpeg_reconstruction/1x1_exif_xmp.jpg";
   const std::string jxl_path = "jxl/jpeg_reconstruction/1x1_exif_xmp.jxl";
@@ -819,6 +819,7 @@ StatusOr<ImageBundle> RoundtripImage(const FrameHeader& frame_header,
   options.coalescing = false;
   options.render_spotcolors = false;
   options.render_noise = false;
+  options.collect_stage_stats = false;
 
   // Same as frame_header.nonserialized_metadata->m
   const ImageMetadata& metadata = *decoded.metadata();
@@ -890,7 +891,7 @@ Status FindBestQuantization(const FrameHeader& frame_header,
   const float original_butteraugli = cparams.original_butteraugli_distance;
   ButteraugliParams params;
   params.intensity_target = 80.f;
-  JxlButteraugliComparator comparator(params, cms);
+  JxlButteraugliComparator comparator(params, cms, pool);
   JXL_CHECK(comparator.SetLinearReferenceImage(linear));
   bool lower_is_better =
       (comparator.GoodQualityScore() < comparator.BadQualityScore());
@@ -11,8 +11,9 @@
 namespace jxl {
 
 JxlButteraugliComparator::JxlButteraugliComparator(
-    const ButteraugliParams& params, const JxlCmsInterface& cms)
-    : params_(params), cms_(cms) {}
+    const ButteraugliParams& params, const JxlCmsInterface& cms,
+    ThreadPool* pool)
+    : params_(params), cms_(cms), pool_(pool) {}
 
 Status JxlButteraugliComparator::SetReferenceImage(const ImageBundle& ref) {
   const ImageBundle* ref_linear_srgb;
@@ -20,11 +21,12 @@ Status JxlButteraugliComparator::SetReferenceImage(const ImageBundle& ref) {
   ImageMetadata metadata = *ref.metadata();
   ImageBundle store(memory_manager, &metadata);
   if (!TransformIfNeeded(ref, ColorEncoding::LinearSRGB(ref.IsGray()), cms_,
-                         /*pool=*/nullptr, &store, &ref_linear_srgb)) {
+                         pool_, &store, &ref_linear_srgb)) {
     return false;
   }
-  JXL_ASSIGN_OR_RETURN(comparator_, ButteraugliComparator::Make(
-                                        ref_linear_srgb->color(), params_));
+  JXL_ASSIGN_OR_RETURN(comparator_,
+                       ButteraugliComparator::Make(ref_linear_srgb->color(),
+                                                   params_, pool_));
   xsize_ = ref.xsize();
   ysize_ = ref.ysize();
   return true;
@@ -33,7 +35,7 @@ Status JxlButteraugliComparator::SetReferenceImage(const ImageBundle& ref) {
 Status JxlButteraugliComparator::SetLinearReferenceImage(
     const Image3F& linear) {
   JXL_ASSIGN_OR_RETURN(comparator_,
-                       ButteraugliComparator::Make(linear, params_));
+                       ButteraugliComparator::Make(linear, params_, pool_));
   xsize_ = linear.xsize();
   ysize_ = linear.ysize();
   return true;
@@ -54,7 +56,7 @@ Status JxlButteraugliComparator::CompareWith(const ImageBundle& actual,
   ImageBundle store(memory_manager, &metadata);
   if (!TransformIfNeeded(actual, ColorEncoding::LinearSRGB(actual.IsGray()),
                          cms_,
-                         /*pool=*/nullptr, &store, &actual_linear_srgb)) {
+                         pool_, &store, &actual_linear_srgb)) {
     return false;
   }
 
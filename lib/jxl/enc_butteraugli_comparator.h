@@ -11,6 +11,7 @@
 
 #include <memory>
 
+#include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/base/status.h"
 #include "lib/jxl/butteraugli/butteraugli.h"
 #include "lib/jxl/enc_comparator.h"
@@ -21,8 +22,10 @@ namespace jxl {
 
 class JxlButteraugliComparator : public Comparator {
  public:
+  // `pool` is used for the butteraugli computation itself; it may be null.
   explicit JxlButteraugliComparator(const ButteraugliParams& params,
-                                    const JxlCmsInterface& cms);
+                                    const JxlCmsInterface& cms,
+                                    ThreadPool* pool = nullptr);
 
   Status SetReferenceImage(const ImageBundle& ref) override;
   Status SetLinearReferenceImage(const Image3F& linear);
@@ -36,6 +39,7 @@ class JxlButteraugliComparator : public Comparator {
  private:
   ButteraugliParams params_;
   JxlCmsInterface cms_;
+  ThreadPool* pool_;
   std::unique_ptr<ButteraugliComparator> comparator_;
   size_t xsize_ = 0;
   size_t ysize_ = 0;
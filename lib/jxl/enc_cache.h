@@ -30,6 +30,7 @@
 namespace jxl {
 
 struct AuxOut;
+struct PatchDictionaryCache;
 
 // Contains encoder state.
 struct PassesEncoderState {
@@ -48,6 +49,11 @@ struct PassesEncoderState {
   // Raw data for special (reference+DC) frames.
   std::vector<std::unique_ptr<BitWriter>> special_frames;
 
+  // Patches shared with other frames of the codestream, or nullptr if every
+  // frame uses its own patch dictionary. Only used if cparams.reuse_patches is
+  // set, otherwise cleared when the frame writes a patch frame.
+  PatchDictionaryCache* patch_cache = nullptr;
+
   // For splitting into passes.
   ProgressiveSplitter progressive_splitter;
 
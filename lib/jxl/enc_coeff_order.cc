@@ -26,6 +26,7 @@
 #include <cmath>
 #include <cstdint>
 #include <hwy/aligned_allocator.h>
+#include <limits>
 #include <vector>
 
 #include "lib/jxl/base/rect.h"
@@ -34,6 +35,7 @@
 #include "lib/jxl/dct_util.h"
 #include "lib/jxl/enc_ans.h"
 #include "lib/jxl/enc_bit_writer.h"
+#include "lib/jxl/enc_coeff_order.h"
 #include "lib/jxl/lehmer_code.h"
 
 namespace jxl {
@@ -69,13 +71,9 @@ std::pair<uint32_t, uint32_t> ComputeUsedOrders(
   return {ret, ret_customize};
 }
 
-void ComputeCoeffOrder(SpeedTier speed, const ACImage& acs,
-                       const AcStrategyImage& ac_strategy,
-                       const FrameDimensions& frame_dim,
-                       uint32_t& all_used_orders, uint32_t prev_used_acs,
-                       uint32_t current_used_acs, uint32_t current_used_orders,
-                       coeff_order_t* JXL_RESTRICT order) {
-  std::vector<int32_t> num_zeros(kCoeffOrderMaxSize);
+CoeffOrderStats::CoeffOrderStats(SpeedTier speed,
+                                 uint32_t current_used_orders)
+    : num_zeros_(kCoeffOrderMaxSize) {
   // If compressing at high speed and only using 8x8 DCTs, only consider a
   // subset of blocks.
   double block_fraction = 1.0f;
@@ -86,76 +84,100 @@ void ComputeCoeffOrder(SpeedTier speed, const ACImage& acs,
   }
   // No need to compute number of zero coefficients if all orders are the
   // default.
-  if (current_used_orders != 0) {
-    uint64_t threshold =
-        (std::numeric_limits<uint64_t>::max() >> 32) * block_fraction;
-    uint64_t s[2] = {static_cast<uint64_t>(0x94D049BB133111EBull),
-                     static_cast<uint64_t>(0xBF58476D1CE4E5B9ull)};
-    // Xorshift128+ adapted from xorshift128+-inl.h
-    auto use_sample = [&]() {
-      auto s1 = s[0];
-      const auto s0 = s[1];
-      const auto bits = s1 + s0;  // b, c
-      s[0] = s0;
-      s1 ^= s1 << 23;
-      s1 ^= s0 ^ (s1 >> 18) ^ (s0 >> 5);
-      s[1] = s1;
-      return (bits >> 32) <= threshold;
-    };
-
-    // Count number of zero coefficients, separately for each DCT band.
-    // TODO(veluca): precompute when doing DCT.
-    for (size_t group_index = 0; group_index < frame_dim.num_groups;
-         group_index++) {
-      const size_t gx = group_index % frame_dim.xsize_groups;
-      const size_t gy = group_index / frame_dim.xsize_groups;
-      const Rect rect(gx * kGroupDimInBlocks, gy * kGroupDimInBlocks,
-                      kGroupDimInBlocks, kGroupDimInBlocks,
-                      frame_dim.xsize_blocks, frame_dim.ysize_blocks);
-      ConstACPtr rows[3];
-      ACType type = acs.Type();
-      for (size_t c = 0; c < 3; c++) {
-        rows[c] = acs.PlaneRow(c, group_index, 0);
-      }
-      size_t ac_offset = 0;
-
-      // TODO(veluca): SIMDfy.
-      for (size_t by = 0; by < rect.ysize(); ++by) {
-        AcStrategyRow acs_row = ac_strategy.ConstRow(rect, by);
-        for (size_t bx = 0; bx < rect.xsize(); ++bx) {
-          AcStrategy acs = acs_row[bx];
-          if (!acs.IsFirstBlock()) continue;
-          if (!use_sample()) continue;
-          size_t size = kDCTBlockSize << acs.log2_covered_blocks();
-          for (size_t c = 0; c < 3; ++c) {
-            const size_t order_offset =
-                CoeffOrderOffset(kStrategyOrder[acs.RawStrategy()], c);
-            if (type == ACType::k16) {
-              for (size_t k = 0; k < size; k++) {
-                bool is_zero = rows[c].ptr16[ac_offset + k] == 0;
-                num_zeros[order_offset + k] += is_zero ? 1 : 0;
-              }
-            } else {
-              for (size_t k = 0; k < size; k++) {
-                bool is_zero = rows[c].ptr32[ac_offset + k] == 0;
-                num_zeros[order_offset + k] += is_zero ? 1 : 0;
-              }
+  enabled_ = current_used_orders != 0;
+  threshold_ = (std::numeric_limits<uint64_t>::max() >> 32) * block_fraction;
+  rng_[0] = static_cast<uint64_t>(0x94D049BB133111EBull);
+  rng_[1] = static_cast<uint64_t>(0xBF58476D1CE4E5B9ull);
+}
+
+void CoeffOrderStats::AddGroups(const ACImage& acs,
+                                const AcStrategyImage& ac_strategy,
+                                const FrameDimensions& frame_dim,
+                                size_t group_begin, size_t group_end) {
+  if (!enabled_) return;
+  // Xorshift128+ adapted from xorshift128+-inl.h
+  auto use_sample = [&]() {
+    auto s1 = rng_[0];
+    const auto s0 = rng_[1];
+    const auto bits = s1 + s0;  // b, c
+    rng_[0] = s0;
+    s1 ^= s1 << 23;
+    s1 ^= s0 ^ (s1 >> 18) ^ (s0 >> 5);
+    rng_[1] = s1;
+    return (bits >> 32) <= threshold_;
+  };
+
+  // Count number of zero coefficients, separately for each DCT band.
+  // TODO(veluca): precompute when doing DCT.
+  for (size_t group_index = group_begin; group_index < group_end;
+       group_index++) {
+    const size_t gx = group_index % frame_dim.xsize_groups;
+    const size_t gy = group_index / frame_dim.xsize_groups;
+    const Rect rect(gx * kGroupDimInBlocks, gy * kGroupDimInBlocks,
+                    kGroupDimInBlocks, kGroupDimInBlocks,
+                    frame_dim.xsize_blocks, frame_dim.ysize_blocks);
+    ConstACPtr rows[3];
+    ACType type = acs.Type();
+    for (size_t c = 0; c < 3; c++) {
+      rows[c] = acs.PlaneRow(c, group_index - group_begin, 0);
+    }
+    size_t ac_offset = 0;
+
+    // TODO(veluca): SIMDfy.
+    for (size_t by = 0; by < rect.ysize(); ++by) {
+      AcStrategyRow acs_row = ac_strategy.ConstRow(rect, by);
+      for (size_t bx = 0; bx < rect.xsize(); ++bx) {
+        AcStrategy acs = acs_row[bx];
+        if (!acs.IsFirstBlock()) continue;
+        if (!use_sample()) continue;
+        size_t size = kDCTBlockSize << acs.log2_covered_blocks();
+        for (size_t c = 0; c < 3; ++c) {
+          const size_t order_offset =
+              CoeffOrderOffset(kStrategyOrder[acs.RawStrategy()], c);
+          if (type == ACType::k16) {
+            for (size_t k = 0; k < size; k++) {
+              bool is_zero = rows[c].ptr16[ac_offset + k] == 0;
+              num_zeros_[order_offset + k] += is_zero ? 1 : 0;
+            }
+          } else {
+            for (size_t k = 0; k < size; k++) {
+              bool is_zero = rows[c].ptr32[ac_offset + k] == 0;
+              num_zeros_[order_offset + k] += is_zero ? 1 : 0;
             }
-            // Ensure LLFs are first in the order.
-            size_t cx = acs.covered_blocks_x();
-            size_t cy = acs.covered_blocks_y();
-            CoefficientLayout(&cy, &cx);
-            for (size_t iy = 0; iy < cy; iy++) {
-              for (size_t ix = 0; ix < cx; ix++) {
-                num_zeros[order_offset + iy * kBlockDim * cx + ix] = -1;
-              }
+          }
+          // Ensure LLFs are first in the order.
+          size_t cx = acs.covered_blocks_x();
+          size_t cy = acs.covered_blocks_y();
+          CoefficientLayout(&cy, &cx);
+          for (size_t iy = 0; iy < cy; iy++) {
+            for (size_t ix = 0; ix < cx; ix++) {
+              num_zeros_[order_offset + iy * kBlockDim * cx + ix] = -1;
             }
           }
-          ac_offset += size;
         }
+        ac_offset += size;
       }
     }
   }
+}
+
+void ComputeCoeffOrder(SpeedTier speed, const ACImage& acs,
+                       const AcStrategyImage& ac_strategy,
+                       const FrameDimensions& frame_dim,
+                       uint32_t& all_used_orders, uint32_t prev_used_acs,
+                       uint32_t current_used_acs, uint32_t current_used_orders,
+                       coeff_order_t* JXL_RESTRICT order) {
+  CoeffOrderStats stats(speed, current_used_orders);
+  stats.AddGroups(acs, ac_strategy, frame_dim, 0, frame_dim.num_groups);
+  ComputeCoeffOrder(stats, all_used_orders, prev_used_acs, current_used_acs,
+                    current_used_orders, order);
+}
+
+void ComputeCoeffOrder(const CoeffOrderStats& stats, uint32_t& all_used_orders,
+                       uint32_t prev_used_acs, uint32_t current_used_acs,
+                       uint32_t current_used_orders,
+                       coeff_order_t* JXL_RESTRICT order) {
+  const std::vector<int32_t>& num_zeros = stats.num_zeros();
   struct PosAndCount {
     uint32_t pos;
     uint32_t count;
@@ -8,6 +8,7 @@
 
 #include <cstddef>
 #include <cstdint>
+#include <vector>
 
 #include "lib/jxl/ac_strategy.h"
 #include "lib/jxl/base/compiler_specific.h"
@@ -27,6 +28,30 @@ struct AuxOut;
 std::pair<uint32_t, uint32_t> ComputeUsedOrders(
     SpeedTier speed, const AcStrategyImage& ac_strategy, const Rect& rect);
 
+// Number of zero coefficients of each DCT band, counted over (a sample of) the
+// blocks of a frame. The groups can be added in several batches, e.g. when the
+// coefficients are only available one stripe at a time; the result is the
+// same as adding all of them at once as long as they are added in order.
+class CoeffOrderStats {
+ public:
+  CoeffOrderStats(SpeedTier speed, uint32_t current_used_orders);
+
+  // Adds the groups [group_begin, group_end) of the frame, whose coefficients
+  // are stored in `acs` starting from its row 0.
+  void AddGroups(const ACImage& acs, const AcStrategyImage& ac_strategy,
+                 const FrameDimensions& frame_dim, size_t group_begin,
+                 size_t group_end);
+
+  const std::vector<int32_t>& num_zeros() const { return num_zeros_; }
+
+ private:
+  bool enabled_;
+  uint64_t threshold_;
+  // State of the generator that picks the sampled blocks.
+  uint64_t rng_[2];
+  std::vector<int32_t> num_zeros_;
+};
+
 // Modify zig-zag order, so that DCT bands with more zeros go later.
 // Order of DCT bands with same number of zeros is untouched, so
 // permutation will be cheaper to encode.
@@ -37,6 +62,12 @@ void ComputeCoeffOrder(SpeedTier speed, const ACImage& acs,
                        uint32_t current_used_acs, uint32_t current_used_orders,
                        coeff_order_t* JXL_RESTRICT order);
 
+// Same as above, from the statistics of all the groups of the frame.
+void ComputeCoeffOrder(const CoeffOrderStats& stats, uint32_t& all_used_orders,
+                       uint32_t prev_used_acs, uint32_t current_used_acs,
+                       uint32_t current_used_orders,
+                       coeff_order_t* JXL_RESTRICT order);
+
 void EncodeCoeffOrders(uint16_t used_orders,
                        const coeff_order_t* JXL_RESTRICT order,
                        BitWriter* writer, size_t layer,
@@ -732,6 +732,45 @@ void FindIndexOfSumMaximum(const V* array, const size_t len, R* idx, V* sum) {
   *sum = maxval;
 }
 
+// Quantization tables of a recompressed JPEG, in JPEG XL channel order.
+struct JPEGTranscodingTables {
+  JPEGTranscodingTables(const jpeg::JPEGData& jpeg_data,
+                        const FrameHeader& frame_header)
+      : jpeg_c_map(JpegOrder(frame_header.color_transform,
+                             jpeg_data.components.size() == 1)),
+        qt(192),
+        scaled_qtable(192) {
+    for (size_t c = 0; c < 3; c++) {
+      size_t jpeg_c = jpeg_c_map[c];
+      const int32_t* quant =
+          jpeg_data.quant[jpeg_data.components[jpeg_c].quant_idx].values.data();
+      for (size_t y = 0; y < 8; y++) {
+        for (size_t x = 0; x < 8; x++) {
+          // JPEG XL transposes the DCT, JPEG doesn't.
+          qt[c * 64 + 8 * x + y] = quant[8 * y + x];
+        }
+      }
+    }
+    for (size_t c = 0; c < 3; c++) {
+      for (size_t i = 0; i < 64; i++) {
+        scaled_qtable[64 * c + i] =
+            (1 << kCFLFixedPointPrecision) * qt[64 + i] / qt[64 * c + i];
+      }
+    }
+  }
+
+  const int16_t* JPEGRow(const jpeg::JPEGData& jpeg_data, size_t c,
+                         size_t y) const {
+    const jpeg::JPEGComponent& component = jpeg_data.components[jpeg_c_map[c]];
+    return component.coeffs.data() +
+           component.width_in_blocks * kDCTBlockSize * y;
+  }
+
+  std::array<int, 3> jpeg_c_map;
+  std::vector<int> qt;
+  std::vector<int32_t> scaled_qtable;
+};
+
 Status ComputeJPEGTranscodingData(const jpeg::JPEGData& jpeg_data,
                                   const FrameHeader& frame_header,
                                   ThreadPool* pool,
@@ -752,36 +791,20 @@ Status ComputeJPEGTranscodingData(const jpeg::JPEGData& jpeg_data,
   shared.ac_strategy.FillDCT8();
   FillImage(static_cast<uint8_t>(0), &shared.epf_sharpness);
 
+  // The AC coefficients are only materialized one stripe at a time by
+  // TokenizeJPEGCoefficients().
   enc_state->coeffs.clear();
-  while (enc_state->coeffs.size() < enc_state->passes.size()) {
-    JXL_ASSIGN_OR_RETURN(
-        std::unique_ptr<ACImageT<int32_t>> coeffs,
-        ACImageT<int32_t>::Make(memory_manager, kGroupDim * kGroupDim,
-                                frame_dim.num_groups));
-    enc_state->coeffs.emplace_back(std::move(coeffs));
-  }
 
   // convert JPEG quantization table to a Quantizer object
   float dcquantization[3];
   std::vector<QuantEncoding> qe(DequantMatrices::kNum,
                                 QuantEncoding::Library(0));
 
-  auto jpeg_c_map =
-      JpegOrder(frame_header.color_transform, jpeg_data.components.size() == 1);
-
-  std::vector<int> qt(192);
+  const JPEGTranscodingTables tables(jpeg_data, frame_header);
+  const std::vector<int>& qt = tables.qt;
+  const std::vector<int32_t>& scaled_qtable = tables.scaled_qtable;
   for (size_t c = 0; c < 3; c++) {
-    size_t jpeg_c = jpeg_c_map[c];
-    const int32_t* quant =
-        jpeg_data.quant[jpeg_data.components[jpeg_c].quant_idx].values.data();
-
-    dcquantization[c] = 255 * 8.0f / quant[0];
-    for (size_t y = 0; y < 8; y++) {
-      for (size_t x = 0; x < 8; x++) {
-        // JPEG XL transposes the DCT, JPEG doesn't.
-        qt[c * 64 + 8 * x + y] = quant[8 * y + x];
-      }
-    }
+    dcquantization[c] = 255 * 8.0f / qt[c * 64];
   }
   DequantMatricesSetCustomDC(memory_manager, &shared.matrices, dcquantization);
   float dcquantization_r[3] = {1.0f / dcquantization[0],
@@ -801,18 +824,8 @@ Status ComputeJPEGTranscodingData(const jpeg::JPEGData& jpeg_data,
   FillImage(static_cast<int32_t>(shared.quantizer.InvGlobalScale()),
             &shared.raw_quant_field);
 
-  std::vector<int32_t> scaled_qtable(192);
-  for (size_t c = 0; c < 3; c++) {
-    for (size_t i = 0; i < 64; i++) {
-      scaled_qtable[64 * c + i] =
-          (1 << kCFLFixedPointPrecision) * qt[64 + i] / qt[64 * c + i];
-    }
-  }
-
   auto jpeg_row = [&](size_t c, size_t y) {
-    return jpeg_data.components[jpeg_c_map[c]].coeffs.data() +
-           jpeg_data.components[jpeg_c_map[c]].width_in_blocks * kDCTBlockSize *
-               y;
+    return tables.JPEGRow(jpeg_data, c, y);
   };
 
   bool DCzero = (frame_header.color_transform == ColorTransform::kYCbCr);
@@ -905,9 +918,6 @@ Status ComputeJPEGTranscodingData(const jpeg::JPEGData& jpeg_data,
       Image3F dc, Image3F::Create(memory_manager, xsize_blocks, ysize_blocks));
   if (!frame_header.chroma_subsampling.Is444()) {
     ZeroFillImage(&dc);
-    for (auto& coeff : enc_state->coeffs) {
-      coeff->ZeroFill();
-    }
   }
   // JPEG DC is from -1024 to 1023.
   std::vector<size_t> dc_counts[3] = {};
@@ -917,9 +927,6 @@ Status ComputeJPEGTranscodingData(const jpeg::JPEGData& jpeg_data,
   size_t total_dc[3] = {};
   for (size_t c : {1, 0, 2}) {
     if (jpeg_data.components.size() == 1 && c != 1) {
-      for (auto& coeff : enc_state->coeffs) {
-        coeff->ZeroFillPlane(c);
-      }
       ZeroFillImage(&dc.Plane(c));
       // Ensure no division by 0.
       dc_counts[c][1024] = 1;
@@ -928,73 +935,23 @@ Status ComputeJPEGTranscodingData(const jpeg::JPEGData& jpeg_data,
     }
     size_t hshift = frame_header.chroma_subsampling.HShift(c);
     size_t vshift = frame_header.chroma_subsampling.VShift(c);
-    ImageSB& map = (c == 0 ? shared.cmap.ytox_map : shared.cmap.ytob_map);
-    for (size_t group_index = 0; group_index < frame_dim.num_groups;
-         group_index++) {
-      const size_t gx = group_index % frame_dim.xsize_groups;
-      const size_t gy = group_index / frame_dim.xsize_groups;
-      int32_t* coeffs[kMaxNumPasses];
-      for (size_t i = 0; i < enc_state->coeffs.size(); i++) {
-        coeffs[i] = enc_state->coeffs[i]->PlaneRow(c, group_index, 0).ptr32;
-      }
-      int32_t block[64];
-      for (size_t by = gy * kGroupDimInBlocks;
-           by < ysize_blocks && by < (gy + 1) * kGroupDimInBlocks; ++by) {
-        if ((by >> vshift) << vshift != by) continue;
-        const int16_t* JXL_RESTRICT inputjpeg = jpeg_row(c, by >> vshift);
-        const int16_t* JXL_RESTRICT inputjpegY = jpeg_row(1, by);
-        float* JXL_RESTRICT fdc = dc.PlaneRow(c, by >> vshift);
-        const int8_t* JXL_RESTRICT cm =
-            map.ConstRow(by / kColorTileDimInBlocks);
-        for (size_t bx = gx * kGroupDimInBlocks;
-             bx < xsize_blocks && bx < (gx + 1) * kGroupDimInBlocks; ++bx) {
-          if ((bx >> hshift) << hshift != bx) continue;
-          size_t base = (bx >> hshift) * kDCTBlockSize;
-          int idc;
-          if (DCzero) {
-            idc = inputjpeg[base];
-          } else {
-            idc = inputjpeg[base] + 1024 / qt[c * 64];
-          }
-          dc_counts[c][std::min(static_cast<uint32_t>(idc + 1024),
-                                static_cast<uint32_t>(2047))]++;
-          total_dc[c]++;
-          fdc[bx >> hshift] = idc * dcquantization_r[c];
-          if (c == 1 || !enc_state->cparams.force_cfl_jpeg_recompression ||
-              !frame_header.chroma_subsampling.Is444()) {
-            for (size_t y = 0; y < 8; y++) {
-              for (size_t x = 0; x < 8; x++) {
-                block[y * 8 + x] = inputjpeg[base + x * 8 + y];
-              }
-            }
-          } else {
-            const int32_t scale =
-                ColorCorrelation::RatioJPEG(cm[bx / kColorTileDimInBlocks]);
-
-            for (size_t y = 0; y < 8; y++) {
-              for (size_t x = 0; x < 8; x++) {
-                int Y = inputjpegY[kDCTBlockSize * bx + x * 8 + y];
-                int QChroma = inputjpeg[kDCTBlockSize * bx + x * 8 + y];
-                // Fixed-point multiply of CfL scale with quant table ratio
-                // first, and Y value second.
-                int coeff_scale = (scale * scaled_qtable[64 * c + y * 8 + x] +
-                                   (1 << (kCFLFixedPointPrecision - 1))) >>
-                                  kCFLFixedPointPrecision;
-                int cfl_factor =
-                    (Y * coeff_scale + (1 << (kCFLFixedPointPrecision - 1))) >>
-                    kCFLFixedPointPrecision;
-                int QCR = QChroma - cfl_factor;
-                block[y * 8 + x] = QCR;
-              }
-            }
-          }
-          enc_state->progressive_splitter.SplitACCoefficients(
-              block, AcStrategy::FromRawStrategy(AcStrategy::Type::DCT), bx, by,
-              coeffs);
-          for (size_t i = 0; i < enc_state->coeffs.size(); i++) {
-            coeffs[i] += kDCTBlockSize;
-          }
+    for (size_t by = 0; by < ysize_blocks; ++by) {
+      if ((by >> vshift) << vshift != by) continue;
+      const int16_t* JXL_RESTRICT inputjpeg = jpeg_row(c, by >> vshift);
+      float* JXL_RESTRICT fdc = dc.PlaneRow(c, by >> vshift);
+      for (size_t bx = 0; bx < xsize_blocks; ++bx) {
+        if ((bx >> hshift) << hshift != bx) continue;
+        size_t base = (bx >> hshift) * kDCTBlockSize;
+        int idc;
+        if (DCzero) {
+          idc = inputjpeg[base];
+        } else {
+          idc = inputjpeg[base] + 1024 / qt[c * 64];
         }
+        dc_counts[c][std::min(static_cast<uint32_t>(idc + 1024),
+                              static_cast<uint32_t>(2047))]++;
+        total_dc[c]++;
+        fdc[bx >> hshift] = idc * dcquantization_r[c];
       }
     }
   }
@@ -1126,9 +1083,12 @@ struct EncCache {
   Image3I num_nzeroes;
 };
 
-Status TokenizeAllCoefficients(const FrameHeader& frame_header,
-                               ThreadPool* pool,
-                               PassesEncoderState* enc_state) {
+// Tokenizes the groups [group_begin, group_end), whose coefficients are
+// stored in `coeffs` starting from its row 0.
+Status TokenizeAllCoefficients(
+    const FrameHeader& frame_header,
+    const std::vector<std::unique_ptr<ACImage>>& coeffs, size_t group_begin,
+    size_t group_end, ThreadPool* pool, PassesEncoderState* enc_state) {
   PassesSharedState& shared = enc_state->shared;
   std::vector<EncCache> group_caches;
   JxlMemoryManager* memory_manager = enc_state->memory_manager();
@@ -1142,12 +1102,13 @@ Status TokenizeAllCoefficients(const FrameHeader& frame_header,
     if (has_error) return;
     // Tokenize coefficients.
     const Rect rect = shared.frame_dim.BlockGroupRect(group_index);
+    const size_t row = group_index - group_begin;
     for (size_t idx_pass = 0; idx_pass < enc_state->passes.size(); idx_pass++) {
-      JXL_ASSERT(enc_state->coeffs[idx_pass]->Type() == ACType::k32);
+      JXL_ASSERT(coeffs[idx_pass]->Type() == ACType::k32);
       const int32_t* JXL_RESTRICT ac_rows[3] = {
-          enc_state->coeffs[idx_pass]->PlaneRow(0, group_index, 0).ptr32,
-          enc_state->coeffs[idx_pass]->PlaneRow(1, group_index, 0).ptr32,
-          enc_state->coeffs[idx_pass]->PlaneRow(2, group_index, 0).ptr32,
+          coeffs[idx_pass]->PlaneRow(0, row, 0).ptr32,
+          coeffs[idx_pass]->PlaneRow(1, row, 0).ptr32,
+          coeffs[idx_pass]->PlaneRow(2, row, 0).ptr32,
       };
       // Ensure group cache is initialized.
       if (!group_caches[thread].InitOnce(memory_manager)) {
@@ -1162,13 +1123,182 @@ Status TokenizeAllCoefficients(const FrameHeader& frame_header,
           shared.raw_quant_field, shared.block_ctx_map);
     }
   };
-  JXL_RETURN_IF_ERROR(RunOnPool(pool, 0, shared.frame_dim.num_groups,
+  JXL_RETURN_IF_ERROR(RunOnPool(pool, group_begin, group_end,
                                 tokenize_group_init, tokenize_group,
                                 "TokenizeGroup"));
   if (has_error) return JXL_FAILURE("TokenizeGroup failed");
   return true;
 }
 
+// Writes the AC coefficients of the group `group_index` of a recompressed JPEG
+// to the row `row` of `coeffs`, one image per pass, applying the
+// chroma-from-luma map computed by ComputeJPEGTranscodingData().
+void FillJPEGGroupCoefficients(
+    const jpeg::JPEGData& jpeg_data, const JPEGTranscodingTables& tables,
+    const FrameHeader& frame_header, size_t group_index, size_t row,
+    const std::vector<std::unique_ptr<ACImage>>& coeffs,
+    PassesEncoderState* enc_state) {
+  const PassesSharedState& shared = enc_state->shared;
+  const FrameDimensions& frame_dim = shared.frame_dim;
+  const size_t gx = group_index % frame_dim.xsize_groups;
+  const size_t gy = group_index / frame_dim.xsize_groups;
+  const bool use_cfl = enc_state->cparams.force_cfl_jpeg_recompression &&
+                       frame_header.chroma_subsampling.Is444();
+  for (size_t c : {1, 0, 2}) {
+    // The planes of the missing channels of grayscale JPEGs stay zero.
+    if (jpeg_data.components.size() == 1 && c != 1) continue;
+    size_t hshift = frame_header.chroma_subsampling.HShift(c);
+    size_t vshift = frame_header.chroma_subsampling.VShift(c);
+    const ImageSB& map =
+        (c == 0 ? shared.cmap.ytox_map : shared.cmap.ytob_map);
+    const int32_t* scaled_qtable = &tables.scaled_qtable[64 * c];
+    int32_t* out[kMaxNumPasses];
+    for (size_t i = 0; i < coeffs.size(); i++) {
+      out[i] = coeffs[i]->PlaneRow(c, row, 0).ptr32;
+    }
+    int32_t block[64];
+    for (size_t by = gy * kGroupDimInBlocks;
+         by < frame_dim.ysize_blocks && by < (gy + 1) * kGroupDimInBlocks;
+         ++by) {
+      if ((by >> vshift) << vshift != by) continue;
+      const int16_t* JXL_RESTRICT inputjpeg =
+          tables.JPEGRow(jpeg_data, c, by >> vshift);
+      const int16_t* JXL_RESTRICT inputjpegY = tables.JPEGRow(jpeg_data, 1, by);
+      const int8_t* JXL_RESTRICT cm = map.ConstRow(by / kColorTileDimInBlocks);
+      for (size_t bx = gx * kGroupDimInBlocks;
+           bx < frame_dim.xsize_blocks && bx < (gx + 1) * kGroupDimInBlocks;
+           ++bx) {
+        if ((bx >> hshift) << hshift != bx) continue;
+        size_t base = (bx >> hshift) * kDCTBlockSize;
+        if (c == 1 || !use_cfl) {
+          for (size_t y = 0; y < 8; y++) {
+            for (size_t x = 0; x < 8; x++) {
+              block[y * 8 + x] = inputjpeg[base + x * 8 + y];
+            }
+          }
+        } else {
+          const int32_t scale =
+              ColorCorrelation::RatioJPEG(cm[bx / kColorTileDimInBlocks]);
+
+          for (size_t y = 0; y < 8; y++) {
+            for (size_t x = 0; x < 8; x++) {
+              int Y = inputjpegY[kDCTBlockSize * bx + x * 8 + y];
+              int QChroma = inputjpeg[kDCTBlockSize * bx + x * 8 + y];
+              // Fixed-point multiply of CfL scale with quant table ratio
+              // first, and Y value second.
+              int coeff_scale = (scale * scaled_qtable[y * 8 + x] +
+                                 (1 << (kCFLFixedPointPrecision - 1))) >>
+                                kCFLFixedPointPrecision;
+              int cfl_factor =
+                  (Y * coeff_scale + (1 << (kCFLFixedPointPrecision - 1))) >>
+                  kCFLFixedPointPrecision;
+              int QCR = QChroma - cfl_factor;
+              block[y * 8 + x] = QCR;
+            }
+          }
+        }
+        enc_state->progressive_splitter.SplitACCoefficients(
+            block, AcStrategy::FromRawStrategy(AcStrategy::Type::DCT), bx, by,
+            out);
+        for (size_t i = 0; i < coeffs.size(); i++) {
+          out[i] += kDCTBlockSize;
+        }
+      }
+    }
+  }
+}
+
+// Computes the coefficient orders and the AC tokens of a recompressed JPEG.
+// For frames larger than cparams.jpeg_max_unstriped_pixels, the coefficients
+// are produced from `jpeg_data` one row of DC groups at a time, so that the
+// memory needed besides the JPEG coefficients themselves is proportional to
+// the width of the image. The orders must be known before tokenizing, so when
+// they are not all the default ones, each stripe is then produced twice: once
+// to count the zero coefficients, and once to tokenize. Frames that fit in a
+// single stripe are produced once.
+Status TokenizeJPEGCoefficients(const jpeg::JPEGData& jpeg_data,
+                                const FrameHeader& frame_header,
+                                ThreadPool* pool,
+                                PassesEncoderState* enc_state) {
+  PassesSharedState& shared = enc_state->shared;
+  JxlMemoryManager* memory_manager = enc_state->memory_manager();
+  const FrameDimensions& frame_dim = shared.frame_dim;
+  const SpeedTier speed = enc_state->cparams.speed_tier;
+  const JPEGTranscodingTables tables(jpeg_data, frame_header);
+  const size_t num_passes = enc_state->progressive_splitter.GetNumPasses();
+  const bool striped = static_cast<uint64_t>(frame_dim.xsize) *
+                           frame_dim.ysize >
+                       enc_state->cparams.jpeg_max_unstriped_pixels;
+  const size_t stripe_groups =
+      striped ? std::min(frame_dim.num_groups,
+                         kBlockDim * frame_dim.xsize_groups)
+              : frame_dim.num_groups;
+  const bool single_stripe = stripe_groups == frame_dim.num_groups;
+
+  std::vector<std::unique_ptr<ACImage>> coeffs;
+  for (size_t i = 0; i < num_passes; i++) {
+    JXL_ASSIGN_OR_RETURN(std::unique_ptr<ACImageT<int32_t>> pass_coeffs,
+                         ACImageT<int32_t>::Make(memory_manager,
+                                                 kGroupDim * kGroupDim,
+                                                 stripe_groups));
+    coeffs.emplace_back(std::move(pass_coeffs));
+  }
+  // Subsampled channels do not fill their groups, and grayscale JPEGs only
+  // fill the Y plane.
+  const bool zero_fill = !frame_header.chroma_subsampling.Is444() ||
+                         jpeg_data.components.size() == 1;
+  const auto fill_stripe = [&](size_t group_begin,
+                               size_t group_end) -> Status {
+    if (zero_fill) {
+      for (auto& coeff : coeffs) {
+        coeff->ZeroFill();
+      }
+    }
+    const auto fill_group = [&](const uint32_t group_index,
+                                size_t /* thread */) {
+      FillJPEGGroupCoefficients(jpeg_data, tables, frame_header, group_index,
+                                group_index - group_begin, coeffs, enc_state);
+    };
+    return RunOnPool(pool, group_begin, group_end, ThreadPool::NoInit,
+                     fill_group, "FillJPEGGroups");
+  };
+
+  auto used_orders_info = ComputeUsedOrders(
+      speed, shared.ac_strategy, Rect(shared.raw_quant_field));
+  std::vector<CoeffOrderStats> stats(
+      num_passes, CoeffOrderStats(speed, used_orders_info.second));
+  if (used_orders_info.second != 0) {
+    for (size_t begin = 0; begin < frame_dim.num_groups;
+         begin += stripe_groups) {
+      const size_t end = std::min(frame_dim.num_groups, begin + stripe_groups);
+      JXL_RETURN_IF_ERROR(fill_stripe(begin, end));
+      for (size_t i = 0; i < num_passes; i++) {
+        stats[i].AddGroups(*coeffs[i], shared.ac_strategy, frame_dim, begin,
+                           end);
+      }
+    }
+  }
+  enc_state->used_orders.resize(num_passes);
+  for (size_t i = 0; i < num_passes; i++) {
+    ComputeCoeffOrder(stats[i], enc_state->used_orders[i],
+                      enc_state->used_acs, used_orders_info.first,
+                      used_orders_info.second,
+                      &shared.coeff_orders[i * shared.coeff_order_size]);
+  }
+  enc_state->used_acs |= used_orders_info.first;
+
+  for (size_t begin = 0; begin < frame_dim.num_groups; begin += stripe_groups) {
+    const size_t end = std::min(frame_dim.num_groups, begin + stripe_groups);
+    // A single stripe is still there from counting the zeros.
+    if (!single_stripe || used_orders_info.second == 0) {
+      JXL_RETURN_IF_ERROR(fill_stripe(begin, end));
+    }
+    JXL_RETURN_IF_ERROR(TokenizeAllCoefficients(frame_header, coeffs, begin,
+                                                end, pool, enc_state));
+  }
+  return true;
+}
+
 Status EncodeGlobalDCInfo(const PassesSharedState& shared, BitWriter* writer,
                           AuxOut* aux_out) {
   // Encode quantizer DC and global scale.
@@ -1600,13 +1730,19 @@ Status ComputeEncodingData(
           frame_header, linear, &color, group_rect, cms, pool, &enc_modular,
           &enc_state, aux_out));
     }
-    ComputeAllCoeffOrders(enc_state, frame_dim);
     if (!enc_state.streaming_mode) {
       shared.num_histograms = 1;
       enc_state.histogram_idx.resize(frame_dim.num_groups);
     }
-    JXL_RETURN_IF_ERROR(
-        TokenizeAllCoefficients(frame_header, pool, &enc_state));
+    if (jpeg_data) {
+      JXL_RETURN_IF_ERROR(
+          TokenizeJPEGCoefficients(*jpeg_data, frame_header, pool, &enc_state));
+    } else {
+      ComputeAllCoeffOrders(enc_state, frame_dim);
+      JXL_RETURN_IF_ERROR(TokenizeAllCoefficients(
+          frame_header, enc_state.coeffs, 0, frame_dim.num_groups, pool,
+          &enc_state));
+    }
   }
 
   if (cparams.modular_mode || !extra_channels.empty()) {
@@ -2101,6 +2237,11 @@ Status EncodeFrameOneShot(JxlMemoryManager* memory_manager,
                           AuxOut* aux_out) {
   fprintf(stdout, "=======> EncodeFrameOneShot() in\n");
   PassesEncoderState enc_state{memory_manager};
+  enc_state.patch_cache = frame_info.patch_cache;
+  if (frame_info.quant_tables) {
+    std::swap(enc_state.shared.matrices, *frame_info.quant_tables);
+    enc_state.shared.matrices.ResetToDefault();
+  }
   // LANDMARK: Encoder state can be read here!
 
   SetProgressiveMode(cparams, &enc_state.progressive_splitter);
@@ -2135,6 +2276,9 @@ Status EncodeFrameOneShot(JxlMemoryManager* memory_manager,
   writer.AppendByteAligned(group_codes);
   PaddedBytes frame_bytes = std::move(writer).TakeBytes();
   JXL_RETURN_IF_ERROR(AppendData(*output_processor, frame_bytes));
+  if (frame_info.quant_tables) {
+    std::swap(enc_state.shared.matrices, *frame_info.quant_tables);
+  }
   
   fprintf(stdout, "<======= EncodeFrameOneShot() out\n");
   return true;
@@ -2205,6 +2349,10 @@ Status EncodeFrame(JxlMemoryManager* memory_manager,
     size.resize(all_params.size());
 
     std::atomic<bool> has_error{false};
+    // Trial encodes must not modify the patches shared with other frames.
+    FrameInfo trial_frame_info = frame_info;
+    trial_frame_info.patch_cache = nullptr;
+    trial_frame_info.quant_tables = nullptr;
 
     JXL_RETURN_IF_ERROR(RunOnPool(
         pool, 0, all_params.size(), ThreadPool::NoInit,
@@ -2215,7 +2363,7 @@ Status EncodeFrame(JxlMemoryManager* memory_manager,
           size_t avail_out = output.size();
           JxlEncoderOutputProcessorWrapper local_output(memory_manager);
           local_output.SetAvailOut(&next_out, &avail_out);
-          if (!EncodeFrame(memory_manager, all_params[task], frame_info,
+          if (!EncodeFrame(memory_manager, all_params[task], trial_frame_info,
                            metadata, frame_data, cms, nullptr, &local_output,
                            aux_out)) {
             has_error = true;
@@ -84,6 +84,16 @@ struct FrameInfo {
   // extra channel info and allows more options. The non-API cjxl leaves it
   // empty and relies on the default behavior.
   std::vector<BlendingInfo> extra_channel_blending_info;
+
+  // If not nullptr, patches are looked up in and added to this cache, which is
+  // shared by all frames of the codestream, if cparams.reuse_patches is set.
+  // Other frames clear it when they write a patch frame of their own.
+  PatchDictionaryCache* patch_cache = nullptr;
+
+  // If not nullptr, the frame starts from these dequantization matrices, whose
+  // already computed tables are kept if the frame uses the default ones, and
+  // leaves its own matrices there when done.
+  DequantMatrices* quant_tables = nullptr;
 };
 
 // Checks and adjusts CompressParams when they are all initialized.
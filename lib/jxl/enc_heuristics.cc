@@ -202,7 +202,7 @@ Status FindBestDequantMatrices(JxlMemoryManager* memory_manager,
                                DequantMatrices* dequant_matrices) {
   // TODO(veluca): quant matrices for no-gaborish.
   // TODO(veluca): heuristics for in-bitstream quant tables.
-  *dequant_matrices = DequantMatrices();
+  dequant_matrices->ResetToDefault();
   if (cparams.max_error_mode || cparams.disable_percepeptual_optimizations) {
     constexpr float kMSEWeights[3] = {0.001, 0.001, 0.001};
     const float* wp = cparams.disable_percepeptual_optimizations
@@ -794,6 +794,7 @@ StatusOr<Image3F> ReconstructImage(
   options.coalescing = false;
   options.render_spotcolors = false;
   options.render_noise = true;
+  options.collect_stage_stats = false;
 
   JXL_CHECK(dec_state.PreparePipeline(frame_header, &shared.metadata->m,
                                       &decoded, options));
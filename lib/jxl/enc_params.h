@@ -60,6 +60,8 @@ struct CompressParams {
   Override noise = Override::kDefault;
   Override dots = Override::kDefault;
   Override patches = Override::kDefault;
+  // Use and update the patches shared by all frames of the codestream.
+  bool reuse_patches = false;
   Override gaborish = Override::kDefault;
   int epf = -1;
 
@@ -94,6 +96,11 @@ struct CompressParams {
   // allowing reconstruction of the original JPEG.
   bool force_cfl_jpeg_recompression = true;
 
+  // JPEG recompression converts the coefficients of frames with more pixels
+  // than this one row of DC groups at a time. Smaller frames are converted at
+  // once, which takes more memory but converts each coefficient only once.
+  size_t jpeg_max_unstriped_pixels = size_t{1} << 24;
+
   // Use brotli compression for any boxes derived from a JPEG frame.
   bool jpeg_compress_boxes = true;
 
@@ -13,6 +13,10 @@
 #include <atomic>
 #include <cstdint>
 #include <cstdlib>
+#include <limits>
+#include <numeric>
+#include <unordered_map>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
@@ -208,10 +212,78 @@ struct PatchColorspaceInfo {
   }
 };
 
+// Number of rows of the image that are searched for patch candidates by a
+// single task.
+constexpr size_t kPatchStripeRows = 64;
+
+// FNV-1a over the quantized pixels, used to group identical candidates.
+uint64_t HashQuantizedPatch(const QuantizedPatch& patch) {
+  uint64_t hash = 0xcbf29ce484222325ull;
+  const auto add = [&hash](uint64_t v) {
+    hash ^= v;
+    hash *= 0x100000001b3ull;
+  };
+  add(patch.xsize);
+  add(patch.ysize);
+  for (size_t c = 0; c < 3; c++) {
+    for (size_t i = 0; i < patch.xsize * patch.ysize; i++) {
+      add(static_cast<uint8_t>(patch.pixels[c][i]));
+    }
+  }
+  return hash;
+}
+
+}  // namespace
+
+std::vector<PatchInfo> MergePatchCandidates(std::vector<PatchInfo> candidates,
+                                            ThreadPool* pool) {
+  // Hashing runs on the pool. Visiting the candidates by position makes the
+  // first occurrence of each patch its representative, and keeps the
+  // occurrences sorted, as sorting the whole list of candidates would.
+  std::vector<uint64_t> hashes(candidates.size());
+  const auto hash_candidate = [&](const uint32_t i, size_t /* thread */) {
+    hashes[i] = HashQuantizedPatch(candidates[i].first);
+  };
+  JXL_CHECK(RunOnPool(pool, 0, candidates.size(), ThreadPool::NoInit,
+                      hash_candidate, "HashPatchCandidates"));
+  std::vector<size_t> order(candidates.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    return candidates[a].second < candidates[b].second;
+  });
+  std::vector<PatchInfo> info;
+  std::unordered_map<uint64_t, std::vector<size_t>> buckets;
+  for (size_t i : order) {
+    std::vector<size_t>& bucket = buckets[hashes[i]];
+    bool merged = false;
+    for (size_t j : bucket) {
+      if (info[j].first == candidates[i].first) {
+        info[j].second.insert(info[j].second.end(),
+                              candidates[i].second.begin(),
+                              candidates[i].second.end());
+        merged = true;
+        break;
+      }
+    }
+    if (merged) continue;
+    bucket.push_back(info.size());
+    info.emplace_back(std::move(candidates[i]));
+  }
+  std::sort(info.begin(), info.end(),
+            [](const PatchInfo& a, const PatchInfo& b) {
+              return a.first < b.first;
+            });
+  return info;
+}
+
+namespace {
+
 StatusOr<std::vector<PatchInfo>> FindTextLikePatches(
     const CompressParams& cparams, const Image3F& opsin,
     const PassesEncoderState* JXL_RESTRICT state, ThreadPool* pool,
     AuxOut* aux_out, bool is_xyb) {
+  const PatchDictionaryCache* cache =
+      state->cparams.reuse_patches ? state->patch_cache : nullptr;
   std::vector<PatchInfo> info;
   if (state->cparams.patches == Override::kOff) return info;
   const auto& frame_dim = state->shared.frame_dim;
@@ -305,7 +377,7 @@ StatusOr<std::vector<PatchInfo>> FindTextLikePatches(
   JXL_CHECK(RunOnPool(pool, 0, frame_dim.ysize / kPatchSide, ThreadPool::NoInit,
                       process_row, "IsScreenshotLike"));
 
-  // TODO(veluca): also parallelize the rest of this function.
+  // TODO(veluca): also parallelize the background search.
   if (WantDebugOutput(cparams)) {
     JXL_RETURN_IF_ERROR(
         DumpPlaneNormalized(cparams, "screenshot_like", is_screenshot_like));
@@ -421,147 +493,307 @@ StatusOr<std::vector<PatchInfo>> FindTextLikePatches(
 
   // Find small CC outside the "similar enough" areas, compute bounding boxes,
   // and run heuristics to exclude some patches.
+  // This runs in horizontal stripes: every CC is extracted by the stripe that
+  // contains its first pixel in scanline order, which keeps the list of
+  // candidates identical to a single-threaded scan of the whole image.
   JXL_ASSIGN_OR_RETURN(
       ImageB visited,
       ImageB::Create(memory_manager, frame_dim.xsize, frame_dim.ysize));
   ZeroFillImage(&visited);
   uint8_t* JXL_RESTRICT visited_row = visited.Row(0);
   const size_t visited_stride = visited.PixelsPerRow();
-  std::vector<std::pair<uint32_t, uint32_t>> cc;
-  std::vector<std::pair<uint32_t, uint32_t>> stack;
-  for (size_t y = 0; y < frame_dim.ysize; y++) {
-    for (size_t x = 0; x < frame_dim.xsize; x++) {
-      if (is_background_row[y * is_background_stride + x]) continue;
-      cc.clear();
-      stack.clear();
-      stack.emplace_back(x, y);
-      size_t min_x = x;
-      size_t max_x = x;
-      size_t min_y = y;
-      size_t max_y = y;
-      std::pair<uint32_t, uint32_t> reference;
-      bool found_border = false;
-      bool all_similar = true;
-      while (!stack.empty()) {
-        std::pair<uint32_t, uint32_t> cur = stack.back();
-        stack.pop_back();
-        if (visited_row[cur.second * visited_stride + cur.first]) continue;
-        visited_row[cur.second * visited_stride + cur.first] = 1;
-        if (cur.first < min_x) min_x = cur.first;
-        if (cur.first > max_x) max_x = cur.first;
-        if (cur.second < min_y) min_y = cur.second;
-        if (cur.second > max_y) max_y = cur.second;
-        if (paint_ccs) {
-          cc.push_back(cur);
+
+  const uint64_t num_pixels =
+      static_cast<uint64_t>(frame_dim.xsize) * frame_dim.ysize;
+  const size_t num_stripes =
+      num_pixels <= std::numeric_limits<uint32_t>::max()
+          ? DivCeil(frame_dim.ysize, kPatchStripeRows)
+          : 1;
+  const size_t stripe_rows = num_stripes == 1 ? frame_dim.ysize
+                                              : kPatchStripeRows;
+  const bool use_labels = num_stripes > 1;
+  const size_t xsize = frame_dim.xsize;
+
+  const auto is_foreground = [&](size_t x, size_t y) {
+    return !is_background_row[y * is_background_stride + x];
+  };
+  // Labels the CCs of the rows [y0, y1) with a union-find forest in `parent`,
+  // indexed by position from the start of row y0. The root of every CC is its
+  // first pixel in scanline order.
+  const auto label_stripe = [&](size_t y0, size_t y1,
+                                std::vector<uint32_t>* parent) {
+    std::vector<uint32_t>& cc_parent = *parent;
+    cc_parent.resize((y1 - y0) * xsize);
+    const auto find_root = [&cc_parent](uint32_t i) {
+      while (cc_parent[i] != i) {
+        cc_parent[i] = cc_parent[cc_parent[i]];
+        i = cc_parent[i];
+      }
+      return i;
+    };
+    const auto unite = [&](uint32_t a, uint32_t b) {
+      a = find_root(a);
+      b = find_root(b);
+      if (a < b) {
+        cc_parent[b] = a;
+      } else if (b < a) {
+        cc_parent[a] = b;
+      }
+    };
+    for (size_t y = y0; y < y1; y++) {
+      for (size_t x = 0; x < xsize; x++) {
+        uint32_t idx = static_cast<uint32_t>((y - y0) * xsize + x);
+        cc_parent[idx] = idx;
+        if (!is_foreground(x, y)) continue;
+        if (x > 0 && is_foreground(x - 1, y)) unite(idx, idx - 1);
+        if (y == y0) continue;
+        for (int dx = -kSearchRadius; dx <= kSearchRadius; dx++) {
+          int64_t nx = static_cast<int64_t>(x) + dx;
+          if (nx < 0 || static_cast<uint64_t>(nx) >= xsize ||
+              !is_foreground(nx, y - 1)) {
+            continue;
+          }
+          unite(idx, static_cast<uint32_t>((y - 1 - y0) * xsize + nx));
         }
+      }
+    }
+    // Flatten the forest.
+    for (uint32_t i = 0; i < cc_parent.size(); i++) {
+      cc_parent[i] = cc_parent[cc_parent[i]];
+    }
+  };
+  // Per-thread label buffers of a single stripe.
+  std::vector<std::vector<uint32_t>> thread_labels;
+  const auto init_labels = [&](size_t num_threads) {
+    thread_labels.resize(num_threads);
+    return true;
+  };
+
+  // CCs that continue in a previous stripe, by the position in the image of
+  // their first pixel within their own stripe. They are extracted by the
+  // stripe that holds the first pixel of the whole CC.
+  std::unordered_set<uint32_t> continued_ccs;
+  if (use_labels) {
+    // First pixel of the CC of each pixel of the first and last row of every
+    // stripe, as a position in the image.
+    std::vector<std::vector<uint32_t>> seam_labels(2 * num_stripes);
+    const auto label_seams = [&](const uint32_t stripe, size_t thread) {
+      size_t y0 = stripe * stripe_rows;
+      size_t y1 = std::min<size_t>(y0 + stripe_rows, frame_dim.ysize);
+      std::vector<uint32_t>& cc_parent = thread_labels[thread];
+      label_stripe(y0, y1, &cc_parent);
+      const uint32_t offset = static_cast<uint32_t>(y0 * xsize);
+      const uint32_t last_row = static_cast<uint32_t>((y1 - 1 - y0) * xsize);
+      seam_labels[2 * stripe].resize(xsize);
+      seam_labels[2 * stripe + 1].resize(xsize);
+      for (size_t x = 0; x < xsize; x++) {
+        seam_labels[2 * stripe][x] = offset + cc_parent[x];
+        seam_labels[2 * stripe + 1][x] = offset + cc_parent[last_row + x];
+      }
+    };
+    JXL_CHECK(RunOnPool(pool, 0, num_stripes, init_labels, label_seams,
+                        "LabelPatchSeams"));
+    // Merge CCs across stripe boundaries; the root of every merged CC is its
+    // first pixel in scanline order.
+    std::unordered_map<uint32_t, uint32_t> seam_parent;
+    const auto find_root = [&seam_parent](uint32_t i) {
+      auto it = seam_parent.find(i);
+      while (it != seam_parent.end() && it->second != i) {
+        i = it->second;
+        it = seam_parent.find(i);
+      }
+      return i;
+    };
+    for (size_t stripe = 1; stripe < num_stripes; stripe++) {
+      size_t y = stripe * stripe_rows;
+      for (size_t x = 0; x < xsize; x++) {
+        if (!is_foreground(x, y)) continue;
         for (int dx = -kSearchRadius; dx <= kSearchRadius; dx++) {
-          for (int dy = -kSearchRadius; dy <= kSearchRadius; dy++) {
-            if (dx == 0 && dy == 0) continue;
-            int next_first = static_cast<int32_t>(cur.first) + dx;
-            int next_second = static_cast<int32_t>(cur.second) + dy;
-            if (next_first < 0 || next_second < 0 ||
-                static_cast<uint32_t>(next_first) >= frame_dim.xsize ||
-                static_cast<uint32_t>(next_second) >= frame_dim.ysize) {
-              continue;
-            }
-            std::pair<uint32_t, uint32_t> next{next_first, next_second};
-            if (!is_background_row[next.second * is_background_stride +
-                                   next.first]) {
-              stack.push_back(next);
-            } else {
-              if (!found_border) {
-                reference = next;
-                found_border = true;
+          int64_t nx = static_cast<int64_t>(x) + dx;
+          if (nx < 0 || static_cast<uint64_t>(nx) >= xsize ||
+              !is_foreground(nx, y - 1)) {
+            continue;
+          }
+          uint32_t a = find_root(seam_labels[2 * stripe][x]);
+          uint32_t b = find_root(seam_labels[2 * stripe - 1][nx]);
+          if (a != b) seam_parent[std::max(a, b)] = std::min(a, b);
+        }
+      }
+    }
+    for (const auto& label : seam_parent) {
+      continued_ccs.insert(label.first);
+    }
+  }
+
+  std::vector<std::vector<PatchInfo>> stripe_info(num_stripes);
+  // Pixels of the accepted CCs, only collected for debug output.
+  std::vector<std::vector<std::vector<std::pair<uint32_t, uint32_t>>>>
+      stripe_ccs(num_stripes);
+  const auto process_stripe = [&](const uint32_t stripe, size_t thread) {
+    size_t y0 = stripe * stripe_rows;
+    size_t y1 = std::min<size_t>(y0 + stripe_rows, frame_dim.ysize);
+    std::vector<uint32_t>& cc_parent = thread_labels[thread];
+    if (use_labels) label_stripe(y0, y1, &cc_parent);
+    std::vector<PatchInfo>& info = stripe_info[stripe];
+    std::vector<std::pair<uint32_t, uint32_t>> cc;
+    std::vector<std::pair<uint32_t, uint32_t>> stack;
+    for (size_t y = y0; y < y1; y++) {
+      for (size_t x = 0; x < frame_dim.xsize; x++) {
+        if (is_background_row[y * is_background_stride + x]) continue;
+        // CCs are disjoint, so different stripes never touch the same visited
+        // pixels.
+        if (use_labels) {
+          const uint32_t idx = static_cast<uint32_t>((y - y0) * xsize + x);
+          if (cc_parent[idx] != idx ||
+              continued_ccs.count(static_cast<uint32_t>(y0 * xsize) + idx)) {
+            continue;
+          }
+        } else if (visited_row[y * visited_stride + x]) {
+          continue;
+        }
+        cc.clear();
+        stack.clear();
+        stack.emplace_back(x, y);
+        size_t min_x = x;
+        size_t max_x = x;
+        size_t min_y = y;
+        size_t max_y = y;
+        std::pair<uint32_t, uint32_t> reference;
+        bool found_border = false;
+        bool all_similar = true;
+        while (!stack.empty()) {
+          std::pair<uint32_t, uint32_t> cur = stack.back();
+          stack.pop_back();
+          if (visited_row[cur.second * visited_stride + cur.first]) continue;
+          visited_row[cur.second * visited_stride + cur.first] = 1;
+          if (cur.first < min_x) min_x = cur.first;
+          if (cur.first > max_x) max_x = cur.first;
+          if (cur.second < min_y) min_y = cur.second;
+          if (cur.second > max_y) max_y = cur.second;
+          if (paint_ccs) {
+            cc.push_back(cur);
+          }
+          for (int dx = -kSearchRadius; dx <= kSearchRadius; dx++) {
+            for (int dy = -kSearchRadius; dy <= kSearchRadius; dy++) {
+              if (dx == 0 && dy == 0) continue;
+              int next_first = static_cast<int32_t>(cur.first) + dx;
+              int next_second = static_cast<int32_t>(cur.second) + dy;
+              if (next_first < 0 || next_second < 0 ||
+                  static_cast<uint32_t>(next_first) >= frame_dim.xsize ||
+                  static_cast<uint32_t>(next_second) >= frame_dim.ysize) {
+                continue;
+              }
+              std::pair<uint32_t, uint32_t> next{next_first, next_second};
+              if (!is_background_row[next.second * is_background_stride +
+                                     next.first]) {
+                stack.push_back(next);
               } else {
-                if (!is_similar_b(next, reference)) all_similar = false;
+                if (!found_border) {
+                  reference = next;
+                  found_border = true;
+                } else {
+                  if (!is_similar_b(next, reference)) all_similar = false;
+                }
               }
             }
           }
         }
-      }
-      if (!found_border || !all_similar || max_x - min_x >= kMaxPatchSize ||
-          max_y - min_y >= kMaxPatchSize) {
-        continue;
-      }
-      size_t bpos = background_stride * reference.second + reference.first;
-      float ref[3] = {background_rows[0][bpos], background_rows[1][bpos],
-                      background_rows[2][bpos]};
-      bool has_similar = false;
-      for (size_t iy = std::max<int>(
-               static_cast<int32_t>(min_y) - kHasSimilarRadius, 0);
-           iy < std::min(max_y + kHasSimilarRadius + 1, frame_dim.ysize);
-           iy++) {
-        for (size_t ix = std::max<int>(
-                 static_cast<int32_t>(min_x) - kHasSimilarRadius, 0);
-             ix < std::min(max_x + kHasSimilarRadius + 1, frame_dim.xsize);
-             ix++) {
-          size_t opos = opsin_stride * iy + ix;
-          float px[3] = {opsin_rows[0][opos], opsin_rows[1][opos],
-                         opsin_rows[2][opos]};
-          if (pci.is_similar_v(ref, px, kHasSimilarThreshold)) {
-            has_similar = true;
+        if (!found_border || !all_similar || max_x - min_x >= kMaxPatchSize ||
+            max_y - min_y >= kMaxPatchSize) {
+          continue;
+        }
+        size_t bpos = background_stride * reference.second + reference.first;
+        float ref[3] = {background_rows[0][bpos], background_rows[1][bpos],
+                        background_rows[2][bpos]};
+        bool has_similar = false;
+        for (size_t iy = std::max<int>(
+                 static_cast<int32_t>(min_y) - kHasSimilarRadius, 0);
+             iy < std::min(max_y + kHasSimilarRadius + 1, frame_dim.ysize);
+             iy++) {
+          for (size_t ix = std::max<int>(
+                   static_cast<int32_t>(min_x) - kHasSimilarRadius, 0);
+               ix < std::min(max_x + kHasSimilarRadius + 1, frame_dim.xsize);
+               ix++) {
+            size_t opos = opsin_stride * iy + ix;
+            float px[3] = {opsin_rows[0][opos], opsin_rows[1][opos],
+                           opsin_rows[2][opos]};
+            if (pci.is_similar_v(ref, px, kHasSimilarThreshold)) {
+              has_similar = true;
+            }
           }
         }
-      }
-      if (!has_similar) continue;
-      info.emplace_back();
-      info.back().second.emplace_back(min_x, min_y);
-      QuantizedPatch& patch = info.back().first;
-      patch.xsize = max_x - min_x + 1;
-      patch.ysize = max_y - min_y + 1;
-      int max_value = 0;
-      for (size_t c : {1, 0, 2}) {
-        for (size_t iy = min_y; iy <= max_y; iy++) {
-          for (size_t ix = min_x; ix <= max_x; ix++) {
-            size_t offset = (iy - min_y) * patch.xsize + ix - min_x;
-            patch.fpixels[c][offset] =
-                opsin_rows[c][iy * opsin_stride + ix] - ref[c];
-            int val = pci.Quantize(patch.fpixels[c][offset], c);
-            patch.pixels[c][offset] = val;
-            if (std::abs(val) > max_value) max_value = std::abs(val);
+        if (!has_similar) continue;
+        info.emplace_back();
+        info.back().second.emplace_back(min_x, min_y);
+        QuantizedPatch& patch = info.back().first;
+        patch.xsize = max_x - min_x + 1;
+        patch.ysize = max_y - min_y + 1;
+        int max_value = 0;
+        for (size_t c : {1, 0, 2}) {
+          for (size_t iy = min_y; iy <= max_y; iy++) {
+            for (size_t ix = min_x; ix <= max_x; ix++) {
+              size_t offset = (iy - min_y) * patch.xsize + ix - min_x;
+              patch.fpixels[c][offset] =
+                  opsin_rows[c][iy * opsin_stride + ix] - ref[c];
+              int val = pci.Quantize(patch.fpixels[c][offset], c);
+              patch.pixels[c][offset] = val;
+              if (std::abs(val) > max_value) max_value = std::abs(val);
+            }
           }
         }
+        if (max_value < kMinPeak) {
+          info.pop_back();
+          continue;
+        }
+        if (paint_ccs) {
+          stripe_ccs[stripe].push_back(cc);
+        }
       }
-      if (max_value < kMinPeak) {
-        info.pop_back();
-        continue;
-      }
-      if (paint_ccs) {
+    }
+  };
+  JXL_CHECK(RunOnPool(pool, 0, num_stripes, init_labels, process_stripe,
+                      "FindPatchCandidates"));
+  thread_labels = std::vector<std::vector<uint32_t>>();
+
+  if (paint_ccs) {
+    JXL_ASSERT(WantDebugOutput(cparams));
+    for (const auto& ccs_in_stripe : stripe_ccs) {
+      for (const auto& cc : ccs_in_stripe) {
         float cc_color = rng.UniformF(0.5, 1.0);
         for (std::pair<uint32_t, uint32_t> p : cc) {
           ccs.Row(p.second)[p.first] = cc_color;
         }
       }
     }
+    JXL_RETURN_IF_ERROR(DumpPlaneNormalized(cparams, "ccs", ccs));
   }
 
-  if (paint_ccs) {
-    JXL_ASSERT(WantDebugOutput(cparams));
-    JXL_RETURN_IF_ERROR(DumpPlaneNormalized(cparams, "ccs", ccs));
+  std::vector<PatchInfo> candidates;
+  for (auto& in_stripe : stripe_info) {
+    for (auto& candidate : in_stripe) {
+      candidates.emplace_back(std::move(candidate));
+    }
+    in_stripe = std::vector<PatchInfo>();
   }
-  if (info.empty()) {
+  if (candidates.empty()) {
     return info;
   }
 
   // Remove duplicates.
   constexpr size_t kMinPatchOccurrences = 2;
-  std::sort(info.begin(), info.end());
-  size_t unique = 0;
-  for (size_t i = 1; i < info.size(); i++) {
-    if (info[i].first == info[unique].first) {
-      info[unique].second.insert(info[unique].second.end(),
-                                 info[i].second.begin(), info[i].second.end());
-    } else {
-      if (info[unique].second.size() >= kMinPatchOccurrences) {
-        unique++;
-      }
-      info[unique] = info[i];
-    }
-  }
-  if (info[unique].second.size() >= kMinPatchOccurrences) {
-    unique++;
-  }
-  info.resize(unique);
+  info = MergePatchCandidates(std::move(candidates), pool);
+  // Patches that are already stored in the reference frame of a previous frame
+  // are worth using even if they occur only once.
+  info.erase(std::remove_if(info.begin(), info.end(),
+                            [cache](const PatchInfo& patch) {
+                              if (patch.second.size() >= kMinPatchOccurrences) {
+                                return false;
+                              }
+                              return cache == nullptr ||
+                                     cache->Find(patch.first) ==
+                                         PatchDictionaryCache::kNotFound;
+                            }),
+             info.end());
 
   size_t max_patch_size = 0;
 
@@ -579,12 +811,111 @@ StatusOr<std::vector<PatchInfo>> FindTextLikePatches(
   return info;
 }
 
+// The new patches of a frame must cover at most this fraction of the area that
+// is covered by cached patches for the cached reference frame to be reused as
+// is; otherwise a new reference frame is encoded.
+constexpr size_t kPatchCacheRefreshRatio = 4;
+
+// Uses the patches of `info` that are present in `cache`, and drops the others.
+// Returns false, without modifying `state`, if too much of the patch area is
+// not in the cache.
+StatusOr<bool> ApplyCachedPatches(const std::vector<PatchInfo>& info,
+                                  const PatchDictionaryCache& cache,
+                                  PassesEncoderState* JXL_RESTRICT state) {
+  std::vector<size_t> cache_idx(info.size());
+  size_t cached_pixels = 0;
+  size_t new_pixels = 0;
+  for (size_t i = 0; i < info.size(); i++) {
+    cache_idx[i] = cache.Find(info[i].first);
+    size_t pixels =
+        info[i].first.xsize * info[i].first.ysize * info[i].second.size();
+    if (cache_idx[i] == PatchDictionaryCache::kNotFound) {
+      new_pixels += pixels;
+    } else {
+      cached_pixels += pixels;
+    }
+  }
+  if (cached_pixels == 0 ||
+      new_pixels * kPatchCacheRefreshRatio > cached_pixels) {
+    return false;
+  }
+
+  std::vector<PatchPosition> positions;
+  std::vector<PatchReferencePosition> pref_positions;
+  std::vector<PatchBlending> blendings;
+  size_t num_ec = state->shared.metadata->m.num_extra_channels;
+  for (size_t i = 0; i < info.size(); i++) {
+    if (cache_idx[i] == PatchDictionaryCache::kNotFound) continue;
+    for (const auto& pos : info[i].second) {
+      positions.emplace_back(
+          PatchPosition{pos.first, pos.second, pref_positions.size()});
+      blendings.push_back({PatchBlendMode::kAdd, 0, false});
+      for (size_t j = 0; j < num_ec; ++j) {
+        blendings.push_back({PatchBlendMode::kNone, 0, false});
+      }
+    }
+    pref_positions.emplace_back(cache.ref_positions[cache_idx[i]]);
+  }
+
+  auto& reference_frame =
+      state->shared.reference_frames[kPatchFrameReferenceId];
+  JXL_ASSIGN_OR_RETURN(ImageBundle frame, cache.reference_frame.frame->Copy());
+  *reference_frame.frame = std::move(frame);
+  reference_frame.ib_is_in_xyb = cache.reference_frame.ib_is_in_xyb;
+
+  PatchDictionaryEncoder::SetPositions(
+      &state->shared.image_features.patches, std::move(positions),
+      std::move(pref_positions), std::move(blendings));
+  return true;
+}
+
 }  // namespace
 
+void PatchDictionaryCache::Clear() {
+  patches.clear();
+  ref_positions.clear();
+  reference_frame.frame.reset();
+  index.clear();
+}
+
+size_t PatchDictionaryCache::Find(const QuantizedPatch& patch) const {
+  auto range = index.equal_range(HashQuantizedPatch(patch));
+  for (auto it = range.first; it != range.second; ++it) {
+    if (patches[it->second] == patch) return it->second;
+  }
+  return kNotFound;
+}
+
+Status PatchDictionaryCache::Update(
+    const std::vector<PatchInfo>& info,
+    const std::vector<PatchReferencePosition>& ref_positions,
+    const PassesSharedState::ReferceFrame& reference_frame, bool is_xyb) {
+  JXL_ASSERT(info.size() == ref_positions.size());
+  Clear();
+  this->is_xyb = is_xyb;
+  JXL_ASSIGN_OR_RETURN(ImageBundle frame, reference_frame.frame->Copy());
+  this->reference_frame.frame = make_unique<ImageBundle>(std::move(frame));
+  this->reference_frame.ib_is_in_xyb = reference_frame.ib_is_in_xyb;
+  this->ref_positions = ref_positions;
+  patches.reserve(info.size());
+  for (size_t i = 0; i < info.size(); i++) {
+    index.emplace(HashQuantizedPatch(info[i].first), i);
+    patches.push_back(info[i].first);
+  }
+  return true;
+}
+
 Status FindBestPatchDictionary(const Image3F& opsin,
                                PassesEncoderState* JXL_RESTRICT state,
                                const JxlCmsInterface& cms, ThreadPool* pool,
                                AuxOut* aux_out, bool is_xyb) {
+  PatchDictionaryCache* cache = state->patch_cache;
+  // Frames that do not reuse patches still get the cache, since their own
+  // patch frame replaces the reference frame that holds the cached patches.
+  const bool reuse = cache && state->cparams.reuse_patches;
+  if (cache && cache->is_xyb != is_xyb) {
+    cache->Clear();
+  }
   JXL_ASSIGN_OR_RETURN(
       std::vector<PatchInfo> info,
       FindTextLikePatches(state->cparams, opsin, state, pool, aux_out, is_xyb));
@@ -608,6 +939,11 @@ Status FindBestPatchDictionary(const Image3F& opsin,
 
   if (info.empty()) return true;
 
+  if (reuse && cache->HasAny()) {
+    JXL_ASSIGN_OR_RETURN(bool reused, ApplyCachedPatches(info, *cache, state));
+    if (reused) return true;
+  }
+
   std::sort(
       info.begin(), info.end(), [&](const PatchInfo& a, const PatchInfo& b) {
         return a.first.xsize * a.first.ysize > b.first.xsize * b.first.ysize;
@@ -754,6 +1090,14 @@ Status FindBestPatchDictionary(const Image3F& opsin,
                                           kPatchFrameReferenceId, cparams, cms,
                                           pool, aux_out, /*subtract=*/true));
 
+  if (reuse) {
+    JXL_RETURN_IF_ERROR(cache->Update(
+        info, pref_positions,
+        state->shared.reference_frames[kPatchFrameReferenceId], is_xyb));
+  } else if (cache) {
+    cache->Clear();
+  }
+
   // TODO(veluca): this assumes that applying patches is commutative, which is
   // not true for all blending modes. This code only produces kAdd patches, so
   // this works out.
@@ -14,6 +14,7 @@
 #include <cstddef>
 #include <cstdint>
 #include <cstring>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
@@ -25,6 +26,7 @@
 #include "lib/jxl/enc_cache.h"
 #include "lib/jxl/enc_params.h"
 #include "lib/jxl/image.h"
+#include "lib/jxl/passes_state.h"
 
 namespace jxl {
 
@@ -73,6 +75,13 @@ struct QuantizedPatch {
 using PatchInfo =
     std::pair<QuantizedPatch, std::vector<std::pair<uint32_t, uint32_t>>>;
 
+// Groups the `candidates`, which have one occurrence each, by their quantized
+// pixels, and sorts the result by patch. The occurrences of every patch are
+// sorted by position and its float pixels are those of the first occurrence,
+// so the result is the same as sorting the candidates and merging equal ones.
+std::vector<PatchInfo> MergePatchCandidates(std::vector<PatchInfo> candidates,
+                                            ThreadPool* pool);
+
 // Friend class of PatchDictionary.
 class PatchDictionaryEncoder {
  public:
@@ -93,6 +102,36 @@ class PatchDictionaryEncoder {
   static void SubtractFrom(const PatchDictionary& pdic, Image3F* opsin);
 };
 
+// Patches found in previous frames of the codestream, together with the
+// reference frame that holds them. The decoder keeps that frame in its
+// reference slot until another patch frame replaces it, so later frames can
+// refer to these patches without encoding them again.
+struct PatchDictionaryCache {
+  static constexpr size_t kNotFound = ~static_cast<size_t>(0);
+
+  bool HasAny() const { return !patches.empty(); }
+  void Clear();
+
+  // Returns the index of `patch` in `patches`, or kNotFound.
+  size_t Find(const QuantizedPatch& patch) const;
+
+  // Replaces the contents of the cache with the given patches, placed at
+  // `ref_positions` of `reference_frame`.
+  Status Update(const std::vector<PatchInfo>& info,
+                const std::vector<PatchReferencePosition>& ref_positions,
+                const PassesSharedState::ReferceFrame& reference_frame,
+                bool is_xyb);
+
+  // Whether the patches were quantized for XYB input.
+  bool is_xyb = true;
+  std::vector<QuantizedPatch> patches;
+  std::vector<PatchReferencePosition> ref_positions;
+  // Reference frame as decoded and stored by the decoder.
+  PassesSharedState::ReferceFrame reference_frame;
+  // Hash of the quantized pixels -> index in `patches`.
+  std::unordered_multimap<uint64_t, size_t> index;
+};
+
 Status FindBestPatchDictionary(const Image3F& opsin,
                                PassesEncoderState* JXL_RESTRICT state,
                                const JxlCmsInterface& cms, ThreadPool* pool,
@@ -33,6 +33,7 @@
 #include "lib/jxl/enc_frame.h"
 #include "lib/jxl/enc_icc_codec.h"
 #include "lib/jxl/enc_params.h"
+#include "lib/jxl/enc_patch_dictionary.h"
 #include "lib/jxl/encode_internal.h"
 #include "lib/jxl/jpeg/enc_jpeg_data.h"
 #include "lib/jxl/luminance.h"
@@ -950,11 +951,33 @@ jxl::Status JxlEncoderStruct::ProcessOneEnqueuedInput() { // LANDMARK: Main enco
       frame_info.duration = duration;
       frame_info.timecode = timecode;
       frame_info.name = input_frame->option_values.frame_name;
+      if (input_frame->option_values.cparams.reuse_patches && !patch_cache) {
+        patch_cache = jxl::MemoryManagerMakeUnique<jxl::PatchDictionaryCache>(
+            &memory_manager);
+        if (!patch_cache) {
+          return JXL_API_ERROR(this, JXL_ENC_ERR_OOM,
+                               "Could not allocate patch cache");
+        }
+      }
+      // Also given to frames that do not reuse patches, which invalidate it
+      // when they write their own patch frame.
+      frame_info.patch_cache = patch_cache.get();
+      if (reuse_buffers) {
+        if (!quant_tables) {
+          quant_tables = jxl::MemoryManagerMakeUnique<jxl::DequantMatrices>(
+              &memory_manager);
+          if (!quant_tables) {
+            return JXL_API_ERROR(this, JXL_ENC_ERR_OOM,
+                                 "Could not allocate quant tables");
+          }
+        }
+        frame_info.quant_tables = quant_tables.get();
+      }
 
       fprintf(stdout, "Calling EncodeFrame from encode.cc");
       if (!jxl::EncodeFrame(&memory_manager, input_frame->option_values.cparams,
                             frame_info, &metadata, input_frame->frame_data, cms,
-                            thread_pool.get(), &output_processor,
+                            GetThreadPool(), &output_processor,
                             input_frame->option_values.aux_out)) {
         return JXL_API_ERROR(this, JXL_ENC_ERR_GENERIC,
                              "Failed to encode frame");
@@ -969,7 +992,7 @@ jxl::Status JxlEncoderStruct::ProcessOneEnqueuedInput() { // LANDMARK: Main enco
             [&](size_t i, size_t) { fun(opaque, i); }, "Encode fast lossless"));
       };
       JxlFastLosslessProcessFrame(fast_lossless_frame.get(), last_frame,
-                                  thread_pool.get(), runner, &output_processor);
+                                  GetThreadPool(), runner, &output_processor);
     }
 
     const size_t frame_codestream_end = output_processor.CurrentPosition();
@@ -1818,6 +1841,13 @@ JxlEncoderStatus JxlEncoderFrameSettingsSetOption(
             "Set uses_original_profile=true for non-perceptual encoding");
       }
       break;
+    case JXL_ENC_FRAME_SETTING_REUSE_PATCHES:
+      if (value < 0 || value > 1) {
+        return JXL_API_ERROR(frame_settings->enc, JXL_ENC_ERR_NOT_SUPPORTED,
+                             "Option value has to be 0 or 1");
+      }
+      frame_settings->values.cparams.reuse_patches = default_to_false(value);
+      break;
 
     default:
       return JXL_API_ERROR(frame_settings->enc, JXL_ENC_ERR_NOT_SUPPORTED,
@@ -1914,6 +1944,7 @@ JxlEncoderStatus JxlEncoderFrameSettingsSetFloatOption(
     case JXL_ENC_FRAME_SETTING_JPEG_KEEP_XMP:
     case JXL_ENC_FRAME_SETTING_JPEG_KEEP_JUMBF:
     case JXL_ENC_FRAME_SETTING_USE_FULL_IMAGE_HEURISTICS:
+    case JXL_ENC_FRAME_SETTING_REUSE_PATCHES:
       return JXL_API_ERROR(frame_settings->enc, JXL_ENC_ERR_NOT_SUPPORTED,
                            "Int option, try setting it with "
                            "JxlEncoderFrameSettingsSetOption");
@@ -1932,7 +1963,8 @@ JxlEncoder* JxlEncoderCreate(const JxlMemoryManager* memory_manager) {
       jxl::MemoryManagerAlloc(&local_memory_manager, sizeof(JxlEncoder));
   if (!alloc) return nullptr;
   JxlEncoder* enc = new (alloc) JxlEncoder();
-  enc->memory_manager = local_memory_manager;
+  enc->memory_counter.inner = local_memory_manager;
+  jxl::MemoryManagerInitCounting(&enc->memory_manager, &enc->memory_counter);
   // TODO(sboukortt): add an API function to set this.
   enc->cms = *JxlGetDefaultCms();
   enc->cms_set = true;
@@ -1945,6 +1977,11 @@ JxlEncoder* JxlEncoderCreate(const JxlMemoryManager* memory_manager) {
 
 void JxlEncoderReset(JxlEncoder* enc) {
   enc->thread_pool.reset();
+  enc->default_thread_pool = false;
+  enc->profiling_sink = nullptr;
+  enc->profiling_sink_opaque = nullptr;
+  enc->patch_cache.reset();
+  if (!enc->reuse_buffers) enc->quant_tables.reset();
   enc->input_queue.clear();
   enc->num_queued_frames = 0;
   enc->num_queued_boxes = 0;
@@ -1975,7 +2012,7 @@ void JxlEncoderReset(JxlEncoder* enc) {
 
 void JxlEncoderDestroy(JxlEncoder* enc) {
   if (enc) {
-    JxlMemoryManager local_memory_manager = enc->memory_manager;
+    JxlMemoryManager local_memory_manager = enc->memory_counter.inner;
     // Call destructor directly since custom free function is used.
     enc->~JxlEncoder();
     jxl::MemoryManagerFree(&local_memory_manager, enc);
@@ -2026,10 +2063,23 @@ void JxlEncoderSetCms(JxlEncoder* enc, JxlCmsInterface cms) {
   enc->cms_set = true;
 }
 
+jxl::ThreadPool* JxlEncoderStruct::GetThreadPool() {
+  if (!thread_pool && profiling_sink) {
+    thread_pool = jxl::MemoryManagerMakeUnique<jxl::ThreadPool>(
+        &memory_manager, nullptr, nullptr);
+    // Without a pool, the stages simply run untimed.
+    if (!thread_pool) return nullptr;
+    thread_pool->SetProfilingSink(profiling_sink, profiling_sink_opaque,
+                                  jxl::MemoryCounterTakePeak, &memory_counter);
+    default_thread_pool = true;
+  }
+  return thread_pool.get();
+}
+
 JxlEncoderStatus JxlEncoderSetParallelRunner(JxlEncoder* enc,
                                              JxlParallelRunner parallel_runner,
                                              void* parallel_runner_opaque) {
-  if (enc->thread_pool) {
+  if (enc->thread_pool && !enc->default_thread_pool) {
     return JXL_API_ERROR(enc, JXL_ENC_ERR_API_USAGE,
                          "parallel runner already set");
   }
@@ -2039,6 +2089,22 @@ JxlEncoderStatus JxlEncoderSetParallelRunner(JxlEncoder* enc,
     return JXL_API_ERROR(enc, JXL_ENC_ERR_GENERIC,
                          "error setting parallel runner");
   }
+  enc->default_thread_pool = false;
+  enc->thread_pool->SetProfilingSink(
+      enc->profiling_sink, enc->profiling_sink_opaque,
+      jxl::MemoryCounterTakePeak, &enc->memory_counter);
+  return JxlErrorOrStatus::Success();
+}
+
+JxlEncoderStatus JxlEncoderSetProfilingSink(JxlEncoder* enc,
+                                            JxlProfilingSink sink,
+                                            void* opaque) {
+  enc->profiling_sink = sink;
+  enc->profiling_sink_opaque = opaque;
+  if (enc->thread_pool) {
+    enc->thread_pool->SetProfilingSink(
+        sink, opaque, jxl::MemoryCounterTakePeak, &enc->memory_counter);
+  }
   return JxlErrorOrStatus::Success();
 }
 
@@ -2074,7 +2140,8 @@ JxlEncoderStatus JxlEncoderAddJPEGFrame(
   }
 
   jxl::CodecInOut io{&frame_settings->enc->memory_manager};
-  if (!jxl::jpeg::DecodeImageJPG(jxl::Bytes(buffer, size), &io)) {
+  if (!jxl::jpeg::DecodeImageJPG(jxl::Bytes(buffer, size), &io,
+                                 frame_settings->enc->GetThreadPool())) {
     return JXL_API_ERROR(frame_settings->enc, JXL_ENC_ERR_BAD_INPUT,
                          "Error during decode of input JPEG");
   }
@@ -2333,7 +2400,7 @@ JxlEncoderStatus JxlEncoderAddImageFrameInternal(
         /*effort=*/2, oneshot);
     if (!streaming) {
       JxlFastLosslessProcessFrame(frame_state, /*is_last=*/false,
-                                  frame_settings->enc->thread_pool.get(),
+                                  frame_settings->enc->GetThreadPool(),
                                   runner, nullptr);
     }
     QueueFastLosslessFrame(frame_settings, frame_state);
@@ -2442,6 +2509,17 @@ JxlEncoderStatus JxlEncoderAddChunkedFrame(
   return JxlErrorOrStatus::Success();
 }
 
+JxlEncoderStatus JxlEncoderSetReuseBuffers(JxlEncoder* enc,
+                                           JXL_BOOL reuse_buffers) {
+  if (enc->wrote_bytes) {
+    return JXL_API_ERROR(enc, JXL_ENC_ERR_API_USAGE,
+                         "this setting can only be set at the beginning");
+  }
+  enc->reuse_buffers = FROM_JXL_BOOL(reuse_buffers);
+  if (!enc->reuse_buffers) enc->quant_tables.reset();
+  return JxlErrorOrStatus::Success();
+}
+
 JxlEncoderStatus JxlEncoderUseBoxes(JxlEncoder* enc) {
   if (enc->wrote_bytes) {
     return JXL_API_ERROR(enc, JXL_ENC_ERR_API_USAGE,
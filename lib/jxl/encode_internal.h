@@ -33,10 +33,12 @@
 #include "lib/jxl/enc_aux_out.h"
 #include "lib/jxl/enc_fast_lossless.h"
 #include "lib/jxl/enc_params.h"
+#include "lib/jxl/enc_patch_dictionary.h"
 #include "lib/jxl/image_metadata.h"
 #include "lib/jxl/jpeg/jpeg_data.h"
 #include "lib/jxl/memory_manager_internal.h"
 #include "lib/jxl/padded_bytes.h"
+#include "lib/jxl/quant_weights.h"
 
 namespace jxl {
 
@@ -589,9 +591,26 @@ jxl::Status AppendData(JxlEncoderOutputProcessorWrapper& output_processor,
 // JxlEncoderCreate.
 struct JxlEncoderStruct {
   JxlEncoderStruct() : output_processor(&memory_manager) {}
+  // Counts the bytes allocated through memory_manager, for the profiling
+  // events; holds the memory manager given to JxlEncoderCreate.
+  jxl::MemoryCounter memory_counter;
   JxlMemoryManager memory_manager;
   jxl::MemoryManagerUniquePtr<jxl::ThreadPool> thread_pool{
       nullptr, jxl::MemoryManagerDeleteHelper(&memory_manager)};
+  // True if thread_pool was only created to time stages for the profiling
+  // sink; JxlEncoderSetParallelRunner may still replace it.
+  bool default_thread_pool = false;
+  JxlProfilingSink profiling_sink = nullptr;
+  void* profiling_sink_opaque = nullptr;
+  // Patches shared by frames with JXL_ENC_FRAME_SETTING_REUSE_PATCHES.
+  jxl::MemoryManagerUniquePtr<jxl::PatchDictionaryCache> patch_cache{
+      nullptr, jxl::MemoryManagerDeleteHelper(&memory_manager)};
+  // Dequantization tables kept across frames and images with
+  // JxlEncoderSetReuseBuffers.
+  jxl::MemoryManagerUniquePtr<jxl::DequantMatrices> quant_tables{
+      nullptr, jxl::MemoryManagerDeleteHelper(&memory_manager)};
+  // Unlike the other settings, not cleared by JxlEncoderReset.
+  bool reuse_buffers = false;
   std::vector<jxl::MemoryManagerUniquePtr<JxlEncoderFrameSettings>>
       encoder_options;
 
@@ -652,6 +671,10 @@ struct JxlEncoderStruct {
   // the bytes to the output_byte_queue.
   jxl::Status ProcessOneEnqueuedInput();
 
+  // Pool to encode with. Without a parallel runner this is null, unless a
+  // profiling sink is set, which needs a (single-threaded) pool.
+  jxl::ThreadPool* GetThreadPool();
+
   bool MustUseContainer() const {
     return use_container || (codestream_level != 5 && codestream_level != -1) ||
            store_jpeg_metadata || use_boxes;
@@ -14,6 +14,7 @@
 #include <jxl/memory_manager.h>
 #include <jxl/types.h>
 
+#include <algorithm>
 #include <cstddef>
 #include <cstdint>
 #include <cstdio>
@@ -269,6 +270,25 @@ TEST(EncodeTest, EncoderResetTest) {
                       false);
 }
 
+TEST(EncodeTest, ReuseBuffersTest) {
+  JxlEncoderPtr enc = JxlEncoderMake(nullptr);
+  EXPECT_NE(nullptr, enc.get());
+  EXPECT_EQ(JXL_ENC_SUCCESS, JxlEncoderSetReuseBuffers(enc.get(), JXL_TRUE));
+  VerifyFrameEncoding(50, 200, enc.get(),
+                      JxlEncoderFrameSettingsCreate(enc.get(), nullptr), 4577,
+                      false);
+  // The setting survives the reset; the next images start from the tables of
+  // the previous one.
+  JxlEncoderReset(enc.get());
+  VerifyFrameEncoding(50, 200, enc.get(),
+                      JxlEncoderFrameSettingsCreate(enc.get(), nullptr), 4577,
+                      false);
+  JxlEncoderReset(enc.get());
+  VerifyFrameEncoding(157, 77, enc.get(),
+                      JxlEncoderFrameSettingsCreate(enc.get(), nullptr), 2300,
+                      false);
+}
+
 TEST(EncodeTest, CmsTest) {
   JxlEncoderPtr enc = JxlEncoderMake(nullptr);
   EXPECT_NE(nullptr, enc.get());
@@ -304,6 +324,54 @@ TEST(EncodeTest, CmsTest) {
   EXPECT_TRUE(cms_called);
 }
 
+TEST(EncodeTest, ProfilingSinkTest) {
+  JxlEncoderPtr enc = JxlEncoderMake(nullptr);
+  EXPECT_NE(nullptr, enc.get());
+  std::set<std::string> stages;
+  ASSERT_EQ(JXL_ENC_SUCCESS,
+            JxlEncoderSetProfilingSink(
+                enc.get(),
+                +[](void* opaque, const JxlProfilingEvent* event) {
+                  EXPECT_GT(event->num_tasks, 0u);
+                  EXPECT_EQ(1u, event->num_threads);
+                  EXPECT_LE(event->thread_busy_time[0],
+                            event->wall_time + 1e-6);
+                  EXPECT_LE(event->thread_wait_time[0],
+                            event->wall_time + 1e-6);
+                  // The thread pool of the profiling sink is allocated
+                  // through the memory manager of the encoder.
+                  EXPECT_GT(event->peak_memory, 0u);
+                  static_cast<std::set<std::string>*>(opaque)->insert(
+                      event->stage);
+                },
+                &stages));
+  VerifyFrameEncoding(enc.get(),
+                      JxlEncoderFrameSettingsCreate(enc.get(), nullptr));
+  EXPECT_FALSE(stages.empty());
+}
+
+TEST(EncodeTest, ProfilingSinkBeforeParallelRunnerTest) {
+  JxlEncoderPtr enc = JxlEncoderMake(nullptr);
+  EXPECT_NE(nullptr, enc.get());
+  size_t max_threads = 0;
+  ASSERT_EQ(JXL_ENC_SUCCESS,
+            JxlEncoderSetProfilingSink(
+                enc.get(),
+                +[](void* opaque, const JxlProfilingEvent* event) {
+                  size_t* max_threads = static_cast<size_t*>(opaque);
+                  *max_threads = std::max(*max_threads, event->num_threads);
+                },
+                &max_threads));
+  jxl::test::ThreadPoolForTests pool(4);
+  ASSERT_EQ(JXL_ENC_SUCCESS,
+            JxlEncoderSetParallelRunner(enc.get(), pool.get()->runner(),
+                                        pool.get()->runner_opaque()));
+  VerifyFrameEncoding(enc.get(),
+                      JxlEncoderFrameSettingsCreate(enc.get(), nullptr));
+  // The sink is applied to the pool of the runner set after it.
+  EXPECT_GT(max_threads, 1u);
+}
+
 TEST(EncodeTest, FrameSettingsTest) {
   {
     JxlEncoderPtr enc = JxlEncoderMake(nullptr);
@@ -83,6 +83,23 @@ struct FrameDimensions {
     return rect;
   }
 
+  // Dimensions in pixels of the frame rendered at 1/`factor` of its size,
+  // where `factor` divides kBlockDim. The groups cover the same blocks, and
+  // the sizes in blocks and groups are unchanged.
+  FrameDimensions Downsampled(size_t factor) const {
+    FrameDimensions result = *this;
+    result.xsize = DivCeil(xsize, factor);
+    result.ysize = DivCeil(ysize, factor);
+    result.xsize_upsampled = DivCeil(xsize_upsampled, factor);
+    result.ysize_upsampled = DivCeil(ysize_upsampled, factor);
+    result.xsize_upsampled_padded = xsize_upsampled_padded / factor;
+    result.ysize_upsampled_padded = ysize_upsampled_padded / factor;
+    result.xsize_padded = xsize_padded / factor;
+    result.ysize_padded = ysize_padded / factor;
+    result.group_dim = group_dim / factor;
+    return result;
+  }
+
   // Image size without any upsampling, i.e. original_size / upsampling.
   size_t xsize;
   size_t ysize;
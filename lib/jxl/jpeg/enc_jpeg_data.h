@@ -11,6 +11,7 @@
 #include <cstdint>
 #include <vector>
 
+#include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/base/status.h"
 #include "lib/jxl/color_encoding_internal.h"
 #include "lib/jxl/enc_params.h"
@@ -37,7 +38,8 @@ Status SetColorTransformFromJpegData(const JPEGData& jpg,
  * Decodes bytes containing JPEG codestream into a CodecInOut as coefficients
  * only, for lossless JPEG transcoding.
  */
-Status DecodeImageJPG(Span<const uint8_t> bytes, CodecInOut* io);
+Status DecodeImageJPG(Span<const uint8_t> bytes, CodecInOut* io,
+                      ThreadPool* pool = nullptr);
 
 }  // namespace jpeg
 }  // namespace jxl
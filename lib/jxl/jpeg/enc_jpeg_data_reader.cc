@@ -9,10 +9,13 @@
 #include <string.h>
 
 #include <algorithm>
+#include <atomic>
 #include <string>
 #include <vector>
 
+#include "lib/jxl/base/byte_order.h"
 #include "lib/jxl/base/common.h"
+#include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/base/printf_macros.h"
 #include "lib/jxl/base/status.h"
 #include "lib/jxl/frame_dimensions.h"
@@ -416,6 +419,24 @@ struct BitReaderState {
 
   void FillBitWindow() {
     if (bits_left_ <= 16) {
+      if (pos_ + 8 <= next_marker_pos_) {
+        // Loads the bytes at once when none of them is 0xff, which would be
+        // either an escape sequence or the start of a marker.
+        const uint64_t word = LoadBE64(data_ + pos_);
+        const uint64_t inv = ~word;
+        if (((inv - 0x0101010101010101ull) & word & 0x8080808080808080ull) ==
+            0) {
+          const int num_bytes = (64 - bits_left_) >> 3;
+          if (num_bytes == 8) {
+            val_ = word;
+          } else {
+            val_ = (val_ << (num_bytes * 8)) | (word >> (64 - num_bytes * 8));
+          }
+          pos_ += num_bytes;
+          bits_left_ += num_bytes * 8;
+          return;
+        }
+      }
       while (bits_left_ <= 56) {
         val_ <<= 8;
         val_ |= static_cast<uint64_t>(GetNextByte());
@@ -435,16 +456,17 @@ struct BitReaderState {
   // Enqueue the padding bits seen (0 or 1).
   // Returns false if there is inconsistent or invalid padding or the stream
   // ended too early.
-  bool FinishStream(JPEGData* jpg, size_t* pos) {
+  bool FinishStream(std::vector<uint8_t>* padding_bits,
+                    bool* has_zero_padding_bit, size_t* pos) {
     int npadbits = bits_left_ & 7;
     if (npadbits > 0) {
       uint64_t padmask = (1ULL << npadbits) - 1;
       uint64_t padbits = (val_ >> (bits_left_ - npadbits)) & padmask;
       if (padbits != padmask) {
-        jpg->has_zero_padding_bit = true;
+        *has_zero_padding_bit = true;
       }
       for (int i = npadbits - 1; i >= 0; --i) {
-        jpg->padding_bits.push_back((padbits >> i) & 1);
+        padding_bits->push_back((padbits >> i) & 1);
       }
     }
     // Give back some bytes that we did not use.
@@ -491,6 +513,17 @@ int ReadSymbol(const HuffmanTableEntry* table, BitReaderState* br) {
   return table->value;
 }
 
+// Entry of a table that decodes at once the Huffman symbol of an AC
+// coefficient and its extra bits, when both fit in the next
+// kJpegHuffmanRootTableBits bits. `bits` is 0 for the other entries.
+struct FastACEntry {
+  coeff_t coeff;  // Scaled by 1 << Al.
+  uint8_t run;
+  uint8_t bits;
+};
+
+constexpr size_t kFastACTableSize = 1 << kJpegHuffmanRootTableBits;
+
 /**
  * Returns the DC diff or AC value for extra bits value x and prefix code s.
  *
@@ -532,9 +565,34 @@ int HuffExtend(int x, int s) {
   }
 }
 
+// Fills `fast` from the root table of `ac_huff` for a scan with the given Al.
+void BuildFastACTable(const HuffmanTableEntry* ac_huff, int Al,
+                      FastACEntry* fast) {
+  for (size_t i = 0; i < kFastACTableSize; ++i) {
+    const HuffmanTableEntry& entry = ac_huff[i];
+    fast[i].bits = 0;
+    if (entry.bits > kJpegHuffmanRootTableBits ||
+        entry.value >= kJpegHuffmanAlphabetSize) {
+      continue;
+    }
+    int r = entry.value >> 4;
+    int s = entry.value & 15;
+    int nbits = entry.bits + s;
+    if (s == 0 || nbits > kJpegHuffmanRootTableBits ||
+        s + Al >= kJpegDCAlphabetSize) {
+      continue;
+    }
+    int extra = (i >> (kJpegHuffmanRootTableBits - nbits)) & ((1 << s) - 1);
+    fast[i].coeff = HuffExtend(extra, s) * (1 << Al);
+    fast[i].run = r;
+    fast[i].bits = nbits;
+  }
+}
+
 // Decodes one 8x8 block of DCT coefficients from the bit stream.
 bool DecodeDCTBlock(const HuffmanTableEntry* dc_huff,
-                    const HuffmanTableEntry* ac_huff, int Ss, int Se, int Al,
+                    const HuffmanTableEntry* ac_huff,
+                    const FastACEntry* fast_ac, int Ss, int Se, int Al,
                     int* eobrun, bool* reset_state, int* num_zero_runs,
                     BitReaderState* br, JPEGData* jpg, coeff_t* last_dc_coeff,
                     coeff_t* coeffs) {
@@ -570,6 +628,21 @@ bool DecodeDCTBlock(const HuffmanTableEntry* dc_huff,
   }
   *num_zero_runs = 0;
   for (int k = Ss; k <= Se; k++) {
+    br->FillBitWindow();
+    const FastACEntry& fast =
+        fast_ac[(br->val_ >> (br->bits_left_ - kJpegHuffmanRootTableBits)) &
+                (kFastACTableSize - 1)];
+    if (fast.bits > 0) {
+      k += fast.run;
+      if (k > Se) {
+        return JXL_FAILURE("Out-of-band coefficient %d band was %d-%d", k, Ss,
+                           Se);
+      }
+      br->bits_left_ -= fast.bits;
+      coeffs[kJPEGNaturalOrder[k]] = fast.coeff;
+      *num_zero_runs = 0;
+      continue;
+    }
     int sr = ReadSymbol(ac_huff, br);
     if (sr >= kJpegHuffmanAlphabetSize) {
       return JXL_FAILURE("Invalid Huffman symbol %d for AC coefficient %d", sr,
@@ -728,7 +801,8 @@ bool ProcessRestart(const uint8_t* data, const size_t len,
                     int* next_restart_marker, BitReaderState* br,
                     JPEGData* jpg) {
   size_t pos = 0;
-  if (!br->FinishStream(jpg, &pos)) {
+  if (!br->FinishStream(&jpg->padding_bits, &jpg->has_zero_padding_bit,
+                        &pos)) {
     return JXL_FAILURE("Invalid scan");
   }
   int expected_marker = 0xd0 + *next_restart_marker;
@@ -744,11 +818,170 @@ bool ProcessRestart(const uint8_t* data, const size_t len,
   return true;
 }
 
+// Parameters of a scan shared by its restart intervals.
+struct ScanParams {
+  bool is_interleaved;
+  int MCUs_per_row;
+  int Ss;
+  int Se;
+  int Al;
+  int Ah;
+};
+
+// Per restart interval output of a scan decoded in parallel.
+struct ScanSegmentOutput {
+  std::vector<uint32_t> reset_points;
+  std::vector<JPEGScanInfo::ExtraZeroRunInfo> extra_zero_runs;
+  std::vector<uint8_t> padding_bits;
+  bool has_zero_padding_bit = false;
+};
+
+// Decodes the MCUs [mcu_begin, mcu_end) of the last scan of *jpg, which are
+// not separated by restart markers, numbering their blocks from
+// *block_scan_index.
+bool DecodeMCUs(const ScanParams& params,
+                const std::vector<HuffmanTableEntry>& dc_huff_lut,
+                const std::vector<HuffmanTableEntry>& ac_huff_lut,
+                const std::vector<FastACEntry>& fast_ac_lut, int mcu_begin,
+                int mcu_end, int* eobrun, coeff_t* last_dc_coeff,
+                int* block_scan_index, BitReaderState* br, JPEGData* jpg,
+                std::vector<uint32_t>* reset_points,
+                std::vector<JPEGScanInfo::ExtraZeroRunInfo>* extra_zero_runs) {
+  JPEGScanInfo* scan_info = &jpg->scan_info.back();
+  for (int mcu = mcu_begin; mcu < mcu_end; ++mcu) {
+    const int mcu_y = mcu / params.MCUs_per_row;
+    const int mcu_x = mcu % params.MCUs_per_row;
+    // Decode one MCU.
+    for (size_t i = 0; i < scan_info->num_components; ++i) {
+      JPEGComponentScanInfo* si = &scan_info->components[i];
+      JPEGComponent* c = &jpg->components[si->comp_idx];
+      const HuffmanTableEntry* dc_lut =
+          &dc_huff_lut[si->dc_tbl_idx * kJpegHuffmanLutSize];
+      const HuffmanTableEntry* ac_lut =
+          &ac_huff_lut[si->ac_tbl_idx * kJpegHuffmanLutSize];
+      const FastACEntry* fast_ac =
+          &fast_ac_lut[si->ac_tbl_idx * kFastACTableSize];
+      int nblocks_y = params.is_interleaved ? c->v_samp_factor : 1;
+      int nblocks_x = params.is_interleaved ? c->h_samp_factor : 1;
+      for (int iy = 0; iy < nblocks_y; ++iy) {
+        for (int ix = 0; ix < nblocks_x; ++ix) {
+          int block_y = mcu_y * nblocks_y + iy;
+          int block_x = mcu_x * nblocks_x + ix;
+          int block_idx = block_y * c->width_in_blocks + block_x;
+          bool reset_state = false;
+          int num_zero_runs = 0;
+          coeff_t* coeffs = &c->coeffs[block_idx * kDCTBlockSize];
+          if (params.Ah == 0) {
+            if (!DecodeDCTBlock(dc_lut, ac_lut, fast_ac, params.Ss, params.Se,
+                                params.Al, eobrun, &reset_state,
+                                &num_zero_runs, br, jpg,
+                                &last_dc_coeff[si->comp_idx], coeffs)) {
+              return false;
+            }
+          } else {
+            if (!RefineDCTBlock(ac_lut, params.Ss, params.Se, params.Al,
+                                eobrun, &reset_state, br, jpg, coeffs)) {
+              return false;
+            }
+          }
+          if (reset_state) {
+            reset_points->emplace_back(*block_scan_index);
+          }
+          if (num_zero_runs > 0) {
+            JPEGScanInfo::ExtraZeroRunInfo info;
+            info.block_idx = *block_scan_index;
+            info.num_extra_zero_runs = num_zero_runs;
+            extra_zero_runs->push_back(info);
+          }
+          ++(*block_scan_index);
+        }
+      }
+    }
+  }
+  return true;
+}
+
+// Returns the start positions of the restart intervals of the scan starting at
+// `pos`, or an empty vector if the scan does not have `num_segments` intervals
+// separated by the expected restart markers.
+std::vector<size_t> FindScanSegments(const uint8_t* data, const size_t len,
+                                     size_t pos, size_t num_segments) {
+  std::vector<size_t> starts = {pos};
+  for (; pos + 1 < len; ++pos) {
+    if (data[pos] != 0xff || data[pos + 1] == 0) continue;
+    const int expected_marker = 0xd0 + ((starts.size() - 1) & 0x7);
+    if (data[pos + 1] != expected_marker || starts.size() == num_segments) {
+      break;
+    }
+    starts.push_back(pos + 2);
+    ++pos;
+  }
+  if (starts.size() != num_segments) return {};
+  return starts;
+}
+
+// Decodes the restart intervals of the last scan of *jpg, which start at the
+// given positions, in parallel. Sets *pos to the end of the scan.
+bool DecodeScanSegments(const uint8_t* data, const size_t len,
+                        const ScanParams& params, ThreadPool* pool,
+                        const std::vector<HuffmanTableEntry>& dc_huff_lut,
+                        const std::vector<HuffmanTableEntry>& ac_huff_lut,
+                        const std::vector<FastACEntry>& fast_ac_lut,
+                        const std::vector<size_t>& starts, int num_mcus,
+                        int blocks_per_mcu, size_t* pos, JPEGData* jpg) {
+  const int interval = jpg->restart_interval;
+  std::vector<ScanSegmentOutput> outputs(starts.size());
+  std::vector<size_t> ends(starts.size());
+  std::atomic<bool> has_error{false};
+  const auto decode_segment = [&](const uint32_t segment,
+                                  size_t /* thread */) {
+    ScanSegmentOutput* out = &outputs[segment];
+    const int mcu_begin = segment * interval;
+    const int mcu_end = std::min(mcu_begin + interval, num_mcus);
+    coeff_t last_dc_coeff[kMaxComponents] = {0};
+    int eobrun = -1;
+    int block_scan_index = mcu_begin * blocks_per_mcu;
+    BitReaderState br(data, len, starts[segment]);
+    if (!DecodeMCUs(params, dc_huff_lut, ac_huff_lut, fast_ac_lut, mcu_begin,
+                    mcu_end, &eobrun, last_dc_coeff, &block_scan_index, &br,
+                    jpg, &out->reset_points, &out->extra_zero_runs) ||
+        eobrun > 0 ||
+        !br.FinishStream(&out->padding_bits, &out->has_zero_padding_bit,
+                         &ends[segment])) {
+      has_error = true;
+    }
+  };
+  JXL_RETURN_IF_ERROR(RunOnPool(pool, 0, starts.size(), ThreadPool::NoInit,
+                                decode_segment, "DecodeJpegScan"));
+  if (has_error) return JXL_FAILURE("Invalid scan.");
+  JPEGScanInfo* scan_info = &jpg->scan_info.back();
+  for (size_t i = 0; i < starts.size(); ++i) {
+    // Each interval but the last must end right at the next restart marker.
+    if (i + 1 < starts.size() && ends[i] + 2 != starts[i + 1]) {
+      return JXL_FAILURE("Did not find expected restart marker %d",
+                         static_cast<int>(0xd0 + (i & 0x7)));
+    }
+    ScanSegmentOutput& out = outputs[i];
+    scan_info->reset_points.insert(scan_info->reset_points.end(),
+                                   out.reset_points.begin(),
+                                   out.reset_points.end());
+    scan_info->extra_zero_runs.insert(scan_info->extra_zero_runs.end(),
+                                      out.extra_zero_runs.begin(),
+                                      out.extra_zero_runs.end());
+    jpg->padding_bits.insert(jpg->padding_bits.end(), out.padding_bits.begin(),
+                             out.padding_bits.end());
+    if (out.has_zero_padding_bit) jpg->has_zero_padding_bit = true;
+  }
+  *pos = ends.back();
+  return true;
+}
+
 bool ProcessScan(const uint8_t* data, const size_t len,
                  const std::vector<HuffmanTableEntry>& dc_huff_lut,
                  const std::vector<HuffmanTableEntry>& ac_huff_lut,
                  uint16_t scan_progression[kMaxComponents][kDCTBlockSize],
-                 bool is_progressive, size_t* pos, JPEGData* jpg) {
+                 bool is_progressive, ThreadPool* pool, size_t* pos,
+                 JPEGData* jpg) {
   if (!ProcessSOS(data, len, pos, jpg)) {
     return false;
   }
@@ -769,15 +1002,20 @@ bool ProcessScan(const uint8_t* data, const size_t len,
     MCU_rows = DivCeil(jpg->height * c.v_samp_factor, 8 * max_v_samp_factor);
   }
   coeff_t last_dc_coeff[kMaxComponents] = {0};
-  BitReaderState br(data, len, *pos);
-  int restarts_to_go = jpg->restart_interval;
   int next_restart_marker = 0;
   int eobrun = -1;
   int block_scan_index = 0;
-  const int Al = is_progressive ? scan_info->Al : 0;
-  const int Ah = is_progressive ? scan_info->Ah : 0;
-  const int Ss = is_progressive ? scan_info->Ss : 0;
-  const int Se = is_progressive ? scan_info->Se : 63;
+  ScanParams params;
+  params.is_interleaved = is_interleaved;
+  params.MCUs_per_row = MCUs_per_row;
+  params.Al = is_progressive ? scan_info->Al : 0;
+  params.Ah = is_progressive ? scan_info->Ah : 0;
+  params.Ss = is_progressive ? scan_info->Ss : 0;
+  params.Se = is_progressive ? scan_info->Se : 63;
+  const int Al = params.Al;
+  const int Ah = params.Ah;
+  const int Ss = params.Ss;
+  const int Se = params.Se;
   const uint16_t scan_bitmask = Ah == 0 ? (0xffff << Al) : (1u << Al);
   const uint16_t refinement_bitmask = (1 << Al) - 1;
   for (size_t i = 0; i < scan_info->num_components; ++i) {
@@ -800,74 +1038,64 @@ bool ProcessScan(const uint8_t* data, const size_t len,
   if (Al > 10) {
     return JXL_FAILURE("Scan parameter Al=%d is not supported.", Al);
   }
-  for (int mcu_y = 0; mcu_y < MCU_rows; ++mcu_y) {
-    for (int mcu_x = 0; mcu_x < MCUs_per_row; ++mcu_x) {
+  std::vector<FastACEntry> fast_ac_lut(kMaxHuffmanTables * kFastACTableSize);
+  if (Ah == 0 && Se > 0) {
+    for (size_t i = 0; i < scan_info->num_components; ++i) {
+      const int tbl_idx = scan_info->components[i].ac_tbl_idx;
+      BuildFastACTable(&ac_huff_lut[tbl_idx * kJpegHuffmanLutSize], Al,
+                       &fast_ac_lut[tbl_idx * kFastACTableSize]);
+    }
+  }
+  const int num_mcus = MCU_rows * MCUs_per_row;
+  const int interval =
+      jpg->restart_interval > 0 ? jpg->restart_interval : num_mcus;
+  const size_t num_segments = DivCeil(num_mcus, interval);
+  std::vector<size_t> starts;
+  if (pool != nullptr && num_segments > 1) {
+    starts = FindScanSegments(data, len, *pos, num_segments);
+  }
+  if (!starts.empty()) {
+    // The restart intervals are independent, so they are decoded in parallel.
+    int blocks_per_mcu = 0;
+    for (size_t i = 0; i < scan_info->num_components; ++i) {
+      const JPEGComponent& c =
+          jpg->components[scan_info->components[i].comp_idx];
+      blocks_per_mcu +=
+          is_interleaved ? c.h_samp_factor * c.v_samp_factor : 1;
+    }
+    if (!DecodeScanSegments(data, len, params, pool, dc_huff_lut, ac_huff_lut,
+                            fast_ac_lut, starts, num_mcus, blocks_per_mcu, pos,
+                            jpg)) {
+      return false;
+    }
+  } else {
+    BitReaderState br(data, len, *pos);
+    for (int mcu = 0; mcu < num_mcus; mcu += interval) {
       // Handle the restart intervals.
-      if (jpg->restart_interval > 0) {
-        if (restarts_to_go == 0) {
-          if (ProcessRestart(data, len, &next_restart_marker, &br, jpg)) {
-            restarts_to_go = jpg->restart_interval;
-            memset(static_cast<void*>(last_dc_coeff), 0, sizeof(last_dc_coeff));
-            if (eobrun > 0) {
-              return JXL_FAILURE("End-of-block run too long.");
-            }
-            eobrun = -1;  // fresh start
-          } else {
-            return JXL_FAILURE("Could not process restart.");
-          }
+      if (mcu > 0) {
+        if (!ProcessRestart(data, len, &next_restart_marker, &br, jpg)) {
+          return JXL_FAILURE("Could not process restart.");
         }
-        --restarts_to_go;
-      }
-      // Decode one MCU.
-      for (size_t i = 0; i < scan_info->num_components; ++i) {
-        JPEGComponentScanInfo* si = &scan_info->components[i];
-        JPEGComponent* c = &jpg->components[si->comp_idx];
-        const HuffmanTableEntry* dc_lut =
-            &dc_huff_lut[si->dc_tbl_idx * kJpegHuffmanLutSize];
-        const HuffmanTableEntry* ac_lut =
-            &ac_huff_lut[si->ac_tbl_idx * kJpegHuffmanLutSize];
-        int nblocks_y = is_interleaved ? c->v_samp_factor : 1;
-        int nblocks_x = is_interleaved ? c->h_samp_factor : 1;
-        for (int iy = 0; iy < nblocks_y; ++iy) {
-          for (int ix = 0; ix < nblocks_x; ++ix) {
-            int block_y = mcu_y * nblocks_y + iy;
-            int block_x = mcu_x * nblocks_x + ix;
-            int block_idx = block_y * c->width_in_blocks + block_x;
-            bool reset_state = false;
-            int num_zero_runs = 0;
-            coeff_t* coeffs = &c->coeffs[block_idx * kDCTBlockSize];
-            if (Ah == 0) {
-              if (!DecodeDCTBlock(dc_lut, ac_lut, Ss, Se, Al, &eobrun,
-                                  &reset_state, &num_zero_runs, &br, jpg,
-                                  &last_dc_coeff[si->comp_idx], coeffs)) {
-                return false;
-              }
-            } else {
-              if (!RefineDCTBlock(ac_lut, Ss, Se, Al, &eobrun, &reset_state,
-                                  &br, jpg, coeffs)) {
-                return false;
-              }
-            }
-            if (reset_state) {
-              scan_info->reset_points.emplace_back(block_scan_index);
-            }
-            if (num_zero_runs > 0) {
-              JPEGScanInfo::ExtraZeroRunInfo info;
-              info.block_idx = block_scan_index;
-              info.num_extra_zero_runs = num_zero_runs;
-              scan_info->extra_zero_runs.push_back(info);
-            }
-            ++block_scan_index;
-          }
+        memset(static_cast<void*>(last_dc_coeff), 0, sizeof(last_dc_coeff));
+        if (eobrun > 0) {
+          return JXL_FAILURE("End-of-block run too long.");
         }
+        eobrun = -1;  // fresh start
+      }
+      if (!DecodeMCUs(params, dc_huff_lut, ac_huff_lut, fast_ac_lut, mcu,
+                      std::min(mcu + interval, num_mcus), &eobrun,
+                      last_dc_coeff, &block_scan_index, &br, jpg,
+                      &scan_info->reset_points, &scan_info->extra_zero_runs)) {
+        return false;
       }
     }
-  }
-  if (eobrun > 0) {
-    return JXL_FAILURE("End-of-block run too long.");
-  }
-  if (!br.FinishStream(jpg, pos)) {
-    return JXL_FAILURE("Invalid scan.");
+    if (eobrun > 0) {
+      return JXL_FAILURE("End-of-block run too long.");
+    }
+    if (!br.FinishStream(&jpg->padding_bits, &jpg->has_zero_padding_bit,
+                         pos)) {
+      return JXL_FAILURE("Invalid scan.");
+    }
   }
   if (*pos > len) {
     return JXL_FAILURE("Unexpected end of file during scan. pos=%" PRIuS
@@ -917,7 +1145,7 @@ size_t FindNextMarker(const uint8_t* data, const size_t len, size_t pos) {
 }  // namespace
 
 bool ReadJpeg(const uint8_t* data, const size_t len, JpegReadMode mode,
-              JPEGData* jpg) {
+              JPEGData* jpg, ThreadPool* pool) {
   size_t pos = 0;
   // Check SOI marker.
   JXL_JPEG_EXPECT_MARKER();
@@ -975,7 +1203,7 @@ bool ReadJpeg(const uint8_t* data, const size_t len, JpegReadMode mode,
       case 0xda:
         if (mode == JpegReadMode::kReadAll) {
           ok = ProcessScan(data, len, dc_huff_lut, ac_huff_lut,
-                           scan_progression, is_progressive, &pos, jpg);
+                           scan_progression, is_progressive, pool, &pos, jpg);
         }
         break;
       case 0xdb:
@@ -40,6 +40,8 @@
 #include "lib/jxl/image_bundle.h"
 #include "lib/jxl/image_metadata.h"
 #include "lib/jxl/jpeg/enc_jpeg_data.h"
+#include "lib/jxl/jpeg/enc_jpeg_data_reader.h"
+#include "lib/jxl/jpeg/jpeg_data.h"
 #include "lib/jxl/test_image.h"
 #include "lib/jxl/test_utils.h"
 #include "lib/jxl/testing.h"
@@ -1589,6 +1591,38 @@ JXL_TRANSCODE_JPEG_TEST(JxlTest, RoundtripJpegRecompressionRestarts) {
   EXPECT_NEAR(RoundtripJpeg(orig, pool.get()), 76054u, 30);
 }
 
+JXL_TRANSCODE_JPEG_TEST(JxlTest, ReadJpegRestartsParallel) {
+  ThreadPoolForTests pool(8);
+  const std::vector<uint8_t> orig =
+      ReadTestData("jxl/jpeg_reconstruction/bicycles_restarts.jpg");
+  jpeg::JPEGData serial;
+  jpeg::JPEGData parallel;
+  ASSERT_TRUE(jpeg::ReadJpeg(orig.data(), orig.size(),
+                             jpeg::JpegReadMode::kReadAll, &serial));
+  ASSERT_TRUE(jpeg::ReadJpeg(orig.data(), orig.size(),
+                             jpeg::JpegReadMode::kReadAll, &parallel,
+                             pool.get()));
+  ASSERT_GT(serial.restart_interval, 0u);
+  ASSERT_EQ(serial.components.size(), parallel.components.size());
+  for (size_t c = 0; c < serial.components.size(); c++) {
+    EXPECT_EQ(serial.components[c].coeffs, parallel.components[c].coeffs);
+  }
+  ASSERT_EQ(serial.scan_info.size(), parallel.scan_info.size());
+  for (size_t i = 0; i < serial.scan_info.size(); i++) {
+    const jpeg::JPEGScanInfo& s = serial.scan_info[i];
+    const jpeg::JPEGScanInfo& p = parallel.scan_info[i];
+    EXPECT_EQ(s.reset_points, p.reset_points);
+    ASSERT_EQ(s.extra_zero_runs.size(), p.extra_zero_runs.size());
+    for (size_t j = 0; j < s.extra_zero_runs.size(); j++) {
+      EXPECT_EQ(s.extra_zero_runs[j].block_idx, p.extra_zero_runs[j].block_idx);
+      EXPECT_EQ(s.extra_zero_runs[j].num_extra_zero_runs,
+                p.extra_zero_runs[j].num_extra_zero_runs);
+    }
+  }
+  EXPECT_EQ(serial.padding_bits, parallel.padding_bits);
+  EXPECT_EQ(serial.has_zero_padding_bit, parallel.has_zero_padding_bit);
+}
+
 JXL_TRANSCODE_JPEG_TEST(JxlTest, RoundtripJpegRecompressionOrientationICC) {
   ThreadPoolForTests pool(8);
   const std::vector<uint8_t> orig =
@@ -10,10 +10,12 @@
 
 #include <atomic>
 #include <cstddef>
+#include <cstdint>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>     // memcpy
 #include <hwy/base.h>  // kMaxVectorSize
+#include <limits>
 
 #include "lib/jxl/base/common.h"
 #include "lib/jxl/base/status.h"
@@ -41,6 +43,38 @@ void* MemoryManagerDefaultAlloc(void* opaque, size_t size) {
 
 void MemoryManagerDefaultFree(void* opaque, void* address) { free(address); }
 
+// Size of the header of the counted allocations, which keeps them aligned.
+constexpr size_t kCountingHeaderSize = alignof(std::max_align_t);
+static_assert(kCountingHeaderSize >= sizeof(size_t), "Header too small");
+
+void* MemoryManagerCountingAlloc(void* opaque, size_t size) {
+  MemoryCounter* counter = static_cast<MemoryCounter*>(opaque);
+  if (size > std::numeric_limits<size_t>::max() - kCountingHeaderSize) {
+    return nullptr;
+  }
+  uint8_t* block = static_cast<uint8_t*>(
+      MemoryManagerAlloc(&counter->inner, kCountingHeaderSize + size));
+  if (block == nullptr) return nullptr;
+  memcpy(block, &size, sizeof(size));
+  const size_t in_use =
+      counter->bytes_in_use.fetch_add(size, std::memory_order_relaxed) + size;
+  size_t peak = counter->peak_bytes_in_use.load(std::memory_order_relaxed);
+  while (peak < in_use && !counter->peak_bytes_in_use.compare_exchange_weak(
+                              peak, in_use, std::memory_order_relaxed)) {
+  }
+  return block + kCountingHeaderSize;
+}
+
+void MemoryManagerCountingFree(void* opaque, void* address) {
+  if (address == nullptr) return;
+  MemoryCounter* counter = static_cast<MemoryCounter*>(opaque);
+  uint8_t* block = static_cast<uint8_t*>(address) - kCountingHeaderSize;
+  size_t size;
+  memcpy(&size, block, sizeof(size));
+  counter->bytes_in_use.fetch_sub(size, std::memory_order_relaxed);
+  MemoryManagerFree(&counter->inner, block);
+}
+
 }  // namespace
 
 void* MemoryManagerAlloc(const JxlMemoryManager* memory_manager, size_t size) {
@@ -69,6 +103,20 @@ Status MemoryManagerInit(JxlMemoryManager* self,
   return true;
 }
 
+void MemoryManagerInitCounting(JxlMemoryManager* self,
+                               MemoryCounter* counter) {
+  self->opaque = counter;
+  self->alloc = MemoryManagerCountingAlloc;
+  self->free = MemoryManagerCountingFree;
+}
+
+size_t MemoryCounterTakePeak(void* opaque) {
+  MemoryCounter* counter = static_cast<MemoryCounter*>(opaque);
+  return counter->peak_bytes_in_use.exchange(
+      counter->bytes_in_use.load(std::memory_order_relaxed),
+      std::memory_order_relaxed);
+}
+
 size_t BytesPerRow(const size_t xsize, const size_t sizeof_t) {
   // Special case: we don't allow any ops -> don't need extra padding/
   if (xsize == 0) {
@@ -10,6 +10,7 @@
 
 #include <jxl/memory_manager.h>
 
+#include <atomic>
 #include <cstddef>
 #include <memory>
 
@@ -29,6 +30,25 @@ Status MemoryManagerInit(JxlMemoryManager* self,
 void* MemoryManagerAlloc(const JxlMemoryManager* memory_manager, size_t size);
 void MemoryManagerFree(const JxlMemoryManager* memory_manager, void* address);
 
+// Bytes allocated through a memory manager set up by
+// MemoryManagerInitCounting, and their high-water mark, for the profiling
+// events of the encoder and decoder.
+struct MemoryCounter {
+  JxlMemoryManager inner;
+  std::atomic<size_t> bytes_in_use{0};
+  std::atomic<size_t> peak_bytes_in_use{0};
+};
+
+// Initializes `self` to allocate through `counter->inner`, which must already
+// be initialized, counting the bytes in `counter`. Each allocation is prefixed
+// with a header that holds its size.
+void MemoryManagerInitCounting(JxlMemoryManager* self, MemoryCounter* counter);
+
+// Returns the high-water mark of the bytes in use since the previous call, and
+// restarts it from the bytes currently in use. `opaque` is a MemoryCounter, as
+// for ThreadPool::PeakMemoryFunc.
+size_t MemoryCounterTakePeak(void* opaque);
+
 // Helper class to be used as a deleter in a unique_ptr<T> call.
 class MemoryManagerDeleteHelper {
  public:
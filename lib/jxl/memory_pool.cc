@@ -0,0 +1,174 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include <jxl/memory_manager.h>
+#include <jxl/memory_pool.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+
+#include "lib/jxl/base/bits.h"
+#include "lib/jxl/base/common.h"
+#include "lib/jxl/memory_manager_internal.h"
+
+namespace {
+
+// Every allocation is preceded by its block size; this keeps the alignment
+// the underlying allocator provides.
+constexpr size_t kHeaderSize = alignof(std::max_align_t);
+static_assert(kHeaderSize >= sizeof(size_t), "Header too small");
+
+// Smaller allocations are not worth recycling; they are mostly small objects
+// and vectors which malloc handles well.
+constexpr size_t kMinPooledSize = 4096;
+
+// Rounds `size` up to one of 8 classes per power of two, wasting at most 12.5%,
+// so that planes of slightly different sizes share buffers.
+// Sizes that cannot be rounded up and still leave room for the header map to
+// SIZE_MAX, which Alloc rejects.
+size_t SizeClass(size_t size) {
+  if (size < kMinPooledSize) return size;
+  const size_t shift = jxl::FloorLog2Nonzero(size) - 3;
+  const size_t granularity = size_t{1} << shift;
+  if (size > std::numeric_limits<size_t>::max() - kHeaderSize - granularity) {
+    return std::numeric_limits<size_t>::max();
+  }
+  return jxl::DivCeil(size, granularity) << shift;
+}
+
+}  // namespace
+
+struct JxlMemoryPoolStruct {
+  JxlMemoryPoolStruct(const JxlMemoryManager& inner, size_t max_cached_bytes)
+      : inner(inner), max_cached_bytes(max_cached_bytes) {
+    outer.opaque = this;
+    outer.alloc = &Alloc;
+    outer.free = &Free;
+  }
+
+  ~JxlMemoryPoolStruct() { Trim(0); }
+
+  static void* Alloc(void* opaque, size_t size) {
+    JxlMemoryPool* pool = static_cast<JxlMemoryPool*>(opaque);
+    const size_t block_size = SizeClass(size);
+    if (block_size > std::numeric_limits<size_t>::max() - kHeaderSize) {
+      return nullptr;
+    }
+    void* block = nullptr;
+    {
+      std::lock_guard<std::mutex> lock(pool->mutex);
+      auto it = pool->free_blocks.find(block_size);
+      if (it != pool->free_blocks.end()) {
+        block = it->second.back();
+        it->second.pop_back();
+        if (it->second.empty()) pool->free_blocks.erase(it);
+        pool->stats.bytes_cached -= block_size;
+        pool->stats.num_reused++;
+      }
+    }
+    if (block == nullptr) {
+      block = jxl::MemoryManagerAlloc(&pool->inner, kHeaderSize + block_size);
+      if (block == nullptr) return nullptr;
+    }
+    memcpy(block, &block_size, sizeof(block_size));
+    {
+      std::lock_guard<std::mutex> lock(pool->mutex);
+      JxlMemoryPoolStats& stats = pool->stats;
+      stats.num_allocations++;
+      stats.bytes_in_use += block_size;
+      stats.peak_bytes_in_use =
+          std::max(stats.peak_bytes_in_use, stats.bytes_in_use);
+      stats.peak_bytes_reserved = std::max(
+          stats.peak_bytes_reserved, stats.bytes_in_use + stats.bytes_cached);
+    }
+    return static_cast<uint8_t*>(block) + kHeaderSize;
+  }
+
+  static void Free(void* opaque, void* address) {
+    if (address == nullptr) return;
+    JxlMemoryPool* pool = static_cast<JxlMemoryPool*>(opaque);
+    void* block = static_cast<uint8_t*>(address) - kHeaderSize;
+    size_t block_size;
+    memcpy(&block_size, block, sizeof(block_size));
+    {
+      std::lock_guard<std::mutex> lock(pool->mutex);
+      pool->stats.bytes_in_use -= block_size;
+      if (block_size >= kMinPooledSize &&
+          pool->stats.bytes_cached + block_size <= pool->max_cached_bytes) {
+        pool->free_blocks[block_size].push_back(block);
+        pool->stats.bytes_cached += block_size;
+        return;
+      }
+    }
+    jxl::MemoryManagerFree(&pool->inner, block);
+  }
+
+  void Trim(size_t max_cached) {
+    std::vector<void*> released;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      while (stats.bytes_cached > max_cached) {
+        auto it = std::prev(free_blocks.end());
+        stats.bytes_cached -= it->first;
+        released.push_back(it->second.back());
+        it->second.pop_back();
+        if (it->second.empty()) free_blocks.erase(it);
+      }
+    }
+    for (void* block : released) jxl::MemoryManagerFree(&inner, block);
+  }
+
+  JxlMemoryManager inner;
+  JxlMemoryManager outer;
+  const size_t max_cached_bytes;
+  std::mutex mutex;
+  // Cached blocks by block size; guarded by `mutex`, as is `stats`. Sizes
+  // without cached blocks are erased, so Trim can take from the last entry.
+  std::map<size_t, std::vector<void*>> free_blocks;
+  JxlMemoryPoolStats stats = {};
+};
+
+JxlMemoryPool* JxlMemoryPoolCreate(const JxlMemoryManager* memory_manager,
+                                   size_t max_cached_bytes) {
+  JxlMemoryManager local_memory_manager;
+  if (!jxl::MemoryManagerInit(&local_memory_manager, memory_manager)) {
+    return nullptr;
+  }
+  void* alloc =
+      jxl::MemoryManagerAlloc(&local_memory_manager, sizeof(JxlMemoryPool));
+  if (!alloc) return nullptr;
+  // Placement new constructor on allocated memory
+  return new (alloc) JxlMemoryPool(local_memory_manager, max_cached_bytes);
+}
+
+void JxlMemoryPoolDestroy(JxlMemoryPool* pool) {
+  if (pool) {
+    JxlMemoryManager local_memory_manager = pool->inner;
+    // Call destructor directly since custom free function is used.
+    pool->~JxlMemoryPool();
+    jxl::MemoryManagerFree(&local_memory_manager, pool);
+  }
+}
+
+const JxlMemoryManager* JxlMemoryPoolGetMemoryManager(JxlMemoryPool* pool) {
+  return &pool->outer;
+}
+
+void JxlMemoryPoolTrim(JxlMemoryPool* pool, size_t max_cached_bytes) {
+  pool->Trim(max_cached_bytes);
+}
+
+void JxlMemoryPoolGetStats(JxlMemoryPool* pool, JxlMemoryPoolStats* stats) {
+  std::lock_guard<std::mutex> lock(pool->mutex);
+  *stats = pool->stats;
+}
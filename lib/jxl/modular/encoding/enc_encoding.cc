@@ -135,7 +135,32 @@ Status GatherTreeData(const Image &image, pixel_type chan, size_t group_id,
   weighted::State wp_state(wp_header, channel.w, channel.h);
   tree_samples.PrepareForSamples(pixel_fraction * channel.h * channel.w + 64);
   const bool multiple_predictors = tree_samples.NumPredictors() != 1;
+  // The weighted predictor state must be advanced on every pixel if either its
+  // prediction or its property can end up in the tree. Everything else only
+  // depends on the neighbourhood, so it is computed for sampled pixels only.
+  bool use_wp = false;
+  for (size_t i = 0; i < tree_samples.NumPredictors(); i++) {
+    if (tree_samples.PredictorFromIndex(i) == Predictor::Weighted) {
+      use_wp = true;
+    }
+  }
+  for (size_t i = 0; i < tree_samples.NumProperties(); i++) {
+    if (tree_samples.PropertyFromIndex(i) == kWPProp) use_wp = true;
+  }
+  // Returns true if the pixel is not sampled; the weighted predictor state is
+  // still updated in that case.
+  auto skip_sample = [&](const pixel_type *p, size_t x, size_t y) {
+    (*total_pixels)++;
+    if (use_sample()) return false;
+    if (use_wp) {
+      PredictNoTreeWP(channel.w, p + x, onerow, x, y, Predictor::Weighted,
+                      &wp_state);
+      wp_state.UpdateErrors(p[x], x, y, channel.w);
+    }
+    return true;
+  };
   auto compute_sample = [&](const pixel_type *p, size_t x, size_t y) {
+    if (skip_sample(p, x, y)) return;
     pixel_type_w pred[kNumModularPredictors];
     if (multiple_predictors) {
       PredictLearnAll(&properties, channel.w, p + x, onerow, x, y, references,
@@ -147,10 +172,7 @@ Status GatherTreeData(const Image &image, pixel_type chan, size_t group_id,
                        &wp_state)
               .guess;
     }
-    (*total_pixels)++;
-    if (use_sample()) {
-      tree_samples.AddSample(p[x], properties, pred);
-    }
+    tree_samples.AddSample(p[x], properties, pred);
     wp_state.UpdateErrors(p[x], x, y, channel.w);
   };
 
@@ -159,13 +181,12 @@ Status GatherTreeData(const Image &image, pixel_type chan, size_t group_id,
     PrecomputeReferences(channel, y, image, chan, &references);
     InitPropsRow(&properties, static_props, y);
 
-    // TODO(veluca): avoid computing WP if we don't use its property or
-    // predictions.
     if (y > 1 && channel.w > 8 && references.w == 0) {
       for (size_t x = 0; x < 2; x++) {
         compute_sample(p, x, y);
       }
       for (size_t x = 2; x < channel.w - 2; x++) {
+        if (skip_sample(p, x, y)) continue;
         pixel_type_w pred[kNumModularPredictors];
         if (multiple_predictors) {
           PredictLearnAllNEC(&properties, channel.w, p + x, onerow, x, y,
@@ -177,10 +198,7 @@ Status GatherTreeData(const Image &image, pixel_type chan, size_t group_id,
                               &wp_state)
                   .guess;
         }
-        (*total_pixels)++;
-        if (use_sample()) {
-          tree_samples.AddSample(p[x], properties, pred);
-        }
+        tree_samples.AddSample(p[x], properties, pred);
         wp_state.UpdateErrors(p[x], x, y, channel.w);
       }
       for (size_t x = channel.w - 2; x < channel.w; x++) {
@@ -7,14 +7,110 @@
 
 #include <jxl/memory_manager.h>
 
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <limits>
 #include <sstream>
 
+#include "lib/jxl/base/rect.h"
 #include "lib/jxl/base/status.h"
 #include "lib/jxl/image_ops.h"
 #include "lib/jxl/modular/transform/transform.h"
 
 namespace jxl {
 
+namespace {
+
+bool FitsInt16(const pixel_type* JXL_RESTRICT row, size_t xsize) {
+  pixel_type min = 0;
+  pixel_type max = 0;
+  for (size_t x = 0; x < xsize; ++x) {
+    min = std::min(min, row[x]);
+    max = std::max(max, row[x]);
+  }
+  return min >= std::numeric_limits<int16_t>::min() &&
+         max <= std::numeric_limits<int16_t>::max();
+}
+
+}  // namespace
+
+Status Channel::Compact(bool copy_samples) {
+  if (compact_) return true;
+  if (copy_samples) {
+    for (size_t y = 0; y < h; ++y) {
+      if (!FitsInt16(plane.Row(y), w)) return true;
+    }
+  }
+  JXL_ASSIGN_OR_RETURN(compact_plane_,
+                       Plane<int16_t>::Create(memory_manager(), w, h));
+  if (copy_samples) {
+    for (size_t y = 0; y < h; ++y) {
+      const pixel_type* JXL_RESTRICT row_in = plane.Row(y);
+      int16_t* JXL_RESTRICT row_out = compact_plane_.Row(y);
+      for (size_t x = 0; x < w; ++x) {
+        row_out[x] = static_cast<int16_t>(row_in[x]);
+      }
+    }
+  }
+  plane = Plane<pixel_type>();
+  compact_ = true;
+  return true;
+}
+
+Status Channel::Expand() {
+  if (!compact_) return true;
+  JXL_ASSIGN_OR_RETURN(plane,
+                       Plane<pixel_type>::Create(memory_manager(), w, h));
+  for (size_t y = 0; y < h; ++y) {
+    const int16_t* JXL_RESTRICT row_in = compact_plane_.Row(y);
+    pixel_type* JXL_RESTRICT row_out = plane.Row(y);
+    for (size_t x = 0; x < w; ++x) row_out[x] = row_in[x];
+  }
+  compact_plane_ = Plane<int16_t>();
+  compact_ = false;
+  return true;
+}
+
+bool Channel::Fits(const Plane<pixel_type>& from, const Rect& rect_to) const {
+  if (!compact_) return true;
+  for (size_t y = 0; y < rect_to.ysize(); ++y) {
+    if (!FitsInt16(from.Row(y), rect_to.xsize())) return false;
+  }
+  return true;
+}
+
+Status Channel::StoreRect(const Plane<pixel_type>& from, const Rect& rect_to) {
+  if (!Fits(from, rect_to)) {
+    JXL_RETURN_IF_ERROR(Expand());
+  }
+  if (!compact_) {
+    CopyImageTo(Rect(0, 0, rect_to.xsize(), rect_to.ysize()), from, rect_to,
+                &plane);
+    return true;
+  }
+  for (size_t y = 0; y < rect_to.ysize(); ++y) {
+    const pixel_type* JXL_RESTRICT row_in = from.Row(y);
+    int16_t* JXL_RESTRICT row_out = rect_to.Row(&compact_plane_, y);
+    for (size_t x = 0; x < rect_to.xsize(); ++x) {
+      row_out[x] = static_cast<int16_t>(row_in[x]);
+    }
+  }
+  return true;
+}
+
+void Channel::ZeroFillRect(const Rect& rect) {
+  for (size_t y = 0; y < rect.ysize(); ++y) {
+    if (compact_) {
+      int16_t* JXL_RESTRICT row = rect.Row(&compact_plane_, y);
+      memset(row, 0, rect.xsize() * sizeof(*row));
+    } else {
+      pixel_type* JXL_RESTRICT row = rect.Row(&plane, y);
+      memset(row, 0, rect.xsize() * sizeof(*row));
+    }
+  }
+}
+
 void Image::undo_transforms(const weighted::Header &wp_header,
                             jxl::ThreadPool *pool) {
   while (!transform.empty()) {
@@ -79,7 +175,12 @@ StatusOr<Image> Image::Clone(const Image &that) {
   for (const Channel &ch : that.channel) {
     JXL_ASSIGN_OR_RETURN(Channel a, Channel::Create(memory_manager, ch.w, ch.h,
                                                     ch.hshift, ch.vshift));
-    CopyImageTo(ch.plane, &a.plane);
+    if (ch.compact()) {
+      JXL_RETURN_IF_ERROR(a.Compact(/*copy_samples=*/false));
+      CopyImageTo(ch.compact_plane_, &a.compact_plane_);
+    } else {
+      CopyImageTo(ch.plane, &a.plane);
+    }
     clone.channel.push_back(std::move(a));
   }
   return clone;
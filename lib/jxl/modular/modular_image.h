@@ -17,13 +17,15 @@
 
 #include "lib/jxl/base/compiler_specific.h"
 #include "lib/jxl/base/data_parallel.h"
+#include "lib/jxl/base/rect.h"
 #include "lib/jxl/base/status.h"
 #include "lib/jxl/image.h"
 
 namespace jxl {
 
-typedef int32_t pixel_type;  // can use int16_t if it's only for 8-bit images.
-                             // Need some wiggle room for YCoCg / Squeeze etc
+// Samples need some wiggle room for YCoCg / Squeeze etc, so they are 32-bit
+// while being decoded and transformed; see Channel::Compact for storage.
+typedef int32_t pixel_type;
 
 typedef int64_t pixel_type_w;
 
@@ -53,13 +55,17 @@ class Channel {
     hshift = other.hshift;
     vshift = other.vshift;
     plane = std::move(other.plane);
+    compact_plane_ = std::move(other.compact_plane_);
+    compact_ = other.compact_;
     return *this;
   }
 
   // Move constructor
   Channel(Channel&& other) noexcept = default;
 
-  JxlMemoryManager* memory_manager() const { return plane.memory_manager(); };
+  JxlMemoryManager* memory_manager() const {
+    return compact_ ? compact_plane_.memory_manager() : plane.memory_manager();
+  };
 
   Status shrink() {
     if (plane.xsize() == w && plane.ysize() == h) return true;
@@ -73,14 +79,42 @@ class Channel {
     return shrink();
   }
 
-  JXL_INLINE pixel_type* Row(const size_t y) { return plane.Row(y); }
+  JXL_INLINE pixel_type* Row(const size_t y) {
+    JXL_DASSERT(!compact_);
+    return plane.Row(y);
+  }
   JXL_INLINE const pixel_type* Row(const size_t y) const {
+    JXL_DASSERT(!compact_);
     return plane.Row(y);
   }
 
+  // A channel that only stores samples until its inverse transforms run can
+  // keep them as int16_t, which halves its footprint. A compact channel has
+  // an empty `plane`; use StoreRect / ZeroFillRect to write it and Expand()
+  // before reading it.
+  bool compact() const { return compact_; }
+  // Moves the samples to 16-bit storage. If some sample does not fit, the
+  // channel is left untouched. If `copy_samples` is false, the samples of the
+  // compact channel are uninitialized.
+  Status Compact(bool copy_samples = true);
+  // Moves the samples back to `plane`.
+  Status Expand();
+  // Whether the top-left `rect_to` sized area of `from` can be stored without
+  // expanding the channel. Only reads `from`.
+  bool Fits(const Plane<pixel_type>& from, const Rect& rect_to) const;
+  // Copies the top-left `rect_to` sized area of `from` to `rect_to`. A compact
+  // channel is expanded first if some of the new samples do not fit; stores to
+  // disjoint rects can run concurrently only if they all fit.
+  Status StoreRect(const Plane<pixel_type>& from, const Rect& rect_to);
+  void ZeroFillRect(const Rect& rect);
+
  private:
   Channel(jxl::Plane<pixel_type>&& p, size_t iw, size_t ih, int hsh, int vsh)
       : plane(std::move(p)), w(iw), h(ih), hshift(hsh), vshift(vsh) {}
+  friend class Image;
+
+  jxl::Plane<int16_t> compact_plane_;
+  bool compact_ = false;
 };
 
 class Transform;
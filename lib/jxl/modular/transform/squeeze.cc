@@ -7,7 +7,9 @@
 
 #include <jxl/memory_manager.h>
 
+#include <algorithm>
 #include <cstdlib>
+#include <cstring>
 
 #include "lib/jxl/base/common.h"
 #include "lib/jxl/base/data_parallel.h"
@@ -99,6 +101,112 @@ JXL_INLINE void FastUnsqueeze(const pixel_type *JXL_RESTRICT p_residual,
 
 #endif
 
+// Undoes the horizontal squeeze of `rows` (at most 8) rows, from the averages
+// `p_avg` and the residuals `p_residual` to `p_out`.
+void InvHSqueezeRows(const pixel_type *p_avg, intptr_t onerow_in, size_t avg_w,
+                     const pixel_type *p_residual, intptr_t onerow_inr,
+                     size_t residual_w, pixel_type *p_out, intptr_t onerow_out,
+                     size_t rows) {
+  const size_t out_w = avg_w + residual_w;
+  auto unsqueeze_row = [&](size_t y, size_t x0) {
+    const pixel_type *JXL_RESTRICT row_residual = p_residual + onerow_inr * y;
+    const pixel_type *JXL_RESTRICT row_avg = p_avg + onerow_in * y;
+    pixel_type *JXL_RESTRICT row_out = p_out + onerow_out * y;
+    for (size_t x = x0; x < residual_w; x++) {
+      pixel_type_w diff_minus_tendency = row_residual[x];
+      pixel_type_w avg = row_avg[x];
+      pixel_type_w next_avg = (x + 1 < avg_w ? row_avg[x + 1] : avg);
+      pixel_type_w left = (x ? row_out[(x << 1) - 1] : avg);
+      pixel_type_w tendency = SmoothTendency(left, avg, next_avg);
+      pixel_type_w diff = diff_minus_tendency + tendency;
+      pixel_type_w A = avg + (diff / 2);
+      row_out[(x << 1)] = A;
+      pixel_type_w B = A - diff;
+      row_out[(x << 1) + 1] = B;
+    }
+    if (out_w & 1) row_out[out_w - 1] = row_avg[avg_w - 1];
+  };
+
+  // somewhat complicated trickery just to be able to SIMD this.
+  // Horizontal unsqueeze has horizontal data dependencies, so we do
+  // 8 rows at a time and treat it as a vertical unsqueeze of a
+  // transposed 8x8 block (or 9x8 for one input).
+  static constexpr const size_t kRowsPerThread = 8;
+  JXL_DASSERT(rows <= kRowsPerThread);
+  size_t x = 0;
+
+#if HWY_TARGET != HWY_SCALAR
+  HWY_ALIGN pixel_type b_p_avg[9 * kRowsPerThread];
+  HWY_ALIGN pixel_type b_p_residual[8 * kRowsPerThread];
+  HWY_ALIGN pixel_type b_p_out_even[8 * kRowsPerThread];
+  HWY_ALIGN pixel_type b_p_out_odd[8 * kRowsPerThread];
+  HWY_ALIGN pixel_type b_p_out_evenT[8 * kRowsPerThread];
+  HWY_ALIGN pixel_type b_p_out_oddT[8 * kRowsPerThread];
+  const HWY_CAPPED(pixel_type, 8) d;
+  const size_t N = Lanes(d);
+  if (residual_w > 16 && rows == kRowsPerThread) {
+    for (; x < residual_w - 9; x += 8) {
+      Transpose8x8Block(p_residual + x, b_p_residual, onerow_inr);
+      Transpose8x8Block(p_avg + x, b_p_avg, onerow_in);
+      for (size_t y = 0; y < kRowsPerThread; y++) {
+        b_p_avg[8 * 8 + y] = p_avg[x + 8 + onerow_in * y];
+      }
+      for (size_t i = 0; i < 8; i++) {
+        FastUnsqueeze(
+            b_p_residual + 8 * i, b_p_avg + 8 * i, b_p_avg + 8 * (i + 1),
+            (x + i ? b_p_out_odd + 8 * ((x + i - 1) & 7) : b_p_avg + 8 * i),
+            b_p_out_even + 8 * i, b_p_out_odd + 8 * i);
+      }
+
+      Transpose8x8Block(b_p_out_even, b_p_out_evenT, 8);
+      Transpose8x8Block(b_p_out_odd, b_p_out_oddT, 8);
+      for (size_t y = 0; y < kRowsPerThread; y++) {
+        for (size_t i = 0; i < kRowsPerThread; i += N) {
+          auto even = Load(d, b_p_out_evenT + 8 * y + i);
+          auto odd = Load(d, b_p_out_oddT + 8 * y + i);
+          StoreInterleaved(d, even, odd,
+                           p_out + ((x + i) << 1) + onerow_out * y);
+        }
+      }
+    }
+  }
+#endif
+  for (size_t y = 0; y < rows; y++) {
+    unsqueeze_row(y, x);
+  }
+}
+
+// Undoes the vertical squeeze of one row of `w` residuals, writing the two
+// output rows `p_out` and `p_nout`. `p_pout` is the output row above them, or
+// `p_avg` for the first row.
+void InvVSqueezeRow(const pixel_type *JXL_RESTRICT p_residual,
+                    const pixel_type *JXL_RESTRICT p_avg,
+                    const pixel_type *JXL_RESTRICT p_navg,
+                    const pixel_type *p_pout, pixel_type *JXL_RESTRICT p_out,
+                    pixel_type *p_nout, size_t w) {
+  size_t x = 0;
+#if HWY_TARGET != HWY_SCALAR
+  for (; x + 7 < w; x += 8) {
+    FastUnsqueeze(p_residual + x, p_avg + x, p_navg + x, p_pout + x, p_out + x,
+                  p_nout + x);
+  }
+#endif
+  for (; x < w; x++) {
+    pixel_type_w avg = p_avg[x];
+    pixel_type_w next_avg = p_navg[x];
+    pixel_type_w top = p_pout[x];
+    pixel_type_w tendency = SmoothTendency(top, avg, next_avg);
+    pixel_type_w diff_minus_tendency = p_residual[x];
+    pixel_type_w diff = diff_minus_tendency + tendency;
+    pixel_type_w out = avg + (diff / 2);
+    p_out[x] = out;
+    // If the residual channel has as many rows as the averages, the output
+    // has an even number of rows so the next line is fine. Otherwise, the
+    // caller handles the last output row separately.
+    p_nout[x] = out - diff;
+  }
+}
+
 Status InvHSqueeze(Image &input, uint32_t c, uint32_t rc, ThreadPool *pool) {
   JXL_ASSERT(c < input.channel.size());
   JXL_ASSERT(rc < input.channel.size());
@@ -129,80 +237,15 @@ Status InvHSqueeze(Image &input, uint32_t c, uint32_t rc, ThreadPool *pool) {
     input.channel[c] = std::move(chout);
     return true;
   }
-  auto unsqueeze_row = [&](size_t y, size_t x0) {
-    const pixel_type *JXL_RESTRICT p_residual = chin_residual.Row(y);
-    const pixel_type *JXL_RESTRICT p_avg = chin.Row(y);
-    pixel_type *JXL_RESTRICT p_out = chout.Row(y);
-    for (size_t x = x0; x < chin_residual.w; x++) {
-      pixel_type_w diff_minus_tendency = p_residual[x];
-      pixel_type_w avg = p_avg[x];
-      pixel_type_w next_avg = (x + 1 < chin.w ? p_avg[x + 1] : avg);
-      pixel_type_w left = (x ? p_out[(x << 1) - 1] : avg);
-      pixel_type_w tendency = SmoothTendency(left, avg, next_avg);
-      pixel_type_w diff = diff_minus_tendency + tendency;
-      pixel_type_w A = avg + (diff / 2);
-      p_out[(x << 1)] = A;
-      pixel_type_w B = A - diff;
-      p_out[(x << 1) + 1] = B;
-    }
-    if (chout.w & 1) p_out[chout.w - 1] = p_avg[chin.w - 1];
-  };
 
-  // somewhat complicated trickery just to be able to SIMD this.
-  // Horizontal unsqueeze has horizontal data dependencies, so we do
-  // 8 rows at a time and treat it as a vertical unsqueeze of a
-  // transposed 8x8 block (or 9x8 for one input).
   static constexpr const size_t kRowsPerThread = 8;
   const auto unsqueeze_span = [&](const uint32_t task, size_t /* thread */) {
     const size_t y0 = task * kRowsPerThread;
     const size_t rows = std::min(kRowsPerThread, chin.h - y0);
-    size_t x = 0;
-
-#if HWY_TARGET != HWY_SCALAR
-    intptr_t onerow_in = chin.plane.PixelsPerRow();
-    intptr_t onerow_inr = chin_residual.plane.PixelsPerRow();
-    intptr_t onerow_out = chout.plane.PixelsPerRow();
-    const pixel_type *JXL_RESTRICT p_residual = chin_residual.Row(y0);
-    const pixel_type *JXL_RESTRICT p_avg = chin.Row(y0);
-    pixel_type *JXL_RESTRICT p_out = chout.Row(y0);
-    HWY_ALIGN pixel_type b_p_avg[9 * kRowsPerThread];
-    HWY_ALIGN pixel_type b_p_residual[8 * kRowsPerThread];
-    HWY_ALIGN pixel_type b_p_out_even[8 * kRowsPerThread];
-    HWY_ALIGN pixel_type b_p_out_odd[8 * kRowsPerThread];
-    HWY_ALIGN pixel_type b_p_out_evenT[8 * kRowsPerThread];
-    HWY_ALIGN pixel_type b_p_out_oddT[8 * kRowsPerThread];
-    const HWY_CAPPED(pixel_type, 8) d;
-    const size_t N = Lanes(d);
-    if (chin_residual.w > 16 && rows == kRowsPerThread) {
-      for (; x < chin_residual.w - 9; x += 8) {
-        Transpose8x8Block(p_residual + x, b_p_residual, onerow_inr);
-        Transpose8x8Block(p_avg + x, b_p_avg, onerow_in);
-        for (size_t y = 0; y < kRowsPerThread; y++) {
-          b_p_avg[8 * 8 + y] = p_avg[x + 8 + onerow_in * y];
-        }
-        for (size_t i = 0; i < 8; i++) {
-          FastUnsqueeze(
-              b_p_residual + 8 * i, b_p_avg + 8 * i, b_p_avg + 8 * (i + 1),
-              (x + i ? b_p_out_odd + 8 * ((x + i - 1) & 7) : b_p_avg + 8 * i),
-              b_p_out_even + 8 * i, b_p_out_odd + 8 * i);
-        }
-
-        Transpose8x8Block(b_p_out_even, b_p_out_evenT, 8);
-        Transpose8x8Block(b_p_out_odd, b_p_out_oddT, 8);
-        for (size_t y = 0; y < kRowsPerThread; y++) {
-          for (size_t i = 0; i < kRowsPerThread; i += N) {
-            auto even = Load(d, b_p_out_evenT + 8 * y + i);
-            auto odd = Load(d, b_p_out_oddT + 8 * y + i);
-            StoreInterleaved(d, even, odd,
-                             p_out + ((x + i) << 1) + onerow_out * y);
-          }
-        }
-      }
-    }
-#endif
-    for (size_t y = 0; y < rows; y++) {
-      unsqueeze_row(y0 + y, x);
-    }
+    InvHSqueezeRows(chin.Row(y0), chin.plane.PixelsPerRow(), chin.w,
+                    chin_residual.Row(y0), chin_residual.plane.PixelsPerRow(),
+                    chin_residual.w, chout.Row(y0), chout.plane.PixelsPerRow(),
+                    rows);
   };
   JXL_RETURN_IF_ERROR(RunOnPool(pool, 0, DivCeil(chin.h, kRowsPerThread),
                                 ThreadPool::NoInit, unsqueeze_span,
@@ -249,38 +292,15 @@ Status InvVSqueeze(Image &input, uint32_t c, uint32_t rc, ThreadPool *pool) {
     const size_t x0 = task * kColsPerThread;
     const size_t x1 =
         std::min(static_cast<size_t>(task + 1) * kColsPerThread, chin.w);
-    const size_t w = x1 - x0;
     // We only iterate up to std::min(chin_residual.h, chin.h) which is
     // always chin_residual.h.
     for (size_t y = 0; y < chin_residual.h; y++) {
-      const pixel_type *JXL_RESTRICT p_residual = chin_residual.Row(y) + x0;
-      const pixel_type *JXL_RESTRICT p_avg = chin.Row(y) + x0;
-      const pixel_type *JXL_RESTRICT p_navg =
-          chin.Row(y + 1 < chin.h ? y + 1 : y) + x0;
-      pixel_type *JXL_RESTRICT p_out = chout.Row(y << 1) + x0;
-      pixel_type *JXL_RESTRICT p_nout = chout.Row((y << 1) + 1) + x0;
-      const pixel_type *p_pout = y > 0 ? chout.Row((y << 1) - 1) + x0 : p_avg;
-      size_t x = 0;
-#if HWY_TARGET != HWY_SCALAR
-      for (; x + 7 < w; x += 8) {
-        FastUnsqueeze(p_residual + x, p_avg + x, p_navg + x, p_pout + x,
-                      p_out + x, p_nout + x);
-      }
-#endif
-      for (; x < w; x++) {
-        pixel_type_w avg = p_avg[x];
-        pixel_type_w next_avg = p_navg[x];
-        pixel_type_w top = p_pout[x];
-        pixel_type_w tendency = SmoothTendency(top, avg, next_avg);
-        pixel_type_w diff_minus_tendency = p_residual[x];
-        pixel_type_w diff = diff_minus_tendency + tendency;
-        pixel_type_w out = avg + (diff / 2);
-        p_out[x] = out;
-        // If the chin_residual.h == chin.h, the output has an even number
-        // of rows so the next line is fine. Otherwise, this loop won't
-        // write to the last output row which is handled separately.
-        p_nout[x] = out - diff;
-      }
+      const pixel_type *p_avg = chin.Row(y) + x0;
+      InvVSqueezeRow(chin_residual.Row(y) + x0, p_avg,
+                     chin.Row(y + 1 < chin.h ? y + 1 : y) + x0,
+                     y > 0 ? chout.Row((y << 1) - 1) + x0 : p_avg,
+                     chout.Row(y << 1) + x0, chout.Row((y << 1) + 1) + x0,
+                     x1 - x0);
     }
   };
   JXL_RETURN_IF_ERROR(RunOnPool(pool, 0, DivCeil(chin.w, kColsPerThread),
@@ -329,11 +349,20 @@ Status InvSqueeze(Image &input, const std::vector<SqueezeParams> &parameters,
           (input.channel[c].h < input.channel[rc].h)) {
         return JXL_FAILURE("Corrupted squeeze transform");
       }
+      const size_t out_pixels =
+          (input.channel[c].w + (horizontal ? input.channel[rc].w : 0)) *
+          (input.channel[c].h + (horizontal ? 0 : input.channel[rc].h));
+      ThreadPool *channel_pool =
+          out_pixels < kMinPixelsForThreadedUnsqueeze ? nullptr : pool;
       if (horizontal) {
-        JXL_RETURN_IF_ERROR(InvHSqueeze(input, c, rc, pool));
+        JXL_RETURN_IF_ERROR(InvHSqueeze(input, c, rc, channel_pool));
       } else {
-        JXL_RETURN_IF_ERROR(InvVSqueeze(input, c, rc, pool));
+        JXL_RETURN_IF_ERROR(InvVSqueeze(input, c, rc, channel_pool));
       }
+      // The residuals are not needed anymore; release them now rather than
+      // when the whole step is done, so that peak memory stays at about one
+      // output channel above the size of the squeezed image.
+      input.channel[rc].plane = Plane<pixel_type>();
     }
     input.channel.erase(input.channel.begin() + offset,
                         input.channel.begin() + offset + (endc - beginc + 1));
@@ -355,6 +384,263 @@ Status InvSqueeze(Image &input, const std::vector<SqueezeParams> &parameters,
   return HWY_DYNAMIC_DISPATCH(InvSqueeze)(input, parameters, pool);
 }
 
+HWY_EXPORT(InvHSqueezeRows);
+HWY_EXPORT(InvVSqueezeRow);
+
+StatusOr<BandedInvSqueeze> BandedInvSqueeze::Create(
+    const Image &input, const std::vector<SqueezeParams> &parameters) {
+  BandedInvSqueeze result(input);
+  std::vector<Node> &nodes = result.nodes_;
+  std::vector<OutputChannel> &channels = result.output_;
+  const auto add_node = [&](size_t w, size_t h, int input_channel) {
+    nodes.emplace_back();
+    Node &node = nodes.back();
+    node.w = w;
+    node.h = h;
+    node.input_channel = input_channel;
+    node.horizontal = false;
+    node.avg = node.residual = 0;
+    node.begin = node.end = 0;
+    return nodes.size() - 1;
+  };
+  for (size_t c = 0; c < input.channel.size(); c++) {
+    const Channel &ch = input.channel[c];
+    channels.push_back(
+        {add_node(ch.w, ch.h, static_cast<int>(c)), ch.hshift, ch.vshift});
+  }
+
+  // Same channel bookkeeping as InvSqueeze, on nodes instead of samples.
+  const size_t nb_meta_channels = input.nb_meta_channels;
+  for (int i = parameters.size() - 1; i >= 0; i--) {
+    JXL_RETURN_IF_ERROR(
+        CheckMetaSqueezeParams(parameters[i], channels.size()));
+    bool horizontal = parameters[i].horizontal;
+    bool in_place = parameters[i].in_place;
+    uint32_t beginc = parameters[i].begin_c;
+    uint32_t endc = parameters[i].begin_c + parameters[i].num_c - 1;
+    uint32_t offset;
+    if (in_place) {
+      offset = endc + 1;
+    } else {
+      offset = channels.size() + beginc - endc - 1;
+    }
+    if (beginc < nb_meta_channels) {
+      result.streamable_ = false;
+      return result;
+    }
+
+    for (uint32_t c = beginc; c <= endc; c++) {
+      uint32_t rc = offset + c - beginc;
+      JXL_ASSERT(rc < channels.size());
+      const size_t avg = channels[c].node;
+      const size_t residual = channels[rc].node;
+      const size_t avg_w = nodes[avg].w;
+      const size_t avg_h = nodes[avg].h;
+      const size_t residual_w = nodes[residual].w;
+      const size_t residual_h = nodes[residual].h;
+      if (avg_w < residual_w || avg_h < residual_h) {
+        return JXL_FAILURE("Corrupted squeeze transform");
+      }
+      size_t out;
+      if (horizontal) {
+        JXL_ASSERT(avg_w == DivCeil(avg_w + residual_w, 2));
+        JXL_ASSERT(avg_h == residual_h);
+        channels[c].hshift--;
+        if (residual_w == 0) continue;
+        out = add_node(avg_w + residual_w, avg_h, -1);
+      } else {
+        JXL_ASSERT(avg_h == DivCeil(avg_h + residual_h, 2));
+        JXL_ASSERT(avg_w == residual_w);
+        channels[c].vshift--;
+        if (residual_h == 0) continue;
+        out = add_node(avg_w, avg_h + residual_h, -1);
+      }
+      nodes[out].horizontal = horizontal;
+      nodes[out].avg = avg;
+      nodes[out].residual = residual;
+      channels[c].node = out;
+    }
+    channels.erase(channels.begin() + offset,
+                   channels.begin() + offset + (endc - beginc + 1));
+  }
+
+  result.nb_meta_channels_ = nb_meta_channels;
+  for (size_t c = nb_meta_channels; c < channels.size(); c++) {
+    const Node &node = nodes[channels[c].node];
+    if (node.w == 0 || node.h != input.h || channels[c].vshift != 0) {
+      result.streamable_ = false;
+    }
+  }
+  return result;
+}
+
+const pixel_type *BandedInvSqueeze::Row(const Node &node, size_t y) const {
+  if (node.input_channel >= 0) {
+    return input_->channel[node.input_channel].Row(y);
+  }
+  JXL_DASSERT(y >= node.begin && y < node.end);
+  return node.rows.ConstRow(y - node.begin);
+}
+
+intptr_t BandedInvSqueeze::PixelsPerRow(const Node &node) const {
+  if (node.input_channel >= 0) {
+    return input_->channel[node.input_channel].plane.PixelsPerRow();
+  }
+  return node.rows.PixelsPerRow();
+}
+
+void BandedInvSqueeze::Need(size_t node, size_t begin, size_t end) {
+  Node &n = nodes_[node];
+  if (n.input_channel >= 0) return;
+  // An empty range still keeps the rows from `begin` for the next band.
+  n.need_begin = std::min(n.need_begin, begin);
+  if (begin < end) n.need_end = std::max(n.need_end, end);
+}
+
+Status BandedInvSqueeze::Produce(Node &node, ThreadPool *pool) {
+  JxlMemoryManager *memory_manager = input_->memory_manager();
+  // Move the rows that are still needed to the top of the window, then
+  // append the new ones.
+  const size_t kept = node.end - node.keep_begin;
+  const size_t rows = node.new_end - node.keep_begin;
+  if (node.w != 0 && rows > node.rows.ysize()) {
+    JXL_ASSIGN_OR_RETURN(
+        Plane<pixel_type> window,
+        Plane<pixel_type>::Create(memory_manager, node.w, rows));
+    for (size_t y = 0; y < kept; y++) {
+      memcpy(window.Row(y),
+             node.rows.ConstRow(node.keep_begin - node.begin + y),
+             node.w * sizeof(pixel_type));
+    }
+    node.rows = std::move(window);
+  } else if (node.w != 0 && node.keep_begin != node.begin) {
+    for (size_t y = 0; y < kept; y++) {
+      memcpy(node.rows.Row(y),
+             node.rows.ConstRow(node.keep_begin - node.begin + y),
+             node.w * sizeof(pixel_type));
+    }
+  }
+  node.begin = node.keep_begin;
+  const size_t first = node.end;
+  node.end = node.new_end;
+  if (node.w == 0 || node.end == first) return true;
+
+  const Node &avg = nodes_[node.avg];
+  const Node &residual = nodes_[node.residual];
+  ThreadPool *band_pool =
+      (node.end - first) * node.w < kMinPixelsForThreadedUnsqueeze ? nullptr
+                                                                   : pool;
+  if (node.horizontal) {
+    static constexpr const size_t kRowsPerThread = 8;
+    const auto unsqueeze_span = [&](const uint32_t task, size_t /* thread */) {
+      const size_t y0 = first + task * kRowsPerThread;
+      const size_t num = std::min(kRowsPerThread, node.end - y0);
+      HWY_DYNAMIC_DISPATCH(InvHSqueezeRows)
+      (Row(avg, y0), PixelsPerRow(avg), avg.w, Row(residual, y0),
+       PixelsPerRow(residual), residual.w, node.rows.Row(y0 - node.begin),
+       node.rows.PixelsPerRow(), num);
+    };
+    JXL_RETURN_IF_ERROR(RunOnPool(
+        band_pool, 0, DivCeil(node.end - first, kRowsPerThread),
+        ThreadPool::NoInit, unsqueeze_span, "InvHorizontalSqueezeBand"));
+    return true;
+  }
+
+  // Vertical: rows are produced in pairs, and each pair needs the output row
+  // above it, which the window kept.
+  static constexpr const int kColsPerThread = 64;
+  const size_t y_begin = first / 2;
+  const size_t y_end = DivCeil(node.end, 2);
+  const auto unsqueeze_slice = [&](const uint32_t task, size_t /* thread */) {
+    const size_t x0 = task * kColsPerThread;
+    const size_t x1 =
+        std::min(static_cast<size_t>(task + 1) * kColsPerThread, node.w);
+    for (size_t y = y_begin; y < y_end; y++) {
+      const pixel_type *p_avg = Row(avg, y) + x0;
+      pixel_type *p_out = node.rows.Row((y << 1) - node.begin) + x0;
+      if (y >= residual.h) {
+        // Last row of an output with an odd number of rows.
+        memcpy(p_out, p_avg, (x1 - x0) * sizeof(pixel_type));
+        continue;
+      }
+      HWY_DYNAMIC_DISPATCH(InvVSqueezeRow)
+      (Row(residual, y) + x0, p_avg,
+       Row(avg, y + 1 < avg.h ? y + 1 : y) + x0,
+       y > 0 ? node.rows.ConstRow((y << 1) - 1 - node.begin) + x0 : p_avg,
+       p_out, node.rows.Row((y << 1) + 1 - node.begin) + x0, x1 - x0);
+    }
+  };
+  JXL_RETURN_IF_ERROR(RunOnPool(band_pool, 0, DivCeil(node.w, kColsPerThread),
+                                ThreadPool::NoInit, unsqueeze_slice,
+                                "InvVertSqueezeBand"));
+  return true;
+}
+
+Status BandedInvSqueeze::Band(size_t y0, size_t y1, ThreadPool *pool,
+                              Image *band) {
+  JXL_ASSERT(streamable_);
+  JXL_ASSERT(y0 < y1 && y1 <= input_->h);
+  for (Node &node : nodes_) {
+    node.need_begin = node.h;
+    node.need_end = 0;
+  }
+  for (size_t c = nb_meta_channels_; c < output_.size(); c++) {
+    Need(output_[c].node, y0, y1);
+  }
+  // Nodes are created after their inputs, so going backwards plans every
+  // node after all of its consumers.
+  for (size_t i = nodes_.size(); i-- > 0;) {
+    Node &node = nodes_[i];
+    if (node.input_channel >= 0) continue;
+    size_t new_end = std::max(node.need_end, node.end);
+    size_t keep_begin = std::min(node.need_begin, node.end);
+    if (!node.horizontal) {
+      // Whole pairs of rows, and the row above the next pair.
+      if (new_end < node.h) new_end += new_end & 1;
+      if (node.end > 0) keep_begin = std::min(keep_begin, node.end - 1);
+    }
+    JXL_ASSERT(keep_begin >= node.begin);
+    node.keep_begin = keep_begin;
+    node.new_end = new_end;
+    if (node.end == node.h) continue;
+    if (node.horizontal) {
+      Need(node.avg, node.end, new_end);
+      Need(node.residual, node.end, new_end);
+    } else {
+      const size_t y_begin = node.end / 2;
+      const size_t y_end = DivCeil(new_end, 2);
+      Need(node.avg, y_begin, std::min(y_end + 1, nodes_[node.avg].h));
+      Need(node.residual, y_begin,
+           std::min(y_end, nodes_[node.residual].h));
+    }
+  }
+  for (Node &node : nodes_) {
+    if (node.input_channel < 0) JXL_RETURN_IF_ERROR(Produce(node, pool));
+  }
+
+  JxlMemoryManager *memory_manager = input_->memory_manager();
+  JXL_ASSIGN_OR_RETURN(Image result,
+                       Image::Create(memory_manager, input_->w, y1 - y0,
+                                     input_->bitdepth, 0));
+  result.nb_meta_channels = nb_meta_channels_;
+  for (size_t c = 0; c < output_.size(); c++) {
+    const OutputChannel &out = output_[c];
+    const Node &node = nodes_[out.node];
+    const bool whole = c < nb_meta_channels_;
+    const size_t first = whole ? 0 : y0;
+    const size_t ysize = whole ? node.h : y1 - y0;
+    JXL_ASSIGN_OR_RETURN(Channel ch,
+                         Channel::Create(memory_manager, node.w, ysize,
+                                         out.hshift, out.vshift));
+    for (size_t y = 0; y < ysize && node.w != 0; y++) {
+      memcpy(ch.Row(y), Row(node, first + y), node.w * sizeof(pixel_type));
+    }
+    result.channel.emplace_back(std::move(ch));
+  }
+  *band = std::move(result);
+  return true;
+}
+
 void DefaultSqueezeParameters(std::vector<SqueezeParams> *parameters,
                               const Image &image) {
   int nb_channels = image.channel.size() - image.nb_meta_channels;
@@ -35,6 +35,11 @@ namespace jxl {
 
 constexpr size_t kMaxFirstPreviewSize = 8;
 
+// Channels smaller than this are unsqueezed on the calling thread: the deep
+// squeeze levels are tiny, and dispatching them to the pool costs more than
+// the work itself.
+constexpr size_t kMinPixelsForThreadedUnsqueeze = 1 << 14;
+
 /*
         int avg=(A+B)>>1;
         int diff=(A-B);
@@ -86,6 +91,62 @@ Status MetaSqueeze(Image &image, std::vector<SqueezeParams> *parameters);
 Status InvSqueeze(Image &input, const std::vector<SqueezeParams> &parameters,
                   ThreadPool *pool);
 
+// Undoes a squeeze transform one band of rows at a time, so that the
+// full-resolution channels are never allocated in full: each intermediate
+// squeeze level only keeps the rows that the next band still needs.
+class BandedInvSqueeze {
+ public:
+  // `input` holds the squeezed channels; it is not modified and must outlive
+  // the returned object.
+  static StatusOr<BandedInvSqueeze> Create(
+      const Image &input, const std::vector<SqueezeParams> &parameters);
+
+  // Whether the output can be produced in bands: no meta channel is squeezed,
+  // and every other output channel has the full image height.
+  bool streamable() const { return streamable_; }
+  size_t nb_meta_channels() const { return nb_meta_channels_; }
+
+  // Sets `band` to rows [y0, y1) of the channels InvSqueeze would produce;
+  // meta channels are copied whole. Bands must cover the image top to bottom,
+  // without gaps.
+  Status Band(size_t y0, size_t y1, ThreadPool *pool, Image *band);
+
+ private:
+  // A channel at some squeeze level. Nodes that are not squeezed channels of
+  // the input are produced by undoing one squeeze step on two other nodes, and
+  // hold a window of their rows.
+  struct Node {
+    size_t w, h;
+    // Channel of the input holding the samples, or -1 for produced nodes.
+    int input_channel;
+    bool horizontal;
+    size_t avg, residual;
+    // Rows [begin, end) are in `rows`, starting from its first row.
+    Plane<pixel_type> rows;
+    size_t begin, end;
+    // Rows needed by the current band, and the window planned for it.
+    size_t need_begin, need_end;
+    size_t keep_begin, new_end;
+  };
+  struct OutputChannel {
+    size_t node;
+    int hshift, vshift;
+  };
+
+  explicit BandedInvSqueeze(const Image &input) : input_(&input) {}
+
+  const pixel_type *Row(const Node &node, size_t y) const;
+  intptr_t PixelsPerRow(const Node &node) const;
+  void Need(size_t node, size_t begin, size_t end);
+  Status Produce(Node &node, ThreadPool *pool);
+
+  const Image *input_;
+  std::vector<Node> nodes_;
+  std::vector<OutputChannel> output_;
+  size_t nb_meta_channels_ = 0;
+  bool streamable_ = true;
+};
+
 }  // namespace jxl
 
 #endif  // LIB_JXL_MODULAR_TRANSFORM_SQUEEZE_H_
@@ -48,6 +48,8 @@
 #include "lib/jxl/modular/encoding/encoding.h"
 #include "lib/jxl/modular/modular_image.h"
 #include "lib/jxl/modular/options.h"
+#include "lib/jxl/modular/transform/enc_squeeze.h"
+#include "lib/jxl/modular/transform/squeeze.h"
 #include "lib/jxl/modular/transform/transform.h"
 #include "lib/jxl/padded_bytes.h"
 #include "lib/jxl/test_image.h"
@@ -91,6 +93,164 @@ JXL_TSAN_SLOW_TEST(ModularTest, RoundtripLosslessGroups1024) {
   TestLosslessGroups(3);
 }
 
+// Decodes `compressed` with and without a thread pool and checks that the
+// results are identical.
+void TestSameDecodeWithThreads(const std::vector<uint8_t>& compressed,
+                               extras::PackedPixelFile* ppf_out) {
+  extras::JXLDecompressParams dparams;
+  dparams.accepted_formats = {{3, JXL_TYPE_UINT16, JXL_LITTLE_ENDIAN, 0}};
+  extras::PackedPixelFile serial;
+  ASSERT_TRUE(extras::DecodeImageJXL(compressed.data(), compressed.size(),
+                                     dparams, nullptr, &serial));
+  // The global squeeze is undone with per-channel thread pool gating.
+  test::ThreadPoolForTests pool(8);
+  dparams.runner = pool.get()->runner();
+  dparams.runner_opaque = pool.get()->runner_opaque();
+  ASSERT_TRUE(extras::DecodeImageJXL(compressed.data(), compressed.size(),
+                                     dparams, nullptr, ppf_out));
+  EXPECT_TRUE(test::SamePixels(serial, *ppf_out));
+}
+
+TEST(ModularTest, RoundtripLosslessResponsiveThreaded) {
+  const std::vector<uint8_t> orig = ReadTestData("jxl/flower/flower.png");
+  TestImage t;
+  t.DecodeFromBytes(orig).ClearMetadata();
+  t.SetDimensions(t.ppf().xsize() / 4, t.ppf().ysize() / 4);
+
+  extras::JXLCompressParams cparams;
+  cparams.distance = 0.0f;
+  cparams.AddOption(JXL_ENC_FRAME_SETTING_RESPONSIVE, 1);
+  std::vector<uint8_t> compressed;
+  ASSERT_TRUE(extras::EncodeImageJXL(cparams, t.ppf(), /*jpeg_bytes=*/nullptr,
+                                     &compressed));
+  extras::PackedPixelFile ppf_out;
+  TestSameDecodeWithThreads(compressed, &ppf_out);
+  EXPECT_EQ(0.0f, test::ComputeDistance2(t.ppf(), ppf_out));
+}
+
+TEST(ModularTest, RoundtripLossyResponsiveThreaded) {
+  const std::vector<uint8_t> orig = ReadTestData("jxl/flower/flower.png");
+  TestImage t;
+  t.DecodeFromBytes(orig).ClearMetadata();
+  t.SetDimensions(t.ppf().xsize() / 4, t.ppf().ysize() / 4);
+
+  extras::JXLCompressParams cparams;
+  cparams.distance = 2.0f;
+  cparams.AddOption(JXL_ENC_FRAME_SETTING_MODULAR, 1);
+  cparams.AddOption(JXL_ENC_FRAME_SETTING_RESPONSIVE, 1);
+  std::vector<uint8_t> compressed;
+  ASSERT_TRUE(extras::EncodeImageJXL(cparams, t.ppf(), /*jpeg_bytes=*/nullptr,
+                                     &compressed));
+  extras::PackedPixelFile ppf_out;
+  TestSameDecodeWithThreads(compressed, &ppf_out);
+}
+
+TEST(ModularTest, CompactChannelRoundtrip) {
+  JxlMemoryManager* memory_manager = jxl::test::MemoryManager();
+  const size_t xsize = 67;
+  const size_t ysize = 41;
+  JXL_ASSIGN_OR_DIE(Channel ch, Channel::Create(memory_manager, xsize, ysize));
+  JXL_ASSIGN_OR_DIE(ImageI expected,
+                    ImageI::Create(memory_manager, xsize, ysize));
+  Rng rng(0);
+  for (size_t y = 0; y < ysize; ++y) {
+    for (size_t x = 0; x < xsize; ++x) {
+      expected.Row(y)[x] = rng.UniformI(-32768, 32768);
+      ch.Row(y)[x] = expected.Row(y)[x];
+    }
+  }
+  ASSERT_TRUE(ch.Compact());
+  ASSERT_TRUE(ch.compact());
+
+  // Stores that fit keep the channel compact.
+  JXL_ASSIGN_OR_DIE(ImageI patch, ImageI::Create(memory_manager, 16, 8));
+  for (size_t y = 0; y < patch.ysize(); ++y) {
+    for (size_t x = 0; x < patch.xsize(); ++x) {
+      patch.Row(y)[x] = rng.UniformI(-32768, 32768);
+    }
+  }
+  const Rect rect(20, 30, 16, 8);
+  EXPECT_TRUE(ch.Fits(patch, rect));
+  ASSERT_TRUE(ch.StoreRect(patch, rect));
+  EXPECT_TRUE(ch.compact());
+  CopyImageTo(Rect(patch), patch, rect, &expected);
+  const Rect zero_rect(60, 0, 7, 5);
+  ch.ZeroFillRect(zero_rect);
+  FillPlane(0, &expected, zero_rect);
+
+  // Cloning keeps the compact storage.
+  JXL_ASSIGN_OR_DIE(Image image, Image::Create(memory_manager, xsize, ysize,
+                                               /*bitdepth=*/8, 0));
+  image.channel.emplace_back(std::move(ch));
+  JXL_ASSIGN_OR_DIE(Image clone, Image::Clone(image));
+  ASSERT_TRUE(clone.channel[0].compact());
+  ASSERT_TRUE(clone.channel[0].Expand());
+  JXL_ASSERT_OK(
+      VerifyRelativeError(expected, clone.channel[0].plane, 0, 0, _));
+
+  // A store that does not fit expands the channel.
+  Channel& compact = image.channel[0];
+  patch.Row(3)[5] = 40000;
+  EXPECT_FALSE(compact.Fits(patch, rect));
+  ASSERT_TRUE(compact.StoreRect(patch, rect));
+  EXPECT_FALSE(compact.compact());
+  EXPECT_TRUE(compact.Fits(patch, rect));
+  CopyImageTo(Rect(patch), patch, rect, &expected);
+  JXL_ASSERT_OK(VerifyRelativeError(expected, compact.plane, 0, 0, _));
+
+  // Samples that do not fit are never compacted.
+  ASSERT_TRUE(compact.Compact());
+  EXPECT_FALSE(compact.compact());
+  JXL_ASSERT_OK(VerifyRelativeError(expected, compact.plane, 0, 0, _));
+}
+
+TEST(ModularTest, BandedInvSqueezeMatchesInvSqueeze) {
+  JxlMemoryManager* memory_manager = jxl::test::MemoryManager();
+  test::ThreadPoolForTests pool(4);
+  // Odd sizes, and bands that do not line up with the squeeze levels.
+  const size_t xsize = 301;
+  const size_t ysize = 517;
+  for (size_t band_rows : {1, 7, 256}) {
+    JXL_ASSIGN_OR_DIE(Image image, Image::Create(memory_manager, xsize, ysize,
+                                                 /*bitdepth=*/8, 3));
+    Rng rng(band_rows);
+    for (Channel& ch : image.channel) {
+      for (size_t y = 0; y < ysize; ++y) {
+        for (size_t x = 0; x < xsize; ++x) {
+          ch.Row(y)[x] = (x + 2 * y + rng.UniformI(0, 32)) & 255;
+        }
+      }
+    }
+    std::vector<SqueezeParams> params;
+    DefaultSqueezeParameters(&params, image);
+    ASSERT_TRUE(FwdSqueeze(image, params, nullptr));
+
+    JXL_ASSIGN_OR_DIE(Image expected, Image::Clone(image));
+    ASSERT_TRUE(InvSqueeze(expected, params, pool.get()));
+    JXL_ASSIGN_OR_DIE(BandedInvSqueeze banded,
+                      BandedInvSqueeze::Create(image, params));
+    ASSERT_TRUE(banded.streamable());
+    for (size_t y0 = 0; y0 < ysize; y0 += band_rows) {
+      const size_t y1 = std::min(ysize, y0 + band_rows);
+      Image band{memory_manager};
+      ASSERT_TRUE(banded.Band(y0, y1, pool.get(), &band));
+      ASSERT_EQ(expected.channel.size(), band.channel.size());
+      for (size_t c = 0; c < band.channel.size(); ++c) {
+        const Channel& ch = band.channel[c];
+        ASSERT_EQ(xsize, ch.w);
+        ASSERT_EQ(y1 - y0, ch.h);
+        EXPECT_EQ(0, ch.hshift);
+        EXPECT_EQ(0, ch.vshift);
+        const Rect rect(0, y0, xsize, y1 - y0);
+        JXL_ASSIGN_OR_DIE(ImageI rows,
+                          ImageI::Create(memory_manager, xsize, y1 - y0));
+        CopyImageTo(rect, expected.channel[c].plane, Rect(rows), &rows);
+        JXL_ASSERT_OK(VerifyRelativeError(rows, ch.plane, 0, 0, _));
+      }
+    }
+  }
+}
+
 TEST(ModularTest, RoundtripLosslessCustomWpPermuteRCT) {
   const std::vector<uint8_t> orig =
       ReadTestData("external/wesaturate/500px/u76c0g_bliznaca_srgb8.png");
@@ -14,6 +14,21 @@
 
 namespace jxl {
 
+namespace {
+
+// Keeps the storage of `image` if it already has the requested size, e.g. from
+// a previous frame of the same dimensions; its contents are unspecified either
+// way.
+template <typename ImageT>
+Status ReuseOrCreate(JxlMemoryManager* memory_manager, size_t xsize,
+                     size_t ysize, ImageT* image) {
+  if (image->xsize() == xsize && image->ysize() == ysize) return true;
+  JXL_ASSIGN_OR_RETURN(*image, ImageT::Create(memory_manager, xsize, ysize));
+  return true;
+}
+
+}  // namespace
+
 Status InitializePassesSharedState(const FrameHeader& frame_header,
                                    PassesSharedState* JXL_RESTRICT shared,
                                    bool encoder) {
@@ -29,12 +44,12 @@ Status InitializePassesSharedState(const FrameHeader& frame_header,
       shared->ac_strategy,
       AcStrategyImage::Create(memory_manager, frame_dim.xsize_blocks,
                               frame_dim.ysize_blocks));
-  JXL_ASSIGN_OR_RETURN(shared->raw_quant_field,
-                       ImageI::Create(memory_manager, frame_dim.xsize_blocks,
-                                      frame_dim.ysize_blocks));
-  JXL_ASSIGN_OR_RETURN(shared->epf_sharpness,
-                       ImageB::Create(memory_manager, frame_dim.xsize_blocks,
-                                      frame_dim.ysize_blocks));
+  JXL_RETURN_IF_ERROR(ReuseOrCreate(memory_manager, frame_dim.xsize_blocks,
+                                    frame_dim.ysize_blocks,
+                                    &shared->raw_quant_field));
+  JXL_RETURN_IF_ERROR(ReuseOrCreate(memory_manager, frame_dim.xsize_blocks,
+                                    frame_dim.ysize_blocks,
+                                    &shared->epf_sharpness));
   JXL_ASSIGN_OR_RETURN(
       shared->cmap, ColorCorrelationMap::Create(memory_manager, frame_dim.xsize,
                                                 frame_dim.ysize));
@@ -50,9 +65,8 @@ Status InitializePassesSharedState(const FrameHeader& frame_header,
                                 kCoeffOrderMaxSize);
   }
 
-  JXL_ASSIGN_OR_RETURN(shared->quant_dc,
-                       ImageB::Create(memory_manager, frame_dim.xsize_blocks,
-                                      frame_dim.ysize_blocks));
+  JXL_RETURN_IF_ERROR(ReuseOrCreate(memory_manager, frame_dim.xsize_blocks,
+                                    frame_dim.ysize_blocks, &shared->quant_dc));
 
   bool use_dc_frame = ((frame_header.flags & FrameHeader::kUseDcFrame) != 0u);
   if (!encoder && use_dc_frame) {
@@ -70,9 +84,9 @@ Status InitializePassesSharedState(const FrameHeader& frame_header,
     }
     ZeroFillImage(&shared->quant_dc);
   } else {
-    JXL_ASSIGN_OR_RETURN(shared->dc_storage,
-                         Image3F::Create(memory_manager, frame_dim.xsize_blocks,
-                                         frame_dim.ysize_blocks));
+    JXL_RETURN_IF_ERROR(ReuseOrCreate(memory_manager, frame_dim.xsize_blocks,
+                                      frame_dim.ysize_blocks,
+                                      &shared->dc_storage));
     shared->dc = &shared->dc_storage;
   }
 
@@ -4,17 +4,26 @@
 // license that can be found in the LICENSE file.
 
 #include <jxl/cms.h>
+#include <jxl/encode.h>
+#include <jxl/encode_cxx.h>
 #include <jxl/memory_manager.h>
 
+#include <algorithm>
 #include <cstddef>
 #include <cstdint>
 #include <vector>
 
 #include "lib/extras/codec.h"
+#include "lib/extras/dec/jxl.h"
+#include "lib/extras/enc/jxl.h"
+#include "lib/extras/packed_image.h"
 #include "lib/jxl/base/override.h"
+#include "lib/jxl/base/random.h"
 #include "lib/jxl/base/span.h"
 #include "lib/jxl/enc_params.h"
+#include "lib/jxl/enc_patch_dictionary.h"
 #include "lib/jxl/image_test_utils.h"
+#include "lib/jxl/test_image.h"
 #include "lib/jxl/test_utils.h"
 #include "lib/jxl/testing.h"
 
@@ -24,6 +33,7 @@ namespace {
 using test::ButteraugliDistance;
 using test::ReadTestData;
 using test::Roundtrip;
+using test::TestImage;
 
 TEST(PatchDictionaryTest, GrayscaleModular) {
   JxlMemoryManager* memory_manager = jxl::test::MemoryManager();
@@ -65,5 +75,193 @@ TEST(PatchDictionaryTest, GrayscaleVarDCT) {
             1.1);
 }
 
+TEST(PatchDictionaryTest, SameResultWithThreads) {
+  JxlMemoryManager* memory_manager = jxl::test::MemoryManager();
+  const std::vector<uint8_t> orig = ReadTestData("jxl/grayscale_patches.png");
+  CodecInOut io{memory_manager};
+  ASSERT_TRUE(SetFromBytes(Bytes(orig), &io));
+
+  CompressParams cparams;
+  cparams.SetLossless();
+  cparams.patches = jxl::Override::kOn;
+
+  std::vector<uint8_t> serial;
+  ASSERT_TRUE(test::EncodeFile(cparams, &io, &serial));
+  test::ThreadPoolForTests pool(8);
+  std::vector<uint8_t> parallel;
+  ASSERT_TRUE(test::EncodeFile(cparams, &io, &parallel, pool.get()));
+  EXPECT_EQ(serial, parallel);
+}
+
+TEST(PatchDictionaryTest, SameResultWithThreadsVarDCT) {
+  JxlMemoryManager* memory_manager = jxl::test::MemoryManager();
+  const std::vector<uint8_t> orig = ReadTestData("jxl/grayscale_patches.png");
+  CodecInOut io{memory_manager};
+  ASSERT_TRUE(SetFromBytes(Bytes(orig), &io));
+
+  CompressParams cparams;
+  cparams.patches = jxl::Override::kOn;
+
+  std::vector<uint8_t> serial;
+  ASSERT_TRUE(test::EncodeFile(cparams, &io, &serial));
+  test::ThreadPoolForTests pool(8);
+  std::vector<uint8_t> parallel;
+  ASSERT_TRUE(test::EncodeFile(cparams, &io, &parallel, pool.get()));
+  EXPECT_EQ(serial, parallel);
+}
+
+// The float pixels of merged patches come from their first occurrence, which
+// matters for lossy encoding.
+TEST(PatchDictionaryTest, MergeCandidatesLikeSort) {
+  Rng rng(0);
+  std::vector<PatchInfo> candidates;
+  for (size_t i = 0; i < 200; i++) {
+    candidates.emplace_back();
+    // A few distinct patches with many occurrences each.
+    const int64_t id = rng.UniformI(0, 8);
+    QuantizedPatch& patch = candidates.back().first;
+    patch.xsize = 2 + id % 2;
+    patch.ysize = 2;
+    for (size_t c = 0; c < 3; c++) {
+      for (size_t k = 0; k < patch.xsize * patch.ysize; k++) {
+        patch.pixels[c][k] = (id >> (k % 3)) & 1;
+        patch.fpixels[c][k] = patch.pixels[c][k] + rng.UniformF(-0.4f, 0.4f);
+      }
+    }
+    // Scanline order, like the candidates found in the image.
+    candidates.back().second.emplace_back(rng.UniformU(0, 64), i);
+  }
+
+  std::vector<PatchInfo> expected = candidates;
+  std::sort(expected.begin(), expected.end());
+  size_t unique = 0;
+  for (size_t i = 1; i < expected.size(); i++) {
+    if (expected[i].first == expected[unique].first) {
+      expected[unique].second.insert(expected[unique].second.end(),
+                                     expected[i].second.begin(),
+                                     expected[i].second.end());
+    } else {
+      expected[++unique] = expected[i];
+    }
+  }
+  expected.resize(unique + 1);
+
+  test::ThreadPoolForTests pool(4);
+  std::vector<PatchInfo> merged =
+      MergePatchCandidates(std::move(candidates), pool.get());
+  ASSERT_EQ(expected.size(), merged.size());
+  for (size_t i = 0; i < merged.size(); i++) {
+    const QuantizedPatch& a = expected[i].first;
+    const QuantizedPatch& b = merged[i].first;
+    EXPECT_TRUE(a == b);
+    EXPECT_EQ(expected[i].second, merged[i].second);
+    for (size_t c = 0; c < 3; c++) {
+      for (size_t k = 0; k < a.xsize * a.ysize; k++) {
+        EXPECT_EQ(a.fpixels[c][k], b.fpixels[c][k]);
+      }
+    }
+  }
+}
+
+TEST(PatchDictionaryTest, ReuseAcrossFrames) {
+  const std::vector<uint8_t> orig = ReadTestData("jxl/grayscale_patches.png");
+  TestImage t;
+  t.DecodeFromBytes(orig).ClearMetadata();
+  // Two pages with the same glyphs.
+  extras::PackedPixelFile& ppf = t.ppf();
+  ppf.info.have_animation = JXL_TRUE;
+  ppf.info.animation.tps_numerator = 1;
+  ppf.info.animation.tps_denominator = 1;
+  ppf.frames[0].frame_info.duration = 1;
+  JXL_ASSIGN_OR_DIE(extras::PackedFrame page, ppf.frames[0].Copy());
+  ppf.frames.emplace_back(std::move(page));
+
+  extras::JXLCompressParams cparams;
+  cparams.distance = 0.0f;
+  cparams.AddOption(JXL_ENC_FRAME_SETTING_PATCHES, 1);
+  extras::JXLDecompressParams dparams;
+  dparams.accepted_formats.push_back(ppf.frames[0].color.format);
+
+  extras::PackedPixelFile ppf_separate;
+  size_t separate_size = Roundtrip(ppf, cparams, dparams, nullptr,
+                                   &ppf_separate);
+  cparams.AddOption(JXL_ENC_FRAME_SETTING_REUSE_PATCHES, 1);
+  extras::PackedPixelFile ppf_reused;
+  size_t reused_size = Roundtrip(ppf, cparams, dparams, nullptr, &ppf_reused);
+  EXPECT_LT(reused_size, separate_size);
+  EXPECT_TRUE(test::SamePixels(ppf, ppf_reused));
+}
+
+// A frame with its own patch dictionary replaces the reference frame of the
+// cached patches, so the next frame that reuses patches must not refer to them.
+TEST(PatchDictionaryTest, ReuseAfterFrameWithOwnPatches) {
+  const std::vector<uint8_t> orig = ReadTestData("jxl/grayscale_patches.png");
+  TestImage t;
+  t.DecodeFromBytes(orig).ClearMetadata();
+  extras::PackedPixelFile& ppf = t.ppf();
+  ppf.info.have_animation = JXL_TRUE;
+  ppf.info.animation.tps_numerator = 1;
+  ppf.info.animation.tps_denominator = 1;
+  ppf.info.uses_original_profile = JXL_TRUE;
+  ppf.frames[0].frame_info.duration = 1;
+  // Second page with inverted glyphs, so its patches differ from the first.
+  JXL_ASSIGN_OR_DIE(extras::PackedFrame inverted, ppf.frames[0].Copy());
+  uint8_t* bytes = reinterpret_cast<uint8_t*>(inverted.color.pixels());
+  for (size_t i = 0; i < inverted.color.pixels_size; i++) {
+    bytes[i] = 255 - bytes[i];
+  }
+  JXL_ASSIGN_OR_DIE(extras::PackedFrame last, ppf.frames[0].Copy());
+  ppf.frames.emplace_back(std::move(inverted));
+  ppf.frames.emplace_back(std::move(last));
+
+  JxlEncoderPtr enc = JxlEncoderMake(nullptr);
+  ASSERT_EQ(JXL_ENC_SUCCESS, JxlEncoderSetBasicInfo(enc.get(), &ppf.info));
+  ASSERT_EQ(JXL_ENC_SUCCESS,
+            JxlEncoderSetColorEncoding(enc.get(), &ppf.color_encoding));
+  for (size_t i = 0; i < ppf.frames.size(); i++) {
+    JxlEncoderFrameSettings* settings =
+        JxlEncoderFrameSettingsCreate(enc.get(), nullptr);
+    ASSERT_EQ(JXL_ENC_SUCCESS, JxlEncoderSetFrameLossless(settings, JXL_TRUE));
+    ASSERT_EQ(JXL_ENC_SUCCESS,
+              JxlEncoderFrameSettingsSetOption(
+                  settings, JXL_ENC_FRAME_SETTING_PATCHES, 1));
+    // Only the middle frame uses its own patches.
+    ASSERT_EQ(JXL_ENC_SUCCESS,
+              JxlEncoderFrameSettingsSetOption(
+                  settings, JXL_ENC_FRAME_SETTING_REUSE_PATCHES, i != 1));
+    JxlFrameHeader header;
+    JxlEncoderInitFrameHeader(&header);
+    header.duration = 1;
+    ASSERT_EQ(JXL_ENC_SUCCESS, JxlEncoderSetFrameHeader(settings, &header));
+    const extras::PackedImage& color = ppf.frames[i].color;
+    ASSERT_EQ(JXL_ENC_SUCCESS,
+              JxlEncoderAddImageFrame(settings, &color.format, color.pixels(),
+                                      color.pixels_size));
+  }
+  JxlEncoderCloseInput(enc.get());
+  std::vector<uint8_t> compressed(64);
+  uint8_t* next_out = compressed.data();
+  size_t avail_out = compressed.size();
+  JxlEncoderStatus result = JXL_ENC_NEED_MORE_OUTPUT;
+  while (result == JXL_ENC_NEED_MORE_OUTPUT) {
+    result = JxlEncoderProcessOutput(enc.get(), &next_out, &avail_out);
+    if (result == JXL_ENC_NEED_MORE_OUTPUT) {
+      size_t offset = next_out - compressed.data();
+      compressed.resize(compressed.size() * 2);
+      next_out = compressed.data() + offset;
+      avail_out = compressed.size() - offset;
+    }
+  }
+  ASSERT_EQ(JXL_ENC_SUCCESS, result);
+  compressed.resize(next_out - compressed.data());
+
+  extras::JXLDecompressParams dparams;
+  dparams.accepted_formats.push_back(ppf.frames[0].color.format);
+  extras::PackedPixelFile decoded;
+  ASSERT_TRUE(extras::DecodeImageJXL(compressed.data(), compressed.size(),
+                                     dparams, nullptr, &decoded));
+  EXPECT_TRUE(test::SamePixels(ppf, decoded));
+}
+
 }  // namespace
 }  // namespace jxl
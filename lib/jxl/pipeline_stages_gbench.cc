@@ -0,0 +1,635 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+// Micro-benchmarks of the hot stages of the decoder and encoder. Every
+// benchmark is registered once per compiled and supported SIMD target (e.g.
+// "BM_StageXYB/AVX2"), so that a regression in a single code path shows up in
+// the results; use --benchmark_filter to select stages or targets.
+
+#include <jxl/decode.h>
+#include <jxl/decode_cxx.h>
+#include <jxl/encode.h>
+#include <jxl/encode_cxx.h>
+#include <jxl/memory_manager.h>
+#include <jxl/types.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "hwy/targets.h"
+#include "lib/jxl/ac_strategy.h"
+#include "lib/jxl/base/common.h"
+#include "lib/jxl/base/compiler_specific.h"
+#include "lib/jxl/base/random.h"
+#include "lib/jxl/base/rect.h"
+#include "lib/jxl/base/status.h"
+#include "lib/jxl/chroma_from_luma.h"
+#include "lib/jxl/dec_ans.h"
+#include "lib/jxl/dec_bit_reader.h"
+#include "lib/jxl/dec_cache.h"
+#include "lib/jxl/dec_xyb.h"
+#include "lib/jxl/enc_ac_strategy.h"
+#include "lib/jxl/enc_ans.h"
+#include "lib/jxl/enc_bit_writer.h"
+#include "lib/jxl/enc_params.h"
+#include "lib/jxl/epf.h"
+#include "lib/jxl/frame_dimensions.h"
+#include "lib/jxl/image.h"
+#include "lib/jxl/image_metadata.h"
+#include "lib/jxl/image_ops.h"
+#include "lib/jxl/loop_filter.h"
+#include "lib/jxl/modular/encoding/enc_encoding.h"
+#include "lib/jxl/modular/encoding/enc_ma.h"
+#include "lib/jxl/modular/modular_image.h"
+#include "lib/jxl/modular/options.h"
+#include "lib/jxl/modular/transform/transform.h"
+#include "lib/jxl/quant_weights.h"
+#include "lib/jxl/render_pipeline/render_pipeline.h"
+#include "lib/jxl/render_pipeline/render_pipeline_stage.h"
+#include "lib/jxl/render_pipeline/stage_epf.h"
+#include "lib/jxl/render_pipeline/stage_from_linear.h"
+#include "lib/jxl/render_pipeline/stage_gaborish.h"
+#include "lib/jxl/render_pipeline/stage_loop_filter.h"
+#include "lib/jxl/render_pipeline/stage_upsampling.h"
+#include "lib/jxl/render_pipeline/stage_write.h"
+#include "lib/jxl/render_pipeline/stage_xyb.h"
+#include "tools/no_memory_manager.h"
+
+namespace jxl {
+namespace {
+
+constexpr size_t kImageSize = 1024;
+
+// Smooth gradients plus noise, in roughly the XYB value range.
+Image3F SyntheticXYB(size_t xsize, size_t ysize) {
+  JXL_ASSIGN_OR_DIE(
+      Image3F image,
+      Image3F::Create(jpegxl::tools::NoMemoryManager(), xsize, ysize));
+  Rng rng(0);
+  const float scale[3] = {0.02f, 0.8f, 0.8f};
+  for (size_t c = 0; c < 3; ++c) {
+    for (size_t y = 0; y < ysize; ++y) {
+      float* JXL_RESTRICT row = image.PlaneRow(c, y);
+      for (size_t x = 0; x < xsize; ++x) {
+        const float gradient = static_cast<float>(x + y) / (xsize + ysize);
+        row[x] = scale[c] * (0.8f * gradient + rng.UniformF(0.0f, 0.2f));
+      }
+    }
+  }
+  return image;
+}
+
+// Reads all channels, so that no earlier stage is skipped as unobservable.
+class ConsumeStage : public RenderPipelineStage {
+ public:
+  ConsumeStage() : RenderPipelineStage(RenderPipelineStage::Settings()) {}
+
+  Status ProcessRow(const RowInfo& input_rows, const RowInfo& output_rows,
+                    size_t xextra, size_t xsize, size_t xpos, size_t ypos,
+                    size_t thread_id) const final {
+    for (size_t c = 0; c < input_rows.size(); ++c) {
+      benchmark::DoNotOptimize(GetInputRow(input_rows, c, 0)[0]);
+    }
+    return true;
+  }
+
+  RenderPipelineChannelMode GetChannelMode(size_t c) const final {
+    return RenderPipelineChannelMode::kInput;
+  }
+
+  const char* GetName() const override { return "BENCH::Consume"; }
+};
+
+// Renders a whole frame through `stages` (with the low-memory pipeline the
+// decoder uses) in every iteration; groups are re-rendered like progressive
+// passes are. Copying the input into the group buffers is included in the
+// timing; BM_StageNone measures that overhead alone.
+void RunPipeline(benchmark::State& state, const FrameDimensions& frame_dim,
+                 std::vector<std::unique_ptr<RenderPipelineStage>> stages) {
+  JxlMemoryManager* memory_manager = jpegxl::tools::NoMemoryManager();
+  RenderPipeline::Builder builder(memory_manager, /*num_c=*/3);
+  for (auto& stage : stages) builder.AddStage(std::move(stage));
+  JXL_ASSIGN_OR_DIE(std::unique_ptr<RenderPipeline> pipeline,
+                    std::move(builder).Finalize(frame_dim));
+  JXL_CHECK(pipeline->PrepareForThreads(1, /*use_group_ids=*/false));
+  const Image3F input = SyntheticXYB(frame_dim.xsize, frame_dim.ysize);
+
+  for (auto _ : state) {
+    for (size_t g = 0; g < frame_dim.num_groups; ++g) {
+      const Rect group_rect = frame_dim.GroupRect(g);
+      RenderPipelineInput input_buffers = pipeline->GetInputBuffers(g, 0);
+      for (size_t c = 0; c < 3; ++c) {
+        const auto& buffer = input_buffers.GetBuffer(c);
+        CopyImageTo(group_rect, input.Plane(c), buffer.second, buffer.first);
+      }
+      JXL_CHECK(input_buffers.Done());
+    }
+    for (size_t g = 0; g < frame_dim.num_groups; ++g) pipeline->ClearDone(g);
+  }
+
+  // Output pixels per second.
+  state.SetItemsProcessed(state.iterations() * frame_dim.xsize_upsampled *
+                          frame_dim.ysize_upsampled);
+}
+
+FrameDimensions PipelineFrameDimensions(size_t upsampling = 1) {
+  FrameDimensions frame_dim;
+  frame_dim.Set(kImageSize, kImageSize, /*group_size_shift=*/1,
+                /*max_hshift=*/0, /*max_vshift=*/0, /*modular_mode=*/false,
+                upsampling);
+  return frame_dim;
+}
+
+void BM_StageNone(benchmark::State& state) {
+  std::vector<std::unique_ptr<RenderPipelineStage>> stages;
+  stages.push_back(jxl::make_unique<ConsumeStage>());
+  RunPipeline(state, PipelineFrameDimensions(), std::move(stages));
+}
+
+void BM_StageGaborish(benchmark::State& state) {
+  LoopFilter lf;
+  lf.gab = true;
+  std::vector<std::unique_ptr<RenderPipelineStage>> stages;
+  stages.push_back(GetGaborishStage(lf));
+  stages.push_back(jxl::make_unique<ConsumeStage>());
+  RunPipeline(state, PipelineFrameDimensions(), std::move(stages));
+}
+
+// Argument: which of the three EPF steps.
+void BM_StageEPF(benchmark::State& state) {
+  const FrameDimensions frame_dim = PipelineFrameDimensions();
+  JXL_ASSIGN_OR_DIE(ImageF sigma,
+                    ImageF::Create(jpegxl::tools::NoMemoryManager(),
+                                   frame_dim.xsize_blocks + 2 * kSigmaPadding,
+                                   frame_dim.ysize_blocks + 2 * kSigmaPadding));
+  // Inverse sigma of every block; any value above kMinSigma is filtered.
+  FillImage(-1.0f, &sigma);
+  LoopFilter lf;
+  lf.epf_iters = 3;
+  std::vector<std::unique_ptr<RenderPipelineStage>> stages;
+  stages.push_back(GetEPFStage(lf, sigma, state.range(0)));
+  stages.push_back(jxl::make_unique<ConsumeStage>());
+  RunPipeline(state, frame_dim, std::move(stages));
+}
+
+// Gaborish and all three EPF steps, as the decoder runs them at the highest
+// EPF level. Argument: whether they run as a single fused stage.
+void BM_StageLoopFilter(benchmark::State& state) {
+  const FrameDimensions frame_dim = PipelineFrameDimensions();
+  JXL_ASSIGN_OR_DIE(ImageF sigma,
+                    ImageF::Create(jpegxl::tools::NoMemoryManager(),
+                                   frame_dim.xsize_blocks + 2 * kSigmaPadding,
+                                   frame_dim.ysize_blocks + 2 * kSigmaPadding));
+  FillImage(-1.0f, &sigma);
+  LoopFilter lf;
+  lf.gab = true;
+  lf.epf_iters = 3;
+  std::vector<std::unique_ptr<RenderPipelineStage>> stages;
+  if (state.range(0)) {
+    stages.push_back(
+        GetLoopFilterStage(jpegxl::tools::NoMemoryManager(), lf, sigma));
+  } else {
+    stages.push_back(GetGaborishStage(lf));
+    for (size_t i = 0; i < 3; ++i) {
+      stages.push_back(GetEPFStage(lf, sigma, i));
+    }
+  }
+  stages.push_back(jxl::make_unique<ConsumeStage>());
+  RunPipeline(state, frame_dim, std::move(stages));
+}
+
+// Argument: log2 of the upsampling factor.
+void BM_StageUpsampling(benchmark::State& state) {
+  const size_t shift = state.range(0);
+  CustomTransformData ups_factors;
+  std::vector<std::unique_ptr<RenderPipelineStage>> stages;
+  for (size_t c = 0; c < 3; ++c) {
+    stages.push_back(GetUpsamplingStage(ups_factors, c, shift));
+  }
+  stages.push_back(jxl::make_unique<ConsumeStage>());
+  RunPipeline(state, PipelineFrameDimensions(1 << shift), std::move(stages));
+}
+
+void BM_StageXYB(benchmark::State& state) {
+  CodecMetadata metadata;
+  metadata.m.xyb_encoded = true;
+  OutputEncodingInfo output_encoding_info;
+  JXL_CHECK(output_encoding_info.SetFromMetadata(metadata));
+  std::vector<std::unique_ptr<RenderPipelineStage>> stages;
+  stages.push_back(GetXYBStage(output_encoding_info));
+  stages.push_back(jxl::make_unique<ConsumeStage>());
+  RunPipeline(state, PipelineFrameDimensions(), std::move(stages));
+}
+
+// Argument: JxlDataType of the interleaved RGB output buffer.
+void BM_StageWrite(benchmark::State& state) {
+  const JxlDataType data_type = static_cast<JxlDataType>(state.range(0));
+  const size_t bytes_per_sample = data_type == JXL_TYPE_FLOAT    ? 4
+                                  : data_type == JXL_TYPE_UINT16 ? 2
+                                                                 : 1;
+  ImageOutput main_output;
+  main_output.format = {3, data_type, JXL_NATIVE_ENDIAN, 0};
+  main_output.bits_per_sample = 8 * bytes_per_sample;
+  main_output.stride = kImageSize * 3 * bytes_per_sample;
+  std::vector<uint8_t> buffer(main_output.stride * kImageSize);
+  main_output.buffer = buffer.data();
+  main_output.buffer_size = buffer.size();
+  std::vector<ImageOutput> extra_output;
+  std::vector<std::unique_ptr<RenderPipelineStage>> stages;
+  stages.push_back(GetWriteToOutputStage(
+      main_output, kImageSize, kImageSize, /*has_alpha=*/false,
+      /*unpremul_alpha=*/false, /*alpha_c=*/0, Orientation::kIdentity,
+      extra_output, jpegxl::tools::NoMemoryManager()));
+  RunPipeline(state, PipelineFrameDimensions(), std::move(stages));
+}
+
+// XYB to opaque 16-bit sRGB RGBA, the path of 16-bit and HDR outputs.
+// Argument: whether the conversion and the write run as a single fused stage.
+void BM_StageXYBToOutput(benchmark::State& state) {
+  CodecMetadata metadata;
+  metadata.m.xyb_encoded = true;
+  OutputEncodingInfo output_encoding_info;
+  JXL_CHECK(output_encoding_info.SetFromMetadata(metadata));
+  ImageOutput main_output;
+  main_output.format = {4, JXL_TYPE_UINT16, JXL_NATIVE_ENDIAN, 0};
+  main_output.bits_per_sample = 16;
+  main_output.stride = kImageSize * 4 * 2;
+  std::vector<uint8_t> buffer(main_output.stride * kImageSize);
+  main_output.buffer = buffer.data();
+  main_output.buffer_size = buffer.size();
+  std::vector<ImageOutput> extra_output;
+  JxlMemoryManager* memory_manager = jpegxl::tools::NoMemoryManager();
+  std::vector<std::unique_ptr<RenderPipelineStage>> stages;
+  if (state.range(0)) {
+    stages.push_back(GetXYBToOutputStage(
+        output_encoding_info, main_output, kImageSize, kImageSize,
+        /*has_alpha=*/false, /*unpremul_alpha=*/false, /*alpha_c=*/0,
+        Orientation::kIdentity, extra_output, memory_manager));
+  } else {
+    stages.push_back(GetXYBStage(output_encoding_info));
+    stages.push_back(GetFromLinearStage(output_encoding_info));
+    stages.push_back(GetWriteToOutputStage(
+        main_output, kImageSize, kImageSize, /*has_alpha=*/false,
+        /*unpremul_alpha=*/false, /*alpha_c=*/0, Orientation::kIdentity,
+        extra_output, memory_manager));
+  }
+  RunPipeline(state, PipelineFrameDimensions(), std::move(stages));
+}
+
+// Random tokens with geometrically distributed values, similar to residuals.
+std::vector<Token> SyntheticTokens(size_t num_contexts, size_t num_tokens,
+                                   bool repetitive) {
+  Rng rng(0);
+  const Rng::GeometricDistribution dist = Rng::MakeGeometric(0.1f);
+  std::vector<Token> tokens;
+  tokens.reserve(num_tokens);
+  while (tokens.size() < num_tokens) {
+    if (repetitive && tokens.size() > 64 && rng.Bernoulli(0.2f)) {
+      // Copy a run from earlier in the stream, which LZ77 can pick up.
+      const size_t len = std::min<size_t>(rng.UniformU(4, 64),
+                                          num_tokens - tokens.size());
+      const size_t from = rng.UniformU(0, tokens.size() - len);
+      for (size_t i = 0; i < len; ++i) tokens.push_back(tokens[from + i]);
+      continue;
+    }
+    tokens.emplace_back(rng.UniformU(0, num_contexts), rng.Geometric(dist));
+  }
+  return tokens;
+}
+
+// Argument: 1 for prefix codes, 0 for ANS.
+void BM_ANSSymbolReader(benchmark::State& state) {
+  JxlMemoryManager* memory_manager = jpegxl::tools::NoMemoryManager();
+  constexpr size_t kNumContexts = 8;
+  constexpr size_t kNumTokens = 1 << 18;
+  std::vector<std::vector<Token>> tokens = {
+      SyntheticTokens(kNumContexts, kNumTokens, /*repetitive=*/false)};
+
+  HistogramParams params;
+  params.force_huffman = state.range(0) != 0;
+  params.lz77_method = HistogramParams::LZ77Method::kNone;
+  BitWriter writer{memory_manager};
+  EntropyEncodingData codes;
+  std::vector<uint8_t> context_map;
+  BuildAndEncodeHistograms(memory_manager, params, kNumContexts, tokens,
+                           &codes, &context_map, &writer, 0, nullptr);
+  WriteTokens(tokens[0], codes, context_map, 0, &writer, 0, nullptr);
+  writer.ZeroPadToByte();
+
+  ANSCode decoded_codes;
+  std::vector<uint8_t> decoded_context_map;
+  size_t histogram_bits;
+  {
+    BitReader br(writer.GetSpan());
+    JXL_CHECK(DecodeHistograms(memory_manager, &br, kNumContexts,
+                               &decoded_codes, &decoded_context_map));
+    histogram_bits = br.TotalBitsConsumed();
+    JXL_CHECK(br.Close());
+  }
+
+  for (auto _ : state) {
+    BitReader br(writer.GetSpan());
+    br.SkipBits(histogram_bits);
+    JXL_ASSIGN_OR_DIE(ANSSymbolReader reader,
+                      ANSSymbolReader::Create(&decoded_codes, &br));
+    size_t sum = 0;
+    for (const Token& token : tokens[0]) {
+      sum += reader.ReadHybridUint(token.context, &br, decoded_context_map);
+    }
+    benchmark::DoNotOptimize(sum);
+    JXL_CHECK(reader.CheckANSFinalState());
+    JXL_CHECK(br.Close());
+  }
+
+  // Symbols per second.
+  state.SetItemsProcessed(state.iterations() * kNumTokens);
+}
+
+// Argument: HistogramParams::LZ77Method. Also includes clustering and
+// histogram encoding, which kNone measures alone.
+void BM_ApplyLZ77(benchmark::State& state) {
+  JxlMemoryManager* memory_manager = jpegxl::tools::NoMemoryManager();
+  constexpr size_t kNumContexts = 8;
+  constexpr size_t kNumTokens = 1 << 16;
+  const std::vector<Token> input =
+      SyntheticTokens(kNumContexts, kNumTokens, /*repetitive=*/true);
+  HistogramParams params;
+  params.lz77_method =
+      static_cast<HistogramParams::LZ77Method>(state.range(0));
+
+  for (auto _ : state) {
+    state.PauseTiming();
+    // BuildAndEncodeHistograms replaces the tokens by their LZ77 version.
+    std::vector<std::vector<Token>> tokens = {input};
+    BitWriter writer{memory_manager};
+    EntropyEncodingData codes;
+    std::vector<uint8_t> context_map;
+    state.ResumeTiming();
+    BuildAndEncodeHistograms(memory_manager, params, kNumContexts, tokens,
+                             &codes, &context_map, &writer, 0, nullptr);
+  }
+
+  // Tokens per second.
+  state.SetItemsProcessed(state.iterations() * kNumTokens);
+}
+
+// Learns a MA tree for a synthetic 3-channel image; the time is dominated by
+// FindBestSplit.
+void BM_FindBestSplit(benchmark::State& state) {
+  JxlMemoryManager* memory_manager = jpegxl::tools::NoMemoryManager();
+  constexpr size_t kSize = 256;
+  JXL_ASSIGN_OR_DIE(Image image, Image::Create(memory_manager, kSize, kSize,
+                                               /*bitdepth=*/8, 3));
+  Rng rng(0);
+  for (size_t c = 0; c < 3; ++c) {
+    for (size_t y = 0; y < kSize; ++y) {
+      pixel_type* JXL_RESTRICT row = image.channel[c].plane.Row(y);
+      for (size_t x = 0; x < kSize; ++x) {
+        row[x] = static_cast<pixel_type>((x + y * c) / 4 + rng.UniformU(0, 8));
+      }
+    }
+  }
+
+  ModularOptions options;
+  options.predictor = Predictor::Gradient;
+  TreeSamples samples;
+  JXL_CHECK(samples.SetPredictor(options.predictor, options.wp_tree_mode));
+  JXL_CHECK(samples.SetProperties(options.splitting_heuristics_properties,
+                                  options.wp_tree_mode));
+  std::vector<pixel_type> pixel_samples;
+  std::vector<pixel_type> diff_samples;
+  std::vector<uint32_t> group_pixel_count;
+  std::vector<uint32_t> channel_pixel_count;
+  CollectPixelSamples(image, options, 0, group_pixel_count,
+                      channel_pixel_count, pixel_samples, diff_samples);
+  StaticPropRange range;
+  range[0] = {{0, 3}};
+  range[1] = {{0, 1}};
+  samples.PreQuantizeProperties(range, {}, group_pixel_count,
+                                channel_pixel_count, pixel_samples,
+                                diff_samples, options.max_property_values);
+  size_t total_pixels = 0;
+  JXL_CHECK(ModularGenericCompress(image, options, /*writer=*/nullptr,
+                                   /*aux_out=*/nullptr, 0, 0, &samples,
+                                   &total_pixels));
+
+  for (auto _ : state) {
+    state.PauseTiming();
+    TreeSamples copy = samples;
+    state.ResumeTiming();
+    Tree tree = LearnTree(std::move(copy), total_pixels, options, {}, range);
+    benchmark::DoNotOptimize(tree.size());
+  }
+
+  // Samples per second.
+  state.SetItemsProcessed(state.iterations() * samples.NumSamples());
+}
+
+// Block size selection (ProcessRectACS) at the default effort.
+void BM_ProcessRectACS(benchmark::State& state) {
+  JxlMemoryManager* memory_manager = jpegxl::tools::NoMemoryManager();
+  FrameDimensions frame_dim;
+  frame_dim.Set(kImageSize, kImageSize, /*group_size_shift=*/1,
+                /*max_hshift=*/0, /*max_vshift=*/0, /*modular_mode=*/false,
+                /*upsampling=*/1);
+  const Image3F opsin = SyntheticXYB(frame_dim.xsize_padded,
+                                     frame_dim.ysize_padded);
+  // Constant fields, as used with disable_perceptual_optimizations.
+  constexpr float kDistance = 1.0f;
+  const float q = 0.79f / kDistance;
+  JXL_ASSIGN_OR_DIE(ImageF quant_field,
+                    ImageF::Create(memory_manager, frame_dim.xsize_blocks,
+                                   frame_dim.ysize_blocks));
+  FillImage(q, &quant_field);
+  JXL_ASSIGN_OR_DIE(ImageF masking,
+                    ImageF::Create(memory_manager, frame_dim.xsize_blocks,
+                                   frame_dim.ysize_blocks));
+  FillImage(1.0f / (q + 0.001f), &masking);
+  JXL_ASSIGN_OR_DIE(ImageF masking1x1,
+                    ImageF::Create(memory_manager, frame_dim.xsize_padded,
+                                   frame_dim.ysize_padded));
+  FillImage(1.0f / (q + 0.001f), &masking1x1);
+  JXL_ASSIGN_OR_DIE(ColorCorrelationMap cmap,
+                    ColorCorrelationMap::Create(memory_manager,
+                                                frame_dim.xsize,
+                                                frame_dim.ysize));
+  JXL_ASSIGN_OR_DIE(AcStrategyImage ac_strategy,
+                    AcStrategyImage::Create(memory_manager,
+                                            frame_dim.xsize_blocks,
+                                            frame_dim.ysize_blocks));
+
+  CompressParams cparams;
+  cparams.butteraugli_distance = kDistance;
+  DequantMatrices matrices;
+  AcStrategyHeuristics heuristics(cparams);
+  heuristics.Init(opsin, Rect(opsin), quant_field, masking, masking1x1,
+                  &matrices);
+  heuristics.PrepareForThreads(1);
+
+  for (auto _ : state) {
+    for (size_t by = 0; by < frame_dim.ysize_blocks;
+         by += kEncTileDimInBlocks) {
+      for (size_t bx = 0; bx < frame_dim.xsize_blocks;
+           bx += kEncTileDimInBlocks) {
+        const Rect rect(bx, by, kEncTileDimInBlocks, kEncTileDimInBlocks,
+                        frame_dim.xsize_blocks, frame_dim.ysize_blocks);
+        heuristics.ProcessRect(rect, cmap, &ac_strategy, 0);
+      }
+    }
+  }
+
+  // Pixels per second.
+  state.SetItemsProcessed(state.iterations() * frame_dim.xsize *
+                          frame_dim.ysize);
+}
+
+// Decodes a VarDCT image encoded at a low distance and without Gaborish and
+// EPF, so that most of the time is spent in the DecodeACVarBlock loop.
+void BM_DecodeACVarBlock(benchmark::State& state) {
+  const Image3F texture = SyntheticXYB(kImageSize, kImageSize);
+  std::vector<uint8_t> pixels(kImageSize * kImageSize * 3);
+  for (size_t y = 0; y < kImageSize; ++y) {
+    for (size_t x = 0; x < kImageSize; ++x) {
+      for (size_t c = 0; c < 3; ++c) {
+        const float v = texture.ConstPlaneRow(1, y)[x] +
+                        texture.ConstPlaneRow(c, y)[x] * (c == 1 ? 0.f : 4.f);
+        pixels[(y * kImageSize + x) * 3 + c] =
+            static_cast<uint8_t>(std::min(std::max(v, 0.0f), 1.0f) * 255);
+      }
+    }
+  }
+
+  JxlEncoderPtr enc = JxlEncoderMake(nullptr);
+  JxlBasicInfo info;
+  JxlEncoderInitBasicInfo(&info);
+  info.xsize = kImageSize;
+  info.ysize = kImageSize;
+  JXL_CHECK(JXL_ENC_SUCCESS == JxlEncoderSetBasicInfo(enc.get(), &info));
+  JxlColorEncoding color_encoding;
+  JxlColorEncodingSetToSRGB(&color_encoding, /*is_gray=*/JXL_FALSE);
+  JXL_CHECK(JXL_ENC_SUCCESS ==
+            JxlEncoderSetColorEncoding(enc.get(), &color_encoding));
+  JxlEncoderFrameSettings* settings =
+      JxlEncoderFrameSettingsCreate(enc.get(), nullptr);
+  JXL_CHECK(JXL_ENC_SUCCESS == JxlEncoderSetFrameDistance(settings, 0.3f));
+  JXL_CHECK(JXL_ENC_SUCCESS ==
+            JxlEncoderFrameSettingsSetOption(
+                settings, JXL_ENC_FRAME_SETTING_GABORISH, 0));
+  JXL_CHECK(JXL_ENC_SUCCESS ==
+            JxlEncoderFrameSettingsSetOption(settings,
+                                             JXL_ENC_FRAME_SETTING_EPF, 0));
+  const JxlPixelFormat format = {3, JXL_TYPE_UINT8, JXL_NATIVE_ENDIAN, 0};
+  JXL_CHECK(JXL_ENC_SUCCESS == JxlEncoderAddImageFrame(settings, &format,
+                                                       pixels.data(),
+                                                       pixels.size()));
+  JxlEncoderCloseInput(enc.get());
+  std::vector<uint8_t> compressed(64);
+  uint8_t* next_out = compressed.data();
+  size_t avail_out = compressed.size();
+  JxlEncoderStatus process_result;
+  while ((process_result = JxlEncoderProcessOutput(
+              enc.get(), &next_out, &avail_out)) == JXL_ENC_NEED_MORE_OUTPUT) {
+    const size_t offset = next_out - compressed.data();
+    compressed.resize(compressed.size() * 2);
+    next_out = compressed.data() + offset;
+    avail_out = compressed.size() - offset;
+  }
+  JXL_CHECK(process_result == JXL_ENC_SUCCESS);
+  compressed.resize(next_out - compressed.data());
+
+  for (auto _ : state) {
+    JxlDecoderPtr dec = JxlDecoderMake(nullptr);
+    JXL_CHECK(JXL_DEC_SUCCESS ==
+              JxlDecoderSubscribeEvents(dec.get(), JXL_DEC_FULL_IMAGE));
+    JXL_CHECK(JXL_DEC_SUCCESS == JxlDecoderSetInput(dec.get(),
+                                                    compressed.data(),
+                                                    compressed.size()));
+    JxlDecoderCloseInput(dec.get());
+    for (;;) {
+      const JxlDecoderStatus status = JxlDecoderProcessInput(dec.get());
+      if (status == JXL_DEC_NEED_IMAGE_OUT_BUFFER) {
+        JXL_CHECK(JXL_DEC_SUCCESS ==
+                  JxlDecoderSetImageOutBuffer(dec.get(), &format,
+                                              pixels.data(), pixels.size()));
+      } else {
+        JXL_CHECK(status == JXL_DEC_FULL_IMAGE);
+        break;
+      }
+    }
+  }
+
+  // Pixels per second.
+  state.SetItemsProcessed(state.iterations() * kImageSize * kImageSize);
+  state.SetBytesProcessed(state.iterations() * compressed.size());
+}
+
+using BenchmarkFunction = void (*)(benchmark::State&);
+
+// Registers `function` as "`name`/<target>" for the given SIMD target; the
+// target is forced for both the setup and the timed part of the benchmark.
+benchmark::internal::Benchmark* RegisterForTarget(const char* name,
+                                                  BenchmarkFunction function,
+                                                  int64_t target) {
+  const std::string full_name =
+      std::string(name) + "/" + hwy::TargetName(target);
+  return benchmark::RegisterBenchmark(
+      full_name.c_str(), [function, target](benchmark::State& state) {
+        hwy::SetSupportedTargetsForTest(target);
+        function(state);
+        hwy::SetSupportedTargetsForTest(0);
+      });
+}
+
+int RegisterBenchmarks() {
+  for (const int64_t target : hwy::SupportedAndGeneratedTargets()) {
+    RegisterForTarget("BM_StageNone", BM_StageNone, target);
+    RegisterForTarget("BM_StageGaborish", BM_StageGaborish, target);
+    RegisterForTarget("BM_StageEPF", BM_StageEPF, target)
+        ->ArgName("step")
+        ->DenseRange(0, 2);
+    RegisterForTarget("BM_StageLoopFilter", BM_StageLoopFilter, target)
+        ->ArgName("fused")
+        ->DenseRange(0, 1);
+    RegisterForTarget("BM_StageUpsampling", BM_StageUpsampling, target)
+        ->ArgName("shift")
+        ->DenseRange(1, 3);
+    RegisterForTarget("BM_StageXYB", BM_StageXYB, target);
+    RegisterForTarget("BM_StageWrite", BM_StageWrite, target)
+        ->ArgName("type")
+        ->Arg(JXL_TYPE_UINT8)
+        ->Arg(JXL_TYPE_UINT16)
+        ->Arg(JXL_TYPE_FLOAT);
+    RegisterForTarget("BM_StageXYBToOutput", BM_StageXYBToOutput, target)
+        ->ArgName("fused")
+        ->DenseRange(0, 1);
+    RegisterForTarget("BM_DecodeACVarBlock", BM_DecodeACVarBlock, target)
+        ->Unit(benchmark::kMillisecond);
+    RegisterForTarget("BM_ANSSymbolReader", BM_ANSSymbolReader, target)
+        ->ArgName("prefix")
+        ->DenseRange(0, 1);
+    RegisterForTarget("BM_FindBestSplit", BM_FindBestSplit, target)
+        ->Unit(benchmark::kMillisecond);
+    RegisterForTarget("BM_ProcessRectACS", BM_ProcessRectACS, target)
+        ->Unit(benchmark::kMillisecond);
+    RegisterForTarget("BM_ApplyLZ77", BM_ApplyLZ77, target)
+        ->ArgName("method")
+        ->Arg(static_cast<int>(HistogramParams::LZ77Method::kNone))
+        ->Arg(static_cast<int>(HistogramParams::LZ77Method::kRLE))
+        ->Arg(static_cast<int>(HistogramParams::LZ77Method::kLZ77))
+        ->Arg(static_cast<int>(HistogramParams::LZ77Method::kOptimal));
+  }
+  return 0;
+}
+
+JXL_MAYBE_UNUSED const int kRegistered = RegisterBenchmarks();
+
+}  // namespace
+}  // namespace jxl
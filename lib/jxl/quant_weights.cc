@@ -489,12 +489,13 @@ Status DequantMatrices::Decode(JxlMemoryManager* memory_manager, BitReader* br,
   size_t num_tables = all_default ? 0 : static_cast<size_t>(kNum);
   encodings_.clear();
   encodings_.resize(kNum, QuantEncoding::Library(0));
+  computed_mask_ = 0;
   for (size_t i = 0; i < num_tables; i++) {
     JXL_RETURN_IF_ERROR(jxl::Decode(
         memory_manager, br, &encodings_[i], required_size_x[i % kNum],
         required_size_y[i % kNum], i, modular_frame_decoder));
   }
-  computed_mask_ = 0;
+  UpdateComputedMask();
   return true;
 }
 
@@ -1161,6 +1162,7 @@ const QuantEncoding* DequantMatrices::Library() {
 DequantMatrices::DequantMatrices() {
   encodings_.resize(static_cast<size_t>(QuantTable::kNum),
                     QuantEncoding::Library(0));
+  stored_encodings_ = encodings_;
   size_t pos = 0;
   size_t offsets[kNum * 3];
   for (size_t i = 0; i < static_cast<size_t>(QuantTable::kNum); i++) {
@@ -1177,6 +1179,46 @@ DequantMatrices::DequantMatrices() {
   }
 }
 
+namespace {
+
+// Whether `a` and `b` give the same tables. Only the library and RAW
+// encodings, which are the ones repeated across frames, are compared.
+bool SameTables(const QuantEncoding& a, const QuantEncoding& b) {
+  if (a.mode != b.mode) return false;
+  if (a.mode == QuantEncoding::kQuantModeLibrary) {
+    return a.predefined == b.predefined;
+  }
+  if (a.mode == QuantEncoding::kQuantModeRAW) {
+    return a.qraw.qtable && b.qraw.qtable &&
+           *a.qraw.qtable == *b.qraw.qtable &&
+           a.qraw.qtable_den == b.qraw.qtable_den;
+  }
+  return false;
+}
+
+}  // namespace
+
+void DequantMatrices::UpdateComputedMask() {
+  computed_mask_ = 0;
+  if (encodings_.size() != kNum) return;
+  for (size_t i = 0; i < AcStrategy::kNumValidStrategies; i++) {
+    size_t table = static_cast<size_t>(kQuantTable[i]);
+    if (!(stored_table_mask_ & (1u << table))) continue;
+    if (!SameTables(encodings_[table], stored_encodings_[table])) continue;
+    computed_mask_ |= 1u << i;
+  }
+}
+
+void DequantMatrices::ResetToDefault() {
+  encodings_.assign(static_cast<size_t>(QuantTable::kNum),
+                    QuantEncoding::Library(0));
+  UpdateComputedMask();
+  for (size_t c = 0; c < 3; c++) {
+    dc_quant_[c] = kDCQuant[c];
+    inv_dc_quant_[c] = kInvDCQuant[c];
+  }
+}
+
 Status DequantMatrices::EnsureComputed(uint32_t acs_mask) {
   const QuantEncoding* library = Library();
 
@@ -1213,6 +1255,7 @@ Status DequantMatrices::EnsureComputed(uint32_t acs_mask) {
   for (size_t table = 0; table < kNum; table++) {
     if ((1 << table) & computed_kind_mask) continue;
     if ((1 << table) & ~kind_mask) continue;
+    stored_table_mask_ &= ~(1u << table);
     size_t pos = offsets[table * 3];
     if (encodings_[table].mode == QuantEncoding::kQuantModeLibrary) {
       JXL_CHECK(HWY_DYNAMIC_DISPATCH(ComputeQuantTable)(
@@ -1226,6 +1269,8 @@ Status DequantMatrices::EnsureComputed(uint32_t acs_mask) {
           &pos));
     }
     JXL_ASSERT(pos == offsets[table * 3 + 3]);
+    stored_encodings_[table] = encodings_[table];
+    stored_table_mask_ |= 1u << table;
   }
   computed_mask_ |= acs_mask;
 
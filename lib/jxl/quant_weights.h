@@ -356,6 +356,11 @@ class DequantMatrices {
 
   DequantMatrices();
 
+  // Restores the default matrices and DC quants, as after construction, but
+  // keeps the table storage and the tables computed so far. Tables are reused
+  // whenever later encodings match the ones they were computed from.
+  void ResetToDefault();
+
   static const QuantEncoding* Library();
 
   typedef std::array<QuantEncodingInternal, kNumPredefinedTables * kNum>
@@ -387,7 +392,7 @@ class DequantMatrices {
   // For encoder.
   void SetEncodings(const std::vector<QuantEncoding>& encodings) {
     encodings_ = encodings;
-    computed_mask_ = 0;
+    UpdateComputedMask();
   }
 
   // For encoder.
@@ -422,7 +427,16 @@ class DequantMatrices {
  private:
   static constexpr size_t kTotalTableSize = kSumRequiredXy * kDCTBlockSize * 3;
 
+  // Marks as computed the strategies whose tables in storage were computed
+  // from the current encodings, so that frames repeating the quant tables of
+  // an earlier one (e.g. JPEGs from the same camera) do not recompute them.
+  void UpdateComputedMask();
+
   uint32_t computed_mask_ = 0;
+  // Tables (by QuantTable) held in storage, and the encodings they were
+  // computed from.
+  uint32_t stored_table_mask_ = 0;
+  std::vector<QuantEncoding> stored_encodings_;
   // kTotalTableSize entries followed by kTotalTableSize for inv_table
   hwy::AlignedFreeUniquePtr<float[]> table_storage_;
   const float* table_;
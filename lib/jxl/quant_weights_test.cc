@@ -181,6 +181,45 @@ TEST(QuantWeightsTest, RAW) {
   RoundtripMatrices(encodings);
 }
 
+TEST(QuantWeightsTest, ReuseRAW) {
+  JxlMemoryManager* memory_manager = jxl::test::MemoryManager();
+  CodecMetadata metadata;
+  FrameHeader frame_header(&metadata);
+  const size_t kind = DequantMatrices::kQuantTable[AcStrategy::DCT];
+  std::vector<std::vector<QuantEncoding>> encodings(
+      2, std::vector<QuantEncoding>(DequantMatrices::kNum,
+                                    QuantEncoding::Library(0)));
+  Rng rng(0);
+  for (std::vector<QuantEncoding>& e : encodings) {
+    std::vector<int> matrix(3 * kDCTBlockSize);
+    for (int& v : matrix) v = rng.UniformI(1, 256);
+    e[kind] = QuantEncoding::RAW(matrix);
+  }
+  // Computes the tables of each set of encodings in turn, with a reset and
+  // the default tables in between, and checks they match fresh ones.
+  DequantMatrices mat;
+  for (size_t i : {0, 1, 1, 0, 0}) {
+    ModularFrameEncoder expected_encoder(memory_manager, frame_header,
+                                         CompressParams{}, false);
+    ModularFrameEncoder encoder(memory_manager, frame_header, CompressParams{},
+                                false);
+    DequantMatrices expected;
+    ASSERT_TRUE(
+        DequantMatricesSetCustom(&expected, encodings[i], &expected_encoder));
+    ASSERT_TRUE(expected.EnsureComputed(1u << AcStrategy::DCT));
+    mat.ResetToDefault();
+    ASSERT_TRUE(mat.EnsureComputed(1u << AcStrategy::DCT));
+    ASSERT_TRUE(DequantMatricesSetCustom(&mat, encodings[i], &encoder));
+    ASSERT_TRUE(mat.EnsureComputed(1u << AcStrategy::DCT));
+    for (size_t c = 0; c < 3; c++) {
+      for (size_t k = 0; k < kDCTBlockSize; k++) {
+        EXPECT_EQ(expected.Matrix(AcStrategy::DCT, c)[k],
+                  mat.Matrix(AcStrategy::DCT, c)[k]);
+      }
+    }
+  }
+}
+
 class QuantWeightsTargetTest : public hwy::TestWithParamTarget {};
 HWY_TARGET_INSTANTIATE_TEST_SUITE_P(QuantWeightsTargetTest);
 
@@ -6,6 +6,7 @@
 #include "lib/jxl/render_pipeline/low_memory_render_pipeline.h"
 
 #include <algorithm>
+#include <atomic>
 #include <cstddef>
 #include <cstdint>
 #include <utility>
@@ -13,6 +14,7 @@
 
 #include "lib/jxl/base/arch_macros.h"
 #include "lib/jxl/base/common.h"
+#include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/base/rect.h"
 #include "lib/jxl/base/status.h"
 #include "lib/jxl/image.h"
@@ -268,6 +270,7 @@ Status LowMemoryRenderPipeline::Init() {
 
   JXL_RETURN_IF_ERROR(EnsureBordersStorage());
   group_border_assigner_.Init(frame_dimensions_);
+  deferred_rects_.resize(frame_dimensions_.num_groups);
 
   for (first_trailing_stage_ = stages_.size(); first_trailing_stage_ > 0;
        first_trailing_stage_--) {
@@ -385,6 +388,12 @@ Status LowMemoryRenderPipeline::PrepareForThreadsInternal(size_t num,
                          GroupInputYSize(c) + group_data_y_border_ * 2));
     }
   }
+  JXL_RETURN_IF_ERROR(PrepareThreadBuffers(num));
+  return true;
+}
+
+Status LowMemoryRenderPipeline::PrepareThreadBuffers(size_t num) {
+  const auto& shifts = channel_shifts_[0];
   // TODO(veluca): avoid reallocating buffers if not needed.
   stage_data_.resize(num);
   size_t upsampling = 1u << base_color_shift_;
@@ -696,6 +705,10 @@ Status LowMemoryRenderPipeline::RenderRect(size_t thread_id,
   int num_extra_rows = *std::max_element(virtual_ypadding_for_output_.begin(),
                                          virtual_ypadding_for_output_.end());
 
+  for (size_t i = 0; i < first_trailing_stage_; i++) {
+    stages_[i]->StartRect(thread_id);
+  }
+
   for (int vy = -num_extra_rows;
        vy < static_cast<int>(image_area_rect.ysize()) + num_extra_rows; vy++) {
     for (size_t i = 0; i < first_trailing_stage_; i++) {
@@ -722,8 +735,8 @@ Status LowMemoryRenderPipeline::RenderRect(size_t thread_id,
       prepare_io_rows(y, i);
 
       // Produce output rows.
-      JXL_RETURN_IF_ERROR(stages_[i]->ProcessRow(
-          input_rows[i], output_rows, xpadding_for_output_[i],
+      JXL_RETURN_IF_ERROR(ProcessStageRow(
+          i, input_rows[i], output_rows, xpadding_for_output_[i],
           group_rect[i].xsize(), group_rect[i].x0(), image_y, thread_id));
     }
 
@@ -764,8 +777,8 @@ Status LowMemoryRenderPipeline::RenderRect(size_t thread_id,
           i < first_image_dim_stage_ ? full_image_x0 - frame_x0 : full_image_x0;
       size_t y =
           i < first_image_dim_stage_ ? full_image_y - frame_y0 : full_image_y;
-      JXL_RETURN_IF_ERROR(stages_[i]->ProcessRow(
-          input_rows[first_trailing_stage_], output_rows,
+      JXL_RETURN_IF_ERROR(ProcessStageRow(
+          i, input_rows[first_trailing_stage_], output_rows,
           /*xextra=*/0, full_image_x1 - full_image_x0, x0, y, thread_id));
     }
   }
@@ -786,8 +799,8 @@ Status LowMemoryRenderPipeline::RenderPadding(size_t thread_id, Rect rect) {
     stages_[first_image_dim_stage_ - 1]->ProcessPaddingRow(
         input_rows, rect.xsize(), rect.x0(), rect.y0() + y);
     for (size_t i = first_image_dim_stage_; i < stages_.size(); i++) {
-      JXL_RETURN_IF_ERROR(stages_[i]->ProcessRow(
-          input_rows, output_rows,
+      JXL_RETURN_IF_ERROR(ProcessStageRow(
+          i, input_rows, output_rows,
           /*xextra=*/0, rect.xsize(), rect.x0(), rect.y0() + y, thread_id));
     }
   }
@@ -889,10 +902,88 @@ Status LowMemoryRenderPipeline::ProcessBuffers(size_t group_id,
             gy * frame_dimensions_.group_dim,
         image_max_color_channel_rect.xsize(),
         image_max_color_channel_rect.ysize());
+    if (defer_threads_ != 0) {
+      deferred_rects_[group_id].push_back(
+          {use_group_ids_ ? group_id : thread_id, data_max_color_channel_rect,
+           image_max_color_channel_rect});
+      continue;
+    }
     JXL_RETURN_IF_ERROR(RenderRect(thread_id, input_data,
                                    data_max_color_channel_rect,
                                    image_max_color_channel_rect));
   }
   return true;
 }
+
+Status LowMemoryRenderPipeline::RenderDeferredInternal(ThreadPool* pool,
+                                                       size_t num_threads) {
+  // Every strip recomputes the rows of the kInOut stages that it shares with
+  // its neighbours, so strips are not made smaller than this.
+  constexpr size_t kMinStripRows = 32;
+  // Strips start at a multiple of the largest vertical shift from the start
+  // of their rect, so that they process the same rows of every stage.
+  constexpr size_t kStripRowsAlign = 8;
+  size_t total_rows = 0;
+  for (const auto& rects : deferred_rects_) {
+    for (const DeferredRect& rect : rects) {
+      total_rows += rect.image_max_color_channel_rect.ysize();
+    }
+  }
+  if (total_rows == 0) return true;
+  const size_t strip_rows =
+      std::max(kMinStripRows,
+               RoundUpTo(DivCeil(total_rows, num_threads), kStripRowsAlign));
+
+  std::vector<DeferredRect> strips;
+  const auto add_strip = [&strips](const DeferredRect& rect, size_t y0,
+                                   size_t y1) {
+    const Rect& data = rect.data_max_color_channel_rect;
+    const Rect& image = rect.image_max_color_channel_rect;
+    strips.push_back({rect.buffer,
+                      Rect(data.x0(), data.y0() + y0, data.xsize(), y1 - y0),
+                      Rect(image.x0(), image.y0() + y0, image.xsize(),
+                           y1 - y0)});
+  };
+  for (auto& rects : deferred_rects_) {
+    for (const DeferredRect& rect : rects) {
+      const size_t ysize = rect.image_max_color_channel_rect.ysize();
+      size_t y0 = 0;
+      for (size_t y = strip_rows; y < ysize; y += strip_rows) {
+        // Like the rects of the group border assigner, strips only start or
+        // end at image borders or far enough from them, as rows beyond the
+        // image are mirrored only for those.
+        const size_t image_y = rect.image_max_color_channel_rect.y0() + y;
+        if (image_y < group_border_.second ||
+            image_y + group_border_.second > frame_dimensions_.ysize) {
+          continue;
+        }
+        add_strip(rect, y0, y);
+        y0 = y;
+      }
+      add_strip(rect, y0, ysize);
+    }
+    rects.clear();
+  }
+
+  std::atomic<bool> has_error{false};
+  JXL_RETURN_IF_ERROR(RunOnPool(
+      pool, 0, strips.size(),
+      [this](size_t num_threads) -> Status {
+        JXL_RETURN_IF_ERROR(PrepareStagesForThreads(num_threads));
+        JXL_RETURN_IF_ERROR(PrepareThreadBuffers(num_threads));
+        return true;
+      },
+      [&](const uint32_t i, size_t thread_id) {
+        if (has_error) return;
+        const DeferredRect& strip = strips[i];
+        if (!RenderRect(thread_id, group_data_[strip.buffer],
+                        strip.data_max_color_channel_rect,
+                        strip.image_max_color_channel_rect)) {
+          has_error = true;
+        }
+      },
+      "RenderStrips"));
+  if (has_error) return JXL_FAILURE("Error rendering deferred rects");
+  return true;
+}
 }  // namespace jxl
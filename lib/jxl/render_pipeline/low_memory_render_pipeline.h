@@ -37,10 +37,13 @@ class LowMemoryRenderPipeline final : public RenderPipeline {
 
   Status ProcessBuffers(size_t group_id, size_t thread_id) override;
 
+  Status RenderDeferredInternal(ThreadPool* pool, size_t num_threads) override;
+
   void ClearDone(size_t i) override { group_border_assigner_.ClearDone(i); }
 
   Status Init() override;
 
+  Status PrepareThreadBuffers(size_t num);
   Status EnsureBordersStorage();
   size_t GroupInputXSize(size_t c) const;
   size_t GroupInputYSize(size_t c) const;
@@ -79,6 +82,16 @@ class LowMemoryRenderPipeline final : public RenderPipeline {
   // [group][channel] depending on `use_group_ids_`.
   std::vector<std::vector<ImageF>> group_data_;
 
+  // A rect to render from the group data in group_data_[buffer].
+  struct DeferredRect {
+    size_t buffer;
+    Rect data_max_color_channel_rect;
+    Rect image_max_color_channel_rect;
+  };
+  // Rects that became ready while rendering was deferred, indexed by group;
+  // each group only appends to its own list, hence no locking is needed.
+  std::vector<std::vector<DeferredRect>> deferred_rects_;
+
   // Borders for storing group data.
   size_t group_data_x_border_;
   size_t group_data_y_border_;
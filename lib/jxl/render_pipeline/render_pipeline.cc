@@ -7,8 +7,12 @@
 
 #include <jxl/memory_manager.h>
 
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
 #include <memory>
 #include <utility>
+#include <vector>
 
 #include "lib/jxl/base/rect.h"
 #include "lib/jxl/base/sanitizers.h"
@@ -123,10 +127,78 @@ Status RenderPipeline::InputReady(
 }
 
 Status RenderPipeline::PrepareForThreads(size_t num, bool use_group_ids) {
+  JXL_RETURN_IF_ERROR(PrepareStagesForThreads(num));
+  JXL_RETURN_IF_ERROR(PrepareForThreadsInternal(num, use_group_ids));
+  return true;
+}
+
+Status RenderPipeline::PrepareStagesForThreads(size_t num) {
   for (const auto& stage : stages_) {
     JXL_RETURN_IF_ERROR(stage->PrepareForThreads(num));
   }
-  JXL_RETURN_IF_ERROR(PrepareForThreadsInternal(num, use_group_ids));
+  if (stage_stats_enabled_ && thread_stage_stats_.size() < num) {
+    thread_stage_stats_.resize(
+        num, std::vector<RenderPipelineStageStats>(stages_.size()));
+  }
+  return true;
+}
+
+std::vector<RenderPipelineStageStats> RenderPipeline::GetStageStats() const {
+  std::vector<RenderPipelineStageStats> stats(stages_.size());
+  for (size_t i = 0; i < stages_.size(); i++) {
+    stats[i].name = stages_[i]->GetName();
+    for (const auto& thread_stats : thread_stage_stats_) {
+      stats[i].seconds += thread_stats[i].seconds;
+      stats[i].bytes += thread_stats[i].bytes;
+    }
+  }
+  return stats;
+}
+
+Status RenderPipeline::ProcessStageRowWithStats(
+    size_t i, const RenderPipelineStage::RowInfo& input_rows,
+    const RenderPipelineStage::RowInfo& output_rows, size_t xextra,
+    size_t xsize, size_t xpos, size_t ypos, size_t thread_id) {
+  const RenderPipelineStage& stage = *stages_[i];
+  const auto start = std::chrono::steady_clock::now();
+  JXL_RETURN_IF_ERROR(stage.ProcessRow(input_rows, output_rows, xextra, xsize,
+                                       xpos, ypos, thread_id));
+  const std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+
+  // Every row of the input window is counted for each output row, as the
+  // stage reads all of them.
+  const size_t width = xsize + 2 * xextra;
+  const RenderPipelineStage::Settings& settings = stage.settings_;
+  uint64_t samples = 0;
+  for (size_t c = 0; c < input_rows.size(); c++) {
+    switch (stage.GetChannelMode(c)) {
+      case RenderPipelineChannelMode::kIgnored:
+        break;
+      case RenderPipelineChannelMode::kInput:
+        samples += width;
+        break;
+      case RenderPipelineChannelMode::kInPlace:
+        samples += 2 * width;
+        break;
+      case RenderPipelineChannelMode::kInOut:
+        samples +=
+            (width + 2 * settings.border_x) * (2 * settings.border_y + 1);
+        samples += (width << settings.shift_x) << settings.shift_y;
+        break;
+    }
+  }
+  RenderPipelineStageStats& stats = thread_stage_stats_[thread_id][i];
+  stats.seconds += elapsed.count();
+  stats.bytes += samples * sizeof(float);
+  return true;
+}
+
+Status RenderPipeline::RenderDeferred(ThreadPool* pool) {
+  const size_t num_threads = defer_threads_;
+  defer_threads_ = 0;
+  if (num_threads == 0) return true;
+  JXL_RETURN_IF_ERROR(RenderDeferredInternal(pool, num_threads));
   return true;
 }
 
@@ -15,6 +15,7 @@
 #include <utility>
 #include <vector>
 
+#include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/base/rect.h"
 #include "lib/jxl/base/status.h"
 #include "lib/jxl/frame_dimensions.h"
@@ -23,6 +24,16 @@
 
 namespace jxl {
 
+// Cumulative cost of one stage of a pipeline.
+struct RenderPipelineStageStats {
+  // See RenderPipelineStage::GetName().
+  const char* name = nullptr;
+  // Time spent in the stage, summed over all threads, in seconds.
+  double seconds = 0;
+  // Approximate number of bytes of samples read and written by the stage.
+  uint64_t bytes = 0;
+};
+
 // Interface to provide input to the rendering pipeline. When this object is
 // destroyed, all the data in the provided ImageF's Rects must have been
 // initialized.
@@ -116,6 +127,26 @@ class RenderPipeline {
 
   virtual void ClearDone(size_t i) {}
 
+  // Makes the pipeline measure the cost of every stage, which reads the clock
+  // twice per row and stage. Must be called before PrepareForThreads().
+  void EnableStageStats() { stage_stats_enabled_ = true; }
+
+  // Returns the stages in the order in which they run, with their cost so far
+  // if stage stats are enabled.
+  std::vector<RenderPipelineStageStats> GetStageStats() const;
+
+  // Makes the rects that become ready as input is provided only be recorded,
+  // until RenderDeferred() renders them as strips of rows on up to
+  // `num_threads` threads. This lets frames with fewer groups than threads use
+  // all of them, but the input buffers of a group must not be reused before
+  // RenderDeferred(), i.e. each group needs a different `thread_id` unless
+  // `use_group_ids` is set.
+  void DeferRendering(size_t num_threads) { defer_threads_ = num_threads; }
+
+  // Renders the rects recorded since the last call to DeferRendering(), and
+  // stops deferring.
+  Status RenderDeferred(ThreadPool* pool);
+
  protected:
   explicit RenderPipeline(JxlMemoryManager* memory_manager)
       : memory_manager_(memory_manager) {}
@@ -133,9 +164,39 @@ class RenderPipeline {
 
   std::vector<uint8_t> group_completed_passes_;
 
+  // Number of threads that will render the deferred rects, or 0 if rendering
+  // is not deferred.
+  size_t defer_threads_ = 0;
+
   friend class RenderPipelineInput;
 
+  // Prepares the stages, and the storage of their stats, for `num` threads.
+  Status PrepareStagesForThreads(size_t num);
+
+  // Runs stage `i` on a row, measuring it if stage stats are enabled.
+  Status ProcessStageRow(size_t i,
+                         const RenderPipelineStage::RowInfo& input_rows,
+                         const RenderPipelineStage::RowInfo& output_rows,
+                         size_t xextra, size_t xsize, size_t xpos, size_t ypos,
+                         size_t thread_id) {
+    if (!stage_stats_enabled_) {
+      return stages_[i]->ProcessRow(input_rows, output_rows, xextra, xsize,
+                                    xpos, ypos, thread_id);
+    }
+    return ProcessStageRowWithStats(i, input_rows, output_rows, xextra, xsize,
+                                    xpos, ypos, thread_id);
+  }
+
  private:
+  Status ProcessStageRowWithStats(
+      size_t i, const RenderPipelineStage::RowInfo& input_rows,
+      const RenderPipelineStage::RowInfo& output_rows, size_t xextra,
+      size_t xsize, size_t xpos, size_t ypos, size_t thread_id);
+
+  bool stage_stats_enabled_ = false;
+  // Indexed by [thread][stage].
+  std::vector<std::vector<RenderPipelineStageStats>> thread_stage_stats_;
+
   Status InputReady(size_t group_id, size_t thread_id,
                     const std::vector<std::pair<ImageF*, Rect>>& buffers);
 
@@ -148,6 +209,10 @@ class RenderPipeline {
   // equal) `num`.
   virtual Status PrepareForThreadsInternal(size_t num, bool use_group_ids) = 0;
 
+  virtual Status RenderDeferredInternal(ThreadPool* pool, size_t num_threads) {
+    return true;
+  }
+
   // Called once frame dimensions and stages are known.
   virtual Status Init() { return true; }
 };
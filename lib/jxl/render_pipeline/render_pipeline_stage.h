@@ -125,6 +125,11 @@ class RenderPipelineStage {
 
   virtual Status PrepareForThreads(size_t num_threads) { return true; }
 
+  // Called before `thread_id` starts processing the rows of a new rect; until
+  // the next call, ProcessRow calls on that thread are for consecutive rows of
+  // the same columns, which lets stages carry state from one row to the next.
+  virtual void StartRect(size_t thread_id) const {}
+
   // Returns a pointer to the input row of channel `c` with offset `y`.
   // `y` must be in [-settings_.border_y, settings_.border_y]. `c` must be such
   // that `GetChannelMode(c) != kIgnored`. The returned pointer points to the
@@ -41,6 +41,11 @@
 #include "lib/jxl/image_ops.h"
 #include "lib/jxl/image_test_utils.h"
 #include "lib/jxl/jpeg/enc_jpeg_data.h"
+#include "lib/jxl/loop_filter.h"
+#include "lib/jxl/render_pipeline/stage_from_linear.h"
+#include "lib/jxl/render_pipeline/stage_gaborish.h"
+#include "lib/jxl/render_pipeline/stage_write.h"
+#include "lib/jxl/render_pipeline/stage_xyb.h"
 #include "lib/jxl/render_pipeline/test_render_pipeline_stages.h"
 #include "lib/jxl/splines.h"
 #include "lib/jxl/test_utils.h"
@@ -585,5 +590,162 @@ TEST(RenderPipelineDecodingTest, Animation) {
   }
 }
 
+// Renders a frame of XYB samples to an interleaved buffer in `format`, with
+// either the fused XYB-to-output stage or the separate stages.
+std::vector<uint8_t> RenderXYBToOutput(
+    const OutputEncodingInfo& output_encoding_info, JxlPixelFormat format,
+    bool fused) {
+  JxlMemoryManager* memory_manager = jxl::test::MemoryManager();
+  const size_t xsize = 300;
+  const size_t ysize = 200;
+  const bool has_alpha = format.num_channels == 4;
+  const size_t bytes_per_sample = format.data_type == JXL_TYPE_FLOAT ? 4 : 2;
+  std::vector<uint8_t> pixels(xsize * ysize * format.num_channels *
+                              bytes_per_sample);
+  ImageOutput output;
+  output.format = format;
+  output.bits_per_sample = 16;
+  output.buffer = pixels.data();
+  output.buffer_size = pixels.size();
+  output.stride = xsize * format.num_channels * bytes_per_sample;
+  std::vector<ImageOutput> extra_output;
+
+  RenderPipeline::Builder builder(memory_manager, has_alpha ? 4 : 3);
+  if (fused) {
+    builder.AddStage(GetXYBToOutputStage(
+        output_encoding_info, output, xsize, ysize, has_alpha,
+        /*unpremul_alpha=*/false, /*alpha_c=*/3, Orientation::kIdentity,
+        extra_output, memory_manager));
+  } else {
+    builder.AddStage(GetXYBStage(output_encoding_info));
+    builder.AddStage(GetFromLinearStage(output_encoding_info));
+    builder.AddStage(GetWriteToOutputStage(
+        output, xsize, ysize, has_alpha, /*unpremul_alpha=*/false,
+        /*alpha_c=*/3, Orientation::kIdentity, extra_output, memory_manager));
+  }
+  FrameDimensions frame_dimensions;
+  frame_dimensions.Set(xsize, ysize, /*group_size_shift=*/0,
+                       /*max_hshift=*/0, /*max_vshift=*/0,
+                       /*modular_mode=*/false, /*upsampling=*/1);
+  auto pipeline = std::move(builder).Finalize(frame_dimensions).value();
+  JXL_CHECK(pipeline->PrepareForThreads(1, /*use_group_ids=*/false));
+
+  // Plausible XYB values, with some out of the output range.
+  const float kMin[4] = {-0.02f, 0.0f, 0.0f, 0.0f};
+  const float kMax[4] = {0.02f, 0.9f, 0.9f, 1.0f};
+  for (size_t i = 0; i < frame_dimensions.num_groups; i++) {
+    auto input_buffers = pipeline->GetInputBuffers(i, 0);
+    for (size_t c = 0; c < (has_alpha ? 4 : 3); c++) {
+      auto buffer = input_buffers.GetBuffer(c);
+      for (size_t y = 0; y < buffer.second.ysize(); y++) {
+        float* row = buffer.second.Row(buffer.first, y);
+        for (size_t x = 0; x < buffer.second.xsize(); x++) {
+          float t = ((x * 7 + y * 13 + i * 31 + c * 3) % 101) / 100.0f;
+          row[x] = kMin[c] + t * (kMax[c] - kMin[c]);
+        }
+      }
+    }
+    JXL_CHECK(input_buffers.Done());
+  }
+  return pixels;
+}
+
+TEST(RenderPipelineTest, XYBToOutputMatchesSeparateStages) {
+  CodecMetadata metadata;
+  metadata.m.xyb_encoded = true;
+  ColorEncoding pq = ColorEncoding::SRGB();
+  pq.Tf().SetTransferFunction(TransferFunction::kPQ);
+  ASSERT_TRUE(pq.CreateICC());
+  for (const ColorEncoding& color_encoding :
+       {ColorEncoding::SRGB(), ColorEncoding::LinearSRGB(), pq}) {
+    OutputEncodingInfo output_encoding_info;
+    ASSERT_TRUE(output_encoding_info.SetFromMetadata(metadata));
+    ASSERT_TRUE(output_encoding_info.MaybeSetColorEncoding(color_encoding));
+    for (JxlPixelFormat format :
+         {JxlPixelFormat{4, JXL_TYPE_UINT16, JXL_NATIVE_ENDIAN, 0},
+          JxlPixelFormat{3, JXL_TYPE_FLOAT16, JXL_NATIVE_ENDIAN, 0},
+          JxlPixelFormat{4, JXL_TYPE_FLOAT, JXL_NATIVE_ENDIAN, 0}}) {
+      EXPECT_EQ(
+          RenderXYBToOutput(output_encoding_info, format, /*fused=*/false),
+          RenderXYBToOutput(output_encoding_info, format, /*fused=*/true));
+    }
+  }
+}
+
+// Renders a frame through stages with borders to a float buffer, with the
+// rects of every group either rendered by the thread that provides the input,
+// or deferred and rendered in strips by all the threads.
+std::vector<float> RenderWithBorders(size_t xsize, size_t ysize, bool defer) {
+  JxlMemoryManager* memory_manager = jxl::test::MemoryManager();
+  FakeParallelRunner fake_pool(/*order_seed=*/123, /*num_threads=*/8);
+  ThreadPool pool(&JxlFakeParallelRunner, &fake_pool);
+  std::vector<float> pixels(xsize * ysize * 3);
+  ImageOutput output;
+  output.format = {3, JXL_TYPE_FLOAT, JXL_NATIVE_ENDIAN, 0};
+  output.bits_per_sample = 32;
+  output.buffer = pixels.data();
+  output.buffer_size = pixels.size() * sizeof(float);
+  output.stride = xsize * 3 * sizeof(float);
+  std::vector<ImageOutput> extra_output;
+
+  LoopFilter lf;
+  RenderPipeline::Builder builder(memory_manager, /*num_c=*/3);
+  builder.AddStage(GetGaborishStage(lf));
+  builder.AddStage(GetGaborishStage(lf));
+  builder.AddStage(GetWriteToOutputStage(
+      output, xsize, ysize, /*has_alpha=*/false, /*unpremul_alpha=*/false,
+      /*alpha_c=*/3, Orientation::kIdentity, extra_output, memory_manager));
+  FrameDimensions frame_dimensions;
+  frame_dimensions.Set(xsize, ysize, /*group_size_shift=*/1,
+                       /*max_hshift=*/0, /*max_vshift=*/0,
+                       /*modular_mode=*/false, /*upsampling=*/1);
+  auto pipeline = std::move(builder).Finalize(frame_dimensions).value();
+
+  const auto provide_input = [&](size_t g, size_t thread) {
+    auto input_buffers = pipeline->GetInputBuffers(g, thread);
+    const size_t gx = g % frame_dimensions.xsize_groups;
+    const size_t gy = g / frame_dimensions.xsize_groups;
+    for (size_t c = 0; c < 3; c++) {
+      auto buffer = input_buffers.GetBuffer(c);
+      for (size_t y = 0; y < buffer.second.ysize(); y++) {
+        float* row = buffer.second.Row(buffer.first, y);
+        for (size_t x = 0; x < buffer.second.xsize(); x++) {
+          size_t ix = gx * frame_dimensions.group_dim + x;
+          size_t iy = gy * frame_dimensions.group_dim + y;
+          row[x] = ((ix * 7 + iy * 13 + c * 3) % 101) / 100.0f;
+        }
+      }
+    }
+    JXL_CHECK(input_buffers.Done());
+  };
+  if (defer) {
+    JXL_CHECK(RunOnPool(
+        &pool, 0, frame_dimensions.num_groups,
+        [&](size_t num_threads) -> Status {
+          JXL_RETURN_IF_ERROR(pipeline->PrepareForThreads(
+              frame_dimensions.num_groups, /*use_group_ids=*/false));
+          pipeline->DeferRendering(num_threads);
+          return true;
+        },
+        [&](const uint32_t g, size_t /*thread*/) { provide_input(g, g); },
+        "ProvideInput"));
+    JXL_CHECK(pipeline->RenderDeferred(&pool));
+  } else {
+    JXL_CHECK(pipeline->PrepareForThreads(1, /*use_group_ids=*/false));
+    for (size_t g = 0; g < frame_dimensions.num_groups; g++) {
+      provide_input(g, 0);
+    }
+  }
+  return pixels;
+}
+
+TEST(RenderPipelineTest, DeferredRenderingMatchesGroupRendering) {
+  // A single group, and fewer groups than threads.
+  for (size_t size : {256, 500}) {
+    EXPECT_EQ(RenderWithBorders(size, size - 10, /*defer=*/false),
+              RenderWithBorders(size, size - 10, /*defer=*/true));
+  }
+}
+
 }  // namespace
 }  // namespace jxl
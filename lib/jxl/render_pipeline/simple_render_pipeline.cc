@@ -178,6 +178,7 @@ Status SimpleRenderPipeline::ProcessBuffers(size_t group_id, size_t thread_id) {
     {
       JXL_RETURN_IF_ERROR(stage->SetInputSizes(input_sizes));
       int border_y = stage->settings_.border_y;
+      stage->StartRect(thread_id);
       for (size_t y = 0; y < ysize; y++) {
         // Prepare input rows.
         for (size_t c = 0; c < channel_data_.size(); c++) {
@@ -199,9 +200,9 @@ Status SimpleRenderPipeline::ProcessBuffers(size_t group_id, size_t thread_id) {
                 (y << stage->settings_.shift_y) + iy + kRenderPipelineXOffset);
           }
         }
-        JXL_RETURN_IF_ERROR(stage->ProcessRow(input_rows, output_rows,
-                                              /*xextra=*/0, xsize,
-                                              /*xpos=*/0, y, thread_id));
+        JXL_RETURN_IF_ERROR(ProcessStageRow(stage_id, input_rows, output_rows,
+                                            /*xextra=*/0, xsize,
+                                            /*xpos=*/0, y, thread_id));
       }
     }
 
@@ -0,0 +1,145 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+// Per-pixel conversions from linear colors to the output transfer function,
+// shared by the stages that apply them.
+
+#if defined(LIB_JXL_RENDER_PIPELINE_STAGE_FROM_LINEAR_INL_H_) == \
+    defined(HWY_TARGET_TOGGLE)
+#ifdef LIB_JXL_RENDER_PIPELINE_STAGE_FROM_LINEAR_INL_H_
+#undef LIB_JXL_RENDER_PIPELINE_STAGE_FROM_LINEAR_INL_H_
+#else
+#define LIB_JXL_RENDER_PIPELINE_STAGE_FROM_LINEAR_INL_H_
+#endif
+
+#include <memory>
+#include <utility>
+
+#include <hwy/highway.h>
+
+#include "lib/jxl/base/status.h"
+#include "lib/jxl/cms/tone_mapping-inl.h"
+#include "lib/jxl/cms/transfer_functions-inl.h"
+#include "lib/jxl/common.h"  // JXL_HIGH_PRECISION
+#include "lib/jxl/dec_xyb.h"
+#include "lib/jxl/render_pipeline/render_pipeline_stage.h"
+
+HWY_BEFORE_NAMESPACE();
+namespace jxl {
+namespace HWY_NAMESPACE {
+namespace {
+
+// These templates are not found via ADL.
+using hwy::HWY_NAMESPACE::IfThenZeroElse;
+
+template <typename Op>
+struct PerChannelOp {
+  explicit PerChannelOp(Op op) : op(op) {}
+  template <typename D, typename T>
+  void Transform(D d, T* r, T* g, T* b) const {
+    *r = op.Transform(d, *r);
+    *g = op.Transform(d, *g);
+    *b = op.Transform(d, *b);
+  }
+
+  Op op;
+};
+template <typename Op>
+PerChannelOp<Op> MakePerChannelOp(Op&& op) {
+  return PerChannelOp<Op>(std::forward<Op>(op));
+}
+
+struct OpLinear {
+  template <typename D, typename T>
+  T Transform(D d, const T& linear) const {
+    return linear;
+  }
+};
+
+struct OpRgb {
+  template <typename D, typename T>
+  T Transform(D d, const T& linear) const {
+#if JXL_HIGH_PRECISION
+    return TF_SRGB().EncodedFromDisplay(d, linear);
+#else
+    return FastLinearToSRGB(d, linear);
+#endif
+  }
+};
+
+struct OpPq {
+  explicit OpPq(const float intensity_target) : tf_pq_(intensity_target) {}
+  template <typename D, typename T>
+  T Transform(D d, const T& linear) const {
+    return tf_pq_.EncodedFromDisplay(d, linear);
+  }
+  TF_PQ tf_pq_;
+};
+
+struct OpHlg {
+  explicit OpHlg(const Vector3& luminances, const float intensity_target)
+      : hlg_ootf_(HlgOOTF::ToSceneLight(/*display_luminance=*/intensity_target,
+                                        luminances)) {}
+
+  template <typename D, typename T>
+  void Transform(D d, T* r, T* g, T* b) const {
+    hlg_ootf_.Apply(r, g, b);
+    *r = TF_HLG().EncodedFromDisplay(d, *r);
+    *g = TF_HLG().EncodedFromDisplay(d, *g);
+    *b = TF_HLG().EncodedFromDisplay(d, *b);
+  }
+  HlgOOTF hlg_ootf_;
+};
+
+struct Op709 {
+  template <typename D, typename T>
+  T Transform(D d, const T& linear) const {
+    return TF_709().EncodedFromDisplay(d, linear);
+  }
+};
+
+struct OpGamma {
+  const float inverse_gamma;
+  template <typename D, typename T>
+  T Transform(D d, const T& linear) const {
+    return IfThenZeroElse(Le(linear, Set(d, 1e-5f)),
+                          FastPowf(d, linear, Set(d, inverse_gamma)));
+  }
+};
+
+// Returns `make(op)`, where `op` converts linear colors to the transfer
+// function of the output encoding with `op.Transform(d, &r, &g, &b)`.
+template <typename Make>
+std::unique_ptr<RenderPipelineStage> MakeWithFromLinearOp(
+    const OutputEncodingInfo& output_encoding_info, const Make& make) {
+  const auto& tf = output_encoding_info.color_encoding.Tf();
+  if (tf.IsLinear()) {
+    return make(MakePerChannelOp(OpLinear()));
+  } else if (tf.IsSRGB()) {
+    return make(MakePerChannelOp(OpRgb()));
+  } else if (tf.IsPQ()) {
+    return make(
+        MakePerChannelOp(OpPq(output_encoding_info.orig_intensity_target)));
+  } else if (tf.IsHLG()) {
+    return make(OpHlg(output_encoding_info.luminances,
+                      output_encoding_info.desired_intensity_target));
+  } else if (tf.Is709()) {
+    return make(MakePerChannelOp(Op709()));
+  } else if (tf.have_gamma || tf.IsDCI()) {
+    return make(
+        MakePerChannelOp(OpGamma{output_encoding_info.inverse_gamma}));
+  } else {
+    // This is a programming error.
+    JXL_UNREACHABLE("Invalid target encoding");
+  }
+}
+
+}  // namespace
+// NOLINTNEXTLINE(google-readability-namespace-comments)
+}  // namespace HWY_NAMESPACE
+}  // namespace jxl
+HWY_AFTER_NAMESPACE();
+
+#endif  // LIB_JXL_RENDER_PIPELINE_STAGE_FROM_LINEAR_INL_H_
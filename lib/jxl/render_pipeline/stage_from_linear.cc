@@ -11,93 +11,13 @@
 #include <hwy/highway.h>
 
 #include "lib/jxl/base/sanitizers.h"
-#include "lib/jxl/cms/tone_mapping-inl.h"
-#include "lib/jxl/cms/transfer_functions-inl.h"
-#include "lib/jxl/common.h"  // JXL_HIGH_PRECISION
+#include "lib/jxl/render_pipeline/stage_from_linear-inl.h"
 
 HWY_BEFORE_NAMESPACE();
 namespace jxl {
 namespace HWY_NAMESPACE {
 namespace {
 
-// These templates are not found via ADL.
-using hwy::HWY_NAMESPACE::IfThenZeroElse;
-
-template <typename Op>
-struct PerChannelOp {
-  explicit PerChannelOp(Op op) : op(op) {}
-  template <typename D, typename T>
-  void Transform(D d, T* r, T* g, T* b) const {
-    *r = op.Transform(d, *r);
-    *g = op.Transform(d, *g);
-    *b = op.Transform(d, *b);
-  }
-
-  Op op;
-};
-template <typename Op>
-PerChannelOp<Op> MakePerChannelOp(Op&& op) {
-  return PerChannelOp<Op>(std::forward<Op>(op));
-}
-
-struct OpLinear {
-  template <typename D, typename T>
-  T Transform(D d, const T& linear) const {
-    return linear;
-  }
-};
-
-struct OpRgb {
-  template <typename D, typename T>
-  T Transform(D d, const T& linear) const {
-#if JXL_HIGH_PRECISION
-    return TF_SRGB().EncodedFromDisplay(d, linear);
-#else
-    return FastLinearToSRGB(d, linear);
-#endif
-  }
-};
-
-struct OpPq {
-  explicit OpPq(const float intensity_target) : tf_pq_(intensity_target) {}
-  template <typename D, typename T>
-  T Transform(D d, const T& linear) const {
-    return tf_pq_.EncodedFromDisplay(d, linear);
-  }
-  TF_PQ tf_pq_;
-};
-
-struct OpHlg {
-  explicit OpHlg(const Vector3& luminances, const float intensity_target)
-      : hlg_ootf_(HlgOOTF::ToSceneLight(/*display_luminance=*/intensity_target,
-                                        luminances)) {}
-
-  template <typename D, typename T>
-  void Transform(D d, T* r, T* g, T* b) const {
-    hlg_ootf_.Apply(r, g, b);
-    *r = TF_HLG().EncodedFromDisplay(d, *r);
-    *g = TF_HLG().EncodedFromDisplay(d, *g);
-    *b = TF_HLG().EncodedFromDisplay(d, *b);
-  }
-  HlgOOTF hlg_ootf_;
-};
-
-struct Op709 {
-  template <typename D, typename T>
-  T Transform(D d, const T& linear) const {
-    return TF_709().EncodedFromDisplay(d, linear);
-  }
-};
-
-struct OpGamma {
-  const float inverse_gamma;
-  template <typename D, typename T>
-  T Transform(D d, const T& linear) const {
-    return IfThenZeroElse(Le(linear, Set(d, 1e-5f)),
-                          FastPowf(d, linear, Set(d, inverse_gamma)));
-  }
-};
-
 template <typename Op>
 class FromLinearStage : public RenderPipelineStage {
  public:
@@ -146,34 +66,16 @@ class FromLinearStage : public RenderPipelineStage {
   Op op_;
 };
 
-template <typename Op>
-std::unique_ptr<FromLinearStage<Op>> MakeFromLinearStage(Op&& op) {
-  return jxl::make_unique<FromLinearStage<Op>>(std::forward<Op>(op));
-}
+struct MakeFromLinearStage {
+  template <typename Op>
+  std::unique_ptr<RenderPipelineStage> operator()(Op op) const {
+    return jxl::make_unique<FromLinearStage<Op>>(std::move(op));
+  }
+};
 
 std::unique_ptr<RenderPipelineStage> GetFromLinearStage(
     const OutputEncodingInfo& output_encoding_info) {
-  const auto& tf = output_encoding_info.color_encoding.Tf();
-  if (tf.IsLinear()) {
-    return MakeFromLinearStage(MakePerChannelOp(OpLinear()));
-  } else if (tf.IsSRGB()) {
-    return MakeFromLinearStage(MakePerChannelOp(OpRgb()));
-  } else if (tf.IsPQ()) {
-    return MakeFromLinearStage(
-        MakePerChannelOp(OpPq(output_encoding_info.orig_intensity_target)));
-  } else if (tf.IsHLG()) {
-    return MakeFromLinearStage(
-        OpHlg(output_encoding_info.luminances,
-              output_encoding_info.desired_intensity_target));
-  } else if (tf.Is709()) {
-    return MakeFromLinearStage(MakePerChannelOp(Op709()));
-  } else if (tf.have_gamma || tf.IsDCI()) {
-    return MakeFromLinearStage(
-        MakePerChannelOp(OpGamma{output_encoding_info.inverse_gamma}));
-  } else {
-    // This is a programming error.
-    JXL_UNREACHABLE("Invalid target encoding");
-  }
+  return MakeWithFromLinearOp(output_encoding_info, MakeFromLinearStage());
 }
 
 }  // namespace
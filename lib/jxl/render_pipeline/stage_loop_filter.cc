@@ -0,0 +1,264 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include "lib/jxl/render_pipeline/stage_loop_filter.h"
+
+#include <jxl/memory_manager.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "lib/jxl/base/common.h"
+#include "lib/jxl/base/compiler_specific.h"
+#include "lib/jxl/base/status.h"
+#include "lib/jxl/image_ops.h"
+#include "lib/jxl/memory_manager_internal.h"
+#include "lib/jxl/render_pipeline/stage_epf.h"
+#include "lib/jxl/render_pipeline/stage_gaborish.h"
+
+namespace jxl {
+namespace {
+
+// Runs the filters one after the other on every row, instead of as separate
+// pipeline stages. Each thread keeps the intermediate results in ring buffers
+// that hold just the rows the next filter still needs, and produces each
+// intermediate row only once per rect, so that rows are filtered again while
+// they are still in cache. Intermediate rows are mirrored at the image borders
+// like the pipeline does between stages, hence the output is identical.
+class LoopFilterStage : public RenderPipelineStage {
+ public:
+  LoopFilterStage(JxlMemoryManager* memory_manager,
+                  std::vector<std::unique_ptr<RenderPipelineStage>> filters,
+                  std::vector<size_t> borders)
+      : RenderPipelineStage(RenderPipelineStage::Settings::SymmetricBorderOnly(
+            TotalBorder(borders))),
+        memory_manager_(memory_manager),
+        filters_(std::move(filters)),
+        borders_(std::move(borders)) {
+    remaining_border_.resize(borders_.size());
+    size_t remaining = 0;
+    for (size_t i = borders_.size(); i-- > 0;) {
+      remaining_border_[i] = remaining;
+      remaining += borders_[i];
+    }
+    // The output of filter i is kept for the 2 * remaining_border_[i] + 1 rows
+    // around the current one; the last filter writes to the output directly.
+    for (size_t i = 0; i + 1 < filters_.size(); i++) {
+      first_ring_row_.push_back(num_ring_rows_);
+      num_ring_rows_ += 3 * (2 * remaining_border_[i] + 1);
+    }
+  }
+
+  Status ProcessRow(const RowInfo& input_rows, const RowInfo& output_rows,
+                    size_t xextra, size_t xsize, size_t xpos, size_t ypos,
+                    size_t thread_id) const final {
+    ThreadRows& t = *threads_[thread_id];
+    JXL_RETURN_IF_ERROR(EnsureCapacity(xsize, xextra, &t));
+    // Rows of the ring buffers computed for the previous row are still valid
+    // if this is the next row of the same rect.
+    const bool next_row = t.has_rows && t.xpos == xpos && t.xsize == xsize &&
+                          t.xextra == xextra && t.ypos + 1 == ypos;
+    t.has_rows = false;
+    const ssize_t y = ypos;
+    const size_t last = filters_.size() - 1;
+    for (size_t i = 0; i < last; i++) {
+      const ssize_t radius = remaining_border_[i];
+      const ssize_t first = next_row ? y + radius : y - radius;
+      const ssize_t end = std::min<ssize_t>(y + radius + 1, ysize_);
+      for (ssize_t r = std::max<ssize_t>(first, 0); r < end; r++) {
+        JXL_RETURN_IF_ERROR(RunFilter(i, input_rows, nullptr, y, r, xextra,
+                                      xsize, xpos, thread_id, &t));
+      }
+    }
+    JXL_RETURN_IF_ERROR(RunFilter(last, input_rows, &output_rows, y, y, xextra,
+                                  xsize, xpos, thread_id, &t));
+    t.has_rows = true;
+    t.xpos = xpos;
+    t.xsize = xsize;
+    t.xextra = xextra;
+    t.ypos = ypos;
+    return true;
+  }
+
+  RenderPipelineChannelMode GetChannelMode(size_t c) const final {
+    return c < 3 ? RenderPipelineChannelMode::kInOut
+                 : RenderPipelineChannelMode::kIgnored;
+  }
+
+  const char* GetName() const override { return "LoopFilter"; }
+
+ private:
+  // Per-thread ring buffers; `pad` floats precede the first pixel of each row
+  // and `stride` is the distance between rows, both multiples of
+  // kRenderPipelineXOffset so that rows stay aligned.
+  struct ThreadRows {
+    AlignedMemory memory;
+    size_t pad = 0;
+    size_t stride = 0;
+    RowInfo input;
+    RowInfo output;
+    // Position of the last row produced, if `has_rows`.
+    bool has_rows = false;
+    size_t xpos = 0;
+    size_t xsize = 0;
+    size_t xextra = 0;
+    size_t ypos = 0;
+  };
+
+  static size_t TotalBorder(const std::vector<size_t>& borders) {
+    size_t total = 0;
+    for (size_t border : borders) total += border;
+    return total;
+  }
+
+  Status SetInputSizes(
+      const std::vector<std::pair<size_t, size_t>>& input_sizes) override {
+#if JXL_ENABLE_ASSERT
+    JXL_ASSERT(input_sizes.size() >= 3);
+    for (size_t c = 1; c < 3; c++) {
+      JXL_ASSERT(input_sizes[c].first == input_sizes[0].first);
+      JXL_ASSERT(input_sizes[c].second == input_sizes[0].second);
+    }
+#endif
+    xsize_ = input_sizes[0].first;
+    ysize_ = input_sizes[0].second;
+    return true;
+  }
+
+  Status PrepareForThreads(size_t num_threads) override {
+    for (size_t t = threads_.size(); t < num_threads; t++) {
+      threads_.emplace_back(jxl::make_unique<ThreadRows>());
+      threads_.back()->input.resize(3);
+      threads_.back()->output.resize(3, ChannelRows(1));
+    }
+    return true;
+  }
+
+  void StartRect(size_t thread_id) const override {
+    threads_[thread_id]->has_rows = false;
+  }
+
+  Status EnsureCapacity(size_t xsize, size_t xextra, ThreadRows* t) const {
+    // Filters may read up to a vector past the rounded-up extra pixels.
+    size_t pad = RoundUpTo(xextra + settings_.border_x + kRenderPipelineXOffset,
+                           kRenderPipelineXOffset);
+    size_t stride = pad + RoundUpTo(xsize + pad, kRenderPipelineXOffset);
+    if (pad <= t->pad && stride <= t->stride) return true;
+    pad = std::max(pad, t->pad);
+    stride = std::max(stride, pad + t->stride - t->pad);
+    const size_t bytes = num_ring_rows_ * stride * sizeof(float);
+    JXL_ASSIGN_OR_RETURN(t->memory,
+                         AlignedMemory::Create(memory_manager_, bytes));
+    // Pixels that are never computed are still loaded (and discarded) by
+    // vector code.
+    memset(t->memory.address<void>(), 0, bytes);
+    t->pad = pad;
+    t->stride = stride;
+    t->has_rows = false;
+    return true;
+  }
+
+  // Row `y` of channel `c` of the output of filter `i`, in the layout that
+  // RowInfo uses, i.e. with the first pixel at kRenderPipelineXOffset.
+  float* RingRow(const ThreadRows& t, size_t i, size_t c, size_t y) const {
+    const size_t num_rows = 2 * remaining_border_[i] + 1;
+    const size_t row = first_ring_row_[i] + (y % num_rows) * 3 + c;
+    return t.memory.address<float>() + row * t.stride + t.pad -
+           kRenderPipelineXOffset;
+  }
+
+  // Runs filter `i` for row `r`, reading the input of the stage (centered on
+  // row `y`) or the ring buffer of the previous filter, and writing to
+  // `output_rows` if given or to its own ring buffer otherwise.
+  Status RunFilter(size_t i, const RowInfo& input_rows,
+                   const RowInfo* output_rows, ssize_t y, ssize_t r,
+                   size_t xextra, size_t xsize, size_t xpos, size_t thread_id,
+                   ThreadRows* t) const {
+    const ssize_t border = borders_[i];
+    for (size_t c = 0; c < 3; c++) {
+      t->input[c].resize(2 * border + 1);
+      for (ssize_t iy = -border; iy <= border; iy++) {
+        t->input[c][iy + border] =
+            i == 0 ? input_rows[c][settings_.border_y + r + iy - y]
+                   : RingRow(*t, i - 1, c, Mirror(r + iy, ysize_));
+      }
+      if (output_rows == nullptr) t->output[c][0] = RingRow(*t, i, c, r);
+    }
+    JXL_RETURN_IF_ERROR(filters_[i]->ProcessRow(
+        t->input, output_rows ? *output_rows : t->output,
+        xextra + remaining_border_[i], xsize, xpos, r, thread_id));
+    if (output_rows == nullptr) {
+      for (size_t c = 0; c < 3; c++) {
+        MirrorX(t->output[c][0] + kRenderPipelineXOffset, borders_[i + 1],
+                xpos, xsize);
+      }
+    }
+    return true;
+  }
+
+  // Same as the mirroring that the pipeline applies to the input of a stage
+  // with horizontal border `border`.
+  void MirrorX(float* row, ssize_t border, ssize_t xpos, ssize_t xsize) const {
+    const ssize_t image_xsize = xsize_;
+    if (xpos == 0) {
+      for (ssize_t ix = 0; ix < border; ix++) {
+        row[-ix - 1] = row[Mirror(-ix - 1, image_xsize)];
+      }
+    }
+    if (xpos + xsize + border >= image_xsize) {
+      for (ssize_t ix = 0; ix < border; ix++) {
+        row[image_xsize - xpos + ix] =
+            row[Mirror(image_xsize + ix, image_xsize) - xpos];
+      }
+    }
+  }
+
+  JxlMemoryManager* memory_manager_;
+  std::vector<std::unique_ptr<RenderPipelineStage>> filters_;
+  // Vertical and horizontal border of each filter, and sum of the borders of
+  // the filters after it.
+  std::vector<size_t> borders_;
+  std::vector<size_t> remaining_border_;
+  std::vector<size_t> first_ring_row_;
+  size_t num_ring_rows_ = 0;
+  size_t xsize_ = 0;
+  size_t ysize_ = 0;
+  std::vector<std::unique_ptr<ThreadRows>> threads_;
+};
+
+}  // namespace
+
+std::unique_ptr<RenderPipelineStage> GetLoopFilterStage(
+    JxlMemoryManager* memory_manager, const LoopFilter& lf,
+    const ImageF& sigma) {
+  std::vector<std::unique_ptr<RenderPipelineStage>> filters;
+  // Borders of the stages in stage_gaborish.cc and stage_epf.cc.
+  std::vector<size_t> borders;
+  if (lf.gab) {
+    filters.push_back(GetGaborishStage(lf));
+    borders.push_back(1);
+  }
+  if (lf.epf_iters >= 3) {
+    filters.push_back(GetEPFStage(lf, sigma, 0));
+    borders.push_back(3);
+  }
+  if (lf.epf_iters >= 1) {
+    filters.push_back(GetEPFStage(lf, sigma, 1));
+    borders.push_back(2);
+  }
+  if (lf.epf_iters >= 2) {
+    filters.push_back(GetEPFStage(lf, sigma, 2));
+    borders.push_back(1);
+  }
+  if (filters.size() < 2) return nullptr;
+  return jxl::make_unique<LoopFilterStage>(memory_manager, std::move(filters),
+                                           std::move(borders));
+}
+
+}  // namespace jxl
@@ -0,0 +1,28 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef LIB_JXL_RENDER_PIPELINE_STAGE_LOOP_FILTER_H_
+#define LIB_JXL_RENDER_PIPELINE_STAGE_LOOP_FILTER_H_
+
+#include <jxl/memory_manager.h>
+
+#include <memory>
+
+#include "lib/jxl/image.h"
+#include "lib/jxl/loop_filter.h"
+#include "lib/jxl/render_pipeline/render_pipeline_stage.h"
+
+namespace jxl {
+
+// Applies Gaborish and all the EPF steps enabled in `lf` in a single stage,
+// with the same results as the separate GetGaborishStage and GetEPFStage
+// stages; `sigma` is as for GetEPFStage. Returns nullptr if fewer than two of
+// the filters are enabled, as there is nothing to fuse then.
+std::unique_ptr<RenderPipelineStage> GetLoopFilterStage(
+    JxlMemoryManager* memory_manager, const LoopFilter& lf,
+    const ImageF& sigma);
+}  // namespace jxl
+
+#endif  // LIB_JXL_RENDER_PIPELINE_STAGE_LOOP_FILTER_H_
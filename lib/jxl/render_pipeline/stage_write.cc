@@ -7,8 +7,10 @@
 
 #include <jxl/memory_manager.h>
 
+#include <algorithm>
 #include <cstdint>
 #include <type_traits>
+#include <utility>
 
 #include "lib/jxl/alpha.h"
 #include "lib/jxl/base/common.h"
@@ -25,6 +27,9 @@
 #include <hwy/foreach_target.h>
 #include <hwy/highway.h>
 
+#include "lib/jxl/dec_xyb-inl.h"
+#include "lib/jxl/render_pipeline/stage_from_linear-inl.h"
+
 HWY_BEFORE_NAMESPACE();
 namespace jxl {
 namespace HWY_NAMESPACE {
@@ -35,6 +40,7 @@ using hwy::HWY_NAMESPACE::Clamp;
 using hwy::HWY_NAMESPACE::Div;
 using hwy::HWY_NAMESPACE::Max;
 using hwy::HWY_NAMESPACE::Mul;
+using hwy::HWY_NAMESPACE::MulAdd;
 using hwy::HWY_NAMESPACE::NearestInt;
 using hwy::HWY_NAMESPACE::Or;
 using hwy::HWY_NAMESPACE::Rebind;
@@ -113,14 +119,58 @@ VFromD<Rebind<T, DF>> MakeUnsigned(VFromD<DF> v, size_t x0, size_t y0,
   return DemoteTo(DU(), NearestInt(v));
 }
 
+// Color conversion of WriteToOutputStage: none, the color channels are
+// already in the output encoding.
+struct NoColorConversion {
+  static constexpr bool kConverts = false;
+  void Convert(const float* input[3], float* output[3], size_t len) const {}
+};
+
+// Color conversion of WriteToOutputStage from XYB to the output encoding, with
+// the same arithmetic as the XYB stage followed by the from-linear stage with
+// `Op`, but without writing the intermediate results back to the rows.
+template <typename Op>
+struct XYBToOutputConversion {
+  static constexpr bool kConverts = true;
+
+  void Convert(const float* input[3], float* output[3], size_t len) const {
+    const HWY_FULL(float) d;
+    const size_t padding = RoundUpTo(len, Lanes(d)) - len;
+    for (size_t c = 0; c < 3; ++c) {
+      msan::UnpoisonMemory(input[c] + len, sizeof(input[c][0]) * padding);
+    }
+    for (size_t i = 0; i < len; i += Lanes(d)) {
+      auto r = Undefined(d);
+      auto g = Undefined(d);
+      auto b = Undefined(d);
+      XybToRgb(d, LoadU(d, input[0] + i), LoadU(d, input[1] + i),
+               LoadU(d, input[2] + i), opsin_params, &r, &g, &b);
+      op.Transform(d, &r, &g, &b);
+      Store(r, d, output[0] + i);
+      Store(g, d, output[1] + i);
+      Store(b, d, output[2] + i);
+    }
+    for (size_t c = 0; c < 3; ++c) {
+      msan::PoisonMemory(input[c] + len, sizeof(input[c][0]) * padding);
+      msan::PoisonMemory(output[c] + len, sizeof(output[c][0]) * padding);
+    }
+  }
+
+  OpsinParams opsin_params;
+  Op op;
+};
+
+template <typename ColorConversion>
 class WriteToOutputStage : public RenderPipelineStage {
  public:
-  WriteToOutputStage(const ImageOutput& main_output, size_t width,
+  WriteToOutputStage(ColorConversion color_conversion,
+                     const ImageOutput& main_output, size_t width,
                      size_t height, bool has_alpha, bool unpremul_alpha,
                      size_t alpha_c, Orientation undo_orientation,
                      const std::vector<ImageOutput>& extra_output,
                      JxlMemoryManager* memory_manager)
       : RenderPipelineStage(RenderPipelineStage::Settings()),
+        color_conversion_(std::move(color_conversion)),
         width_(width),
         height_(height),
         main_(main_output),
@@ -175,8 +225,21 @@ class WriteToOutputStage : public RenderPipelineStage {
       size_t len = std::min<size_t>(kMaxPixelsPerCall, limit - x0);
 
       const float* line_buffers[4];
-      for (size_t c = 0; c < num_color_; c++) {
-        line_buffers[c] = GetInputRow(input_rows, c, 0) + x0;
+      if (ColorConversion::kConverts) {
+        const float* input[3];
+        float* output[3];
+        for (size_t c = 0; c < 3; c++) {
+          input[c] = GetInputRow(input_rows, c, 0) + x0;
+          output[c] = temp_color_[thread_id * 3 + c].address<float>();
+        }
+        color_conversion_.Convert(input, output, len);
+        for (size_t c = 0; c < num_color_; c++) {
+          line_buffers[c] = output[c];
+        }
+      } else {
+        for (size_t c = 0; c < num_color_; c++) {
+          line_buffers[c] = GetInputRow(input_rows, c, 0) + x0;
+        }
       }
       if (has_alpha_) {
         line_buffers[num_color_] = GetInputRow(input_rows, alpha_c_, 0) + x0;
@@ -197,7 +260,10 @@ class WriteToOutputStage : public RenderPipelineStage {
   }
 
   RenderPipelineChannelMode GetChannelMode(size_t c) const final {
-    if (c < num_color_ || (has_alpha_ && c == alpha_c_)) {
+    // The conversion from XYB needs all three channels, even for grayscale
+    // output.
+    const size_t num_color_input = ColorConversion::kConverts ? 3 : num_color_;
+    if (c < num_color_input || (has_alpha_ && c == alpha_c_)) {
       return RenderPipelineChannelMode::kInput;
     }
     for (const auto& extra : extra_channels_) {
@@ -208,7 +274,9 @@ class WriteToOutputStage : public RenderPipelineStage {
     return RenderPipelineChannelMode::kIgnored;
   }
 
-  const char* GetName() const override { return "WritePixelCB"; }
+  const char* GetName() const override {
+    return ColorConversion::kConverts ? "XYBToOutput" : "WritePixelCB";
+  }
 
  private:
   struct Output {
@@ -224,9 +292,13 @@ class WriteToOutputStage : public RenderPipelineStage {
 
     Status PrepareForThreads(size_t num_threads) {
       if (pixel_callback_.IsPresent()) {
+        // Keep the state of the callback if it is valid for enough threads.
+        if (run_opaque_ && num_threads <= run_opaque_threads_) return true;
+        if (run_opaque_) pixel_callback_.destroy(run_opaque_);
         run_opaque_ =
             pixel_callback_.Init(num_threads, /*num_pixels=*/kMaxPixelsPerCall);
         JXL_RETURN_IF_ERROR(run_opaque_ != nullptr);
+        run_opaque_threads_ = num_threads;
       } else {
         JXL_RETURN_IF_ERROR(buffer_ != nullptr);
       }
@@ -235,6 +307,7 @@ class WriteToOutputStage : public RenderPipelineStage {
 
     PixelCallback pixel_callback_;
     void* run_opaque_ = nullptr;
+    size_t run_opaque_threads_ = 0;
     void* buffer_ = nullptr;
     size_t buffer_size_;
     size_t stride_;
@@ -257,6 +330,14 @@ class WriteToOutputStage : public RenderPipelineStage {
       JXL_ASSIGN_OR_RETURN(temp,
                            AlignedMemory::Create(memory_manager_, alloc_size));
     }
+    if (ColorConversion::kConverts) {
+      temp_color_.resize(num_threads * 3);
+      for (AlignedMemory& temp : temp_color_) {
+        size_t alloc_size = sizeof(float) * kMaxPixelsPerCall;
+        JXL_ASSIGN_OR_RETURN(
+            temp, AlignedMemory::Create(memory_manager_, alloc_size));
+      }
+    }
     if ((has_alpha_ && want_alpha_ && unpremul_alpha_) || flip_x_) {
       temp_in_.resize(num_threads * main_.num_channels_);
       for (AlignedMemory& temp : temp_in_) {
@@ -522,6 +603,7 @@ class WriteToOutputStage : public RenderPipelineStage {
   }
 
   static constexpr size_t kMaxPixelsPerCall = 1024;
+  ColorConversion color_conversion_;
   size_t width_;
   size_t height_;
   Output main_;  // color + alpha
@@ -538,17 +620,147 @@ class WriteToOutputStage : public RenderPipelineStage {
   JxlMemoryManager* memory_manager_;
   std::vector<AlignedMemory> temp_in_;
   std::vector<AlignedMemory> temp_out_;
+  // Converted color channels, if ColorConversion::kConverts.
+  std::vector<AlignedMemory> temp_color_;
 };
 
-constexpr size_t WriteToOutputStage::kMaxPixelsPerCall;
+template <typename ColorConversion>
+constexpr size_t WriteToOutputStage<ColorConversion>::kMaxPixelsPerCall;
 
 std::unique_ptr<RenderPipelineStage> GetWriteToOutputStage(
     const ImageOutput& main_output, size_t width, size_t height, bool has_alpha,
     bool unpremul_alpha, size_t alpha_c, Orientation undo_orientation,
     std::vector<ImageOutput>& extra_output, JxlMemoryManager* memory_manager) {
-  return jxl::make_unique<WriteToOutputStage>(
-      main_output, width, height, has_alpha, unpremul_alpha, alpha_c,
-      undo_orientation, extra_output, memory_manager);
+  return jxl::make_unique<WriteToOutputStage<NoColorConversion>>(
+      NoColorConversion(), main_output, width, height, has_alpha,
+      unpremul_alpha, alpha_c, undo_orientation, extra_output, memory_manager);
+}
+
+struct MakeXYBToOutputStage {
+  template <typename Op>
+  std::unique_ptr<RenderPipelineStage> operator()(Op op) const {
+    return jxl::make_unique<WriteToOutputStage<XYBToOutputConversion<Op>>>(
+        XYBToOutputConversion<Op>{opsin_params, std::move(op)}, main_output,
+        width, height, has_alpha, unpremul_alpha, alpha_c, undo_orientation,
+        extra_output, memory_manager);
+  }
+
+  const OpsinParams& opsin_params;
+  const ImageOutput& main_output;
+  size_t width;
+  size_t height;
+  bool has_alpha;
+  bool unpremul_alpha;
+  size_t alpha_c;
+  Orientation undo_orientation;
+  const std::vector<ImageOutput>& extra_output;
+  JxlMemoryManager* memory_manager;
+};
+
+std::unique_ptr<RenderPipelineStage> GetXYBToOutputStage(
+    const OutputEncodingInfo& output_encoding_info,
+    const ImageOutput& main_output, size_t width, size_t height, bool has_alpha,
+    bool unpremul_alpha, size_t alpha_c, Orientation undo_orientation,
+    std::vector<ImageOutput>& extra_output, JxlMemoryManager* memory_manager) {
+  return MakeWithFromLinearOp(
+      output_encoding_info,
+      MakeXYBToOutputStage{output_encoding_info.opsin_params, main_output,
+                           width, height, has_alpha, unpremul_alpha, alpha_c,
+                           undo_orientation, extra_output, memory_manager});
+}
+
+// Writes channel `c` of a YCbCr frame, which is Cb for 0, Y for 1 and Cr for 2,
+// to its plane of a YCbCr output as 8-bit samples.
+class WriteToYCbCrPlaneStage : public RenderPipelineStage {
+ public:
+  WriteToYCbCrPlaneStage(const YCbCrOutput& output, size_t c, size_t shift,
+                         size_t width, size_t height)
+      : RenderPipelineStage(RenderPipelineStage::Settings::Symmetric(
+            /*shift=*/shift, /*border=*/0)),
+        c_(c),
+        shift_(shift),
+        xsize_(DivCeil(width, 1 << shift)),
+        ysize_(DivCeil(height, 1 << shift)) {
+    size_t plane = c == 1 ? 0 : c == 0 ? 1 : 2;
+    size_t offset = 0;
+    step_ = 1;
+    if (output.layout == JXL_YCBCR_NV12 && c != 1) {
+      plane = 1;
+      offset = c == 0 ? 0 : 1;
+      step_ = 2;
+    }
+    plane_ = output.planes[plane] + offset;
+    stride_ = output.strides[plane];
+  }
+
+  Status ProcessRow(const RowInfo& input_rows, const RowInfo& output_rows,
+                    size_t xextra, size_t xsize, size_t xpos, size_t ypos,
+                    size_t thread_id) const final {
+    if (shift_ != 0) {
+      // The stage only declares the upsampling that the pipeline expects for
+      // subsampled channels; no later stage reads its output.
+      for (size_t iy = 0; iy < (1u << shift_); iy++) {
+        float* row_out = GetOutputRow(output_rows, c_, iy);
+        std::fill(row_out - (xextra << shift_),
+                  row_out + ((xsize + xextra) << shift_), 0.0f);
+      }
+    }
+    if (ypos >= ysize_ || xpos >= xsize_) return true;
+    const size_t len = std::min(xsize, xsize_ - xpos);
+    const HWY_FULL(float) d;
+    const Rebind<uint8_t, decltype(d)> du;
+    // The samples are stored with an offset of -128, see stage_ycbcr.cc.
+    const auto scale = Set(d, 255.0f);
+    const auto offset = Set(d, 128.0f);
+    const float* JXL_RESTRICT row_in = GetInputRow(input_rows, c_, 0);
+    uint8_t* JXL_RESTRICT row_out = plane_ + ypos * stride_ + xpos * step_;
+    HWY_ALIGN uint8_t bytes[hwy::kMaxVectorSize / sizeof(float)];
+    const size_t padding = RoundUpTo(len, Lanes(d)) - len;
+    msan::UnpoisonMemory(row_in + len, sizeof(float) * padding);
+    for (size_t x = 0; x < len; x += Lanes(d)) {
+      auto v = Clamp(MulAdd(LoadU(d, row_in + x), scale, offset), Zero(d),
+                     scale);
+      const auto samples = DemoteTo(du, NearestInt(v));
+      const size_t n = std::min(Lanes(d), len - x);
+      if (step_ == 1 && n == Lanes(d)) {
+        StoreU(samples, du, row_out + x);
+        continue;
+      }
+      // Partial vector or interleaved chroma of NV12.
+      StoreU(samples, du, bytes);
+      for (size_t i = 0; i < n; i++) {
+        row_out[(x + i) * step_] = bytes[i];
+      }
+    }
+    msan::PoisonMemory(row_in + len, sizeof(float) * padding);
+    return true;
+  }
+
+  RenderPipelineChannelMode GetChannelMode(size_t c) const final {
+    if (c != c_) return RenderPipelineChannelMode::kIgnored;
+    return shift_ != 0 ? RenderPipelineChannelMode::kInOut
+                       : RenderPipelineChannelMode::kInput;
+  }
+
+  const char* GetName() const override { return "WriteYCbCr"; }
+
+ private:
+  size_t c_;
+  size_t shift_;
+  // Dimensions of the plane.
+  size_t xsize_;
+  size_t ysize_;
+  uint8_t* plane_;
+  size_t stride_;
+  // Distance between samples of the channel within a row of the plane.
+  size_t step_;
+};
+
+std::unique_ptr<RenderPipelineStage> GetWriteToYCbCrPlaneStage(
+    const YCbCrOutput& output, size_t c, size_t shift, size_t width,
+    size_t height) {
+  return jxl::make_unique<WriteToYCbCrPlaneStage>(output, c, shift, width,
+                                                  height);
 }
 
 // NOLINTNEXTLINE(google-readability-namespace-comments)
@@ -561,6 +773,8 @@ HWY_AFTER_NAMESPACE();
 namespace jxl {
 
 HWY_EXPORT(GetWriteToOutputStage);
+HWY_EXPORT(GetXYBToOutputStage);
+HWY_EXPORT(GetWriteToYCbCrPlaneStage);
 
 namespace {
 class WriteToImageBundleStage : public RenderPipelineStage {
@@ -693,6 +907,23 @@ std::unique_ptr<RenderPipelineStage> GetWriteToOutputStage(
       undo_orientation, extra_output, memory_manager);
 }
 
+std::unique_ptr<RenderPipelineStage> GetXYBToOutputStage(
+    const OutputEncodingInfo& output_encoding_info,
+    const ImageOutput& main_output, size_t width, size_t height, bool has_alpha,
+    bool unpremul_alpha, size_t alpha_c, Orientation undo_orientation,
+    std::vector<ImageOutput>& extra_output, JxlMemoryManager* memory_manager) {
+  return HWY_DYNAMIC_DISPATCH(GetXYBToOutputStage)(
+      output_encoding_info, main_output, width, height, has_alpha,
+      unpremul_alpha, alpha_c, undo_orientation, extra_output, memory_manager);
+}
+
+std::unique_ptr<RenderPipelineStage> GetWriteToYCbCrPlaneStage(
+    const YCbCrOutput& output, size_t c, size_t shift, size_t width,
+    size_t height) {
+  return HWY_DYNAMIC_DISPATCH(GetWriteToYCbCrPlaneStage)(output, c, shift,
+                                                         width, height);
+}
+
 }  // namespace jxl
 
 #endif
@@ -34,6 +34,25 @@ std::unique_ptr<RenderPipelineStage> GetWriteToOutputStage(
     bool unpremul_alpha, size_t alpha_c, Orientation undo_orientation,
     std::vector<ImageOutput>& extra_output, JxlMemoryManager* memory_manager);
 
+// Same as the XYB stage followed by the from-linear stage and the stage of
+// GetWriteToOutputStage, but converts each chunk of a row from XYB to the
+// output encoding just before storing it, in a single pass over the rows.
+// Only valid if no CMS or tone mapping is needed for the output encoding.
+std::unique_ptr<RenderPipelineStage> GetXYBToOutputStage(
+    const OutputEncodingInfo& output_encoding_info,
+    const ImageOutput& main_output, size_t width, size_t height, bool has_alpha,
+    bool unpremul_alpha, size_t alpha_c, Orientation undo_orientation,
+    std::vector<ImageOutput>& extra_output, JxlMemoryManager* memory_manager);
+
+// Gets a stage to write channel `c` of a YCbCr frame to its plane of `output`.
+// `shift` is 1 if the channel is subsampled in both directions, in which case
+// the stage takes the place of the chroma upsampling stages and no later stage
+// may use the channel. `width` and `height` are the dimensions of the luma
+// plane.
+std::unique_ptr<RenderPipelineStage> GetWriteToYCbCrPlaneStage(
+    const YCbCrOutput& output, size_t c, size_t shift, size_t width,
+    size_t height);
+
 }  // namespace jxl
 
 #endif  // LIB_JXL_RENDER_PIPELINE_STAGE_WRITE_H_
@@ -179,6 +179,8 @@ libjxl_dec_sources = [
     "jxl/dec_noise.h",
     "jxl/dec_patch_dictionary.cc",
     "jxl/dec_patch_dictionary.h",
+    "jxl/dec_resample.cc",
+    "jxl/dec_resample.h",
     "jxl/dec_transforms-inl.h",
     "jxl/dec_xyb-inl.h",
     "jxl/dec_xyb.cc",
@@ -225,6 +227,7 @@ libjxl_dec_sources = [
     "jxl/luminance.h",
     "jxl/memory_manager_internal.cc",
     "jxl/memory_manager_internal.h",
+    "jxl/memory_pool.cc",
     "jxl/modular/encoding/context_predict.h",
     "jxl/modular/encoding/dec_ma.cc",
     "jxl/modular/encoding/dec_ma.h",
@@ -270,10 +273,13 @@ libjxl_dec_sources = [
     "jxl/render_pipeline/stage_cms.h",
     "jxl/render_pipeline/stage_epf.cc",
     "jxl/render_pipeline/stage_epf.h",
+    "jxl/render_pipeline/stage_from_linear-inl.h",
     "jxl/render_pipeline/stage_from_linear.cc",
     "jxl/render_pipeline/stage_from_linear.h",
     "jxl/render_pipeline/stage_gaborish.cc",
     "jxl/render_pipeline/stage_gaborish.h",
+    "jxl/render_pipeline/stage_loop_filter.cc",
+    "jxl/render_pipeline/stage_loop_filter.h",
     "jxl/render_pipeline/stage_noise.cc",
     "jxl/render_pipeline/stage_noise.h",
     "jxl/render_pipeline/stage_patches.cc",
@@ -456,6 +462,7 @@ libjxl_gbench_sources = [
     "extras/tone_mapping_gbench.cc",
     "jxl/dec_external_image_gbench.cc",
     "jxl/enc_external_image_gbench.cc",
+    "jxl/pipeline_stages_gbench.cc",
     "jxl/splines_gbench.cc",
     "jxl/tf_gbench.cc",
 ]
@@ -563,6 +570,7 @@ libjxl_public_headers = [
     "include/jxl/encode.h",
     "include/jxl/encode_cxx.h",
     "include/jxl/memory_manager.h",
+    "include/jxl/memory_pool.h",
     "include/jxl/parallel_runner.h",
     "include/jxl/stats.h",
     "include/jxl/types.h",
@@ -176,6 +176,8 @@ set(JPEGXL_INTERNAL_DEC_SOURCES
   jxl/dec_noise.h
   jxl/dec_patch_dictionary.cc
   jxl/dec_patch_dictionary.h
+  jxl/dec_resample.cc
+  jxl/dec_resample.h
   jxl/dec_transforms-inl.h
   jxl/dec_xyb-inl.h
   jxl/dec_xyb.cc
@@ -222,6 +224,7 @@ set(JPEGXL_INTERNAL_DEC_SOURCES
   jxl/luminance.h
   jxl/memory_manager_internal.cc
   jxl/memory_manager_internal.h
+  jxl/memory_pool.cc
   jxl/modular/encoding/context_predict.h
   jxl/modular/encoding/dec_ma.cc
   jxl/modular/encoding/dec_ma.h
@@ -267,10 +270,13 @@ set(JPEGXL_INTERNAL_DEC_SOURCES
   jxl/render_pipeline/stage_cms.h
   jxl/render_pipeline/stage_epf.cc
   jxl/render_pipeline/stage_epf.h
+  jxl/render_pipeline/stage_from_linear-inl.h
   jxl/render_pipeline/stage_from_linear.cc
   jxl/render_pipeline/stage_from_linear.h
   jxl/render_pipeline/stage_gaborish.cc
   jxl/render_pipeline/stage_gaborish.h
+  jxl/render_pipeline/stage_loop_filter.cc
+  jxl/render_pipeline/stage_loop_filter.h
   jxl/render_pipeline/stage_noise.cc
   jxl/render_pipeline/stage_noise.h
   jxl/render_pipeline/stage_patches.cc
@@ -453,6 +459,7 @@ set(JPEGXL_INTERNAL_GBENCH_SOURCES
   extras/tone_mapping_gbench.cc
   jxl/dec_external_image_gbench.cc
   jxl/enc_external_image_gbench.cc
+  jxl/pipeline_stages_gbench.cc
   jxl/splines_gbench.cc
   jxl/tf_gbench.cc
 )
@@ -552,6 +559,7 @@ set(JPEGXL_INTERNAL_PUBLIC_HEADERS
   include/jxl/encode.h
   include/jxl/encode_cxx.h
   include/jxl/memory_manager.h
+  include/jxl/memory_pool.h
   include/jxl/parallel_runner.h
   include/jxl/stats.h
   include/jxl/types.h
@@ -28,8 +28,10 @@ endif()
 
 list(APPEND JPEGXL_INTERNAL_TESTS
   # TODO(deymo): Move this to tools/
+  ../tools/benchmark/distance_search_test.cc
   ../tools/djxl_fuzzer_test.cc
   ../tools/gauss_blur_test.cc
+  ../tools/ssimulacra2_test.cc
 )
 
 find_package(GTest)
@@ -83,6 +85,8 @@ foreach (TESTFILE IN LISTS JPEGXL_INTERNAL_TESTS)
   )
   if(TESTFILE STREQUAL ../tools/gauss_blur_test.cc)
     target_link_libraries(${TESTNAME} jxl_gauss_blur)
+  elseif(TESTFILE STREQUAL ../tools/ssimulacra2_test.cc)
+    target_link_libraries(${TESTNAME} jxl_ssimulacra2)
   endif()
 
   # Output test targets in the test directory.
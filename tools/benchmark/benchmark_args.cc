@@ -218,6 +218,17 @@ Status BenchmarkArgs::AddCommandLineOptions() {
       "That is, the decoded image gets re-encoded, iteratively, N times.",
       0);
 
+  AddDouble(&throughput_seconds, "throughput_seconds",
+            "If nonzero, runs a load test instead of the per-image table: "
+            "every outer thread is an independent codec instance that "
+            "encodes and decodes images from the input set for this many "
+            "seconds. Reports images/s, MP/s, latency percentiles, RSS and "
+            "allocator call counts.",
+            0.0);
+  AddString(&throughput_json, "throughput_json",
+            "If not empty, also write the throughput report as JSON to this "
+            "file.");
+
   if (!AddCommandLineOptionsCustomCodec(this)) return false;
   if (!AddCommandLineOptionsJxlCodec(this)) return false;
   if (!AddCommandLineOptionsJPEGCodec(this)) return false;
@@ -269,6 +280,13 @@ Status BenchmarkArgs::ValidateArgs() {
     return JXL_FAILURE("override_bitdepth must be <= 32");
   }
 
+  if (throughput_seconds < 0) {
+    return JXL_FAILURE("throughput_seconds must not be negative");
+  }
+  if (!throughput_json.empty() && throughput_seconds == 0) {
+    return JXL_FAILURE("throughput_json requires throughput_seconds");
+  }
+
   if (!color_hints_string.empty()) {
     std::vector<std::string> hints = SplitString(color_hints_string, ',');
     for (const auto& hint : hints) {
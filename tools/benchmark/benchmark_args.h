@@ -148,6 +148,9 @@ struct BenchmarkArgs {
   size_t encode_reps;
   size_t generations;
 
+  double throughput_seconds;
+  std::string throughput_json;
+
   std::string sample_tmp_dir;
 
   int num_samples;
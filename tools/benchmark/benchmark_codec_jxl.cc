@@ -10,6 +10,7 @@
 #include <jxl/stats.h>
 #include <jxl/types.h>
 
+#include <algorithm>
 #include <cstdint>
 #include <cstdlib>
 #include <cstring>
@@ -24,15 +25,19 @@
 #include "lib/extras/enc/encode.h"
 #include "lib/extras/enc/jxl.h"
 #include "lib/extras/packed_image.h"
+#include "lib/extras/packed_image_convert.h"
 #include "lib/extras/time.h"
 #include "lib/jxl/base/status.h"
+#include "lib/jxl/codec_in_out.h"
 #include "lib/jxl/image.h"
 #include "tools/benchmark/benchmark_args.h"
 #include "tools/benchmark/benchmark_codec.h"
 #include "tools/benchmark/benchmark_file_io.h"
 #include "tools/benchmark/benchmark_stats.h"
+#include "tools/benchmark/distance_search.h"
 #include "tools/file_io.h"
 #include "tools/speed_stats.h"
+#include "tools/ssimulacra2.h"
 #include "tools/thread_pool_internal.h"
 
 namespace jpegxl {
@@ -136,6 +141,7 @@ class JxlCodec : public ImageCodec {
     const std::string kDownsamplingPrefix = "downsampling=";
     const std::string kResamplingPrefix = "resampling=";
     const std::string kEcResamplingPrefix = "ec_resampling=";
+    const std::string kSsimulacra2Prefix = "ssim2=";
     int val;
     float fval;
     if (param.substr(0, kResamplingPrefix.size()) == kResamplingPrefix) {
@@ -150,6 +156,13 @@ class JxlCodec : public ImageCodec {
       parser >> ec_resampling;
       cparams_.AddOption(JXL_ENC_FRAME_SETTING_EXTRA_CHANNEL_RESAMPLING,
                          ec_resampling);
+    } else if (param.substr(0, kSsimulacra2Prefix.size()) ==
+               kSsimulacra2Prefix) {
+      ssimulacra2_target_ =
+          strtof(param.substr(kSsimulacra2Prefix.size()).c_str(), nullptr);
+      if (ssimulacra2_target_ <= 0.f || ssimulacra2_target_ >= 100.f) {
+        return JXL_FAILURE("Invalid ssim2 target");
+      }
     } else if (ImageCodec::ParseParam(param)) {
       // Nothing to do.
     } else if (param == "uint8") {
@@ -278,7 +291,8 @@ class JxlCodec : public ImageCodec {
                        TO_JXL_BOOL(jxlargs->qprogressive));
     cparams_.AddOption(JXL_ENC_FRAME_SETTING_PROGRESSIVE_DC,
                        jxlargs->progressive_dc);
-    if (butteraugli_target_ > 0.f && modular_mode_ && !has_ctransform_) {
+    if ((butteraugli_target_ > 0.f || ssimulacra2_target_ > 0.f) &&
+        modular_mode_ && !has_ctransform_) {
       // Reset color transform to default XYB for lossy modular.
       cparams_.AddOption(JXL_ENC_FRAME_SETTING_COLOR_TRANSFORM, -1);
     }
@@ -289,8 +303,13 @@ class JxlCodec : public ImageCodec {
       cparams_.stats = stats_.get();
     }
     const double start = jxl::Now();
-    JXL_RETURN_IF_ERROR(jxl::extras::EncodeImageJXL(
-        cparams_, ppf, /*jpeg_bytes=*/nullptr, compressed));
+    if (ssimulacra2_target_ > 0.f) {
+      JXL_RETURN_IF_ERROR(
+          CompressToSsimulacra2Target(cparams_, ppf, pool, compressed));
+    } else {
+      JXL_RETURN_IF_ERROR(jxl::extras::EncodeImageJXL(
+          cparams_, ppf, /*jpeg_bytes=*/nullptr, compressed));
+    }
     const double end = jxl::Now();
     speed_stats->NotifyElapsed(end - start);
     return true;
@@ -335,8 +354,62 @@ class JxlCodec : public ImageCodec {
   bool uint8_ = false;
   JxlMemoryManager* memory_manager_;
   std::unique_ptr<JxlEncoderStats, decltype(JxlEncoderStatsDestroy)*> stats_;
+  float ssimulacra2_target_ = 0.f;
 
  private:
+  // Encodes at the largest distance whose SSIMULACRA2 score reaches
+  // ssimulacra2_target_, see SearchDistanceForTarget. This search is specific
+  // to benchmark_xl, libjxl has no SSIMULACRA2 target. The reference is
+  // prepared once; every step costs one encode, one decode and the distorted
+  // half of the metric. Probes encode with a copy of `cparams`, so the
+  // distance they try does not carry over to the next image.
+  Status CompressToSsimulacra2Target(const JXLCompressParams& cparams,
+                                     const PackedPixelFile& ppf,
+                                     ThreadPool* pool,
+                                     std::vector<uint8_t>* compressed) {
+    jxl::CodecInOut ref_io{memory_manager_};
+    JXL_RETURN_IF_ERROR(
+        jxl::extras::ConvertPackedPixelFileToCodecInOut(ppf, pool, &ref_io));
+    Ssimulacra2Comparator comparator(0.5f, pool);
+    JXL_RETURN_IF_ERROR(comparator.SetReference(ref_io.Main()));
+
+    JXLDecompressParams dparams;
+    dparams.runner = pool->runner();
+    dparams.runner_opaque = pool->runner_opaque();
+    dparams.memory_manager = memory_manager_;
+    dparams.keep_orientation = true;
+    for (uint32_t c = 1; c <= 4; ++c) {
+      dparams.accepted_formats.push_back(
+          {c, JXL_TYPE_FLOAT, JXL_LITTLE_ENDIAN, 0});
+    }
+
+    JXLCompressParams probe_cparams = cparams;
+    std::vector<uint8_t> candidate;
+    const auto probe = [&](float distance, double* score) -> Status {
+      probe_cparams.distance = distance;
+      candidate.clear();
+      JXL_RETURN_IF_ERROR(jxl::extras::EncodeImageJXL(
+          probe_cparams, ppf, /*jpeg_bytes=*/nullptr, &candidate));
+      PackedPixelFile decoded;
+      JXL_RETURN_IF_ERROR(jxl::extras::DecodeImageJXL(
+          candidate.data(), candidate.size(), dparams,
+          /*decoded_bytes=*/nullptr, &decoded));
+      jxl::CodecInOut decoded_io{memory_manager_};
+      JXL_RETURN_IF_ERROR(jxl::extras::ConvertPackedPixelFileToCodecInOut(
+          decoded, pool, &decoded_io));
+      JXL_ASSIGN_OR_RETURN(Msssim msssim,
+                           comparator.CompareWith(decoded_io.Main()));
+      *score = msssim.Score();
+      return true;
+    };
+    const auto keep = [&]() { compressed->swap(candidate); };
+    // SSIMULACRA2 scores roughly follow libjpeg quality, so the quality to
+    // distance mapping is a good first guess.
+    return SearchDistanceForTarget(
+        ssimulacra2_target_, JxlEncoderDistanceFromQuality(ssimulacra2_target_),
+        probe, keep);
+  }
+
   void SetDebugImageCallback(const std::string& filename,
                              std::string* debug_prefix,
                              JXLCompressParams* cparams) {
@@ -10,6 +10,8 @@
 #include <jxl/types.h>
 
 #include <algorithm>
+#include <atomic>
+#include <cinttypes>
 #include <cmath>
 #include <cstdint>
 #include <cstdio>
@@ -31,6 +33,7 @@
 #include "lib/extras/metrics.h"
 #include "lib/extras/packed_image.h"
 #include "lib/extras/packed_image_convert.h"
+#include "lib/extras/time.h"
 #include "lib/jxl/base/compiler_specific.h"
 #include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/base/printf_macros.h"
@@ -86,6 +89,20 @@ class TrackingMemoryManager {
 
   JxlMemoryManager* get() { return &outer_; }
 
+  // Number of alloc/free calls that reached the inner memory manager so far.
+  uint64_t NumAllocCalls() {
+    std::lock_guard<std::mutex> guard(mutex_);
+    return num_alloc_calls_;
+  }
+  uint64_t NumFreeCalls() {
+    std::lock_guard<std::mutex> guard(mutex_);
+    return num_free_calls_;
+  }
+  uint64_t MaxBytesInUse() {
+    std::lock_guard<std::mutex> guard(mutex_);
+    return max_bytes_in_use_;
+  }
+
   void PrintStats() const {
     fprintf(stderr, "Allocations: %" PRIuS " (max bytes in use: %E)\n",
             static_cast<size_t>(num_allocations_),
@@ -101,6 +118,7 @@ class TrackingMemoryManager {
     if (result != nullptr) {
       std::lock_guard<std::mutex> guard(self->mutex_);
       self->num_allocations_++;
+      self->num_alloc_calls_++;
       self->bytes_in_use_ += size;
       self->max_bytes_in_use_ =
           std::max(self->max_bytes_in_use_, self->bytes_in_use_);
@@ -119,6 +137,7 @@ class TrackingMemoryManager {
       auto entry = self->allocations_.find(address);
       JXL_CHECK(entry != self->allocations_.end());
       self->num_allocations_--;
+      self->num_free_calls_++;
       self->bytes_in_use_ -= entry->second;
       self->allocations_.erase(entry);
     }
@@ -130,6 +149,8 @@ class TrackingMemoryManager {
   uint64_t bytes_in_use_ = 0;
   uint64_t max_bytes_in_use_ = 0;
   uint64_t num_allocations_ = 0;
+  uint64_t num_alloc_calls_ = 0;
+  uint64_t num_free_calls_ = 0;
   JxlMemoryManager outer_;
   JxlMemoryManager* inner_;
 };
@@ -318,7 +339,7 @@ void DoCompress(const std::string& filename, const PackedPixelFile& ppf,
       params.intensity_target = 80.0;
 
       const JxlCmsInterface& cms = *JxlGetDefaultCms();
-      JxlButteraugliComparator comparator(params, cms);
+      JxlButteraugliComparator comparator(params, cms, inner_pool);
       JXL_CHECK(ComputeScore(ib1, ib2, &comparator, cms, &distance, &distmap,
                              inner_pool, codec->IgnoreAlpha()));
     } else {
@@ -335,8 +356,12 @@ void DoCompress(const std::string& filename, const PackedPixelFile& ppf,
     s->distance_p_norm +=
         ComputeDistanceP(distmap, ButteraugliParams(), Args()->error_pnorm) *
         input_pixels;
-    JXL_ASSIGN_OR_DIE(Msssim msssim, ComputeSSIMULACRA2(ib1, ib2));
-    s->ssimulacra2 += msssim.Score() * input_pixels;
+    if (jxl::SameSize(ppf, ppf2)) {
+      Ssimulacra2Comparator ssimulacra2(0.5f, inner_pool);
+      JXL_CHECK(ssimulacra2.SetReference(ib1));
+      JXL_ASSIGN_OR_DIE(Msssim msssim, ssimulacra2.CompareWith(ib2));
+      s->ssimulacra2 += msssim.Score() * input_pixels;
+    }
     s->max_distance = std::max(s->max_distance, distance);
     s->distances.push_back(distance);
   }
@@ -848,6 +873,93 @@ struct StatPrinter {
   std::mutex mutex;
 };
 
+// Returns the value of a "<key>: <n> kB" line of /proc/self/status in bytes,
+// or 0 if it is not available (e.g. on non-Linux systems).
+uint64_t ReadProcStatusBytes(const char* key) {
+  FILE* f = fopen("/proc/self/status", "r");
+  if (f == nullptr) return 0;
+  const size_t key_len = strlen(key);
+  uint64_t result = 0;
+  char line[256];
+  while (fgets(line, sizeof(line), f) != nullptr) {
+    if (strncmp(line, key, key_len) == 0 && line[key_len] == ':') {
+      unsigned long long kb = 0;  // NOLINT
+      if (sscanf(line + key_len + 1, "%llu", &kb) == 1) result = kb * 1024;
+      break;
+    }
+  }
+  fclose(f);
+  return result;
+}
+
+// Nearest-rank percentile of an already sorted vector, in milliseconds.
+double PercentileMs(const std::vector<double>& sorted_seconds, double p) {
+  if (sorted_seconds.empty()) return 0.0;
+  size_t rank = static_cast<size_t>(
+      std::ceil(p / 100.0 * static_cast<double>(sorted_seconds.size())));
+  rank = std::min(std::max<size_t>(rank, 1), sorted_seconds.size());
+  return sorted_seconds[rank - 1] * 1000.0;
+}
+
+// Results of one codec method (or of all methods) in throughput mode.
+struct ThroughputStats {
+  size_t images = 0;
+  size_t errors = 0;
+  uint64_t pixels = 0;
+  uint64_t compressed_bytes = 0;
+  std::vector<double> encode_seconds;
+  std::vector<double> decode_seconds;
+
+  void Assimilate(const ThroughputStats& other) {
+    images += other.images;
+    errors += other.errors;
+    pixels += other.pixels;
+    compressed_bytes += other.compressed_bytes;
+    encode_seconds.insert(encode_seconds.end(), other.encode_seconds.begin(),
+                          other.encode_seconds.end());
+    decode_seconds.insert(decode_seconds.end(), other.decode_seconds.begin(),
+                          other.decode_seconds.end());
+  }
+
+  void Sort() {
+    std::sort(encode_seconds.begin(), encode_seconds.end());
+    std::sort(decode_seconds.begin(), decode_seconds.end());
+  }
+
+  std::string PrintLine(const std::string& method, double elapsed) const {
+    std::string line = StringPrintf(
+        "%-30s %9.2f %8.2f %6" PRIuS, method.c_str(), images / elapsed,
+        pixels * 1E-6 / elapsed, errors);
+    for (const auto* v : {&encode_seconds, &decode_seconds}) {
+      for (double p : {50.0, 95.0, 99.0, 99.9}) {
+        line += StringPrintf(" %8.2f", PercentileMs(*v, p));
+      }
+    }
+    return line + "\n";
+  }
+
+  std::string ToJson(const std::string& method, double elapsed) const {
+    std::string json = StringPrintf(
+        "{\"method\": \"%s\", \"images\": %" PRIuS ", \"errors\": %" PRIuS
+        ", \"images_per_second\": %.4f, \"mp_per_second\": %.4f, "
+        "\"bpp\": %.6f",
+        method.c_str(), images, errors, images / elapsed,
+        pixels * 1E-6 / elapsed,
+        pixels == 0 ? 0.0 : compressed_bytes * 8.0 / pixels);
+    const char* names[2] = {"encode_latency_ms", "decode_latency_ms"};
+    const std::vector<double>* values[2] = {&encode_seconds, &decode_seconds};
+    for (size_t i = 0; i < 2; ++i) {
+      json += StringPrintf(
+          ", \"%s\": {\"p50\": %.4f, \"p95\": %.4f, \"p99\": %.4f, "
+          "\"p99.9\": %.4f}",
+          names[i], PercentileMs(*values[i], 50.0),
+          PercentileMs(*values[i], 95.0), PercentileMs(*values[i], 99.0),
+          PercentileMs(*values[i], 99.9));
+    }
+    return json + "}";
+  }
+};
+
 class Benchmark {
   using StringVec = std::vector<std::string>;
 
@@ -863,6 +975,11 @@ class Benchmark {
       const StringVec extra_metrics_names = GetExtraMetricsNames();
       const StringVec extra_metrics_commands = GetExtraMetricsCommands();
       const StringVec fnames = GetFilenames();
+      if (Args()->throughput_seconds > 0) {
+        ret = RunThroughput(methods, fnames, &memory_manager);
+        memory_manager.PrintStats();
+        return ret;
+      }
       // (non-const because Task.stats are updated)
       std::vector<Task> tasks =
           CreateTasks(methods, fnames, memory_manager.get());
@@ -1168,6 +1285,188 @@ class Benchmark {
     return std::accumulate(errors_thread.begin(), errors_thread.end(),
                            static_cast<size_t>(0));
   }
+
+  // Load test: every outer thread acts as an independent codec instance that
+  // round-trips images from the input set until the time budget is spent.
+  // Returns the exit code of the program.
+  static int RunThroughput(const StringVec& methods, const StringVec& fnames,
+                           TrackingMemoryManager* memory_manager) {
+    std::unique_ptr<ThreadPoolInternal> pool;
+    std::vector<std::unique_ptr<ThreadPoolInternal>> inner_pools;
+    // There is no fixed number of tasks; pass the upper bound that
+    // NumOuterThreads applies anyway so that only --num_threads matters.
+    InitThreads(4 * std::thread::hardware_concurrency(), &pool, &inner_pools);
+    const size_t num_instances = inner_pools.size();
+
+    std::vector<PackedPixelFile> loaded_images =
+        LoadImages(fnames, pool->get());
+    // Raw file contents, for decode_only and JPEG recompression.
+    std::vector<std::vector<uint8_t>> file_bytes(fnames.size());
+    for (size_t i = 0; i < fnames.size(); ++i) {
+      if (!ReadFile(fnames[i], &file_bytes[i])) {
+        fprintf(stderr, "Failed to read %s\n", fnames[i].c_str());
+        return EXIT_FAILURE;
+      }
+    }
+
+    // One codec per (instance, method), so that instances share no state.
+    std::vector<std::vector<ImageCodecPtr>> codecs(num_instances);
+    for (auto& instance_codecs : codecs) {
+      for (const std::string& method : methods) {
+        instance_codecs.push_back(
+            CreateImageCodec(method, memory_manager->get()));
+      }
+    }
+    // Indexed by [instance][method].
+    std::vector<std::vector<ThroughputStats>> stats(
+        num_instances, std::vector<ThroughputStats>(methods.size()));
+
+    // (seconds since start, bytes) samples of the resident set size.
+    std::vector<std::pair<double, uint64_t>> rss_samples;
+    std::atomic<size_t> next_item{0};
+    const uint64_t alloc_calls_before = memory_manager->NumAllocCalls();
+    const uint64_t free_calls_before = memory_manager->NumFreeCalls();
+    const double duration = Args()->throughput_seconds;
+    const double start = jxl::Now();
+    const double deadline = start + duration;
+
+    const auto run_instance = [&](const uint32_t instance,
+                                  const size_t thread) {
+      ThreadPool* inner_pool = inner_pools[thread]->get();
+      double last_rss_sample = -1.0;
+      for (double now = jxl::Now(); now < deadline; now = jxl::Now()) {
+        if (instance == 0 && now - last_rss_sample >= 0.1) {
+          rss_samples.emplace_back(now - start, ReadProcStatusBytes("VmRSS"));
+          last_rss_sample = now;
+        }
+        const size_t item = next_item.fetch_add(1);
+        const size_t idx_image = item % fnames.size();
+        const size_t idx_method = (item / fnames.size()) % methods.size();
+        const std::string& filename = fnames[idx_image];
+        const PackedPixelFile& ppf = loaded_images[idx_image];
+        ImageCodec* codec = codecs[instance][idx_method].get();
+        ThroughputStats& s = stats[instance][idx_method];
+
+        jpegxl::tools::SpeedStats speed_stats;
+        std::vector<uint8_t> compressed;
+        if (Args()->decode_only) {
+          compressed = file_bytes[idx_image];
+        } else {
+          if (ppf.frames.size() != 1 || ppf.info.xsize == 0) {
+            // Failed to load, or multiframe; both are errors in DoCompress.
+            s.errors++;
+            continue;
+          }
+          const std::string ext = FileExtension(filename);
+          const double t0 = jxl::Now();
+          Status ok = true;
+          if (codec->CanRecompressJpeg() && (ext == ".jpg" || ext == ".jpeg")) {
+            ok = codec->RecompressJpeg(filename, file_bytes[idx_image],
+                                       &compressed, &speed_stats);
+          } else {
+            ok = codec->Compress(filename, ppf, inner_pool, &compressed,
+                                 &speed_stats);
+          }
+          const double t1 = jxl::Now();
+          if (!ok) {
+            s.errors++;
+            continue;
+          }
+          s.encode_seconds.push_back(t1 - t0);
+        }
+
+        PackedPixelFile ppf2;
+        const double t0 = jxl::Now();
+        Status ok = codec->Decompress(filename, Bytes(compressed), inner_pool,
+                                      &ppf2, &speed_stats);
+        const double t1 = jxl::Now();
+        if (!ok) {
+          s.errors++;
+          continue;
+        }
+        s.decode_seconds.push_back(t1 - t0);
+        s.images++;
+        s.pixels += ppf2.info.xsize * ppf2.info.ysize;
+        s.compressed_bytes += compressed.size();
+      }
+    };
+    JXL_CHECK(jxl::RunOnPool(pool->get(), 0, num_instances, ThreadPool::NoInit,
+                             run_instance, "Throughput"));
+    const double elapsed = jxl::Now() - start;
+
+    const uint64_t alloc_calls =
+        memory_manager->NumAllocCalls() - alloc_calls_before;
+    const uint64_t free_calls =
+        memory_manager->NumFreeCalls() - free_calls_before;
+    const uint64_t peak_rss = ReadProcStatusBytes("VmHWM");
+    // Steady state: median of the samples taken in the second half of the run,
+    // after caches and pools have warmed up.
+    std::vector<uint64_t> steady_rss;
+    for (const auto& sample : rss_samples) {
+      if (sample.first >= duration / 2) steady_rss.push_back(sample.second);
+    }
+    if (steady_rss.empty() && !rss_samples.empty()) {
+      steady_rss.push_back(rss_samples.back().second);
+    }
+    std::sort(steady_rss.begin(), steady_rss.end());
+    const uint64_t steady_state_rss =
+        steady_rss.empty() ? 0 : steady_rss[steady_rss.size() / 2];
+
+    std::vector<ThroughputStats> method_stats(methods.size());
+    ThroughputStats total;
+    for (const auto& instance_stats : stats) {
+      for (size_t i = 0; i < methods.size(); ++i) {
+        method_stats[i].Assimilate(instance_stats[i]);
+        total.Assimilate(instance_stats[i]);
+      }
+    }
+    total.Sort();
+
+    if (Args()->markdown) printf("```\n");
+    printf("%" PRIuS " instances, %.2f s\n", num_instances, elapsed);
+    printf("%-30s %9s %8s %6s %35s %35s\n", "Method", "images/s", "MP/s",
+           "Errors", "encode p50/p95/p99/p99.9 (ms)",
+           "decode p50/p95/p99/p99.9 (ms)");
+    std::string json = StringPrintf(
+        "{\n  \"instances\": %" PRIuS ",\n  \"seconds\": %.4f,\n"
+        "  \"methods\": [\n",
+        num_instances, elapsed);
+    for (size_t i = 0; i < methods.size(); ++i) {
+      method_stats[i].Sort();
+      printf("%s", method_stats[i].PrintLine(methods[i], elapsed).c_str());
+      json += "    " + method_stats[i].ToJson(methods[i], elapsed) +
+              (i + 1 < methods.size() ? ",\n" : "\n");
+    }
+    printf("%s", total.PrintLine("Aggregate:", elapsed).c_str());
+    printf("RSS: peak %.1f MB, steady state %.1f MB\n", peak_rss * 1E-6,
+           steady_state_rss * 1E-6);
+    printf("Allocator calls: %" PRIu64 " alloc, %" PRIu64
+           " free (%.1f allocs per image)\n",
+           alloc_calls, free_calls,
+           total.images == 0 ? 0.0
+                             : static_cast<double>(alloc_calls) / total.images);
+    if (Args()->markdown) printf("```\n");
+    fflush(stdout);
+
+    json += "  ],\n  \"aggregate\": " + total.ToJson("", elapsed) + ",\n";
+    json += StringPrintf(
+        "  \"peak_rss_bytes\": %" PRIu64 ",\n"
+        "  \"steady_state_rss_bytes\": %" PRIu64 ",\n"
+        "  \"alloc_calls\": %" PRIu64 ",\n  \"free_calls\": %" PRIu64 "\n}\n",
+        peak_rss, steady_state_rss, alloc_calls, free_calls);
+    if (!Args()->throughput_json.empty() &&
+        !WriteFile(Args()->throughput_json, json)) {
+      return EXIT_FAILURE;
+    }
+
+    if (total.errors != 0) {
+      if (!Args()->silent_errors) {
+        fprintf(stderr, "There were error(s) in the benchmark.\n");
+      }
+      return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+  }
 };
 
 int BenchmarkMain(int argc, const char** argv) {
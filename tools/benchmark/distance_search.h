@@ -0,0 +1,81 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef TOOLS_BENCHMARK_DISTANCE_SEARCH_H_
+#define TOOLS_BENCHMARK_DISTANCE_SEARCH_H_
+
+#include <algorithm>
+#include <functional>
+
+#include "lib/jxl/base/status.h"
+
+namespace jpegxl {
+namespace tools {
+
+// Searches for the largest distance whose score reaches `target`, assuming
+// that the score decreases as the distance grows. `probe` encodes at the
+// given distance and returns the score of the result; `keep` is called right
+// after the probe whose output should be kept: the largest passing distance,
+// or, if no probe reaches the target, the smallest (best scoring) one.
+inline jxl::Status SearchDistanceForTarget(
+    double target, float initial_distance,
+    const std::function<jxl::Status(float distance, double* score)>& probe,
+    const std::function<void()>& keep) {
+  constexpr int kMaxSteps = 8;
+  constexpr double kScoreTolerance = 0.5;
+  constexpr float kMinDistance = 0.05f;
+  constexpr float kMaxDistance = 25.0f;
+
+  // Distances known to pass (lo) and fail (hi) the target, with scores.
+  float lo = 0.f;
+  double lo_score = 100.0;
+  float hi = 0.f;
+  double hi_score = 0.0;
+  bool passed = false;
+  float distance = initial_distance;
+  for (int step = 0; step < kMaxSteps; ++step) {
+    distance = std::min(std::max(distance, kMinDistance), kMaxDistance);
+    double score;
+    JXL_RETURN_IF_ERROR(probe(distance, &score));
+
+    if (score >= target) {
+      if (!passed || distance > lo) {
+        lo = distance;
+        lo_score = score;
+        passed = true;
+        keep();
+      }
+      if (score - target < kScoreTolerance) break;
+    } else {
+      if (hi == 0.f || distance < hi) {
+        hi = distance;
+        hi_score = score;
+        if (!passed) keep();
+      }
+    }
+
+    float next;
+    if (passed && hi > 0.f) {
+      // Bracketed: interpolate the score linearly in distance.
+      const double t =
+          (lo_score - target) / std::max(lo_score - hi_score, 1e-6);
+      next = lo + (hi - lo) * std::min(std::max(t, 0.1), 0.9);
+      if (hi - lo < 0.01f) break;
+    } else if (passed) {
+      if (lo >= kMaxDistance) break;
+      next = lo * 1.5f;
+    } else {
+      if (hi <= kMinDistance) break;
+      next = hi / 1.5f;
+    }
+    distance = next;
+  }
+  return true;
+}
+
+}  // namespace tools
+}  // namespace jpegxl
+
+#endif  // TOOLS_BENCHMARK_DISTANCE_SEARCH_H_
@@ -0,0 +1,71 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include "tools/benchmark/distance_search.h"
+
+#include <vector>
+
+#include "lib/jxl/base/status.h"
+#include "lib/jxl/testing.h"
+
+namespace jpegxl {
+namespace tools {
+namespace {
+
+// Runs the search against a score that falls linearly with the distance and
+// returns the distance of the kept probe.
+float Search(double target, float initial_distance, double slope,
+             std::vector<float>* probed) {
+  float last = 0.f;
+  float kept = -1.f;
+  const auto probe = [&](float distance, double* score) -> jxl::Status {
+    probed->push_back(distance);
+    last = distance;
+    *score = 100.0 - slope * distance;
+    return true;
+  };
+  const auto keep = [&]() { kept = last; };
+  EXPECT_TRUE(SearchDistanceForTarget(target, initial_distance, probe, keep));
+  return kept;
+}
+
+TEST(DistanceSearchTest, ConvergesFromBothSides) {
+  for (float initial : {0.3f, 2.0f, 9.0f}) {
+    std::vector<float> probed;
+    const float kept = Search(80.0, initial, 10.0, &probed);
+    EXPECT_LE(probed.size(), 8u);
+    // Passes the target, and is within the score tolerance of it.
+    EXPECT_LE(kept, 2.0f) << initial;
+    EXPECT_GT(kept, 1.9f) << initial;
+    // Nothing larger that also passes was probed.
+    for (float d : probed) {
+      if (d <= 2.0f) {
+        EXPECT_LE(d, kept);
+      }
+    }
+  }
+}
+
+TEST(DistanceSearchTest, KeepsBestScoreIfTargetIsUnreachable) {
+  std::vector<float> probed;
+  // Even the smallest distance scores below the target.
+  const float kept = Search(99.9, 0.2f, 10.0, &probed);
+  EXPECT_FLOAT_EQ(0.05f, kept);
+}
+
+TEST(DistanceSearchTest, PropagatesProbeErrors) {
+  int calls = 0;
+  const auto probe = [&](float /*distance*/, double* /*score*/) -> jxl::Status {
+    ++calls;
+    return JXL_FAILURE("encode failed");
+  };
+  const auto keep = []() {};
+  EXPECT_FALSE(SearchDistanceForTarget(80.0, 1.0f, probe, keep));
+  EXPECT_EQ(1, calls);
+}
+
+}  // namespace
+}  // namespace tools
+}  // namespace jpegxl
@@ -100,7 +100,7 @@ Status RunButteraugli(const char* pathname1, const char* pathname2,
   ba_params.xmul = 1.0f;
   ba_params.intensity_target = intensity_target;
   const JxlCmsInterface& cms = *JxlGetDefaultCms();
-  JxlButteraugliComparator comparator(ba_params, cms);
+  JxlButteraugliComparator comparator(ba_params, cms, pool.get());
   float distance;
   JXL_CHECK(ComputeScore(io1.Main(), io2.Main(), &comparator, cms, &distance,
                          &distmap, pool.get(),
@@ -47,6 +47,7 @@
 #include "tools/cmdline.h"
 #include "tools/codec_config.h"
 #include "tools/file_io.h"
+#include "tools/profiling_trace.h"
 #include "tools/speed_stats.h"
 
 namespace jpegxl {
@@ -364,6 +365,11 @@ struct CompressArgs {
     cmdline->AddOptionFlag('\0', "disable_output",
                            "No output file will be written (for benchmarking)",
                            &disable_output, &SetBooleanTrue, 3);
+    cmdline->AddOptionValue('\0', "profile_trace_out", "FILENAME",
+                            "If specified, writes the timing of every "
+                            "parallel encoding stage as Chrome trace events "
+                            "to a JSON file.",
+                            &profile_trace_out, &ParseString, 3);
 
     cmdline->AddOptionValue(
         '\0', "dots", "0|1",
@@ -475,6 +481,7 @@ struct CompressArgs {
   jxl::Override container = jxl::Override::kDefault;
   bool quiet = false;
   bool disable_output = false;
+  std::string profile_trace_out;
 
   jxl::Override print_profile = jxl::Override::kDefault;
   bool streaming_input = false;
@@ -1177,6 +1184,12 @@ int main(int argc, char** argv) {
   params.runner = JxlThreadParallelRunner;
   params.runner_opaque = runner.get();
 
+  jpegxl::tools::ProfilingTrace profiling_trace;
+  if (!args.profile_trace_out.empty()) {
+    params.profiling_sink = jpegxl::tools::ProfilingTrace::Sink;
+    params.profiling_sink_opaque = &profiling_trace;
+  }
+
   if (args.streaming_input) {
     params.options.emplace_back(JXL_ENC_FRAME_SETTING_BUFFERING,
                                 static_cast<int64_t>(3), 0);
@@ -1218,6 +1231,11 @@ int main(int argc, char** argv) {
       return EXIT_FAILURE;
     }
   }
+  if (!args.profile_trace_out.empty() &&
+      !jpegxl::tools::WriteFile(args.profile_trace_out,
+                                profiling_trace.ToJson())) {
+    return EXIT_FAILURE;
+  }
   if (!args.quiet) {
     if (compressed_size < 100000) {
       cmdline.VerbosePrintf(0, "Compressed to %" PRIuS " bytes ",
@@ -18,6 +18,7 @@
 #include <memory>
 #include <sstream>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "lib/extras/alpha_blend.h"
@@ -27,12 +28,15 @@
 #include "lib/extras/enc/encode.h"
 #include "lib/extras/enc/exr.h"
 #include "lib/extras/enc/jpg.h"
+#include "lib/extras/mmap.h"
 #include "lib/extras/packed_image.h"
 #include "lib/extras/time.h"
 #include "lib/jxl/base/printf_macros.h"
+#include "lib/jxl/base/span.h"
 #include "tools/cmdline.h"
 #include "tools/codec_config.h"
 #include "tools/file_io.h"
+#include "tools/profiling_trace.h"
 #include "tools/speed_stats.h"
 
 namespace jpegxl {
@@ -217,6 +221,12 @@ struct DecompressArgs {
     cmdline->AddOptionFlag('\0', "print_read_bytes",
                            "Print total number of decoded bytes.",
                            &print_read_bytes, &SetBooleanTrue, 2);
+
+    cmdline->AddOptionValue('\0', "profile_trace_out", "FILENAME",
+                            "If specified, writes the timing of every "
+                            "parallel decoding stage as Chrome trace events "
+                            "to a JSON file.",
+                            &profile_trace_out, &ParseString, 2);
   }
 
   // Validate the passed arguments, checking whether all passed options are
@@ -261,6 +271,7 @@ struct DecompressArgs {
   std::string background_spec = "white";
   bool alpha_blend = false;
   bool print_read_bytes = false;
+  std::string profile_trace_out;
   bool quiet = false;
   // References (ids) of specific options to check if they were matched.
   CommandLineParser::OptionId opt_bits_per_sample_id = -1;
@@ -348,16 +359,21 @@ bool ParseBackgroundColor(const std::string& background_desc,
 }
 
 bool DecompressJxlReconstructJPEG(const jpegxl::tools::DecompressArgs& args,
-                                  const std::vector<uint8_t>& compressed,
+                                  jxl::Bytes compressed,
                                   void* runner,
                                   std::vector<uint8_t>* jpeg_bytes,
-                                  jpegxl::tools::SpeedStats* stats) {
+                                  jpegxl::tools::SpeedStats* stats,
+                                  jpegxl::tools::ProfilingTrace* trace) {
   const double t0 = jxl::Now();
   jxl::extras::PackedPixelFile ppf;  // for JxlBasicInfo
   jxl::extras::JXLDecompressParams dparams;
   dparams.allow_partial_input = args.allow_partial_files;
   dparams.runner = JxlThreadParallelRunner;
   dparams.runner_opaque = runner;
+  if (trace) {
+    dparams.profiling_sink = jpegxl::tools::ProfilingTrace::Sink;
+    dparams.profiling_sink_opaque = trace;
+  }
   if (!jxl::extras::DecodeImageJXL(compressed.data(), compressed.size(),
                                    dparams, nullptr, &ppf, jpeg_bytes)) {
     return false;
@@ -372,11 +388,10 @@ bool DecompressJxlReconstructJPEG(const jpegxl::tools::DecompressArgs& args,
 }
 
 bool DecompressJxlToPackedPixelFile(
-    const jpegxl::tools::DecompressArgs& args,
-    const std::vector<uint8_t>& compressed,
+    const jpegxl::tools::DecompressArgs& args, jxl::Bytes compressed,
     const std::vector<JxlPixelFormat>& accepted_formats, void* runner,
     jxl::extras::PackedPixelFile* ppf, size_t* decoded_bytes,
-    jpegxl::tools::SpeedStats* stats) {
+    jpegxl::tools::SpeedStats* stats, jpegxl::tools::ProfilingTrace* trace) {
   jxl::extras::JXLDecompressParams dparams;
   dparams.max_downsampling = args.downsampling;
   dparams.accepted_formats = accepted_formats;
@@ -386,6 +401,10 @@ bool DecompressJxlToPackedPixelFile(
   dparams.runner = JxlThreadParallelRunner;
   dparams.runner_opaque = runner;
   dparams.allow_partial_input = args.allow_partial_files;
+  if (trace) {
+    dparams.profiling_sink = jpegxl::tools::ProfilingTrace::Sink;
+    dparams.profiling_sink_opaque = trace;
+  }
   if (args.bits_per_sample == 0) {
     dparams.output_bitdepth.type = JXL_BIT_DEPTH_FROM_CODESTREAM;
   } else if (args.bits_per_sample > 0) {
@@ -439,11 +458,28 @@ int main(int argc, const char* argv[]) {
     return EXIT_FAILURE;
   }
 
-  std::vector<uint8_t> compressed;
-  // Reading compressed JPEG XL input
-  if (!jpegxl::tools::ReadFile(args.file_in, &compressed)) {
-    fprintf(stderr, "couldn't load %s\n", args.file_in);
-    return EXIT_FAILURE;
+  // Reading compressed JPEG XL input. Regular files are memory mapped, so that
+  // only the pages the decoder actually needs are read, e.g. just the headers
+  // and TOCs of frames that are skipped.
+  jxl::MemoryMappedFile compressed_mmap;
+  std::vector<uint8_t> compressed_storage;
+  jxl::Bytes compressed;
+  bool mapped = false;
+  if (strcmp(args.file_in, "-") != 0) {
+    jxl::StatusOr<jxl::MemoryMappedFile> mmap_or =
+        jxl::MemoryMappedFile::Init(args.file_in);
+    if (mmap_or.ok()) {
+      compressed_mmap = std::move(mmap_or).value();
+      compressed = jxl::Bytes(compressed_mmap.data(), compressed_mmap.size());
+      mapped = true;
+    }
+  }
+  if (!mapped) {
+    if (!jpegxl::tools::ReadFile(args.file_in, &compressed_storage)) {
+      fprintf(stderr, "couldn't load %s\n", args.file_in);
+      return EXIT_FAILURE;
+    }
+    compressed = jxl::Bytes(compressed_storage);
   }
   if (!args.quiet) {
     cmdline.VerbosePrintf(1, "Read %" PRIuS " compressed bytes.\n",
@@ -485,6 +521,9 @@ int main(int argc, const char* argv[]) {
   }
 
   jpegxl::tools::SpeedStats stats;
+  jpegxl::tools::ProfilingTrace profiling_trace;
+  jpegxl::tools::ProfilingTrace* trace =
+      args.profile_trace_out.empty() ? nullptr : &profiling_trace;
   size_t num_worker_threads = JxlThreadParallelRunnerDefaultNumWorkerThreads();
   {
     int64_t flag_num_worker_threads = args.num_threads;
@@ -507,7 +546,7 @@ int main(int argc, const char* argv[]) {
     std::vector<uint8_t> bytes;
     for (size_t i = 0; i < num_reps; ++i) {
       if (!DecompressJxlReconstructJPEG(args, compressed, runner.get(), &bytes,
-                                        &stats)) {
+                                        &stats, trace)) {
         if (bytes.empty()) {
           if (!args.quiet) {
             fprintf(stderr,
@@ -563,7 +602,7 @@ int main(int argc, const char* argv[]) {
     for (size_t i = 0; i < num_reps; ++i) {
       if (!DecompressJxlToPackedPixelFile(args, compressed, accepted_formats,
                                           runner.get(), &ppf, &decoded_bytes,
-                                          &stats)) {
+                                          &stats, trace)) {
         fprintf(stderr, "DecompressJxlToPackedPixelFile failed\n");
         return EXIT_FAILURE;
       }
@@ -622,6 +661,10 @@ int main(int argc, const char* argv[]) {
       }
     }
   }
+  if (trace &&
+      !jpegxl::tools::WriteFile(args.profile_trace_out, trace->ToJson())) {
+    return EXIT_FAILURE;
+  }
   if (!args.quiet) {
     stats.Print(num_worker_threads);
   }
@@ -0,0 +1,361 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+// Losslessly recompresses many JPEG files to JPEG XL through a bounded
+// pipeline: a reader thread, a parser thread that extracts the quantization
+// and Huffman tables, a pool of encoder threads and a writer thread. Each
+// encoder keeps its buffers across files and prefers queued files whose tables
+// match the ones of its previous file, so that batches of JPEGs from the same
+// camera reuse the tables computed for the first one.
+
+#include <jxl/encode.h>
+#include <jxl/encode_cxx.h>
+#include <jxl/types.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "tools/file_io.h"
+
+namespace {
+
+struct Job {
+  std::string input;
+  std::string output;
+  std::vector<uint8_t> data;
+  size_t input_size = 0;
+  // Concatenated DQT and DHT segments before the first scan.
+  std::string tables;
+  std::string error;
+  // How often a younger job was popped first; see BoundedQueue::Pop.
+  size_t times_skipped = 0;
+};
+
+// Queue of at most `capacity` jobs shared by the stages of the pipeline.
+// Push() blocks while the queue is full and Pop() while it is empty, until
+// Close() is called.
+class BoundedQueue {
+ public:
+  explicit BoundedQueue(size_t capacity) : capacity_(capacity) {}
+
+  void Push(Job&& job) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    not_full_.wait(lock, [this] { return jobs_.size() < capacity_; });
+    jobs_.push_back(std::move(job));
+    not_empty_.notify_one();
+  }
+
+  // Pops the first job with the given `tables` if any, otherwise the oldest
+  // one. The oldest job is popped regardless once it has been skipped
+  // kMaxSkips times, so that a job with unique tables is not starved by a
+  // steady stream of matching ones. Returns false once the queue is closed
+  // and empty.
+  bool Pop(const std::string& tables, Job* job) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    not_empty_.wait(lock, [this] { return !jobs_.empty() || closed_; });
+    if (jobs_.empty()) return false;
+    auto it = jobs_.begin();
+    if (!tables.empty() && jobs_.front().times_skipped < kMaxSkips) {
+      for (auto match = jobs_.begin(); match != jobs_.end(); ++match) {
+        if (match->tables == tables) {
+          it = match;
+          break;
+        }
+      }
+      for (auto skipped = jobs_.begin(); skipped != it; ++skipped) {
+        skipped->times_skipped++;
+      }
+    }
+    *job = std::move(*it);
+    jobs_.erase(it);
+    not_full_.notify_one();
+    return true;
+  }
+
+  void Close() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    closed_ = true;
+    not_empty_.notify_all();
+  }
+
+ private:
+  static constexpr size_t kMaxSkips = 8;
+
+  const size_t capacity_;
+  std::mutex mutex_;
+  std::condition_variable not_full_;
+  std::condition_variable not_empty_;
+  std::deque<Job> jobs_;
+  bool closed_ = false;
+};
+
+struct Options {
+  size_t num_workers = std::thread::hardware_concurrency();
+  size_t queue_size = 0;  // 0 means twice the number of workers.
+  int64_t effort = 7;
+  int64_t brotli_effort = -1;
+  bool store_jpeg_metadata = true;
+};
+
+// Appends the DQT and DHT segments found before the first scan of `data` to
+// `tables`. Returns false if `data` is not a JPEG file.
+bool ParseTables(const std::vector<uint8_t>& data, std::string* tables) {
+  tables->clear();
+  if (data.size() < 4 || data[0] != 0xFF || data[1] != 0xD8) return false;
+  size_t pos = 2;
+  while (pos + 4 <= data.size()) {
+    if (data[pos] != 0xFF) return false;
+    uint8_t marker = data[pos + 1];
+    if (marker == 0xFF) {
+      // Fill byte.
+      pos++;
+      continue;
+    }
+    if (marker == 0xDA || marker == 0xD9) break;  // SOS or EOI
+    size_t length = (data[pos + 2] << 8) | data[pos + 3];
+    if (length < 2 || pos + 2 + length > data.size()) return false;
+    if (marker == 0xDB || marker == 0xC4) {
+      tables->append(reinterpret_cast<const char*>(&data[pos + 1]),
+                     length + 1);
+    }
+    pos += 2 + length;
+  }
+  return true;
+}
+
+std::string OutputFilename(const std::string& input) {
+  size_t slash = input.find_last_of('/');
+  size_t dot = input.find_last_of('.');
+  if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) {
+    return input + ".jxl";
+  }
+  return input.substr(0, dot) + ".jxl";
+}
+
+bool Transcode(JxlEncoder* enc, const Options& options, const Job& job,
+               std::vector<uint8_t>* compressed, std::string* error) {
+  JxlEncoderReset(enc);
+  if (options.store_jpeg_metadata &&
+      JXL_ENC_SUCCESS != JxlEncoderStoreJPEGMetadata(enc, JXL_TRUE)) {
+    *error = "storing JPEG metadata failed";
+    return false;
+  }
+  JxlEncoderFrameSettings* settings =
+      JxlEncoderFrameSettingsCreate(enc, nullptr);
+  if (JXL_ENC_SUCCESS != JxlEncoderFrameSettingsSetOption(
+                             settings, JXL_ENC_FRAME_SETTING_EFFORT,
+                             options.effort) ||
+      JXL_ENC_SUCCESS != JxlEncoderFrameSettingsSetOption(
+                             settings, JXL_ENC_FRAME_SETTING_BROTLI_EFFORT,
+                             options.brotli_effort)) {
+    *error = "setting the encoder options failed";
+    return false;
+  }
+  if (JXL_ENC_SUCCESS !=
+      JxlEncoderAddJPEGFrame(settings, job.data.data(), job.data.size())) {
+    *error = JxlEncoderGetError(enc) == JXL_ENC_ERR_JBRD
+                 ? "JPEG bitstream reconstruction data could not be created"
+                 : "error while decoding the JPEG image";
+    return false;
+  }
+  JxlEncoderCloseInput(enc);
+  compressed->resize(job.data.size() + 4096);
+  uint8_t* next_out = compressed->data();
+  size_t avail_out = compressed->size();
+  JxlEncoderStatus result = JXL_ENC_NEED_MORE_OUTPUT;
+  while (result == JXL_ENC_NEED_MORE_OUTPUT) {
+    result = JxlEncoderProcessOutput(enc, &next_out, &avail_out);
+    if (result == JXL_ENC_NEED_MORE_OUTPUT) {
+      size_t offset = next_out - compressed->data();
+      compressed->resize(compressed->size() * 2);
+      next_out = compressed->data() + offset;
+      avail_out = compressed->size() - offset;
+    }
+  }
+  compressed->resize(next_out - compressed->data());
+  if (result != JXL_ENC_SUCCESS) {
+    *error = "JxlEncoderProcessOutput failed";
+    return false;
+  }
+  return true;
+}
+
+void PrintUsage(const char* name) {
+  fprintf(stderr,
+          "Usage: %s [options] LIST\n"
+          "Losslessly recompresses the JPEG files listed in LIST, one per "
+          "line,\nor read from stdin if LIST is '-'. A line may give the "
+          "output file\nafter a tab; by default the extension is replaced "
+          "with .jxl.\n\n"
+          "Options:\n"
+          "  --workers=N        number of encoder threads "
+          "(default: one per core)\n"
+          "  --queue=N          files held by each stage "
+          "(default: 2 * workers)\n"
+          "  --effort=N         encoder effort, 1-10 (default: 7)\n"
+          "  --brotli_effort=N  Brotli effort for the reconstruction data, "
+          "0-11\n"
+          "                     (default: chosen from the effort)\n"
+          "  --strip            do not store the JPEG reconstruction data\n",
+          name);
+}
+
+bool ParseOptions(int argc, char** argv, Options* options, std::string* list) {
+  for (int i = 1; i < argc; i++) {
+    const std::string arg = argv[i];
+    const auto value = [&](const char* flag, int64_t* out) {
+      size_t len = strlen(flag);
+      if (arg.compare(0, len, flag) != 0) return false;
+      *out = strtoll(arg.c_str() + len, nullptr, 10);
+      return true;
+    };
+    int64_t v;
+    if (value("--workers=", &v)) {
+      if (v < 1) return false;
+      options->num_workers = v;
+    } else if (value("--queue=", &v)) {
+      if (v < 1) return false;
+      options->queue_size = v;
+    } else if (value("--effort=", &options->effort) ||
+               value("--brotli_effort=", &options->brotli_effort)) {
+    } else if (arg == "--strip") {
+      options->store_jpeg_metadata = false;
+    } else if (list->empty() && (arg == "-" || arg[0] != '-')) {
+      *list = arg;
+    } else {
+      return false;
+    }
+  }
+  if (options->num_workers == 0) options->num_workers = 1;
+  if (options->queue_size == 0) options->queue_size = 2 * options->num_workers;
+  return !list->empty();
+}
+
+int Run(int argc, char** argv) {
+  Options options;
+  std::string list;
+  if (!ParseOptions(argc, argv, &options, &list)) {
+    PrintUsage(argv[0]);
+    return 1;
+  }
+  std::ifstream list_file;
+  if (list != "-") {
+    list_file.open(list);
+    if (!list_file) {
+      fprintf(stderr, "Failed to open %s\n", list.c_str());
+      return 1;
+    }
+  }
+  std::istream& lines = list == "-" ? std::cin : list_file;
+
+  BoundedQueue read_queue(options.queue_size);
+  BoundedQueue encode_queue(options.queue_size);
+  BoundedQueue write_queue(options.queue_size);
+  const auto start = std::chrono::steady_clock::now();
+
+  std::thread reader([&] {
+    std::string line;
+    while (std::getline(lines, line)) {
+      if (line.empty()) continue;
+      Job job;
+      size_t tab = line.find('\t');
+      job.input = line.substr(0, tab);
+      job.output = tab == std::string::npos ? OutputFilename(job.input)
+                                            : line.substr(tab + 1);
+      if (!jpegxl::tools::ReadFile(job.input, &job.data)) {
+        job.error = "failed to read the file";
+      }
+      job.input_size = job.data.size();
+      read_queue.Push(std::move(job));
+    }
+    read_queue.Close();
+  });
+
+  std::thread parser([&] {
+    Job job;
+    while (read_queue.Pop("", &job)) {
+      if (job.error.empty() && !ParseTables(job.data, &job.tables)) {
+        job.error = "not a JPEG file";
+      }
+      // Failed jobs skip the encoders.
+      BoundedQueue& next = job.error.empty() ? encode_queue : write_queue;
+      next.Push(std::move(job));
+    }
+    encode_queue.Close();
+  });
+
+  std::vector<std::thread> encoders;
+  for (size_t i = 0; i < options.num_workers; i++) {
+    encoders.emplace_back([&] {
+      JxlEncoderPtr enc = JxlEncoderMake(/*memory_manager=*/nullptr);
+      JxlEncoderSetReuseBuffers(enc.get(), JXL_TRUE);
+      std::string tables;
+      Job job;
+      while (encode_queue.Pop(tables, &job)) {
+        std::vector<uint8_t> compressed;
+        if (Transcode(enc.get(), options, job, &compressed, &job.error)) {
+          tables = job.tables;
+        }
+        job.data.swap(compressed);
+        write_queue.Push(std::move(job));
+      }
+    });
+  }
+
+  size_t num_files = 0;
+  size_t num_failed = 0;
+  uint64_t input_bytes = 0;
+  uint64_t output_bytes = 0;
+  std::thread writer([&] {
+    Job job;
+    while (write_queue.Pop("", &job)) {
+      num_files++;
+      if (job.error.empty() &&
+          !jpegxl::tools::WriteFile(job.output, job.data)) {
+        job.error = "failed to write " + job.output;
+      }
+      if (!job.error.empty()) {
+        fprintf(stderr, "%s: %s\n", job.input.c_str(), job.error.c_str());
+        num_failed++;
+        continue;
+      }
+      input_bytes += job.input_size;
+      output_bytes += job.data.size();
+    }
+  });
+
+  reader.join();
+  parser.join();
+  for (std::thread& encoder : encoders) encoder.join();
+  write_queue.Close();
+  writer.join();
+
+  const double seconds = std::chrono::duration<double>(
+                             std::chrono::steady_clock::now() - start)
+                             .count();
+  fprintf(stderr,
+          "%zu files, %zu failed, %.1f MB -> %.1f MB (%.2f%%), "
+          "%.2f files/s, %.2f MB/s\n",
+          num_files, num_failed, input_bytes * 1e-6, output_bytes * 1e-6,
+          input_bytes ? 100.0 * output_bytes / input_bytes : 0.0,
+          num_files / seconds, input_bytes * 1e-6 / seconds);
+  return num_failed == 0 ? 0 : 1;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) { return Run(argc, argv); }
@@ -0,0 +1,81 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include "tools/profiling_trace.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace jpegxl {
+namespace tools {
+
+void ProfilingTrace::Sink(void* opaque, const JxlProfilingEvent* event) {
+  auto* trace = static_cast<ProfilingTrace*>(opaque);
+  Stage stage;
+  stage.name = event->stage;
+  stage.num_tasks = event->num_tasks;
+  stage.start = event->start;
+  stage.wall_time = event->wall_time;
+  stage.thread_busy_time.assign(
+      event->thread_busy_time, event->thread_busy_time + event->num_threads);
+  stage.thread_cpu_time.assign(
+      event->thread_cpu_time, event->thread_cpu_time + event->num_threads);
+  stage.thread_wait_time.assign(
+      event->thread_wait_time, event->thread_wait_time + event->num_threads);
+  stage.peak_memory = event->peak_memory;
+  trace->stages_.push_back(std::move(stage));
+}
+
+std::string ProfilingTrace::ToJson() const {
+  const auto micros = [](double seconds) {
+    return static_cast<int64_t>(seconds * 1e6);
+  };
+  const auto list = [&micros](std::ostream& os,
+                              const std::vector<double>& times) {
+    os << "[";
+    for (size_t t = 0; t < times.size(); ++t) {
+      os << (t ? "," : "") << micros(times[t]);
+    }
+    os << "]";
+  };
+  const double origin = stages_.empty() ? 0.0 : stages_[0].start;
+  std::ostringstream os;
+  os << "{\"traceEvents\":[";
+  for (size_t i = 0; i < stages_.size(); ++i) {
+    const Stage& stage = stages_[i];
+    double busy = 0.0;
+    for (double t : stage.thread_busy_time) busy += t;
+    const double idle = stage.wall_time * stage.thread_busy_time.size() - busy;
+    os << (i ? ",\n" : "\n") << "{\"name\":\"";
+    // Stage names are identifiers from the library, but stay valid JSON.
+    for (char c : stage.name) {
+      if (c == '"' || c == '\\') os << '\\';
+      os << c;
+    }
+    os << "\",\"ph\":\"X\",\"pid\":0,\"tid\":0"
+       << ",\"ts\":" << micros(stage.start - origin)
+       << ",\"dur\":" << micros(stage.wall_time) << ",\"args\":{"
+       << "\"tasks\":" << stage.num_tasks
+       << ",\"threads\":" << stage.thread_busy_time.size()
+       << ",\"idle_us\":" << micros(idle)
+       << ",\"peak_memory\":" << stage.peak_memory << ",\"busy_us\":";
+    list(os, stage.thread_busy_time);
+    os << ",\"cpu_us\":";
+    list(os, stage.thread_cpu_time);
+    os << ",\"wait_us\":";
+    list(os, stage.thread_wait_time);
+    os << "}}";
+  }
+  os << "\n]}\n";
+  return os.str();
+}
+
+}  // namespace tools
+}  // namespace jpegxl
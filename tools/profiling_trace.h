@@ -0,0 +1,45 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef TOOLS_PROFILING_TRACE_H_
+#define TOOLS_PROFILING_TRACE_H_
+
+#include <jxl/parallel_runner.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+namespace jpegxl {
+namespace tools {
+
+// Collects the stages reported to a JxlProfilingSink and writes them in the
+// Chrome trace event format, which chrome://tracing and Perfetto can load.
+class ProfilingTrace {
+ public:
+  // Pass as JxlProfilingSink, with a ProfilingTrace* as opaque pointer.
+  static void Sink(void* opaque, const JxlProfilingEvent* event);
+
+  std::string ToJson() const;
+
+ private:
+  struct Stage {
+    std::string name;
+    uint32_t num_tasks;
+    double start;
+    double wall_time;
+    std::vector<double> thread_busy_time;
+    std::vector<double> thread_cpu_time;
+    std::vector<double> thread_wait_time;
+    size_t peak_memory;
+  };
+  std::vector<Stage> stages_;
+};
+
+}  // namespace tools
+}  // namespace jpegxl
+
+#endif  // TOOLS_PROFILING_TRACE_H_
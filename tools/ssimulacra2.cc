@@ -25,14 +25,23 @@ Design:
 #include "tools/ssimulacra2.h"
 
 #include <jxl/cms.h>
+#include <jxl/memory_manager.h>
 
 #include <algorithm>
 #include <cmath>
+#include <cstdint>
 #include <cstdio>
 #include <hwy/aligned_allocator.h>
 #include <utility>
+#include <vector>
+
+#undef HWY_TARGET_INCLUDE
+#define HWY_TARGET_INCLUDE "tools/ssimulacra2.cc"
+#include <hwy/foreach_target.h>
+#include <hwy/highway.h>
 
 #include "lib/jxl/base/compiler_specific.h"
+#include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/base/printf_macros.h"
 #include "lib/jxl/base/status.h"
 #include "lib/jxl/color_encoding_internal.h"
@@ -40,118 +49,79 @@ Design:
 #include "lib/jxl/image.h"
 #include "lib/jxl/image_bundle.h"
 #include "tools/gauss_blur.h"
-#include "tools/no_memory_manager.h"
 
+HWY_BEFORE_NAMESPACE();
+namespace jxl {
+namespace HWY_NAMESPACE {
 namespace {
 
-using jxl::Image3F;
-using jxl::ImageBundle;
-using jxl::ImageF;
-using jxl::StatusOr;
+// These templates are not found via ADL.
+using hwy::HWY_NAMESPACE::Abs;
+using hwy::HWY_NAMESPACE::Add;
+using hwy::HWY_NAMESPACE::Div;
+using hwy::HWY_NAMESPACE::FirstN;
+using hwy::HWY_NAMESPACE::GetLane;
+using hwy::HWY_NAMESPACE::IfThenElseZero;
+using hwy::HWY_NAMESPACE::Max;
+using hwy::HWY_NAMESPACE::Mul;
+using hwy::HWY_NAMESPACE::MulAdd;
+using hwy::HWY_NAMESPACE::Neg;
+using hwy::HWY_NAMESPACE::NegMulAdd;
+using hwy::HWY_NAMESPACE::Sub;
 
 const float kC2 = 0.0009f;
-const int kNumScales = 6;
 
-StatusOr<Image3F> Downsample(const Image3F& in, size_t fx, size_t fy) {
-  const size_t out_xsize = (in.xsize() + fx - 1) / fx;
-  const size_t out_ysize = (in.ysize() + fy - 1) / fy;
-  JXL_ASSIGN_OR_RETURN(
-      Image3F out,
-      Image3F::Create(jpegxl::tools::NoMemoryManager(), out_xsize, out_ysize));
-  const float normalize = 1.0f / (fx * fy);
-  for (size_t c = 0; c < 3; ++c) {
-    for (size_t oy = 0; oy < out_ysize; ++oy) {
-      float* JXL_RESTRICT row_out = out.PlaneRow(c, oy);
-      for (size_t ox = 0; ox < out_xsize; ++ox) {
-        float sum = 0.0f;
-        for (size_t iy = 0; iy < fy; ++iy) {
-          for (size_t ix = 0; ix < fx; ++ix) {
-            const size_t x = std::min(ox * fx + ix, in.xsize() - 1);
-            const size_t y = std::min(oy * fy + iy, in.ysize() - 1);
-            sum += in.PlaneRow(c, y)[x];
-          }
-        }
-        row_out[ox] = sum * normalize;
-      }
-    }
-  }
-  return out;
+template <class V>
+V Quartic(V x) {
+  x = Mul(x, x);
+  return Mul(x, x);
 }
 
-void Multiply(const Image3F& a, const Image3F& b, Image3F* mul) {
-  for (size_t c = 0; c < 3; ++c) {
-    for (size_t y = 0; y < a.ysize(); ++y) {
+Status Multiply(const Image3F& a, const Image3F& b, Image3F* mul,
+                ThreadPool* pool) {
+  const auto process_row = [&](const uint32_t y, size_t /* thread */) {
+    const HWY_FULL(float) d;
+    for (size_t c = 0; c < 3; ++c) {
       const float* JXL_RESTRICT in1 = a.PlaneRow(c, y);
       const float* JXL_RESTRICT in2 = b.PlaneRow(c, y);
       float* JXL_RESTRICT out = mul->PlaneRow(c, y);
-      for (size_t x = 0; x < a.xsize(); ++x) {
-        out[x] = in1[x] * in2[x];
+      for (size_t x = 0; x < a.xsize(); x += Lanes(d)) {
+        Store(Mul(Load(d, in1 + x), Load(d, in2 + x)), d, out + x);
       }
     }
-  }
+  };
+  return RunOnPool(pool, 0, a.ysize(), ThreadPool::NoInit, process_row,
+                   "SSIMULACRA2Multiply");
 }
 
-// Temporary storage for Gaussian blur, reused for multiple images.
-class Blur {
- public:
-  static StatusOr<Blur> Create(const size_t xsize, const size_t ysize) {
-    JxlMemoryManager* memory_manager = jpegxl::tools::NoMemoryManager();
-    Blur result;
-    JXL_ASSIGN_OR_RETURN(result.temp_,
-                         ImageF::Create(memory_manager, xsize, ysize));
-    return result;
-  }
-
-  void operator()(const ImageF& in, ImageF* JXL_RESTRICT out) {
-    FastGaussian(
-        rg_, in.xsize(), in.ysize(), [&](size_t y) { return in.ConstRow(y); },
-        [&](size_t y) { return temp_.Row(y); },
-        [&](size_t y) { return out->Row(y); });
-  }
-
-  StatusOr<Image3F> operator()(const Image3F& in) {
-    JxlMemoryManager* memory_manager = jpegxl::tools::NoMemoryManager();
-    JXL_ASSIGN_OR_RETURN(
-        Image3F out, Image3F::Create(memory_manager, in.xsize(), in.ysize()));
-    operator()(in.Plane(0), &out.Plane(0));
-    operator()(in.Plane(1), &out.Plane(1));
-    operator()(in.Plane(2), &out.Plane(2));
-    return out;
-  }
-
-  // Allows reusing across scales.
-  void ShrinkTo(const size_t xsize, const size_t ysize) {
-    temp_.ShrinkTo(xsize, ysize);
-  }
-
- private:
-  Blur() : rg_(jxl::CreateRecursiveGaussian(1.5)) {}
-  hwy::AlignedUniquePtr<jxl::RecursiveGaussian> rg_;
-  ImageF temp_;
-};
-
-double quartic(double x) {
-  x *= x;
-  x *= x;
-  return x;
-}
-void SSIMMap(const Image3F& m1, const Image3F& m2, const Image3F& s11,
-             const Image3F& s22, const Image3F& s12, double* plane_averages) {
-  const double onePerPixels = 1.0 / (m1.ysize() * m1.xsize());
+// The error maps are summed in float along each row, and the row sums in
+// double, in row order, so that the averages do not depend on the pool.
+Status SSIMMap(const Image3F& m1, const Image3F& m2, const Image3F& s11,
+               const Image3F& s22, const Image3F& s12, ThreadPool* pool,
+               double* plane_averages) {
+  const size_t xsize = m1.xsize();
+  const size_t ysize = m1.ysize();
+  const double onePerPixels = 1.0 / (ysize * xsize);
+  std::vector<double> row_sums(ysize * 2);
   for (size_t c = 0; c < 3; ++c) {
-    double sum1[2] = {0.0};
-    for (size_t y = 0; y < m1.ysize(); ++y) {
+    const auto process_row = [&](const uint32_t y, size_t /* thread */) {
+      const HWY_FULL(float) d;
       const float* JXL_RESTRICT row_m1 = m1.PlaneRow(c, y);
       const float* JXL_RESTRICT row_m2 = m2.PlaneRow(c, y);
       const float* JXL_RESTRICT row_s11 = s11.PlaneRow(c, y);
       const float* JXL_RESTRICT row_s22 = s22.PlaneRow(c, y);
       const float* JXL_RESTRICT row_s12 = s12.PlaneRow(c, y);
-      for (size_t x = 0; x < m1.xsize(); ++x) {
-        float mu1 = row_m1[x];
-        float mu2 = row_m2[x];
-        float mu11 = mu1 * mu1;
-        float mu22 = mu2 * mu2;
-        float mu12 = mu1 * mu2;
+      const auto one = Set(d, 1.0f);
+      const auto two = Set(d, 2.0f);
+      const auto c2 = Set(d, kC2);
+      auto sum0 = Zero(d);
+      auto sum1 = Zero(d);
+      for (size_t x = 0; x < xsize; x += Lanes(d)) {
+        const auto mu1 = Load(d, row_m1 + x);
+        const auto mu2 = Load(d, row_m2 + x);
+        const auto mu11 = Mul(mu1, mu1);
+        const auto mu22 = Mul(mu2, mu2);
+        const auto mu12 = Mul(mu1, mu2);
         /* Correction applied compared to the original SSIM formula, which has:
 
              luma_err = 2 * mu1 * mu2 / (mu1^2 + mu2^2)
@@ -165,56 +135,94 @@ void SSIMMap(const Image3F& m1, const Image3F& m2, const Image3F& s11,
            or blue more than yellow does not make any sense at all). So it is
            better to simply drop this denominator.
         */
-        float num_m = 1.0 - (mu1 - mu2) * (mu1 - mu2);
-        float num_s = 2 * (row_s12[x] - mu12) + kC2;
-        float denom_s = (row_s11[x] - mu11) + (row_s22[x] - mu22) + kC2;
+        const auto diff = Sub(mu1, mu2);
+        const auto num_m = NegMulAdd(diff, diff, one);
+        const auto num_s = MulAdd(two, Sub(Load(d, row_s12 + x), mu12), c2);
+        const auto denom_s = Add(Add(Sub(Load(d, row_s11 + x), mu11),
+                                     Sub(Load(d, row_s22 + x), mu22)),
+                                 c2);
 
         // Use 1 - SSIM' so it becomes an error score instead of a quality
         // index. This makes it make sense to compute an L_4 norm.
-        double d = 1.0 - (num_m * num_s / denom_s);
-        d = std::max(d, 0.0);
-        sum1[0] += d;
-        sum1[1] += quartic(d);
+        auto err = Max(Sub(one, Div(Mul(num_m, num_s), denom_s)), Zero(d));
+        // The lanes past the end of the row read uninitialized padding.
+        err = IfThenElseZero(FirstN(d, xsize - x), err);
+        sum0 = Add(sum0, err);
+        sum1 = Add(sum1, Quartic(err));
       }
+      row_sums[y * 2] = GetLane(SumOfLanes(d, sum0));
+      row_sums[y * 2 + 1] = GetLane(SumOfLanes(d, sum1));
+    };
+    JXL_RETURN_IF_ERROR(RunOnPool(pool, 0, ysize, ThreadPool::NoInit,
+                                  process_row, "SSIMULACRA2SSIMMap"));
+    double sum1[2] = {0.0};
+    for (size_t y = 0; y < ysize; ++y) {
+      sum1[0] += row_sums[y * 2];
+      sum1[1] += row_sums[y * 2 + 1];
     }
     plane_averages[c * 2] = onePerPixels * sum1[0];
     plane_averages[c * 2 + 1] = sqrt(sqrt(onePerPixels * sum1[1]));
   }
+  return true;
 }
 
-void EdgeDiffMap(const Image3F& img1, const Image3F& mu1, const Image3F& img2,
-                 const Image3F& mu2, double* plane_averages) {
-  const double onePerPixels = 1.0 / (img1.ysize() * img1.xsize());
+Status EdgeDiffMap(const Image3F& img1, const Image3F& mu1,
+                   const Image3F& img2, const Image3F& mu2, ThreadPool* pool,
+                   double* plane_averages) {
+  const size_t xsize = img1.xsize();
+  const size_t ysize = img1.ysize();
+  const double onePerPixels = 1.0 / (ysize * xsize);
+  std::vector<double> row_sums(ysize * 4);
   for (size_t c = 0; c < 3; ++c) {
-    double sum1[4] = {0.0};
-    for (size_t y = 0; y < img1.ysize(); ++y) {
+    const auto process_row = [&](const uint32_t y, size_t /* thread */) {
+      const HWY_FULL(float) d;
       const float* JXL_RESTRICT row1 = img1.PlaneRow(c, y);
       const float* JXL_RESTRICT row2 = img2.PlaneRow(c, y);
       const float* JXL_RESTRICT rowm1 = mu1.PlaneRow(c, y);
       const float* JXL_RESTRICT rowm2 = mu2.PlaneRow(c, y);
-      for (size_t x = 0; x < img1.xsize(); ++x) {
-        double d1 = (1.0 + std::abs(row2[x] - rowm2[x])) /
-                        (1.0 + std::abs(row1[x] - rowm1[x])) -
-                    1.0;
+      const auto one = Set(d, 1.0f);
+      auto sum_artifact = Zero(d);
+      auto sum_artifact4 = Zero(d);
+      auto sum_detail_lost = Zero(d);
+      auto sum_detail_lost4 = Zero(d);
+      for (size_t x = 0; x < xsize; x += Lanes(d)) {
+        const auto edge1 =
+            Add(one, Abs(Sub(Load(d, row1 + x), Load(d, rowm1 + x))));
+        const auto edge2 =
+            Add(one, Abs(Sub(Load(d, row2 + x), Load(d, rowm2 + x))));
+        auto d1 = Sub(Div(edge2, edge1), one);
+        // The lanes past the end of the row read uninitialized padding.
+        d1 = IfThenElseZero(FirstN(d, xsize - x), d1);
 
         // d1 > 0: distorted has an edge where original is smooth
         //         (indicating ringing, color banding, blockiness, etc)
-        double artifact = std::max(d1, 0.0);
-        sum1[0] += artifact;
-        sum1[1] += quartic(artifact);
+        const auto artifact = Max(d1, Zero(d));
+        sum_artifact = Add(sum_artifact, artifact);
+        sum_artifact4 = Add(sum_artifact4, Quartic(artifact));
 
         // d1 < 0: original has an edge where distorted is smooth
         //         (indicating smoothing, blurring, smearing, etc)
-        double detail_lost = std::max(-d1, 0.0);
-        sum1[2] += detail_lost;
-        sum1[3] += quartic(detail_lost);
+        const auto detail_lost = Max(Neg(d1), Zero(d));
+        sum_detail_lost = Add(sum_detail_lost, detail_lost);
+        sum_detail_lost4 = Add(sum_detail_lost4, Quartic(detail_lost));
       }
+      row_sums[y * 4] = GetLane(SumOfLanes(d, sum_artifact));
+      row_sums[y * 4 + 1] = GetLane(SumOfLanes(d, sum_artifact4));
+      row_sums[y * 4 + 2] = GetLane(SumOfLanes(d, sum_detail_lost));
+      row_sums[y * 4 + 3] = GetLane(SumOfLanes(d, sum_detail_lost4));
+    };
+    JXL_RETURN_IF_ERROR(RunOnPool(pool, 0, ysize, ThreadPool::NoInit,
+                                  process_row, "SSIMULACRA2EdgeDiffMap"));
+    double sum1[4] = {0.0};
+    for (size_t y = 0; y < ysize; ++y) {
+      for (size_t i = 0; i < 4; ++i) sum1[i] += row_sums[y * 4 + i];
     }
     plane_averages[c * 4] = onePerPixels * sum1[0];
     plane_averages[c * 4 + 1] = sqrt(sqrt(onePerPixels * sum1[1]));
     plane_averages[c * 4 + 2] = onePerPixels * sum1[2];
     plane_averages[c * 4 + 3] = sqrt(sqrt(onePerPixels * sum1[3]));
   }
+  return true;
 }
 
 /* Get all components in more or less 0..1 range
@@ -229,17 +237,128 @@ void EdgeDiffMap(const Image3F& img1, const Image3F& mu1, const Image3F& img2,
    The maximum pixel-wise difference has to be <= 1 for the ssim formula to make
    sense.
 */
-void MakePositiveXYB(Image3F& img) {
-  for (size_t y = 0; y < img.ysize(); ++y) {
+Status MakePositiveXYB(Image3F& img, ThreadPool* pool) {
+  const auto process_row = [&](const uint32_t y, size_t /* thread */) {
+    const HWY_FULL(float) d;
     float* JXL_RESTRICT rowY = img.PlaneRow(1, y);
     float* JXL_RESTRICT rowB = img.PlaneRow(2, y);
     float* JXL_RESTRICT rowX = img.PlaneRow(0, y);
-    for (size_t x = 0; x < img.xsize(); ++x) {
-      rowB[x] = (rowB[x] - rowY[x]) + 0.55f;
-      rowX[x] = rowX[x] * 14.f + 0.42f;
-      rowY[x] += 0.01f;
+    for (size_t x = 0; x < img.xsize(); x += Lanes(d)) {
+      const auto y_val = Load(d, rowY + x);
+      Store(Add(Sub(Load(d, rowB + x), y_val), Set(d, 0.55f)), d, rowB + x);
+      Store(MulAdd(Load(d, rowX + x), Set(d, 14.f), Set(d, 0.42f)), d,
+            rowX + x);
+      Store(Add(y_val, Set(d, 0.01f)), d, rowY + x);
     }
+  };
+  return RunOnPool(pool, 0, img.ysize(), ThreadPool::NoInit, process_row,
+                   "SSIMULACRA2PositiveXYB");
+}
+
+}  // namespace
+// NOLINTNEXTLINE(google-readability-namespace-comments)
+}  // namespace HWY_NAMESPACE
+}  // namespace jxl
+HWY_AFTER_NAMESPACE();
+
+#if HWY_ONCE
+namespace jxl {
+namespace {
+
+HWY_EXPORT(Multiply);
+HWY_EXPORT(SSIMMap);
+HWY_EXPORT(EdgeDiffMap);
+HWY_EXPORT(MakePositiveXYB);
+
+const int kNumScales = 6;
+
+StatusOr<Image3F> Downsample(const Image3F& in, size_t fx, size_t fy,
+                             ThreadPool* pool) {
+  const size_t out_xsize = (in.xsize() + fx - 1) / fx;
+  const size_t out_ysize = (in.ysize() + fy - 1) / fy;
+  JXL_ASSIGN_OR_RETURN(
+      Image3F out,
+      Image3F::Create(in.memory_manager(), out_xsize, out_ysize));
+  const float normalize = 1.0f / (fx * fy);
+  const auto process_row = [&](const uint32_t oy, size_t /* thread */) {
+    for (size_t c = 0; c < 3; ++c) {
+      float* JXL_RESTRICT row_out = out.PlaneRow(c, oy);
+      for (size_t ox = 0; ox < out_xsize; ++ox) {
+        float sum = 0.0f;
+        for (size_t iy = 0; iy < fy; ++iy) {
+          for (size_t ix = 0; ix < fx; ++ix) {
+            const size_t x = std::min(ox * fx + ix, in.xsize() - 1);
+            const size_t y = std::min(oy * fy + iy, in.ysize() - 1);
+            sum += in.PlaneRow(c, y)[x];
+          }
+        }
+        row_out[ox] = sum * normalize;
+      }
+    }
+  };
+  JXL_RETURN_IF_ERROR(RunOnPool(pool, 0, out_ysize, ThreadPool::NoInit,
+                                process_row, "SSIMULACRA2Downsample"));
+  return out;
+}
+
+Status Multiply(const Image3F& a, const Image3F& b, Image3F* mul,
+                ThreadPool* pool) {
+  return HWY_DYNAMIC_DISPATCH(Multiply)(a, b, mul, pool);
+}
+
+// Temporary storage for Gaussian blur, reused for multiple images.
+class Blur {
+ public:
+  static StatusOr<Blur> Create(JxlMemoryManager* memory_manager,
+                               const size_t xsize, const size_t ysize,
+                               ThreadPool* pool) {
+    Blur result;
+    result.pool_ = pool;
+    JXL_ASSIGN_OR_RETURN(result.temp_,
+                         ImageF::Create(memory_manager, xsize, ysize));
+    return result;
   }
+
+  void operator()(const ImageF& in, ImageF* JXL_RESTRICT out) {
+    FastGaussian(
+        rg_, in.xsize(), in.ysize(), [&](size_t y) { return in.ConstRow(y); },
+        [&](size_t y) { return temp_.Row(y); },
+        [&](size_t y) { return out->Row(y); }, pool_);
+  }
+
+  StatusOr<Image3F> operator()(const Image3F& in) {
+    JXL_ASSIGN_OR_RETURN(Image3F out, Image3F::Create(in.memory_manager(),
+                                                      in.xsize(), in.ysize()));
+    operator()(in.Plane(0), &out.Plane(0));
+    operator()(in.Plane(1), &out.Plane(1));
+    operator()(in.Plane(2), &out.Plane(2));
+    return out;
+  }
+
+  // Allows reusing across scales.
+  void ShrinkTo(const size_t xsize, const size_t ysize) {
+    temp_.ShrinkTo(xsize, ysize);
+  }
+
+ private:
+  Blur() : rg_(CreateRecursiveGaussian(1.5)) {}
+  hwy::AlignedUniquePtr<RecursiveGaussian> rg_;
+  ImageF temp_;
+  ThreadPool* pool_ = nullptr;
+};
+
+Status SSIMMap(const Image3F& m1, const Image3F& m2, const Image3F& s11,
+               const Image3F& s22, const Image3F& s12, ThreadPool* pool,
+               double* plane_averages) {
+  return HWY_DYNAMIC_DISPATCH(SSIMMap)(m1, m2, s11, s22, s12, pool,
+                                       plane_averages);
+}
+
+Status EdgeDiffMap(const Image3F& img1, const Image3F& mu1,
+                   const Image3F& img2, const Image3F& mu2, ThreadPool* pool,
+                   double* plane_averages) {
+  return HWY_DYNAMIC_DISPATCH(EdgeDiffMap)(img1, mu1, img2, mu2, pool,
+                                           plane_averages);
 }
 
 void AlphaBlend(ImageBundle& img, float bg) {
@@ -256,6 +375,49 @@ void AlphaBlend(ImageBundle& img, float bg) {
   }
 }
 
+// Returns an alpha-blended copy of `in` in linear sRGB, which is the space
+// the scale pyramid is downsampled in.
+StatusOr<ImageBundle> ToLinear(const ImageBundle& in, float bg,
+                               ThreadPool* pool) {
+  JXL_ASSIGN_OR_RETURN(ImageBundle out, in.Copy());
+  if (in.HasAlpha()) AlphaBlend(out, bg);
+  out.ClearExtraChannels();
+  JXL_RETURN_IF_ERROR(out.TransformTo(
+      ColorEncoding::LinearSRGB(out.IsGray()), *JxlGetDefaultCms(), pool));
+  return out;
+}
+
+// Downsamples `linear` if `scale` is not the first one, then converts it to
+// the positive XYB representation the error maps are computed on.
+Status NextScale(size_t scale, ImageBundle* linear, Image3F* xyb,
+                 ThreadPool* pool) {
+  if (scale) {
+    JXL_ASSIGN_OR_RETURN(Image3F tmp, Downsample(*linear->color(), 2, 2, pool));
+    linear->SetFromImage(std::move(tmp),
+                         ColorEncoding::LinearSRGB(linear->IsGray()));
+  }
+  JXL_RETURN_IF_ERROR(
+      ToXYB(*linear, pool, xyb, *JxlGetDefaultCms(), nullptr));
+  return HWY_DYNAMIC_DISPATCH(MakePositiveXYB)(*xyb, pool);
+}
+
+}  // namespace
+}  // namespace jxl
+
+namespace {
+
+using jxl::Blur;
+using jxl::EdgeDiffMap;
+using jxl::Image3F;
+using jxl::ImageBundle;
+using jxl::kNumScales;
+using jxl::Multiply;
+using jxl::NextScale;
+using jxl::SSIMMap;
+using jxl::Status;
+using jxl::StatusOr;
+using jxl::ToLinear;
+
 }  // namespace
 
 /*
@@ -441,80 +603,127 @@ double Msssim::Score() const {
   return ssim;
 }
 
-StatusOr<Msssim> ComputeSSIMULACRA2(const ImageBundle& orig,
-                                    const ImageBundle& dist, float bg) {
-  JxlMemoryManager* memory_manager = jpegxl::tools::NoMemoryManager();
+Status Ssimulacra2Comparator::SetReference(const ImageBundle& ref) {
+  JxlMemoryManager* memory_manager = ref.memory_manager();
+  ref_scales_.clear();
+  has_reference_ = false;
+  xsize_ = ref.xsize();
+  ysize_ = ref.ysize();
+  JXL_ASSIGN_OR_RETURN(ImageBundle linear, ToLinear(ref, bg_, pool_));
+  JXL_ASSIGN_OR_RETURN(Image3F mul,
+                       Image3F::Create(memory_manager, xsize_, ysize_));
+  JXL_ASSIGN_OR_RETURN(Blur blur,
+                       Blur::Create(memory_manager, xsize_, ysize_, pool_));
+
+  for (int scale = 0; scale < kNumScales; scale++) {
+    // Like the single-pair loop this replaces, the size check looks at the
+    // previous scale, so the last scale may be smaller than 8x8.
+    if (linear.xsize() < 8 || linear.ysize() < 8) {
+      break;
+    }
+    ReferenceScale rscale;
+    JXL_RETURN_IF_ERROR(NextScale(scale, &linear, &rscale.img, pool_));
+    const Image3F& img1 = rscale.img;
+    mul.ShrinkTo(img1.xsize(), img1.ysize());
+    blur.ShrinkTo(img1.xsize(), img1.ysize());
+
+    JXL_RETURN_IF_ERROR(Multiply(img1, img1, &mul, pool_));
+    JXL_ASSIGN_OR_RETURN(rscale.sigma_sq, blur(mul));
+    JXL_ASSIGN_OR_RETURN(rscale.mu, blur(img1));
+    ref_scales_.push_back(std::move(rscale));
+  }
+  has_reference_ = true;
+  return true;
+}
+
+StatusOr<Msssim> Ssimulacra2Comparator::CompareWith(
+    const ImageBundle& distorted) const {
+  JxlMemoryManager* memory_manager = distorted.memory_manager();
+  if (!has_reference_) {
+    return JXL_FAILURE("SetReference was not called");
+  }
+  if (distorted.xsize() != xsize_ || distorted.ysize() != ysize_) {
+    return JXL_FAILURE("Image size mismatch");
+  }
   Msssim msssim;
 
-  JXL_ASSIGN_OR_RETURN(
-      Image3F img1,
-      Image3F::Create(memory_manager, orig.xsize(), orig.ysize()));
-  JXL_ASSIGN_OR_RETURN(
-      Image3F img2,
-      Image3F::Create(memory_manager, img1.xsize(), img1.ysize()));
+  JXL_ASSIGN_OR_RETURN(ImageBundle linear, ToLinear(distorted, bg_, pool_));
+  JXL_ASSIGN_OR_RETURN(Image3F mul,
+                       Image3F::Create(memory_manager, xsize_, ysize_));
+  JXL_ASSIGN_OR_RETURN(Blur blur,
+                       Blur::Create(memory_manager, xsize_, ysize_, pool_));
+  Image3F img2;
+
+  for (size_t scale = 0; scale < ref_scales_.size(); scale++) {
+    const ReferenceScale& rscale = ref_scales_[scale];
+    const Image3F& img1 = rscale.img;
+    JXL_RETURN_IF_ERROR(NextScale(scale, &linear, &img2, pool_));
+    mul.ShrinkTo(img1.xsize(), img1.ysize());
+    blur.ShrinkTo(img1.xsize(), img1.ysize());
 
-  JXL_ASSIGN_OR_RETURN(ImageBundle orig2, orig.Copy());
-  JXL_ASSIGN_OR_RETURN(ImageBundle dist2, dist.Copy());
+    JXL_RETURN_IF_ERROR(Multiply(img2, img2, &mul, pool_));
+    JXL_ASSIGN_OR_RETURN(Image3F sigma2_sq, blur(mul));
 
-  if (orig.HasAlpha()) AlphaBlend(orig2, bg);
-  if (dist.HasAlpha()) AlphaBlend(dist2, bg);
-  orig2.ClearExtraChannels();
-  dist2.ClearExtraChannels();
+    JXL_RETURN_IF_ERROR(Multiply(img1, img2, &mul, pool_));
+    JXL_ASSIGN_OR_RETURN(Image3F sigma12, blur(mul));
 
-  JXL_CHECK(orig2.TransformTo(jxl::ColorEncoding::LinearSRGB(orig2.IsGray()),
-                              *JxlGetDefaultCms()));
-  JXL_CHECK(dist2.TransformTo(jxl::ColorEncoding::LinearSRGB(dist2.IsGray()),
-                              *JxlGetDefaultCms()));
+    JXL_ASSIGN_OR_RETURN(Image3F mu2, blur(img2));
 
-  JXL_RETURN_IF_ERROR(
-      jxl::ToXYB(orig2, nullptr, &img1, *JxlGetDefaultCms(), nullptr));
-  JXL_RETURN_IF_ERROR(
-      jxl::ToXYB(dist2, nullptr, &img2, *JxlGetDefaultCms(), nullptr));
-  MakePositiveXYB(img1);
-  MakePositiveXYB(img2);
+    MsssimScale sscale;
+    JXL_RETURN_IF_ERROR(SSIMMap(rscale.mu, mu2, rscale.sigma_sq, sigma2_sq,
+                                sigma12, pool_, sscale.avg_ssim));
+    JXL_RETURN_IF_ERROR(EdgeDiffMap(img1, rscale.mu, img2, mu2, pool_,
+                                    sscale.avg_edgediff));
+    msssim.scales.push_back(sscale);
+  }
+  return msssim;
+}
 
+// Kept separate from Ssimulacra2Comparator: it processes both images scale by
+// scale without a pool, which makes it the reference the comparator is
+// tested against.
+StatusOr<Msssim> ComputeSSIMULACRA2(const ImageBundle& orig,
+                                    const ImageBundle& dist, float bg) {
+  JxlMemoryManager* memory_manager = orig.memory_manager();
+  Msssim msssim;
+
+  JXL_ASSIGN_OR_RETURN(ImageBundle orig2, ToLinear(orig, bg, nullptr));
+  JXL_ASSIGN_OR_RETURN(ImageBundle dist2, ToLinear(dist, bg, nullptr));
+  Image3F img1;
+  Image3F img2;
   JXL_ASSIGN_OR_RETURN(
-      Image3F mul, Image3F::Create(memory_manager, img1.xsize(), img1.ysize()));
-  JXL_ASSIGN_OR_RETURN(Blur blur, Blur::Create(img1.xsize(), img1.ysize()));
+      Image3F mul,
+      Image3F::Create(memory_manager, orig.xsize(), orig.ysize()));
+  JXL_ASSIGN_OR_RETURN(
+      Blur blur,
+      Blur::Create(memory_manager, orig.xsize(), orig.ysize(), nullptr));
 
   for (int scale = 0; scale < kNumScales; scale++) {
-    if (img1.xsize() < 8 || img1.ysize() < 8) {
+    if (orig2.xsize() < 8 || orig2.ysize() < 8) {
       break;
     }
-    if (scale) {
-      JXL_ASSIGN_OR_RETURN(Image3F tmp, Downsample(*orig2.color(), 2, 2));
-      orig2.SetFromImage(std::move(tmp),
-                         jxl::ColorEncoding::LinearSRGB(orig2.IsGray()));
-      JXL_ASSIGN_OR_RETURN(tmp, Downsample(*dist2.color(), 2, 2));
-      dist2.SetFromImage(std::move(tmp),
-                         jxl::ColorEncoding::LinearSRGB(dist2.IsGray()));
-      img1.ShrinkTo(orig2.xsize(), orig2.ysize());
-      img2.ShrinkTo(orig2.xsize(), orig2.ysize());
-      JXL_RETURN_IF_ERROR(
-          jxl::ToXYB(orig2, nullptr, &img1, *JxlGetDefaultCms(), nullptr));
-      JXL_RETURN_IF_ERROR(
-          jxl::ToXYB(dist2, nullptr, &img2, *JxlGetDefaultCms(), nullptr));
-      MakePositiveXYB(img1);
-      MakePositiveXYB(img2);
-    }
+    JXL_RETURN_IF_ERROR(NextScale(scale, &orig2, &img1, nullptr));
+    JXL_RETURN_IF_ERROR(NextScale(scale, &dist2, &img2, nullptr));
     mul.ShrinkTo(img1.xsize(), img1.ysize());
     blur.ShrinkTo(img1.xsize(), img1.ysize());
 
-    Multiply(img1, img1, &mul);
+    JXL_RETURN_IF_ERROR(Multiply(img1, img1, &mul, nullptr));
     JXL_ASSIGN_OR_RETURN(Image3F sigma1_sq, blur(mul));
 
-    Multiply(img2, img2, &mul);
+    JXL_RETURN_IF_ERROR(Multiply(img2, img2, &mul, nullptr));
     JXL_ASSIGN_OR_RETURN(Image3F sigma2_sq, blur(mul));
 
-    Multiply(img1, img2, &mul);
+    JXL_RETURN_IF_ERROR(Multiply(img1, img2, &mul, nullptr));
     JXL_ASSIGN_OR_RETURN(Image3F sigma12, blur(mul));
 
     JXL_ASSIGN_OR_RETURN(Image3F mu1, blur(img1));
     JXL_ASSIGN_OR_RETURN(Image3F mu2, blur(img2));
 
     MsssimScale sscale;
-    SSIMMap(mu1, mu2, sigma1_sq, sigma2_sq, sigma12, sscale.avg_ssim);
-    EdgeDiffMap(img1, mu1, img2, mu2, sscale.avg_edgediff);
+    JXL_RETURN_IF_ERROR(SSIMMap(mu1, mu2, sigma1_sq, sigma2_sq, sigma12,
+                                nullptr, sscale.avg_ssim));
+    JXL_RETURN_IF_ERROR(
+        EdgeDiffMap(img1, mu1, img2, mu2, nullptr, sscale.avg_edgediff));
     msssim.scales.push_back(sscale);
   }
   return msssim;
@@ -524,3 +733,4 @@ StatusOr<Msssim> ComputeSSIMULACRA2(const ImageBundle& orig,
                                     const ImageBundle& distorted) {
   return ComputeSSIMULACRA2(orig, distorted, 0.5f);
 }
+#endif  // HWY_ONCE
@@ -6,9 +6,12 @@
 #ifndef TOOLS_SSIMULACRA2_H_
 #define TOOLS_SSIMULACRA2_H_
 
+#include <cstddef>
 #include <vector>
 
+#include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/base/status.h"
+#include "lib/jxl/image.h"
 #include "lib/jxl/image_bundle.h"
 
 struct MsssimScale {
@@ -22,6 +25,39 @@ struct Msssim {
   double Score() const;
 };
 
+// Computes SSIMULACRA 2 scores of several distorted images against the same
+// reference. The reference pyramid (XYB image, its blur and blurred square at
+// each scale) is computed once by SetReference, so each CompareWith only
+// processes the distorted image. Scores are identical to ComputeSSIMULACRA2,
+// with or without a thread pool.
+class Ssimulacra2Comparator {
+ public:
+  // In case of alpha transparency, both images are blended against a gray
+  // background of intensity 'bg' (in range 0..1).
+  explicit Ssimulacra2Comparator(float bg = 0.5f,
+                                 jxl::ThreadPool *pool = nullptr)
+      : bg_(bg), pool_(pool) {}
+
+  jxl::Status SetReference(const jxl::ImageBundle &ref);
+
+  // Requires a prior SetReference with an image of the same size.
+  jxl::StatusOr<Msssim> CompareWith(const jxl::ImageBundle &distorted) const;
+
+ private:
+  struct ReferenceScale {
+    jxl::Image3F img;
+    jxl::Image3F mu;
+    jxl::Image3F sigma_sq;
+  };
+
+  float bg_;
+  jxl::ThreadPool *pool_;
+  bool has_reference_ = false;
+  size_t xsize_ = 0;
+  size_t ysize_ = 0;
+  std::vector<ReferenceScale> ref_scales_;
+};
+
 // Computes the SSIMULACRA 2 score between reference image 'orig' and
 // distorted image 'distorted'. In case of alpha transparency, assume
 // a gray background if intensity 'bg' (in range 0..1).
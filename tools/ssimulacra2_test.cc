@@ -0,0 +1,123 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include "tools/ssimulacra2.h"
+
+#include <jxl/memory_manager.h>
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+#include "lib/jxl/base/data_parallel.h"
+#include "lib/jxl/base/random.h"
+#include "lib/jxl/base/status.h"
+#include "lib/jxl/color_encoding_internal.h"
+#include "lib/jxl/image.h"
+#include "lib/jxl/image_bundle.h"
+#include "lib/jxl/image_metadata.h"
+#include "lib/jxl/test_utils.h"
+#include "lib/jxl/testing.h"
+
+namespace jxl {
+namespace {
+
+// Smooth gradients with a few sharp edges, so that every scale has structure.
+Image3F MakeImage(size_t xsize, size_t ysize) {
+  JxlMemoryManager* memory_manager = jxl::test::MemoryManager();
+  JXL_ASSIGN_OR_DIE(Image3F image,
+                    Image3F::Create(memory_manager, xsize, ysize));
+  for (size_t c = 0; c < 3; ++c) {
+    for (size_t y = 0; y < ysize; ++y) {
+      float* row = image.PlaneRow(c, y);
+      for (size_t x = 0; x < xsize; ++x) {
+        const bool edge = ((x / 16) + (y / 24) + c) % 3 == 0;
+        row[x] = (x + y * (c + 1)) / static_cast<float>(xsize + 3 * ysize) *
+                     0.7f +
+                 (edge ? 0.25f : 0.0f);
+      }
+    }
+  }
+  return image;
+}
+
+// Adds noise of the given amplitude and blurs horizontally with `radius`.
+Image3F Distort(const Image3F& in, float noise, size_t radius, Rng* rng) {
+  JxlMemoryManager* memory_manager = jxl::test::MemoryManager();
+  JXL_ASSIGN_OR_DIE(Image3F out,
+                    Image3F::Create(memory_manager, in.xsize(), in.ysize()));
+  for (size_t c = 0; c < 3; ++c) {
+    for (size_t y = 0; y < in.ysize(); ++y) {
+      const float* row_in = in.ConstPlaneRow(c, y);
+      float* row_out = out.PlaneRow(c, y);
+      for (size_t x = 0; x < in.xsize(); ++x) {
+        float sum = 0.0f;
+        size_t count = 0;
+        for (size_t ix = x > radius ? x - radius : 0;
+             ix <= x + radius && ix < in.xsize(); ++ix, ++count) {
+          sum += row_in[ix];
+        }
+        row_out[x] = sum / count + rng->UniformF(-noise, noise);
+      }
+    }
+  }
+  return out;
+}
+
+ImageBundle MakeBundle(const ImageMetadata* metadata, Image3F&& image) {
+  ImageBundle bundle(jxl::test::MemoryManager(), metadata);
+  bundle.SetFromImage(std::move(image), metadata->color_encoding);
+  return bundle;
+}
+
+TEST(Ssimulacra2Test, ComparatorMatchesPairwiseScores) {
+  const size_t xsize = 200;
+  const size_t ysize = 136;
+  ImageMetadata metadata;
+  metadata.color_encoding = ColorEncoding::SRGB();
+  const ImageBundle orig = MakeBundle(&metadata, MakeImage(xsize, ysize));
+  Rng rng(0);
+  std::vector<ImageBundle> distorted;
+  JXL_ASSIGN_OR_DIE(ImageBundle same, orig.Copy());
+  distorted.push_back(std::move(same));
+  const std::pair<float, size_t> distortions[] = {
+      {0.01f, 0}, {0.0f, 2}, {0.05f, 1}, {0.2f, 4}};
+  for (const auto& d : distortions) {
+    distorted.push_back(MakeBundle(
+        &metadata, Distort(orig.color(), d.first, d.second, &rng)));
+  }
+
+  std::vector<double> expected;
+  for (const ImageBundle& dist : distorted) {
+    JXL_ASSIGN_OR_DIE(Msssim msssim, ComputeSSIMULACRA2(orig, dist));
+    expected.push_back(msssim.Score());
+  }
+  EXPECT_EQ(100.0, expected[0]);
+  for (size_t i = 1; i < expected.size(); ++i) {
+    EXPECT_LT(expected[i], 100.0);
+  }
+
+  test::ThreadPoolForTests pool(4);
+  for (ThreadPool* comparator_pool : {static_cast<ThreadPool*>(nullptr),
+                                      pool.get()}) {
+    // One reference, several distorted images, compared out of order to
+    // check that CompareWith does not depend on earlier calls.
+    Ssimulacra2Comparator comparator(0.5f, comparator_pool);
+    ASSERT_TRUE(comparator.SetReference(orig));
+    for (size_t i = distorted.size(); i-- > 0;) {
+      JXL_ASSIGN_OR_DIE(Msssim msssim, comparator.CompareWith(distorted[i]));
+      EXPECT_EQ(expected[i], msssim.Score()) << "image " << i;
+    }
+  }
+
+  // Images of another size are rejected.
+  Ssimulacra2Comparator comparator;
+  ASSERT_TRUE(comparator.SetReference(orig));
+  const ImageBundle small = MakeBundle(&metadata, MakeImage(64, 64));
+  EXPECT_FALSE(comparator.CompareWith(small).ok());
+}
+
+}  // namespace
+}  // namespace jxl